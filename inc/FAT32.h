@@ -0,0 +1,214 @@
+/*MIT License
+
+Copyright (c) 2019 DoHelloWorld
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.*/
+
+
+#ifndef FAT32_H_INCLUDED
+#define FAT32_H_INCLUDED
+#include "SDCard_Partition.h"
+
+/*Number of cluster runs cached for every open file*/
+#ifndef FAT_RUNS
+#define FAT_RUNS    8
+#endif
+
+/// FAT API functions return value
+typedef enum
+{
+    FAT_OK,                 ///< API function executed correctly
+    FAT_DISK_ERROR,         ///< SD card transfer failed
+    FAT_NO_FILESYSTEM,      ///< Volume is not FAT32 with 512-byte sectors
+    FAT_NOT_FOUND,          ///< File or directory is not found
+    FAT_INVALID_NAME,       ///< Path component is not valid 8.3 name
+    FAT_DENIED,             ///< File is not opened for this access or path is a directory
+    FAT_NO_SPACE,           ///< No free clusters on volume
+    FAT_CORRUPT             ///< Cluster chain points outside of volume
+}FAT_Error_t;
+
+/// File open modes, can be combined
+typedef enum
+{
+    FAT_MODE_READ       = 0x01,     ///< Read access
+    FAT_MODE_WRITE      = 0x02,     ///< Write access
+    FAT_MODE_CREATE     = 0x04,     ///< Create file if it does not exist
+    FAT_MODE_APPEND     = 0x08,     ///< Start at the end of file
+    FAT_MODE_TRUNCATE   = 0x10      ///< Drop file data at open
+}FAT_Mode_t;
+
+/// State of group of FAT blocks in free map
+typedef enum
+{
+    FAT_MAP_UNKNOWN = 0,    ///< Group is not scanned yet
+    FAT_MAP_FULL    = 1,    ///< Group has no free clusters
+    FAT_MAP_PARTIAL = 2,    ///< Group has free clusters
+    FAT_MAP_EMPTY   = 3     ///< All clusters of group were free at scan
+}FAT_MapState_t;
+
+/// State of directory index
+typedef enum
+{
+    FAT_INDEX_EMPTY,        ///< Index is built at the first lookup in directory
+    FAT_INDEX_READY,        ///< Index has all entries of directory
+    FAT_INDEX_OVERFLOW      ///< Directory has too many entries, lookups scan directory
+}FAT_IndexState_t;
+
+/*Slot of directory index*/
+typedef struct
+{
+    /*block and offset of directory entry*/
+    uint32_t block;
+    uint16_t offset;
+    /*part of name hash, 0 for empty slot*/
+    uint16_t tag;
+}FAT_IndexSlot_t;
+
+/*Hash index of one directory
+    Name lookup is one probe of slots and one block read*/
+typedef struct
+{
+    /*first cluster of indexed directory*/
+    uint32_t dir;
+    /*table of slots, its size is power of two*/
+    FAT_IndexSlot_t * slots;
+    uint32_t size;
+    /*slots with entries and removed entries*/
+    uint32_t used;
+    /*state from FAT_IndexState_t*/
+    uint8_t state;
+    /*cluster with the end of directory, new entries are searched from it*/
+    uint32_t tail;
+}FAT_DirIndex_t;
+
+/*FAT32 volume
+    Keeps volume geometry and one sector window for FAT, directories and partial data blocks*/
+typedef struct
+{
+    /*partition with volume, block numbers of volume are relative to partition start*/
+    SD_Partition_t * part;
+    /*first block of the first FAT*/
+    uint32_t fatStart;
+    /*blocks in one FAT*/
+    uint32_t fatSize;
+    /*number of FAT copies*/
+    uint8_t numFATs;
+    /*blocks in cluster*/
+    uint8_t clusterBlocks;
+    /*first block of cluster 2*/
+    uint32_t dataStart;
+    /*number of data clusters*/
+    uint32_t clusters;
+    /*first cluster of root directory*/
+    uint32_t rootCluster;
+    /*block of FSInfo sector, 0 if volume has no FSInfo*/
+    uint32_t fsInfo;
+    /*cluster where search of free cluster starts*/
+    uint32_t nextFree;
+    /*FSInfo on SD card is not changed since mount*/
+    uint8_t freeValid;
+    /*free clusters, 0xFFFFFFFF if unknown. Taken from FSInfo until scan of FAT verifies it*/
+    uint32_t freeCount;
+    uint8_t freeVerified;
+    /*free map with 2-bit FAT_MapState_t for every group of FAT blocks, NULL if map is not used*/
+    uint8_t * map;
+    /*number of groups and FAT blocks in group as power of two*/
+    uint32_t mapGroups;
+    uint8_t groupShift;
+    /*next group of background scan and free clusters found in scanned groups*/
+    uint32_t scanGroup;
+    uint32_t scanFree;
+    /*hash index of one directory, NULL if index is not used*/
+    FAT_DirIndex_t * index;
+    /*block in window, 0xFFFFFFFF if window is empty*/
+    uint32_t window;
+    /*window is changed and not written yet*/
+    uint8_t dirty;
+    /*sector window*/
+    uint8_t buffer[512];
+}FAT_FS_t;
+
+/*Run of contiguous clusters of file*/
+typedef struct
+{
+    /*number of the first cluster in file*/
+    uint32_t index;
+    /*first cluster of run on volume*/
+    uint32_t cluster;
+    /*clusters in run*/
+    uint32_t length;
+}FAT_Run_t;
+
+/*Open file
+    Keeps cluster chain as list of runs, so sequential access does not walk FAT again*/
+typedef struct
+{
+    /*volume of file*/
+    FAT_FS_t * fs;
+    /*first cluster, 0 for empty file*/
+    uint32_t firstCluster;
+    /*file size in bytes*/
+    uint32_t size;
+    /*current position in bytes*/
+    uint32_t position;
+    /*open mode from FAT_Mode_t*/
+    uint8_t mode;
+    /*block and offset of directory entry*/
+    uint32_t entryBlock;
+    uint16_t entryOffset;
+    /*size or first cluster is changed and directory entry is not updated*/
+    uint8_t modified;
+    /*cached runs of cluster chain, they start from the first cluster of file*/
+    FAT_Run_t runs[FAT_RUNS];
+    uint8_t runCount;
+    /*the last cached run ends the chain*/
+    uint8_t chainEnd;
+}FAT_File_t;
+
+/*Mount FAT32 volume which starts at the first block of partition*/
+FAT_Error_t FAT_Mount(FAT_FS_t * fs, SD_Partition_t * part);
+
+/*Write changed sector window and FSInfo to SD card*/
+FAT_Error_t FAT_Unmount(FAT_FS_t * fs);
+
+/*Give RAM for free map, 4 groups of FAT blocks per byte. Allocation skips full groups*/
+FAT_Error_t FAT_MapInit(FAT_FS_t * fs, uint8_t * map, uint32_t mapBytes);
+
+/*Scan next groups of FAT in idle time, exact free count is known when freeVerified is set*/
+FAT_Error_t FAT_MapStep(FAT_FS_t * fs, uint32_t groups);
+
+/*Use hash index for directory by path, "" is root directory. Slots are given by user*/
+FAT_Error_t FAT_IndexInit(FAT_FS_t * fs, FAT_DirIndex_t * index, const char * path, FAT_IndexSlot_t * slots, uint32_t size);
+
+/*Open file by path like "DIR/FILE.TXT" with modes from FAT_Mode_t*/
+FAT_Error_t FAT_Open(FAT_File_t * file, FAT_FS_t * fs, const char * path, uint8_t mode);
+
+/*Delete file*/
+FAT_Error_t FAT_Remove(FAT_FS_t * fs, const char * path);
+
+/*File access functions*/
+FAT_Error_t FAT_Read(FAT_File_t * file, uint8_t * data, uint32_t len, uint32_t * read);
+FAT_Error_t FAT_Write(FAT_File_t * file, uint8_t * data, uint32_t len, uint32_t * written);
+FAT_Error_t FAT_Seek(FAT_File_t * file, uint32_t position);
+
+/*Update directory entry of file and write changed sector window*/
+FAT_Error_t FAT_Sync(FAT_File_t * file);
+FAT_Error_t FAT_Close(FAT_File_t * file);
+
+#endif /* FAT32_H_INCLUDED */
@@ -0,0 +1,132 @@
+/*MIT License
+
+Copyright (c) 2019 DoHelloWorld
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.*/
+
+
+#ifndef KVSTORE_H_INCLUDED
+#define KVSTORE_H_INCLUDED
+#include "SDCard_Partition.h"
+#include "SDCard_Stream.h"
+
+/*Longest key, record with key and value should fit in one block*/
+#define KV_MAX_KEY      255
+#define KV_MAX_RECORD   512
+
+/// Key-value store API functions return value
+typedef enum
+{
+    KV_OK,                  ///< API function executed correctly
+    KV_DISK_ERROR,          ///< SD card transfer failed, store should be mounted again after write error
+    KV_NOT_FOUND,           ///< Key is not in store
+    KV_FULL,                ///< Live records do not leave free segment for compaction
+    KV_DENIED               ///< Wrong parameter, record does not fit in block or value is bigger than buffer
+}KV_Error_t;
+
+/*Segment of store in RAM*/
+typedef struct
+{
+    /*order of segment, 0 for free segment*/
+    uint32_t sequence;
+    /*Bloom filter of keys written to segment, bloomBytes of store RAM*/
+    uint8_t * bloom;
+}KV_Segment_t;
+
+/*Slot of key index*/
+typedef struct
+{
+    /*two independent key hashes*/
+    uint32_t hash;
+    uint32_t check;
+    /*partition block and offset of the newest record of key*/
+    uint32_t block;
+    uint16_t offset;
+}KV_Slot_t;
+
+/*Log-structured key-value store
+    Records are appended to segments of allocation unit size and never span blocks. Index in RAM maps key to
+    its newest record, so get reads one block. When index is full, lookups of other keys scan segments from
+    the newest one and skip segments by Bloom filter. Compaction copies live records of the oldest segment*/
+typedef struct
+{
+    /*partition with store*/
+    SD_Partition_t * part;
+    /*write stream of active segment*/
+    SD_Stream_t stream;
+    /*segment size in blocks, allocation unit of partition*/
+    uint32_t segmentBlocks;
+    /*segments in RAM*/
+    KV_Segment_t * segments;
+    uint32_t segmentCount;
+    /*Bloom filter size of one segment in bytes*/
+    uint32_t bloomBytes;
+    /*index slots, number of slots is power of two*/
+    KV_Slot_t * slots;
+    uint32_t size;
+    /*slots with keys, removed keys free their slots*/
+    uint32_t used;
+    /*index has no slot for some keys*/
+    uint8_t overflow;
+    /*segment which gets new records*/
+    uint32_t active;
+    /*sequence of next segment*/
+    uint32_t sequence;
+    /*number of free segments*/
+    uint32_t freeCount;
+    /*compaction starts when free segments are not more than this, at least 1 segment is kept for it*/
+    uint32_t minFree;
+    /*partition block and offset of next record*/
+    uint32_t block;
+    uint32_t offset;
+    /*segment being compacted and its next block, victim is segmentCount when compaction is not running*/
+    uint32_t victim;
+    uint32_t victimBlock;
+    /*block of partition in buffer*/
+    uint32_t window;
+    /*buffer for one block*/
+    uint8_t buffer[512];
+}KV_t;
+
+/*Set partition and RAM of store. Staging buffer of write stream should be at least 1 block.
+    Bloom filters take segmentCount * bloomBytes bytes. Filter sets 3 bits per key, with n distinct keys in segment
+    false positive rate is about (1 - exp(-3 * n / (8 * bloomBytes)))^3: 3% for 1 byte per key, 0.5% for 2 bytes
+    per key. Size it from the number of distinct keys one segment holds*/
+KV_Error_t KV_Init(KV_t * kv, SD_Partition_t * part, KV_Segment_t * segments, uint32_t segmentCount,
+                   uint8_t * bloom, uint32_t bloomBytes, KV_Slot_t * slots, uint32_t size,
+                   uint8_t * buffer, uint32_t bufferBlocks);
+
+/*Erase all segments and start empty store*/
+KV_Error_t KV_Format(KV_t * kv);
+
+/*Read all segments and build index*/
+KV_Error_t KV_Mount(KV_t * kv);
+
+/*Key-value functions, key is NULL-terminated string*/
+KV_Error_t KV_Put(KV_t * kv, const char * key, const uint8_t * value, uint32_t len);
+KV_Error_t KV_Get(KV_t * kv, const char * key, uint8_t * value, uint32_t maxLen, uint32_t * len);
+KV_Error_t KV_Delete(KV_t * kv, const char * key);
+
+/*Write records from staging buffer to SD card*/
+KV_Error_t KV_Sync(KV_t * kv);
+
+/*Compact up to blocks blocks of the oldest segment when free segments are few, call in idle time*/
+KV_Error_t KV_Compact(KV_t * kv, uint32_t blocks);
+
+#endif /* KVSTORE_H_INCLUDED */
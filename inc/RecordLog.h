@@ -0,0 +1,111 @@
+/*MIT License
+
+Copyright (c) 2019 DoHelloWorld
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.*/
+
+
+#ifndef RECORDLOG_H_INCLUDED
+#define RECORDLOG_H_INCLUDED
+#include "SDCard_Partition.h"
+#include "SDCard_Stream.h"
+
+/*Sequence of the first record after format*/
+#define LOG_FIRST_SEQUENCE  1
+
+/// Record log API functions return value
+typedef enum
+{
+    LOG_OK,                 ///< API function executed correctly
+    LOG_DISK_ERROR,         ///< SD card transfer failed, log should be opened again after append error
+    LOG_NO_LOG,             ///< Partition has no valid checkpoint, it should be formatted
+    LOG_FULL,               ///< Record does not fit in partition
+    LOG_END,                ///< No more records
+    LOG_CORRUPT,            ///< Record is damaged
+    LOG_DENIED              ///< Wrong parameter or record is bigger than buffer
+}LOG_Error_t;
+
+/*Append-only record log
+    Records are framed with length, sequence and CRC32 and packed across block boundaries.
+    Two checkpoint blocks at the start of partition keep log end, recovery scans only records after the last one*/
+typedef struct
+{
+    /*partition with log*/
+    SD_Partition_t * part;
+    /*write stream of record area*/
+    SD_Stream_t stream;
+    /*first block of record area, it starts on allocation unit boundary*/
+    uint32_t dataStart;
+    /*format number, records of previous formats are not valid*/
+    uint32_t epoch;
+    /*number of last written checkpoint*/
+    uint32_t generation;
+    /*sequence of next appended record*/
+    uint32_t sequence;
+    /*bytes of record area which are on SD card*/
+    uint64_t synced;
+    /*end of log at last checkpoint*/
+    uint64_t checkpoint;
+    /*bytes after checkpoint which start next checkpoint at append, 0 for manual checkpoints*/
+    uint32_t checkpointBytes;
+    /*block of partition in buffer*/
+    uint32_t window;
+    /*buffer for checkpoint and read blocks*/
+    uint8_t buffer[512];
+}LOG_t;
+
+/*Log reader, it goes through records from the first one*/
+typedef struct
+{
+    /*offset of next record in record area*/
+    uint64_t position;
+    /*sequence of next record*/
+    uint32_t sequence;
+    /*read-ahead buffer, NULL to read through log buffer*/
+    uint8_t * buffer;
+    /*size of read-ahead buffer in blocks*/
+    uint32_t bufferBlocks;
+    /*first partition block in read-ahead buffer*/
+    uint32_t first;
+    /*number of blocks in read-ahead buffer*/
+    uint32_t loaded;
+}LOG_Reader_t;
+
+/*Create empty log on partition. Staging buffer of write stream should be at least 1 block*/
+LOG_Error_t LOG_Format(LOG_t * log, SD_Partition_t * part, uint8_t * buffer, uint32_t bufferBlocks);
+
+/*Open log and find its end from the last checkpoint*/
+LOG_Error_t LOG_Open(LOG_t * log, SD_Partition_t * part, uint8_t * buffer, uint32_t bufferBlocks);
+
+/*Append record to log*/
+LOG_Error_t LOG_Append(LOG_t * log, uint8_t * data, uint32_t len);
+
+/*Write collected records to SD card*/
+LOG_Error_t LOG_Sync(LOG_t * log);
+
+/*Write collected records and save log end in checkpoint*/
+LOG_Error_t LOG_Checkpoint(LOG_t * log);
+
+/*Read records which are written to SD card*/
+void LOG_ReaderInit(LOG_Reader_t * reader);
+void LOG_ReaderBuffer(LOG_Reader_t * reader, uint8_t * buffer, uint32_t bufferBlocks);
+void LOG_ReaderSeek(LOG_Reader_t * reader, uint64_t position, uint32_t sequence);
+LOG_Error_t LOG_ReadNext(LOG_t * log, LOG_Reader_t * reader, uint8_t * data, uint32_t maxLen, uint32_t * len);
+
+#endif /* RECORDLOG_H_INCLUDED */
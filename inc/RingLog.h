@@ -0,0 +1,78 @@
+/*MIT License
+
+Copyright (c) 2019 DoHelloWorld
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.*/
+
+
+#ifndef RINGLOG_H_INCLUDED
+#define RINGLOG_H_INCLUDED
+#include "SDCard_Partition.h"
+
+/*Payload bytes in one ring block, the rest is block header*/
+#define RING_PAYLOAD_SIZE   488
+
+/// Ring log API functions return value
+typedef enum
+{
+    RING_OK,                ///< API function executed correctly
+    RING_DISK_ERROR,        ///< SD card transfer failed
+    RING_NOT_FOUND,         ///< Record with this index is not in log
+    RING_CORRUPT,           ///< Block does not keep expected record
+    RING_DENIED             ///< Wrong parameter or record is bigger than block payload
+}RING_Error_t;
+
+/*Ring log of fixed-size blocks
+    Block n of ring keeps record with sequence lap * blocks + n, so sequences grow along the ring up to the newest
+    block and mount finds it with binary search. Erase unit after the one being written is erased ahead*/
+typedef struct
+{
+    /*partition with ring*/
+    SD_Partition_t * part;
+    /*ring size in blocks, multiple of erase unit*/
+    uint32_t blocks;
+    /*erase unit in blocks*/
+    uint32_t eraseBlocks;
+    /*format number, blocks of previous formats are not valid*/
+    uint32_t epoch;
+    /*block for next record*/
+    uint32_t head;
+    /*sequence of next record*/
+    uint64_t sequence;
+    /*number of records in ring*/
+    uint32_t count;
+    /*number of block reads since mount, mount itself takes about log2(blocks) + 2*/
+    uint32_t probes;
+    /*buffer for one block*/
+    uint8_t buffer[512];
+}RING_t;
+
+/*Drop all records and start new ring on partition*/
+RING_Error_t RING_Format(RING_t * ring, SD_Partition_t * part, uint32_t eraseBlocks);
+
+/*Find the newest record of ring on partition*/
+RING_Error_t RING_Mount(RING_t * ring, SD_Partition_t * part, uint32_t eraseBlocks);
+
+/*Write record to the next block, the oldest records are overwritten*/
+RING_Error_t RING_Append(RING_t * ring, uint8_t * data, uint32_t len);
+
+/*Read record by index, 0 is the oldest one*/
+RING_Error_t RING_Read(RING_t * ring, uint32_t index, uint8_t * data, uint32_t * len);
+
+#endif /* RINGLOG_H_INCLUDED */
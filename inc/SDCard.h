@@ -23,6 +23,8 @@ SOFTWARE.*/
 #ifndef SDCARD_H_INCLUDED
 #define SDCARD_H_INCLUDED
 #include "stm32f30x.h"
+#include "SDCard_SPI.h"
+#include "SDCard_Quirks.h"
 
 /// SD card API functions return value
 typedef enum
@@ -31,6 +33,8 @@ typedef enum
     SD_INCORRECT_RESPONSE,          ///< API function received wrong response from SD
     SD_CRC_ERROR,                   ///< SD card gets wrong CRC16 after data block
     SD_WRITE_ERROR,                 ///< Error occured while programming flash
+    SD_ABORTED,                     ///< Transfer is stopped by deadline or SD_Cancel
+    SD_OUT_OF_RANGE,                ///< Blocks are outside of partition
     SD_ERROR                        ///< Some hardware problems with SD
 }SD_Error_t;
 
@@ -57,6 +61,7 @@ typedef enum
 typedef enum
 {
     SD_CMD_0 = 0,               ///< Go to idle mode
+    SD_CMD_6 = 6,               ///< Check or switch card function
     SD_CMD_8 = 8,               ///< Checks working parameters
     SD_CMD_9 = 9,               ///< Read CSD
     SD_CMD_10 = 10,             ///< Read CID
@@ -65,8 +70,12 @@ typedef enum
     SD_CMD_16 = 16,             ///< Set block size
     SD_CMD_17 = 17,             ///< Read block
     SD_CMD_18 = 18,             ///< Read multiple blocks
+    SD_CMD_23 = 23,             ///< Set number of blocks for next multiple read or write
     SD_CMD_24 = 24,             ///< Write block
     SD_CMD_25 = 25,             ///< Write multiple blocks
+    SD_CMD_32 = 32,             ///< Set first block to erase
+    SD_CMD_33 = 33,             ///< Set last block to erase
+    SD_CMD_38 = 38,             ///< Erase selected blocks
     SD_CMD_55 = 55,             ///< Preceed ACMD
     SD_CMD_58 = 58              ///< Read OCR
 }SD_Command_t;
@@ -74,8 +83,11 @@ typedef enum
 ///List of used acommands
 typedef enum
 {
+    SD_ACMD_13 = 13,            ///< Read SD status
     SD_ACMD_22 = 22,            ///< Get number of successfully written blocks
-    SD_ACMD_41 = 41             ///< Checks initialization status
+    SD_ACMD_23 = 23,            ///< Set number of blocks to pre-erase before multiple write
+    SD_ACMD_41 = 41,            ///< Checks initialization status
+    SD_ACMD_51 = 51             ///< Read SCR register
 }SD_ACommand_t;
 
 ///List of SD card types
@@ -252,6 +264,73 @@ typedef struct __attribute__((packed))
     uint16_t CSDStructure : 2;
 }SD_CSDv2_t;
 
+/*SCR structure*/
+typedef struct __attribute__((packed))
+{
+    uint32_t reserved;
+    uint8_t cmdSupport : 4;
+    uint8_t reserved1 : 2;
+    uint8_t specX : 4;
+    uint8_t spec4 : 1;
+    uint8_t exSecurity : 4;
+    uint8_t spec3 : 1;
+    uint8_t busWidths : 4;
+    uint8_t security : 3;
+    uint8_t dataStatAfterErase : 1;
+    uint8_t spec : 4;
+    uint8_t SCRStructure : 4;
+}SD_SCR_t;
+
+/*SD status structure*/
+typedef struct __attribute__((packed))
+{
+    uint8_t busWidth : 2;
+    uint8_t securedMode : 1;
+    uint8_t reserved : 5;
+    uint16_t cardType;
+    uint32_t protectedAreaSize;
+    uint8_t speedClass;
+    uint8_t performanceMove;
+    uint8_t AUSize : 4;
+    uint8_t reserved1 : 4;
+    uint16_t eraseSize;
+    uint8_t eraseTimeout : 6;
+    uint8_t eraseOffset : 2;
+    uint8_t UHSSpeedGrade : 4;
+    uint8_t UHSAUSize : 4;
+    uint8_t videoSpeedClass;
+    uint16_t VSCAUSize : 10;
+    uint16_t reserved2 : 6;
+}SD_SDStatus_t;
+
+/*Transfer statistics
+    Collected for every data transfer, used to estimate link quality*/
+typedef struct
+{
+    uint32_t blocks;            ///< Number of blocks transferred successfully
+    uint32_t crcErrors;         ///< Number of CRC16 errors in both directions
+    uint32_t responseErrors;    ///< Number of wrong R1 responses and data error tokens
+    uint32_t retries;           ///< Number of repeated transfers after recoverable errors
+    uint32_t downshifts;        ///< Number of SPI clock decreases
+    uint32_t upshifts;          ///< Number of SPI clock increases
+    uint32_t busyWaits;         ///< Number of busy waits after programming
+    uint64_t busyCycles;        ///< Sum of busy wait times in DWT cycles
+    uint32_t busyMaxCycles;     ///< Longest busy wait in DWT cycles
+}SD_Stats_t;
+
+/*Card characterization
+    Filled by SD_Probe, higher layers can take transfer sizes from it*/
+typedef struct
+{
+    uint32_t chunkBlocks;       ///< Smallest multiple write size with near maximum throughput, blocks
+    uint32_t writeOverhead;     ///< Time of multiple write command without data, us
+    uint32_t writeBlockTime;    ///< Time of every block in multiple write, us
+    uint32_t readOverhead;      ///< Time of multiple read command without data, us
+    uint32_t readBlockTime;     ///< Time of every block in multiple read, us
+    uint32_t busyAverage;       ///< Average busy time after programming, us
+    uint32_t busyMax;           ///< Longest busy time after programming, us
+}SD_Probe_t;
+
 /*SD parameters
     Used in all API functions*/
 typedef struct
@@ -275,9 +354,11 @@ typedef struct
     SD_Type_t type;
     /*Response on last command*/
     SD_R1_t lastR1;
+    /*Data error token after last command, 0 if there was none*/
+    uint8_t lastDataError;
     /*Last status of SD card*/
     SD_R2_t lastR2;
-    /*Last successfully written blocks*/
+    /*Blocks confirmed by SD card in last write function*/
     uint32_t writtenBlocks;
     /*raw OCR register*/
     uint8_t rawOCR[4];
@@ -289,8 +370,94 @@ typedef struct
     uint16_t blockSize;
     /*capacity in bytes*/
     uint64_t capacity;
+    /*read access timeout in microseconds*/
+    uint32_t readTimeout;
+    /*write busy timeout for one block in microseconds*/
+    uint32_t writeTimeout;
+    /*erase timeout for one allocation unit in microseconds*/
+    uint32_t eraseTimeout;
+    /*erase timeout offset in microseconds, added once to every erase*/
+    uint32_t eraseOffset;
+    /*raw SCR register*/
+    uint8_t rawSCR[8];
+    /*SD card supports CMD23 for multiple read and write*/
+    uint8_t cmd23;
+    /*SD card is switched to high speed mode with CMD6*/
+    uint8_t highSpeed;
+    /*raw SD status register*/
+    uint8_t rawSDStatus[64];
+    /*allocation unit size in blocks*/
+    uint32_t auBlocks;
+    /*fastest SPI prescaler allowed for transfers*/
+    SD_SPI_Prescaler_t prescalerLimit;
+    /*SPI prescaler currently used for transfers*/
+    SD_SPI_Prescaler_t prescaler;
+    /*CRC errors in a row, SPI clock goes down when it reaches limit*/
+    uint8_t crcErrorRun;
+    /*blocks transferred without errors, SPI clock goes up when it reaches limit*/
+    uint32_t cleanRun;
+    /*transfer statistics*/
+    SD_Stats_t stats;
+    /*card characterization, valid after SD_Probe*/
+    SD_Probe_t probe;
+    /*profile matched by CID at init, NULL if card has no profile*/
+    const SD_Profile_t * profile;
+    /*blocks read successfully in last multiple read function*/
+    uint32_t readBlocks;
+    /*deadline of transfer in DWT cycles, checked only when useDeadline is set*/
+    uint32_t deadline;
+    uint8_t useDeadline;
+    /*request to stop running transfer, set by SD_Cancel and cleared when transfer starts and ends*/
+    volatile uint8_t cancel;
+    /*card can be busy after aborted write, next transfer waits for it*/
+    uint8_t pendingBusy;
+    /*multiple write was aborted while card programmed block, next transfer sends stop token*/
+    uint8_t pendingStop;
+    /*multiple transfer is running, deadline and cancel are checked only in it*/
+    volatile uint8_t abortable;
 }SD_Parameters_t;
 
+/// States of write job on shared SPI bus
+typedef enum
+{
+    SD_JOB_START,       ///< Multiple write command is not sent yet
+    SD_JOB_DATA,        ///< SD card waits for the next block
+    SD_JOB_BUSY,        ///< SD card programs block
+    SD_JOB_CLOSE,       ///< SD card finishes transfer after stop token
+    SD_JOB_DONE         ///< Job is finished, result is in error member
+}SD_JobState_t;
+
+/*Write job for one SD card on shared SPI bus
+    sd, address, data and num are set by user, other members by SD_WriteInterleaved*/
+typedef struct
+{
+    SD_Parameters_t * sd;       ///< SD card
+    uint32_t address;           ///< Address of the first block
+    uint8_t * data;             ///< Data of all blocks
+    uint32_t num;               ///< Number of blocks
+    uint32_t accepted;          ///< Blocks accepted by SD card
+    SD_Error_t error;           ///< Result of job
+    SD_JobState_t state;        ///< Current state of job
+    uint8_t predefined;         ///< Number of blocks is set by CMD23
+    uint32_t timestamp;         ///< Start of busy state in DWT cycles
+}SD_BusJob_t;
+
+/** \brief Callback which gets blocks from SD_ReadMultipleBlockSink
+  * \param  context: user pointer passed to SD_ReadMultipleBlockSink
+  * \param  index: number of block from the start of read
+  * \param  block: pointer to block data, valid only until callback returns
+  * \retval 1 to continue reading, 0 to stop
+*/
+typedef uint8_t (*SD_BlockSink_t)(void * context, uint32_t index, uint8_t * block);
+
+/** \brief Callback which fills blocks for SD_WriteMultipleBlockSource
+  * \param  context: user pointer passed to SD_WriteMultipleBlockSource
+  * \param  index: number of block from the start of write
+  * \param  block: pointer to buffer for block data
+  * \retval 1 if block is filled, 0 to stop writing
+*/
+typedef uint8_t (*SD_BlockSource_t)(void * context, uint32_t index, uint8_t * block);
+
 /*Initialize SD card*/
 SD_Error_t SD_Init(SD_Parameters_t * params);
 
@@ -300,17 +467,53 @@ SD_Error_t SD_ReadStatus(SD_Parameters_t * sd);
 /*Get number of successfully written blocks in a writtenBlocks member of sd struct*/
 SD_Error_t SD_GetWrittenBlocks(SD_Parameters_t * sd);
 
+/*Reads SD status register in rawSDStatus member of sd struct*/
+SD_Error_t SD_ReadSDStatus(SD_Parameters_t * sd);
+
+/*Measure transfer times on scratch region and put results in probe member of sd struct. Data in region is lost*/
+SD_Error_t SD_Probe(SD_Parameters_t * sd, uint32_t address, uint8_t * buffer, uint32_t maxBlocks);
+
+/*Clear transfer statistics in stats member of sd struct*/
+void SD_ResetStats(SD_Parameters_t * sd);
+
 /*Transfer functions*/
 SD_Error_t SD_ReadBlock(SD_Parameters_t * sd, uint32_t address, uint8_t * buffer);
 SD_Error_t SD_ReadMultipleBlock(SD_Parameters_t * sd, uint32_t address, uint8_t * data, uint32_t num);
 SD_Error_t SD_WriteBlock(SD_Parameters_t * sd, uint32_t address, uint8_t * data);
 SD_Error_t SD_WriteMultipleBlock(SD_Parameters_t * sd, uint32_t address, uint8_t * data, uint32_t num);
 
-/*Functions to make user-friendly structs from the raw OCR, CID, CSD registers*/
+/*Transfer functions which stop at the next block boundary or in wait for card after deadline in DWT cycles*/
+SD_Error_t SD_ReadMultipleBlockUntil(SD_Parameters_t * sd, uint32_t address, uint8_t * data, uint32_t num, uint32_t deadline);
+SD_Error_t SD_WriteMultipleBlockUntil(SD_Parameters_t * sd, uint32_t address, uint8_t * data, uint32_t num, uint32_t deadline);
+
+/*Stop running multiple transfer at the next block boundary or in wait for card, safe to call from interrupt.
+    Request without running multiple transfer is ignored*/
+void SD_Cancel(SD_Parameters_t * sd);
+
+/*Read blocks through one or two block buffers and give every block to sink callback*/
+SD_Error_t SD_ReadMultipleBlockSink(SD_Parameters_t * sd, uint32_t address, uint32_t num, SD_BlockSink_t sink, void * context,
+                                    uint8_t * buffer, uint8_t buffers);
+
+/*Write blocks filled by producer callback through one block buffer*/
+SD_Error_t SD_WriteMultipleBlockSource(SD_Parameters_t * sd, uint32_t address, uint32_t num, SD_BlockSource_t source, void * context,
+                                       uint8_t * buffer);
+
+/*Write to several SD cards on one SPIx, bus goes to other cards while one card is busy*/
+SD_Error_t SD_WriteInterleaved(SD_BusJob_t * jobs, uint32_t num);
+
+/*Erase blocks, big ranges are split in parts with bounded busy time*/
+SD_Error_t SD_Erase(SD_Parameters_t * sd, uint32_t address, uint32_t num);
+
+/*Continue failed multiple write from the first block not confirmed in writtenBlocks member of sd struct*/
+SD_Error_t SD_ResumeMultipleBlock(SD_Parameters_t * sd, uint32_t address, uint8_t * data, uint32_t num);
+
+/*Functions to make user-friendly structs from the raw OCR, CID, CSD, SCR, SD status registers*/
 SD_OCR_t SD_GetOCR(SD_Parameters_t * sd);
 SD_CID_t SD_GetCID(SD_Parameters_t * sd);
 SD_CSDv1_t SD_GetCSD_v1(SD_Parameters_t * sd);
 SD_CSDv2_t SD_GetCSD_v2(SD_Parameters_t * sd);
+SD_SCR_t SD_GetSCR(SD_Parameters_t * sd);
+SD_SDStatus_t SD_GetSDStatus(SD_Parameters_t * sd);
 
 
 #endif /* SDCARD_H_INCLUDED */
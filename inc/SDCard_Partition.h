@@ -0,0 +1,96 @@
+/*MIT License
+
+Copyright (c) 2019 DoHelloWorld
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.*/
+
+
+#ifndef SDCARD_PARTITION_H_INCLUDED
+#define SDCARD_PARTITION_H_INCLUDED
+#include "SDCard.h"
+
+/// Maximum number of GPT partition entries checked by SD_PartitionScan
+#define SD_PARTITION_GPT_MAX_ENTRIES    128
+
+/// Cache policy of filesystem layers mounted on partition
+typedef enum
+{
+    SD_PARTITION_WRITE_BACK,        ///< Changed window is kept until other block is needed or file is synced
+    SD_PARTITION_WRITE_THROUGH      ///< Changed window is written at the end of each write call
+}SD_PartitionCache_t;
+
+/*Partition statistics
+    Counted for every call of partition API functions*/
+typedef struct
+{
+    /*number of read calls*/
+    uint32_t reads;
+    /*number of write calls*/
+    uint32_t writes;
+    /*number of erase calls*/
+    uint32_t erases;
+    /*number of successfully read blocks*/
+    uint32_t blocksRead;
+    /*number of successfully written blocks*/
+    uint32_t blocksWritten;
+    /*number of erased blocks*/
+    uint32_t blocksErased;
+    /*number of calls finished with SD error*/
+    uint32_t errors;
+    /*number of calls rejected because of range outside partition*/
+    uint32_t rangeErrors;
+}SD_PartitionStats_t;
+
+/*Partition of SD card
+    Block addresses of partition API functions are relative to partition start and bounded by partition size*/
+typedef struct
+{
+    /*SD card with partition*/
+    SD_Parameters_t * sd;
+    /*first SD data block of partition*/
+    uint32_t start;
+    /*partition size in blocks*/
+    uint32_t blocks;
+    /*MBR partition type, 0xEE for GPT partitions and 0 for whole card*/
+    uint8_t type;
+    /*GPT partition type GUID, zeros for MBR partitions*/
+    uint8_t typeGUID[16];
+    /*allocation unit size in blocks used for alignment by layers on partition*/
+    uint32_t auBlocks;
+    /*cache policy of layers on partition*/
+    SD_PartitionCache_t cache;
+    /*partition statistics*/
+    SD_PartitionStats_t stats;
+}SD_Partition_t;
+
+/*Find partitions in MBR or GPT, card without partition table is returned as one partition. Buffer should hold 1 block*/
+SD_Error_t SD_PartitionScan(SD_Parameters_t * sd, uint8_t * buffer, SD_Partition_t * parts, uint8_t maxParts, uint8_t * count);
+
+/*Make partition from range of SD data blocks*/
+void SD_PartitionInit(SD_Partition_t * part, SD_Parameters_t * sd, uint32_t start, uint32_t blocks);
+
+/*Clear partition statistics*/
+void SD_PartitionResetStats(SD_Partition_t * part);
+
+/*Data transfer functions, address is block number inside partition*/
+SD_Error_t SD_PartitionRead(SD_Partition_t * part, uint32_t address, uint8_t * data, uint32_t num);
+SD_Error_t SD_PartitionWrite(SD_Partition_t * part, uint32_t address, uint8_t * data, uint32_t num);
+SD_Error_t SD_PartitionErase(SD_Partition_t * part, uint32_t address, uint32_t num);
+
+#endif /* SDCARD_PARTITION_H_INCLUDED */
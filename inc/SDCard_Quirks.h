@@ -0,0 +1,59 @@
+/*MIT License
+
+Copyright (c) 2019 DoHelloWorld
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.*/
+
+
+#ifndef SDCARD_QUIRKS_H_INCLUDED
+#define SDCARD_QUIRKS_H_INCLUDED
+#include "stm32f30x.h"
+
+/*SD card profile
+    Tuning for cards matched by CID fields. Zero fields match any card and keep driver settings*/
+typedef struct
+{
+    /*profile name, NULL ends profile table*/
+    const char * name;
+    /*manufacturer ID*/
+    uint8_t MID;
+    /*OEM/Application ID, 2 ASCII characters*/
+    char OID[2];
+    /*product name, 5 ASCII characters*/
+    char PNM[5];
+    /*product revision*/
+    uint8_t PRV;
+    /*highest SPI clock in Hz*/
+    uint32_t maxClock;
+    /*preferred multiple write size in blocks*/
+    uint32_t chunkBlocks;
+    /*pre-erase blocks with ACMD23 before multiple write*/
+    uint8_t preErase;
+    /*read access timeout in microseconds*/
+    uint32_t readTimeout;
+    /*write busy timeout for one block in microseconds*/
+    uint32_t writeTimeout;
+    /*delay after every write function in microseconds*/
+    uint32_t writeDelay;
+}SD_Profile_t;
+
+/*Find profile for raw CID register, returns NULL if no profile matches*/
+const SD_Profile_t * SD_FindProfile(const uint8_t * rawCID);
+
+#endif /* SDCARD_QUIRKS_H_INCLUDED */
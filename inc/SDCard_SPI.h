@@ -27,8 +27,9 @@ SOFTWARE.*/
 /// SD SPI return states
 typedef enum
 {
-    SD_SPI_OK,      ///< API function executed successfully
-    SD_SPI_ERROR    ///< API function executed with a fail
+    SD_SPI_OK,          ///< API function executed successfully
+    SD_SPI_ERROR,       ///< API function executed with a fail
+    SD_SPI_CRC_ERROR    ///< Data received successfully but CRC16 is wrong
 }SD_SPI_Status_t;
 
 /// Arguments for function SD_SPI_SetSpeed
@@ -38,9 +39,25 @@ typedef enum
     SD_SPI_TRANSFER_SPEED   ///< Transfer mode clock < 50 MHz
 }SD_SPI_Speed_t;
 
+/// SPIx clock prescalers, value is written to BR bits of CR1 register
+typedef enum
+{
+    SD_SPI_PRESCALER_2,     ///< SPIx clock = fPCLK / 2
+    SD_SPI_PRESCALER_4,     ///< SPIx clock = fPCLK / 4
+    SD_SPI_PRESCALER_8,     ///< SPIx clock = fPCLK / 8
+    SD_SPI_PRESCALER_16,    ///< SPIx clock = fPCLK / 16
+    SD_SPI_PRESCALER_32,    ///< SPIx clock = fPCLK / 32
+    SD_SPI_PRESCALER_64,    ///< SPIx clock = fPCLK / 64
+    SD_SPI_PRESCALER_128,   ///< SPIx clock = fPCLK / 128
+    SD_SPI_PRESCALER_256    ///< SPIx clock = fPCLK / 256
+}SD_SPI_Prescaler_t;
+
 /* Functions to configure SPI module */
 void SD_SPI_Config(SPI_TypeDef * SPIx, uint8_t CS_Pin, GPIO_TypeDef * CS_Port);
 void SD_SPI_SetSpeed(SPI_TypeDef * SPIx, uint32_t clk, SD_SPI_Speed_t speed);
+void SD_SPI_SetPrescaler(SPI_TypeDef * SPIx, SD_SPI_Prescaler_t prescaler);
+SD_SPI_Prescaler_t SD_SPI_GetPrescaler(SPI_TypeDef * SPIx);
+SD_SPI_Prescaler_t SD_SPI_GetPrescalerFor(uint32_t clk, uint32_t maxClk);
 
 /* Functions to select/deselect SPI slave */
 void SD_SPI_CS_Set(GPIO_TypeDef * port, uint8_t pin);
@@ -52,5 +69,10 @@ SD_SPI_Status_t SD_SPI_Receive8Data(SPI_TypeDef * SPIx, uint8_t * data, uint32_t
 SD_SPI_Status_t SD_SPI_Send16Data(SPI_TypeDef * SPIx, uint16_t * data, uint32_t len, FunctionalState crcState);
 SD_SPI_Status_t SD_SPI_Receive16Data(SPI_TypeDef * SPIx, uint16_t * data, uint32_t len, FunctionalState crcState);
 
+/* Functions to receive data block in background, define SD_SPI_DMA to use DMA */
+SD_SPI_Status_t SD_SPI_StartReceive16Data(SPI_TypeDef * SPIx, uint16_t * data, uint32_t len);
+SD_SPI_Status_t SD_SPI_WaitReceive16Data(SPI_TypeDef * SPIx);
+void SD_SPI_Swap16Data(uint16_t * data, uint32_t len);
+
 
 #endif /* SDCARD_SPI_H_INCLUDED */
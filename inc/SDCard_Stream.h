@@ -0,0 +1,56 @@
+/*MIT License
+
+Copyright (c) 2019 DoHelloWorld
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.*/
+
+#ifndef SDCARD_STREAM_H_INCLUDED
+#define SDCARD_STREAM_H_INCLUDED
+#include "SDCard.h"
+
+/*Sequential write stream
+    Splits writes on allocation unit boundaries and collects small writes in staging buffer*/
+typedef struct
+{
+    /*SD card where stream is written*/
+    SD_Parameters_t * sd;
+    /*staging buffer, its size should be multiple of block size*/
+    uint8_t * buffer;
+    /*staging buffer size in blocks*/
+    uint32_t bufferBlocks;
+    /*number of bytes in staging buffer*/
+    uint32_t fill;
+    /*SD data block where staging buffer is written*/
+    uint32_t address;
+    /*allocation unit size in blocks*/
+    uint32_t auBlocks;
+    /*number of bytes accepted by stream*/
+    uint64_t position;
+}SD_Stream_t;
+
+/*Start stream at SD data block address. Buffer is used to collect parts of allocation units*/
+void SD_StreamInit(SD_Stream_t * stream, SD_Parameters_t * sd, uint32_t address, uint8_t * buffer, uint32_t bufferBlocks);
+
+/*Write data to stream*/
+SD_Error_t SD_StreamWrite(SD_Stream_t * stream, uint8_t * data, uint32_t len);
+
+/*Write staging buffer to SD card, last not full block is padded with zeros and kept in buffer*/
+SD_Error_t SD_StreamFlush(SD_Stream_t * stream);
+
+#endif /* SDCARD_STREAM_H_INCLUDED */
@@ -0,0 +1,82 @@
+/*MIT License
+
+Copyright (c) 2019 DoHelloWorld
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.*/
+
+
+#ifndef TIMEINDEX_H_INCLUDED
+#define TIMEINDEX_H_INCLUDED
+#include "RecordLog.h"
+
+/*Index entries in one index block*/
+#define TIDX_ENTRIES    20
+
+/// Time index API functions return value
+typedef enum
+{
+    TIDX_OK,                ///< API function executed correctly
+    TIDX_DISK_ERROR,        ///< SD card transfer failed
+    TIDX_LOG_ERROR,         ///< Record log returned error, it is in logError member of index
+    TIDX_FULL,              ///< Index partition is full, record is not appended
+    TIDX_CORRUPT,           ///< Index block is damaged
+    TIDX_DENIED             ///< Wrong parameter or timestamp goes back
+}TIDX_Error_t;
+
+/*Sparse time index of record log
+    Index partition keeps array of blocks with entries (timestamp, record position, record sequence).
+    Entry is added when record starts more than interval bytes after previous entry, so records from entry
+    position have timestamps not less than entry timestamp. Blocks are found with binary search*/
+typedef struct
+{
+    /*partition with index blocks*/
+    SD_Partition_t * part;
+    /*indexed log*/
+    LOG_t * log;
+    /*number of full index blocks on SD card*/
+    uint32_t blocks;
+    /*log bytes between entries*/
+    uint32_t interval;
+    /*number of entries in pending block*/
+    uint32_t count;
+    /*log position of the last entry*/
+    uint64_t last;
+    /*timestamp of the last entry*/
+    uint64_t lastTimestamp;
+    /*last error of record log*/
+    LOG_Error_t logError;
+    /*block which gets new entries, it is written when it is full or index is synced*/
+    uint8_t pending[512];
+    /*buffer for search*/
+    uint8_t buffer[512];
+}TIDX_t;
+
+/*Open index of opened log, entries after log end are dropped*/
+TIDX_Error_t TIDX_Open(TIDX_t * index, SD_Partition_t * part, LOG_t * log, uint32_t interval);
+
+/*Append record with timestamp to log and add index entry when it is time*/
+TIDX_Error_t TIDX_Append(TIDX_t * index, uint64_t timestamp, uint8_t * data, uint32_t len);
+
+/*Sync log and write pending index block*/
+TIDX_Error_t TIDX_Sync(TIDX_t * index);
+
+/*Move log reader to the last indexed record with timestamp before given one, so no record with given timestamp is skipped*/
+TIDX_Error_t TIDX_Find(TIDX_t * index, uint64_t timestamp, LOG_Reader_t * reader);
+
+#endif /* TIMEINDEX_H_INCLUDED */
@@ -33,4 +33,16 @@ uint32_t DWT_GetCycle(void);
 /*Calculating timeout from timestamp*/
 uint8_t DWT_Timeout(uint32_t timeout_ms, uint32_t timestamp);
 
+/*Converting number of cycles to microseconds*/
+uint32_t DWT_CyclesToUs(uint32_t cycles);
+
+/*Calculating timeout in microseconds from timestamp*/
+uint8_t DWT_TimeoutUs(uint32_t timeout_us, uint32_t timestamp);
+
+/*Check if absolute deadline in cycles is passed*/
+uint8_t DWT_Expired(uint32_t deadline);
+
+/*Continue CRC32 (IEEE 802.3) over data, start with crc = 0*/
+uint32_t CRC32_Update(uint32_t crc, const uint8_t * data, uint32_t len);
+
 #endif /* UTILS_H_INCLUDED */
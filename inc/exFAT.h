@@ -0,0 +1,160 @@
+/*MIT License
+
+Copyright (c) 2019 DoHelloWorld
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.*/
+
+
+
+#ifndef EXFAT_H_INCLUDED
+#define EXFAT_H_INCLUDED
+#include "SDCard_Partition.h"
+#include "SDCard_Stream.h"
+
+/// exFAT API functions return value
+typedef enum
+{
+    EXFAT_OK,               ///< API function executed correctly
+    EXFAT_DISK_ERROR,       ///< SD card transfer failed
+    EXFAT_NO_FILESYSTEM,    ///< Volume is not exFAT with 512-byte sectors or has no allocation bitmap
+    EXFAT_NOT_FOUND,        ///< File or directory is not found
+    EXFAT_INVALID_NAME,     ///< Path component is not valid ASCII exFAT name
+    EXFAT_DENIED,           ///< File is not opened for this access or path is a directory
+    EXFAT_NO_SPACE,         ///< No free clusters on volume or no free entries in subdirectory
+    EXFAT_CORRUPT           ///< Cluster chain or entry set is broken
+}EXFAT_Error_t;
+
+/// File open modes, can be combined
+typedef enum
+{
+    EXFAT_MODE_READ     = 0x01,     ///< Read access
+    EXFAT_MODE_WRITE    = 0x02,     ///< Write access
+    EXFAT_MODE_CREATE   = 0x04,     ///< Create file if it does not exist
+    EXFAT_MODE_APPEND   = 0x08,     ///< Start at the end of file
+    EXFAT_MODE_TRUNCATE = 0x10      ///< Drop file data at open
+}EXFAT_Mode_t;
+
+/*exFAT volume
+    Keeps volume geometry and one sector window for FAT, bitmap, directories and partial data blocks*/
+typedef struct
+{
+    /*partition with volume, block numbers of volume are relative to partition start*/
+    SD_Partition_t * part;
+    /*first block of active FAT*/
+    uint32_t fatStart;
+    /*blocks in cluster*/
+    uint32_t clusterBlocks;
+    /*first block of cluster 2*/
+    uint32_t dataStart;
+    /*number of data clusters*/
+    uint32_t clusters;
+    /*first cluster of root directory*/
+    uint32_t rootCluster;
+    /*first block of allocation bitmap*/
+    uint32_t bitmapStart;
+    /*cluster where search of free cluster starts*/
+    uint32_t nextFree;
+    /*VolumeDirty flag is set by driver*/
+    uint8_t volumeDirty;
+    /*VolumeDirty flag was set already at mount*/
+    uint8_t wasDirty;
+    /*block in window, 0xFFFFFFFF if window is empty*/
+    uint32_t window;
+    /*window is changed and not written yet*/
+    uint8_t dirty;
+    /*sector window*/
+    uint8_t buffer[512];
+}EXFAT_FS_t;
+
+/*Position in directory*/
+typedef struct
+{
+    /*first cluster of directory*/
+    uint32_t first;
+    /*clusters of contiguous directory, 0 if directory uses FAT chain*/
+    uint32_t length;
+    /*current cluster and its number in directory*/
+    uint32_t cluster;
+    uint32_t index;
+    /*block in cluster and offset of entry in block*/
+    uint32_t block;
+    uint16_t offset;
+}EXFAT_Dir_t;
+
+/*Open file
+    Contiguous files (NoFatChain) are mapped arithmetically, fragmented files keep cursor in FAT chain*/
+typedef struct
+{
+    /*volume of file*/
+    EXFAT_FS_t * fs;
+    /*position of file entry set*/
+    EXFAT_Dir_t entry;
+    /*first cluster, 0 for empty file*/
+    uint32_t firstCluster;
+    /*allocated clusters*/
+    uint32_t clusters;
+    /*clusters are contiguous and FAT is not used*/
+    uint8_t noFatChain;
+    /*last cluster of chain, 0 if not known yet*/
+    uint32_t tail;
+    /*file size (ValidDataLength) and allocated size (DataLength) in bytes*/
+    uint64_t size;
+    uint64_t length;
+    /*current position in bytes*/
+    uint64_t position;
+    /*open mode from EXFAT_Mode_t*/
+    uint8_t mode;
+    /*entry set is changed and not written yet*/
+    uint8_t modified;
+    /*last visited cluster of FAT chain and its number in file*/
+    uint32_t cursorIndex;
+    uint32_t cursorCluster;
+}EXFAT_File_t;
+
+/*Mount exFAT volume which starts at the first block of partition*/
+EXFAT_Error_t EXFAT_Mount(EXFAT_FS_t * fs, SD_Partition_t * part);
+
+/*Write changed sector window and clear VolumeDirty flag*/
+EXFAT_Error_t EXFAT_Unmount(EXFAT_FS_t * fs);
+
+/*Open file by path like "Logs/Data.bin" with modes from EXFAT_Mode_t*/
+EXFAT_Error_t EXFAT_Open(EXFAT_File_t * file, EXFAT_FS_t * fs, const char * path, uint8_t mode);
+
+/*File access functions*/
+EXFAT_Error_t EXFAT_Read(EXFAT_File_t * file, uint8_t * data, uint32_t len, uint32_t * read);
+EXFAT_Error_t EXFAT_Write(EXFAT_File_t * file, uint8_t * data, uint32_t len, uint32_t * written);
+EXFAT_Error_t EXFAT_Seek(EXFAT_File_t * file, uint64_t position);
+
+/*Reserve contiguous clusters aligned to allocation units for empty file, optionally erase them.
+    Reservation after file end is kept until EXFAT_Trim or EXFAT_Close*/
+EXFAT_Error_t EXFAT_Preallocate(EXFAT_File_t * file, uint64_t bytes, uint8_t erase);
+
+/*Write preallocated file through write stream from current position, file functions are not used until close*/
+EXFAT_Error_t EXFAT_StreamOpen(EXFAT_File_t * file, SD_Stream_t * stream, uint8_t * buffer, uint32_t bufferBlocks);
+EXFAT_Error_t EXFAT_StreamWrite(EXFAT_File_t * file, SD_Stream_t * stream, uint8_t * data, uint32_t len);
+EXFAT_Error_t EXFAT_StreamClose(EXFAT_File_t * file, SD_Stream_t * stream);
+
+/*Update entry set of file and write changed sector window*/
+EXFAT_Error_t EXFAT_Sync(EXFAT_File_t * file);
+
+/*Free clusters after file size and sync file, close of file opened for write calls it*/
+EXFAT_Error_t EXFAT_Trim(EXFAT_File_t * file);
+EXFAT_Error_t EXFAT_Close(EXFAT_File_t * file);
+
+#endif /* EXFAT_H_INCLUDED */
@@ -0,0 +1,1492 @@
+/*MIT License
+
+Copyright (c) 2019 DoHelloWorld
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.*/
+
+
+#include <string.h>
+#include "FAT32.h"
+
+#define FAT_BLOCK_SIZE      512         /**< FAT32 sector size supported by driver */
+#define FAT_NO_WINDOW       0xFFFFFFFF  /**< Window block when window is empty */
+#define FAT_ENTRY_MASK      0x0FFFFFFF  /**< FAT32 entries have 28 bits */
+#define FAT_EOC             0x0FFFFFF8  /**< Entries from this value end cluster chain */
+#define FAT_EOC_MARK        0x0FFFFFFF  /**< End of chain mark written by driver */
+#define FAT_MIN_CLUSTERS    65525       /**< FAT32 volume has at least this number of clusters */
+#define FAT_DIR_ENTRY       32          /**< Size of directory entry */
+#define FAT_NAME_LEN        11          /**< Length of 8.3 name in directory entry */
+#define FAT_ENTRY_FREE      0xE5        /**< First name byte of deleted entry */
+#define FAT_ATTR_VOLUME     0x08        /**< Volume label, also set in long name entries */
+#define FAT_ATTR_DIRECTORY  0x10        /**< Directory */
+#define FAT_ATTR_ARCHIVE    0x20        /**< Archive, set for new files */
+#define FAT_FSI_LEAD_SIG    0x41615252  /**< FSInfo signature at offset 0 */
+#define FAT_FSI_STRUCT_SIG  0x61417272  /**< FSInfo signature at offset 484 */
+#define FAT_FSI_FREE_COUNT  488         /**< Offset of free cluster count in FSInfo */
+#define FAT_FSI_NEXT_FREE   492         /**< Offset of next free cluster hint in FSInfo */
+#define FAT_FREE_UNKNOWN    0xFFFFFFFF  /**< Free cluster count is not known */
+#define FAT_ENTRY_SHIFT     7           /**< FAT block has 2^7 entries */
+#define FAT_TAG_REMOVED     0xFFFF      /**< Tag of index slot with removed entry */
+
+/*Little-endian fields of on-disk structures*/
+static uint16_t FAT_Load16(const uint8_t * data);
+static uint32_t FAT_Load32(const uint8_t * data);
+static void FAT_Store16(uint8_t * data, uint16_t value);
+static void FAT_Store32(uint8_t * data, uint32_t value);
+/*Sector window functions*/
+static FAT_Error_t FAT_Flush(FAT_FS_t * fs);
+static FAT_Error_t FAT_Move(FAT_FS_t * fs, uint32_t block);
+static FAT_Error_t FAT_DropWindow(FAT_FS_t * fs, uint32_t block, uint32_t num);
+/*Multiple block transfers of data clusters*/
+static FAT_Error_t FAT_ReadBlocks(FAT_FS_t * fs, uint32_t block, uint8_t * data, uint32_t num);
+static FAT_Error_t FAT_WriteBlocks(FAT_FS_t * fs, uint32_t block, uint8_t * data, uint32_t num);
+/*First block of cluster*/
+static uint32_t FAT_ClusterBlock(FAT_FS_t * fs, uint32_t cluster);
+/*Check if cluster number is inside volume*/
+static uint8_t FAT_IsCluster(FAT_FS_t * fs, uint32_t cluster);
+/*FAT entry access*/
+static FAT_Error_t FAT_GetEntry(FAT_FS_t * fs, uint32_t cluster, uint32_t * value);
+static FAT_Error_t FAT_SetEntry(FAT_FS_t * fs, uint32_t cluster, uint32_t value);
+/*Mark free cluster count in FSInfo as unknown*/
+static FAT_Error_t FAT_InvalidateFree(FAT_FS_t * fs);
+/*Free map access*/
+static uint8_t FAT_MapGet(FAT_FS_t * fs, uint32_t group);
+static void FAT_MapSet(FAT_FS_t * fs, uint32_t group, uint8_t state);
+static uint32_t FAT_Group(FAT_FS_t * fs, uint32_t cluster);
+static uint32_t FAT_GroupStart(FAT_FS_t * fs, uint32_t group);
+static uint32_t FAT_GroupEnd(FAT_FS_t * fs, uint32_t group);
+/*Count free clusters of group and update its state*/
+static FAT_Error_t FAT_MapGroup(FAT_FS_t * fs, uint32_t group, uint32_t * free);
+/*Update free count and free map after change of cluster*/
+static void FAT_MapUpdate(FAT_FS_t * fs, uint32_t cluster, uint8_t used);
+/*Allocate free cluster and link it after previous cluster*/
+static FAT_Error_t FAT_AllocCluster(FAT_FS_t * fs, uint32_t previous, uint32_t * cluster);
+/*Free all clusters of chain*/
+static FAT_Error_t FAT_FreeChain(FAT_FS_t * fs, uint32_t cluster);
+/*Add cluster at the end of cached runs*/
+static void FAT_AddRun(FAT_File_t * file, uint32_t index, uint32_t cluster);
+/*Find volume cluster of file cluster and number of contiguous clusters from it*/
+static FAT_Error_t FAT_MapCluster(FAT_File_t * file, uint32_t index, uint32_t want, uint32_t * cluster, uint32_t * count);
+/*Make cluster chain of file at least clusters long*/
+static FAT_Error_t FAT_ExtendFile(FAT_File_t * file, uint32_t clusters);
+/*Convert path component to 8.3 name of directory entry*/
+static FAT_Error_t FAT_MakeName(const char ** path, uint8_t * name);
+/*Get first cluster from directory entry*/
+static uint32_t FAT_EntryCluster(const uint8_t * entry);
+/*Find entry in directory with index or scan, entry stays in window*/
+static FAT_Error_t FAT_FindEntry(FAT_FS_t * fs, uint32_t dir, const uint8_t * name, uint32_t * block, uint16_t * offset);
+static FAT_Error_t FAT_ScanEntry(FAT_FS_t * fs, uint32_t dir, const uint8_t * name, uint32_t * block, uint16_t * offset);
+/*Find directory by path*/
+static FAT_Error_t FAT_OpenDir(FAT_FS_t * fs, const char * path, uint32_t * dir);
+/*Directory index functions*/
+static uint8_t FAT_IndexReady(FAT_FS_t * fs, uint32_t dir);
+static uint32_t FAT_Hash(const uint8_t * name);
+static uint16_t FAT_IndexTag(uint32_t hash);
+static uint8_t FAT_IndexInsert(FAT_DirIndex_t * index, const uint8_t * name, uint32_t block, uint16_t offset);
+static void FAT_IndexRemove(FAT_DirIndex_t * index, const uint8_t * name, uint32_t block, uint16_t offset);
+static FAT_Error_t FAT_IndexBuild(FAT_FS_t * fs, FAT_DirIndex_t * index);
+static FAT_Error_t FAT_IndexFind(FAT_FS_t * fs, FAT_DirIndex_t * index, const uint8_t * name, uint32_t * block, uint16_t * offset);
+/*Find free entry in directory or add cluster to it, entry stays in window*/
+static FAT_Error_t FAT_AddEntry(FAT_FS_t * fs, uint32_t dir, uint32_t * block, uint16_t * offset);
+
+/** \brief Load 16-bit little-endian value
+  * \param  data: pointer to value
+  * \retval value
+*/
+static uint16_t FAT_Load16(const uint8_t * data)
+{
+    return data[0] | (data[1] << 8);
+}
+
+/** \brief Load 32-bit little-endian value
+  * \param  data: pointer to value
+  * \retval value
+*/
+static uint32_t FAT_Load32(const uint8_t * data)
+{
+    return data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+/** \brief Store 16-bit little-endian value
+  * \param  data: pointer where to put value
+  * \param  value: value
+  * \retval None
+*/
+static void FAT_Store16(uint8_t * data, uint16_t value)
+{
+    data[0] = (uint8_t)value;
+    data[1] = (uint8_t)(value >> 8);
+}
+
+/** \brief Store 32-bit little-endian value
+  * \param  data: pointer where to put value
+  * \param  value: value
+  * \retval None
+*/
+static void FAT_Store32(uint8_t * data, uint32_t value)
+{
+    data[0] = (uint8_t)value;
+    data[1] = (uint8_t)(value >> 8);
+    data[2] = (uint8_t)(value >> 16);
+    data[3] = (uint8_t)(value >> 24);
+}
+
+/** \brief Write changed window to SD card, FAT sectors are written to every FAT copy
+  * \param  fs: pointer to volume structure
+  * \retval FAT error number
+*/
+static FAT_Error_t FAT_Flush(FAT_FS_t * fs)
+{
+    if(!fs->dirty)
+        return FAT_OK;
+    if(SD_PartitionWrite(fs->part, fs->window, fs->buffer, 1) != SD_OK)
+        return FAT_DISK_ERROR;
+    /*Mirror FAT sector to other FAT copies*/
+    if((fs->window >= fs->fatStart) && (fs->window < fs->fatStart + fs->fatSize))
+    {
+        for(uint8_t i = 1; i < fs->numFATs; ++i)
+        {
+            if(SD_PartitionWrite(fs->part, fs->window + i * fs->fatSize, fs->buffer, 1) != SD_OK)
+                return FAT_DISK_ERROR;
+        }
+    }
+    fs->dirty = 0;
+    return FAT_OK;
+}
+
+/** \brief Load block to window, changed window is written before
+  * \param  fs: pointer to volume structure
+  * \param  block: volume block
+  * \retval FAT error number
+*/
+static FAT_Error_t FAT_Move(FAT_FS_t * fs, uint32_t block)
+{
+    FAT_Error_t error = FAT_OK;
+    if(fs->window == block)
+        return FAT_OK;
+    error = FAT_Flush(fs);
+    if(error != FAT_OK)
+        return error;
+    if(SD_PartitionRead(fs->part, block, fs->buffer, 1) != SD_OK)
+    {
+        fs->window = FAT_NO_WINDOW;
+        return FAT_DISK_ERROR;
+    }
+    fs->window = block;
+    return FAT_OK;
+}
+
+/** \brief Drop window if it is inside range of direct transfer, changed window is written before
+  * \param  fs: pointer to volume structure
+  * \param  block: first volume block of transfer
+  * \param  num: number of blocks
+  * \retval FAT error number
+*/
+static FAT_Error_t FAT_DropWindow(FAT_FS_t * fs, uint32_t block, uint32_t num)
+{
+    FAT_Error_t error = FAT_OK;
+    if((fs->window < block) || (fs->window >= block + num))
+        return FAT_OK;
+    error = FAT_Flush(fs);
+    fs->window = FAT_NO_WINDOW;
+    return error;
+}
+
+/** \brief Read data blocks, several blocks are read with one multiple read
+  * \param  fs: pointer to volume structure
+  * \param  block: first volume block
+  * \param  data: pointer to buffer for data
+  * \param  num: number of blocks
+  * \retval FAT error number
+*/
+static FAT_Error_t FAT_ReadBlocks(FAT_FS_t * fs, uint32_t block, uint8_t * data, uint32_t num)
+{
+    return (SD_PartitionRead(fs->part, block, data, num) == SD_OK) ? FAT_OK : FAT_DISK_ERROR;
+}
+
+/** \brief Write data blocks, several blocks are written with one multiple write
+  * \param  fs: pointer to volume structure
+  * \param  block: first volume block
+  * \param  data: pointer to data
+  * \param  num: number of blocks
+  * \retval FAT error number
+*/
+static FAT_Error_t FAT_WriteBlocks(FAT_FS_t * fs, uint32_t block, uint8_t * data, uint32_t num)
+{
+    return (SD_PartitionWrite(fs->part, block, data, num) == SD_OK) ? FAT_OK : FAT_DISK_ERROR;
+}
+
+/** \brief Get first block of cluster
+  * \param  fs: pointer to volume structure
+  * \param  cluster: cluster number
+  * \retval volume block
+*/
+static uint32_t FAT_ClusterBlock(FAT_FS_t * fs, uint32_t cluster)
+{
+    return fs->dataStart + (cluster - 2) * fs->clusterBlocks;
+}
+
+/** \brief Check if cluster number is inside volume
+  * \param  fs: pointer to volume structure
+  * \param  cluster: cluster number
+  * \retval 1 if cluster is valid, 0 if not
+*/
+static uint8_t FAT_IsCluster(FAT_FS_t * fs, uint32_t cluster)
+{
+    return (cluster >= 2) && (cluster < fs->clusters + 2);
+}
+
+/** \brief Read FAT entry
+  * \param  fs: pointer to volume structure
+  * \param  cluster: cluster number
+  * \param  value: pointer where to put entry value
+  * \retval FAT error number
+*/
+static FAT_Error_t FAT_GetEntry(FAT_FS_t * fs, uint32_t cluster, uint32_t * value)
+{
+    FAT_Error_t error = FAT_Move(fs, fs->fatStart + cluster / (FAT_BLOCK_SIZE / 4));
+    if(error != FAT_OK)
+        return error;
+    *value = FAT_Load32(fs->buffer + (cluster % (FAT_BLOCK_SIZE / 4)) * 4) & FAT_ENTRY_MASK;
+    return FAT_OK;
+}
+
+/** \brief Write FAT entry, high 4 reserved bits are kept
+  * \param  fs: pointer to volume structure
+  * \param  cluster: cluster number
+  * \param  value: entry value
+  * \retval FAT error number
+*/
+static FAT_Error_t FAT_SetEntry(FAT_FS_t * fs, uint32_t cluster, uint32_t value)
+{
+    FAT_Error_t error = FAT_Move(fs, fs->fatStart + cluster / (FAT_BLOCK_SIZE / 4));
+    if(error != FAT_OK)
+        return error;
+    uint8_t * entry = fs->buffer + (cluster % (FAT_BLOCK_SIZE / 4)) * 4;
+    FAT_Store32(entry, (FAT_Load32(entry) & ~FAT_ENTRY_MASK) | (value & FAT_ENTRY_MASK));
+    fs->dirty = 1;
+    return FAT_OK;
+}
+
+/** \brief Mark free cluster count in FSInfo as unknown before the first change of FAT
+  * \param  fs: pointer to volume structure
+  * \retval FAT error number
+*/
+static FAT_Error_t FAT_InvalidateFree(FAT_FS_t * fs)
+{
+    FAT_Error_t error = FAT_OK;
+    if(!fs->freeValid)
+        return FAT_OK;
+    fs->freeValid = 0;
+    if(!fs->fsInfo)
+        return FAT_OK;
+    /*Exact count is written at unmount*/
+    error = FAT_Move(fs, fs->fsInfo);
+    if(error != FAT_OK)
+        return error;
+    if((FAT_Load32(fs->buffer) != FAT_FSI_LEAD_SIG) || (FAT_Load32(fs->buffer + 484) != FAT_FSI_STRUCT_SIG))
+        return FAT_OK;
+    FAT_Store32(fs->buffer + FAT_FSI_FREE_COUNT, 0xFFFFFFFF);
+    fs->dirty = 1;
+    return FAT_OK;
+}
+
+/** \brief Get state of group from free map
+  * \param  fs: pointer to volume structure
+  * \param  group: number of group
+  * \retval state from FAT_MapState_t
+*/
+static uint8_t FAT_MapGet(FAT_FS_t * fs, uint32_t group)
+{
+    return (fs->map[group >> 2] >> ((group & 3) * 2)) & 3;
+}
+
+/** \brief Set state of group in free map
+  * \param  fs: pointer to volume structure
+  * \param  group: number of group
+  * \param  state: state from FAT_MapState_t
+  * \retval None
+*/
+static void FAT_MapSet(FAT_FS_t * fs, uint32_t group, uint8_t state)
+{
+    uint8_t shift = (group & 3) * 2;
+    fs->map[group >> 2] = (fs->map[group >> 2] & ~(3 << shift)) | (state << shift);
+}
+
+/** \brief Get group of FAT blocks with entry of cluster
+  * \param  fs: pointer to volume structure
+  * \param  cluster: cluster number
+  * \retval number of group
+*/
+static uint32_t FAT_Group(FAT_FS_t * fs, uint32_t cluster)
+{
+    return cluster >> (FAT_ENTRY_SHIFT + fs->groupShift);
+}
+
+/** \brief Get the first valid cluster of group
+  * \param  fs: pointer to volume structure
+  * \param  group: number of group
+  * \retval cluster number
+*/
+static uint32_t FAT_GroupStart(FAT_FS_t * fs, uint32_t group)
+{
+    uint32_t cluster = group << (FAT_ENTRY_SHIFT + fs->groupShift);
+    return (cluster < 2) ? 2 : cluster;
+}
+
+/** \brief Get cluster after the last valid cluster of group
+  * \param  fs: pointer to volume structure
+  * \param  group: number of group
+  * \retval cluster number
+*/
+static uint32_t FAT_GroupEnd(FAT_FS_t * fs, uint32_t group)
+{
+    uint32_t cluster = (group + 1) << (FAT_ENTRY_SHIFT + fs->groupShift);
+    return (cluster > fs->clusters + 2) ? fs->clusters + 2 : cluster;
+}
+
+/** \brief Count free clusters of group, state of group in free map is updated
+  * \param  fs: pointer to volume structure
+  * \param  group: number of group
+  * \param  free: pointer where to put number of free clusters
+  * \retval FAT error number
+*/
+static FAT_Error_t FAT_MapGroup(FAT_FS_t * fs, uint32_t group, uint32_t * free)
+{
+    FAT_Error_t error = FAT_OK;
+    uint32_t start = FAT_GroupStart(fs, group);
+    uint32_t end = FAT_GroupEnd(fs, group);
+    uint32_t value = 0;
+    *free = 0;
+    for(uint32_t cluster = start; cluster < end; ++cluster)
+    {
+        error = FAT_GetEntry(fs, cluster, &value);
+        if(error != FAT_OK)
+            return error;
+        if(!value)
+            (*free)++;
+    }
+    if(fs->map)
+        FAT_MapSet(fs, group, !*free ? FAT_MAP_FULL : ((*free == end - start) ? FAT_MAP_EMPTY : FAT_MAP_PARTIAL));
+    return FAT_OK;
+}
+
+/** \brief Update free count, free map and counter of background scan after cluster is allocated or freed
+  * \param  fs: pointer to volume structure
+  * \param  cluster: cluster number
+  * \param  used: 1 if cluster is allocated, 0 if it is freed
+  * \retval None
+*/
+static void FAT_MapUpdate(FAT_FS_t * fs, uint32_t cluster, uint8_t used)
+{
+    uint32_t group = FAT_Group(fs, cluster);
+    if(fs->freeCount != FAT_FREE_UNKNOWN)
+        fs->freeCount += used ? -1 : 1;
+    /*Groups behind scan are counted already*/
+    if(!fs->freeVerified && (group < fs->scanGroup))
+        fs->scanFree += used ? -1 : 1;
+    if(!fs->map)
+        return;
+    uint8_t state = FAT_MapGet(fs, group);
+    if(used && (state == FAT_MAP_EMPTY))
+        FAT_MapSet(fs, group, FAT_MAP_PARTIAL);
+    else if(!used && (state == FAT_MAP_FULL))
+        FAT_MapSet(fs, group, FAT_MAP_PARTIAL);
+}
+
+/** \brief Allocate free cluster, search starts right after previous cluster to keep chain contiguous.
+  *        Groups which are full in free map are skipped without reading FAT
+  * \param  fs: pointer to volume structure
+  * \param  previous: last cluster of chain, 0 for new chain
+  * \param  cluster: pointer where to put allocated cluster
+  * \retval FAT error number
+*/
+static FAT_Error_t FAT_AllocCluster(FAT_FS_t * fs, uint32_t previous, uint32_t * cluster)
+{
+    FAT_Error_t error = FAT_InvalidateFree(fs);
+    uint32_t candidate = previous ? previous + 1 : fs->nextFree;
+    uint32_t value = 0;
+    uint32_t checked = 0;
+    uint32_t group = 0xFFFFFFFF;
+    uint8_t whole = 0;
+    if(error != FAT_OK)
+        return error;
+    while(checked < fs->clusters)
+    {
+        if(!FAT_IsCluster(fs, candidate))
+            candidate = 2;
+        if(fs->map && (FAT_Group(fs, candidate) != group))
+        {
+            group = FAT_Group(fs, candidate);
+            /*Group walked from its start without free cluster is full*/
+            whole = (candidate == FAT_GroupStart(fs, group));
+            if(FAT_MapGet(fs, group) == FAT_MAP_UNKNOWN)
+            {
+                error = FAT_MapGroup(fs, group, &value);
+                if(error != FAT_OK)
+                    return error;
+            }
+            if(FAT_MapGet(fs, group) == FAT_MAP_FULL)
+            {
+                uint32_t skip = FAT_GroupEnd(fs, group) - candidate;
+                candidate += skip;
+                checked += skip;
+                continue;
+            }
+        }
+        error = FAT_GetEntry(fs, candidate, &value);
+        if(error != FAT_OK)
+            return error;
+        if(!value)
+        {
+            error = FAT_SetEntry(fs, candidate, FAT_EOC_MARK);
+            if((error == FAT_OK) && previous)
+                error = FAT_SetEntry(fs, previous, candidate);
+            if(error != FAT_OK)
+                return error;
+            FAT_MapUpdate(fs, candidate, 1);
+            fs->nextFree = candidate + 1;
+            *cluster = candidate;
+            return FAT_OK;
+        }
+        candidate++;
+        checked++;
+        if(fs->map && whole && (candidate == FAT_GroupEnd(fs, group)))
+            FAT_MapSet(fs, group, FAT_MAP_FULL);
+    }
+    return FAT_NO_SPACE;
+}
+
+/** \brief Free all clusters of chain
+  * \param  fs: pointer to volume structure
+  * \param  cluster: first cluster of chain
+  * \retval FAT error number
+*/
+static FAT_Error_t FAT_FreeChain(FAT_FS_t * fs, uint32_t cluster)
+{
+    FAT_Error_t error = FAT_InvalidateFree(fs);
+    uint32_t next = 0;
+    while((error == FAT_OK) && FAT_IsCluster(fs, cluster))
+    {
+        error = FAT_GetEntry(fs, cluster, &next);
+        if(error == FAT_OK)
+            error = FAT_SetEntry(fs, cluster, 0);
+        if(error == FAT_OK)
+            FAT_MapUpdate(fs, cluster, 0);
+        if(cluster < fs->nextFree)
+            fs->nextFree = cluster;
+        cluster = next;
+    }
+    return error;
+}
+
+/** \brief Add cluster at the end of cached runs, full cache keeps the newest run in its last slot
+  * \param  file: pointer to file structure
+  * \param  index: number of cluster in file
+  * \param  cluster: volume cluster
+  * \retval None
+*/
+static void FAT_AddRun(FAT_File_t * file, uint32_t index, uint32_t cluster)
+{
+    FAT_Run_t * run = &file->runs[file->runCount ? file->runCount - 1 : 0];
+    if(file->runCount && (run->cluster + run->length == cluster) && (run->index + run->length == index))
+    {
+        run->length++;
+        return;
+    }
+    if(file->runCount < FAT_RUNS)
+        run = &file->runs[file->runCount++];
+    run->index = index;
+    run->cluster = cluster;
+    run->length = 1;
+}
+
+/** \brief Find volume cluster of file cluster. FAT is walked only past cached runs,
+  *        contiguous clusters are added to runs until want clusters are known
+  * \param  file: pointer to file structure
+  * \param  index: number of cluster in file
+  * \param  want: number of clusters needed from index
+  * \param  cluster: pointer where to put volume cluster
+  * \param  count: pointer where to put number of known contiguous clusters from cluster
+  * \retval FAT error number, FAT_NOT_FOUND if chain is shorter
+*/
+static FAT_Error_t FAT_MapCluster(FAT_File_t * file, uint32_t index, uint32_t want, uint32_t * cluster, uint32_t * count)
+{
+    FAT_FS_t * fs = file->fs;
+    FAT_Error_t error = FAT_OK;
+    FAT_Run_t local;
+    FAT_Run_t * run = 0;
+    uint8_t last = 0;
+    uint8_t r = 0;
+    if(!file->firstCluster)
+        return FAT_NOT_FOUND;
+    if(!file->runCount)
+    {
+        file->runs[0].index = 0;
+        file->runs[0].cluster = file->firstCluster;
+        file->runs[0].length = 1;
+        file->runCount = 1;
+        file->chainEnd = 0;
+    }
+    /*Runs are sorted, start from the last run which begins before index*/
+    while((r + 1 < file->runCount) && (file->runs[r + 1].index <= index))
+        r++;
+    last = (r + 1 == file->runCount);
+    /*Only the last run is extended in cache, walk in a gap of full cache uses copy*/
+    if(last)
+        run = &file->runs[r];
+    else
+    {
+        local = file->runs[r];
+        run = &local;
+    }
+    while(1)
+    {
+        uint32_t end = run->index + run->length;
+        uint32_t tail = run->cluster + run->length - 1;
+        uint32_t next = 0;
+        if((index < end) && ((end - index >= want) || !last || file->chainEnd))
+            break;
+        if(last && file->chainEnd)
+            return FAT_NOT_FOUND;
+        error = FAT_GetEntry(fs, tail, &next);
+        if(error != FAT_OK)
+            return error;
+        if(next >= FAT_EOC)
+        {
+            if(last)
+                file->chainEnd = 1;
+            if(index < end)
+                break;
+            return FAT_NOT_FOUND;
+        }
+        if(!FAT_IsCluster(fs, next))
+            return FAT_CORRUPT;
+        if(next == tail + 1)
+            run->length++;
+        /*Fragment after index is left for the next call*/
+        else if(index < end)
+            break;
+        else if(last)
+        {
+            FAT_AddRun(file, end, next);
+            run = &file->runs[file->runCount - 1];
+        }
+        else
+        {
+            local.index = end;
+            local.cluster = next;
+            local.length = 1;
+        }
+    }
+    *cluster = run->cluster + (index - run->index);
+    *count = run->index + run->length - index;
+    return FAT_OK;
+}
+
+/** \brief Make cluster chain of file at least clusters long, new clusters follow the last one if they are free
+  * \param  file: pointer to file structure
+  * \param  clusters: needed number of clusters
+  * \retval FAT error number
+*/
+static FAT_Error_t FAT_ExtendFile(FAT_File_t * file, uint32_t clusters)
+{
+    FAT_Error_t error = FAT_OK;
+    uint32_t have = 0;
+    uint32_t tail = 0;
+    uint32_t cluster = 0;
+    uint32_t count = 0;
+    if(!clusters)
+        return FAT_OK;
+    if(file->firstCluster)
+    {
+        error = FAT_MapCluster(file, clusters - 1, 1, &cluster, &count);
+        if(error != FAT_NOT_FOUND)
+            return error;
+        /*Walk stopped at the end of chain, it is the end of the last run*/
+        FAT_Run_t * run = &file->runs[file->runCount - 1];
+        have = run->index + run->length;
+        tail = run->cluster + run->length - 1;
+    }
+    while(have < clusters)
+    {
+        error = FAT_AllocCluster(file->fs, tail, &cluster);
+        if(error != FAT_OK)
+            return error;
+        if(!tail)
+        {
+            file->firstCluster = cluster;
+            file->modified = 1;
+            file->runCount = 0;
+        }
+        FAT_AddRun(file, have, cluster);
+        file->chainEnd = 1;
+        tail = cluster;
+        have++;
+    }
+    return FAT_OK;
+}
+
+/** \brief Convert path component to 8.3 name of directory entry
+  * \param  path: pointer to path, it is moved to the next component
+  * \param  name: pointer to 11-byte buffer for name
+  * \retval FAT error number
+*/
+static FAT_Error_t FAT_MakeName(const char ** path, uint8_t * name)
+{
+    const char * p = *path;
+    uint8_t i = 0;
+    uint8_t limit = 8;
+    memset(name, ' ', FAT_NAME_LEN);
+    while(*p && (*p != '/'))
+    {
+        char c = *p++;
+        if(c == '.')
+        {
+            /*One dot after non-empty base name*/
+            if(!i || (limit != 8))
+                return FAT_INVALID_NAME;
+            i = 8;
+            limit = FAT_NAME_LEN;
+            continue;
+        }
+        if((i >= limit) || ((uint8_t)c <= ' ') || strchr("\"*+,:;<=>?[\\]|", c))
+            return FAT_INVALID_NAME;
+        if((c >= 'a') && (c <= 'z'))
+            c -= 'a' - 'A';
+        name[i++] = (uint8_t)c;
+    }
+    if(name[0] == ' ')
+        return FAT_INVALID_NAME;
+    /*0xE5 marks deleted entry, it is stored as 0x05*/
+    if(name[0] == FAT_ENTRY_FREE)
+        name[0] = 0x05;
+    if(*p == '/')
+        p++;
+    *path = p;
+    return FAT_OK;
+}
+
+/** \brief Get first cluster from directory entry
+  * \param  entry: pointer to directory entry
+  * \retval cluster number
+*/
+static uint32_t FAT_EntryCluster(const uint8_t * entry)
+{
+    return ((uint32_t)FAT_Load16(entry + 20) << 16) | FAT_Load16(entry + 26);
+}
+
+/** \brief Find entry in directory. Indexed directory is searched with index, it is built at the first lookup
+  * \param  fs: pointer to volume structure
+  * \param  dir: first cluster of directory
+  * \param  name: 8.3 name of entry
+  * \param  block: pointer where to put block of entry
+  * \param  offset: pointer where to put offset of entry in block
+  * \retval FAT error number. Block of entry stays in window
+*/
+static FAT_Error_t FAT_FindEntry(FAT_FS_t * fs, uint32_t dir, const uint8_t * name, uint32_t * block, uint16_t * offset)
+{
+    FAT_Error_t error = FAT_OK;
+    if(fs->index && (fs->index->dir == dir) && (fs->index->state == FAT_INDEX_EMPTY))
+    {
+        error = FAT_IndexBuild(fs, fs->index);
+        if(error != FAT_OK)
+            return error;
+    }
+    if(FAT_IndexReady(fs, dir))
+        return FAT_IndexFind(fs, fs->index, name, block, offset);
+    return FAT_ScanEntry(fs, dir, name, block, offset);
+}
+
+/** \brief Find entry by reading directory, long name entries and volume label are skipped
+  * \param  fs: pointer to volume structure
+  * \param  dir: first cluster of directory
+  * \param  name: 8.3 name of entry
+  * \param  block: pointer where to put block of entry
+  * \param  offset: pointer where to put offset of entry in block
+  * \retval FAT error number. Block of entry stays in window
+*/
+static FAT_Error_t FAT_ScanEntry(FAT_FS_t * fs, uint32_t dir, const uint8_t * name, uint32_t * block, uint16_t * offset)
+{
+    FAT_Error_t error = FAT_OK;
+    uint32_t cluster = dir;
+    while(FAT_IsCluster(fs, cluster))
+    {
+        for(uint32_t b = 0; b < fs->clusterBlocks; ++b)
+        {
+            uint32_t current = FAT_ClusterBlock(fs, cluster) + b;
+            error = FAT_Move(fs, current);
+            if(error != FAT_OK)
+                return error;
+            for(uint16_t o = 0; o < FAT_BLOCK_SIZE; o += FAT_DIR_ENTRY)
+            {
+                uint8_t * entry = fs->buffer + o;
+                /*Zero name ends directory*/
+                if(!entry[0])
+                    return FAT_NOT_FOUND;
+                if((entry[0] == FAT_ENTRY_FREE) || (entry[11] & FAT_ATTR_VOLUME))
+                    continue;
+                if(!memcmp(entry, name, FAT_NAME_LEN))
+                {
+                    *block = current;
+                    *offset = o;
+                    return FAT_OK;
+                }
+            }
+        }
+        error = FAT_GetEntry(fs, cluster, &cluster);
+        if(error != FAT_OK)
+            return error;
+    }
+    return (cluster >= FAT_EOC) ? FAT_NOT_FOUND : FAT_CORRUPT;
+}
+
+/** \brief Find directory by path
+  * \param  fs: pointer to volume structure
+  * \param  path: path from root directory, "" or "/" is root directory
+  * \param  dir: pointer where to put first cluster of directory
+  * \retval FAT error number
+*/
+static FAT_Error_t FAT_OpenDir(FAT_FS_t * fs, const char * path, uint32_t * dir)
+{
+    FAT_Error_t error = FAT_OK;
+    uint8_t name[FAT_NAME_LEN];
+    uint32_t block = 0;
+    uint16_t offset = 0;
+    *dir = fs->rootCluster;
+    if(*path == '/')
+        path++;
+    while(*path)
+    {
+        error = FAT_MakeName(&path, name);
+        if(error == FAT_OK)
+            error = FAT_FindEntry(fs, *dir, name, &block, &offset);
+        if(error != FAT_OK)
+            return error;
+        uint8_t * entry = fs->buffer + offset;
+        if(!(entry[11] & FAT_ATTR_DIRECTORY))
+            return FAT_NOT_FOUND;
+        *dir = FAT_EntryCluster(entry);
+        if(!*dir)
+            *dir = fs->rootCluster;
+    }
+    return FAT_OK;
+}
+
+/** \brief Check if directory has ready index
+  * \param  fs: pointer to volume structure
+  * \param  dir: first cluster of directory
+  * \retval 1 if index can be used, 0 if not
+*/
+static uint8_t FAT_IndexReady(FAT_FS_t * fs, uint32_t dir)
+{
+    return fs->index && (fs->index->dir == dir) && (fs->index->state == FAT_INDEX_READY);
+}
+
+/** \brief Calculate FNV-1a hash of 8.3 name
+  * \param  name: 8.3 name of entry
+  * \retval hash
+*/
+static uint32_t FAT_Hash(const uint8_t * name)
+{
+    uint32_t hash = 2166136261u;
+    for(uint8_t i = 0; i < FAT_NAME_LEN; ++i)
+        hash = (hash ^ name[i]) * 16777619u;
+    return hash;
+}
+
+/** \brief Get slot tag from hash, tags 0 and FAT_TAG_REMOVED are not used for names
+  * \param  hash: name hash
+  * \retval tag
+*/
+static uint16_t FAT_IndexTag(uint32_t hash)
+{
+    return (uint16_t)((hash >> 16) % (FAT_TAG_REMOVED - 1) + 1);
+}
+
+/** \brief Add entry to index, slot of removed entry is used again
+  * \param  index: pointer to index structure
+  * \param  name: 8.3 name of entry
+  * \param  block: block of entry
+  * \param  offset: offset of entry in block
+  * \retval 1 if entry is added, 0 if index is full
+*/
+static uint8_t FAT_IndexInsert(FAT_DirIndex_t * index, const uint8_t * name, uint32_t block, uint16_t offset)
+{
+    uint32_t hash = FAT_Hash(name);
+    uint32_t mask = index->size - 1;
+    for(uint32_t i = 0; i < index->size; ++i)
+    {
+        FAT_IndexSlot_t * slot = &index->slots[(hash + i) & mask];
+        if(slot->tag && (slot->tag != FAT_TAG_REMOVED))
+            continue;
+        if(!slot->tag)
+        {
+            /*Probes stay short while table is at most 3/4 full*/
+            if(index->used >= index->size - index->size / 4)
+                return 0;
+            index->used++;
+        }
+        slot->block = block;
+        slot->offset = offset;
+        slot->tag = FAT_IndexTag(hash);
+        return 1;
+    }
+    return 0;
+}
+
+/** \brief Remove entry from index
+  * \param  index: pointer to index structure
+  * \param  name: 8.3 name of entry
+  * \param  block: block of entry
+  * \param  offset: offset of entry in block
+  * \retval None
+*/
+static void FAT_IndexRemove(FAT_DirIndex_t * index, const uint8_t * name, uint32_t block, uint16_t offset)
+{
+    uint32_t hash = FAT_Hash(name);
+    uint32_t mask = index->size - 1;
+    for(uint32_t i = 0; i < index->size; ++i)
+    {
+        FAT_IndexSlot_t * slot = &index->slots[(hash + i) & mask];
+        if(!slot->tag)
+            return;
+        if((slot->block == block) && (slot->offset == offset) && (slot->tag != FAT_TAG_REMOVED))
+        {
+            slot->tag = FAT_TAG_REMOVED;
+            return;
+        }
+    }
+}
+
+/** \brief Read directory once and put all its entries to index
+  * \param  fs: pointer to volume structure
+  * \param  index: pointer to index structure
+  * \retval FAT error number. Directory which does not fit index gets FAT_INDEX_OVERFLOW state
+*/
+static FAT_Error_t FAT_IndexBuild(FAT_FS_t * fs, FAT_DirIndex_t * index)
+{
+    FAT_Error_t error = FAT_OK;
+    uint32_t cluster = index->dir;
+    memset(index->slots, 0, index->size * sizeof(FAT_IndexSlot_t));
+    index->used = 0;
+    while(FAT_IsCluster(fs, cluster))
+    {
+        index->tail = cluster;
+        for(uint32_t b = 0; b < fs->clusterBlocks; ++b)
+        {
+            uint32_t current = FAT_ClusterBlock(fs, cluster) + b;
+            error = FAT_Move(fs, current);
+            if(error != FAT_OK)
+                return error;
+            for(uint16_t o = 0; o < FAT_BLOCK_SIZE; o += FAT_DIR_ENTRY)
+            {
+                uint8_t * entry = fs->buffer + o;
+                if(!entry[0])
+                {
+                    index->state = FAT_INDEX_READY;
+                    return FAT_OK;
+                }
+                if((entry[0] == FAT_ENTRY_FREE) || (entry[11] & FAT_ATTR_VOLUME))
+                    continue;
+                if(!FAT_IndexInsert(index, entry, current, o))
+                {
+                    index->state = FAT_INDEX_OVERFLOW;
+                    return FAT_OK;
+                }
+            }
+        }
+        error = FAT_GetEntry(fs, cluster, &cluster);
+        if(error != FAT_OK)
+            return error;
+    }
+    if(cluster < FAT_EOC)
+        return FAT_CORRUPT;
+    index->state = FAT_INDEX_READY;
+    return FAT_OK;
+}
+
+/** \brief Find entry with index, only blocks of entries with the same tag are read
+  * \param  fs: pointer to volume structure
+  * \param  index: pointer to ready index structure
+  * \param  name: 8.3 name of entry
+  * \param  block: pointer where to put block of entry
+  * \param  offset: pointer where to put offset of entry in block
+  * \retval FAT error number. Block of entry stays in window
+*/
+static FAT_Error_t FAT_IndexFind(FAT_FS_t * fs, FAT_DirIndex_t * index, const uint8_t * name, uint32_t * block, uint16_t * offset)
+{
+    FAT_Error_t error = FAT_OK;
+    uint32_t hash = FAT_Hash(name);
+    uint16_t tag = FAT_IndexTag(hash);
+    uint32_t mask = index->size - 1;
+    for(uint32_t i = 0; i < index->size; ++i)
+    {
+        FAT_IndexSlot_t * slot = &index->slots[(hash + i) & mask];
+        if(!slot->tag)
+            return FAT_NOT_FOUND;
+        if(slot->tag != tag)
+            continue;
+        error = FAT_Move(fs, slot->block);
+        if(error != FAT_OK)
+            return error;
+        if(!memcmp(fs->buffer + slot->offset, name, FAT_NAME_LEN))
+        {
+            *block = slot->block;
+            *offset = slot->offset;
+            return FAT_OK;
+        }
+    }
+    return FAT_NOT_FOUND;
+}
+
+/** \brief Find free entry in directory, full directory gets new zeroed cluster
+  * \param  fs: pointer to volume structure
+  * \param  dir: first cluster of directory
+  * \param  block: pointer where to put block of entry
+  * \param  offset: pointer where to put offset of entry in block
+  * \retval FAT error number. Block of entry stays in window
+*/
+static FAT_Error_t FAT_AddEntry(FAT_FS_t * fs, uint32_t dir, uint32_t * block, uint16_t * offset)
+{
+    FAT_Error_t error = FAT_OK;
+    /*Indexed directory is not read again, search starts at its end*/
+    uint32_t cluster = FAT_IndexReady(fs, dir) ? fs->index->tail : dir;
+    uint32_t next = 0;
+    while(1)
+    {
+        for(uint32_t b = 0; b < fs->clusterBlocks; ++b)
+        {
+            uint32_t current = FAT_ClusterBlock(fs, cluster) + b;
+            error = FAT_Move(fs, current);
+            if(error != FAT_OK)
+                return error;
+            for(uint16_t o = 0; o < FAT_BLOCK_SIZE; o += FAT_DIR_ENTRY)
+            {
+                if(!fs->buffer[o] || (fs->buffer[o] == FAT_ENTRY_FREE))
+                {
+                    if(FAT_IndexReady(fs, dir))
+                        fs->index->tail = cluster;
+                    *block = current;
+                    *offset = o;
+                    return FAT_OK;
+                }
+            }
+        }
+        error = FAT_GetEntry(fs, cluster, &next);
+        if(error != FAT_OK)
+            return error;
+        if(next >= FAT_EOC)
+            break;
+        if(!FAT_IsCluster(fs, next))
+            return FAT_CORRUPT;
+        cluster = next;
+    }
+    /*Directory is full - add zeroed cluster*/
+    error = FAT_AllocCluster(fs, cluster, &cluster);
+    if(error != FAT_OK)
+        return error;
+    for(uint32_t b = fs->clusterBlocks; b--; )
+    {
+        error = FAT_Flush(fs);
+        if(error != FAT_OK)
+            return error;
+        memset(fs->buffer, 0, FAT_BLOCK_SIZE);
+        fs->window = FAT_ClusterBlock(fs, cluster) + b;
+        fs->dirty = 1;
+    }
+    if(FAT_IndexReady(fs, dir))
+        fs->index->tail = cluster;
+    *block = fs->window;
+    *offset = 0;
+    return FAT_OK;
+}
+
+/** \brief Mount FAT32 volume
+  * \param  fs: pointer to volume structure
+  * \param  part: pointer to partition with boot sector of volume in its first block
+  * \retval FAT error number
+*/
+FAT_Error_t FAT_Mount(FAT_FS_t * fs, SD_Partition_t * part)
+{
+    FAT_Error_t error = FAT_OK;
+    uint8_t * bpb = fs->buffer;
+    fs->part = part;
+    fs->window = FAT_NO_WINDOW;
+    fs->dirty = 0;
+    error = FAT_Move(fs, 0);
+    if(error != FAT_OK)
+        return error;
+    /*Boot sector signature and FAT32 BPB: 512-byte sectors, no fixed root directory, no 16-bit sizes*/
+    if((FAT_Load16(bpb + 510) != 0xAA55) || (FAT_Load16(bpb + 11) != FAT_BLOCK_SIZE))
+        return FAT_NO_FILESYSTEM;
+    uint8_t clusterBlocks = bpb[13];
+    uint16_t reserved = FAT_Load16(bpb + 14);
+    uint32_t total = FAT_Load16(bpb + 19) ? FAT_Load16(bpb + 19) : FAT_Load32(bpb + 32);
+    fs->numFATs = bpb[16];
+    fs->fatSize = FAT_Load32(bpb + 36);
+    if(!clusterBlocks || (clusterBlocks & (clusterBlocks - 1)) || !reserved || !fs->numFATs || !fs->fatSize ||
+       FAT_Load16(bpb + 17) || FAT_Load16(bpb + 22))
+        return FAT_NO_FILESYSTEM;
+    fs->clusterBlocks = clusterBlocks;
+    fs->fatStart = reserved;
+    fs->dataStart = fs->fatStart + fs->numFATs * fs->fatSize;
+    if((total <= reserved + fs->numFATs * fs->fatSize) || (total > part->blocks))
+        return FAT_NO_FILESYSTEM;
+    fs->clusters = (total - reserved - fs->numFATs * fs->fatSize) / clusterBlocks;
+    if(fs->clusters < FAT_MIN_CLUSTERS)
+        return FAT_NO_FILESYSTEM;
+    /*FAT can be shorter than data area*/
+    if(fs->clusters > fs->fatSize * (FAT_BLOCK_SIZE / 4) - 2)
+        fs->clusters = fs->fatSize * (FAT_BLOCK_SIZE / 4) - 2;
+    fs->rootCluster = FAT_Load32(bpb + 44);
+    if(!FAT_IsCluster(fs, fs->rootCluster))
+        return FAT_NO_FILESYSTEM;
+    uint16_t fsInfo = FAT_Load16(bpb + 48);
+    fs->fsInfo = (fsInfo && (fsInfo < reserved)) ? fsInfo : 0;
+    fs->nextFree = 2;
+    fs->freeValid = 1;
+    fs->freeCount = FAT_FREE_UNKNOWN;
+    fs->freeVerified = 0;
+    fs->map = 0;
+    fs->groupShift = 0;
+    fs->mapGroups = FAT_Group(fs, fs->clusters + 1) + 1;
+    fs->scanGroup = 0;
+    fs->scanFree = 0;
+    fs->index = 0;
+    /*Trust FSInfo hints until scan of FAT verifies them*/
+    if(fs->fsInfo)
+    {
+        error = FAT_Move(fs, fs->fsInfo);
+        if(error != FAT_OK)
+            return error;
+        uint32_t hint = FAT_Load32(fs->buffer + FAT_FSI_NEXT_FREE);
+        uint32_t free = FAT_Load32(fs->buffer + FAT_FSI_FREE_COUNT);
+        if((FAT_Load32(fs->buffer) == FAT_FSI_LEAD_SIG) && (FAT_Load32(fs->buffer + 484) == FAT_FSI_STRUCT_SIG))
+        {
+            if(FAT_IsCluster(fs, hint))
+                fs->nextFree = hint;
+            if(free <= fs->clusters)
+                fs->freeCount = free;
+        }
+    }
+    return FAT_OK;
+}
+
+/** \brief Use free map. Groups of FAT blocks are as small as map size allows
+  * \param  fs: pointer to mounted volume structure
+  * \param  map: pointer to RAM for map, 4 groups per byte. NULL turns map off
+  * \param  mapBytes: size of map in bytes
+  * \retval FAT error number
+*/
+FAT_Error_t FAT_MapInit(FAT_FS_t * fs, uint8_t * map, uint32_t mapBytes)
+{
+    if(map && !mapBytes)
+        return FAT_DENIED;
+    fs->map = 0;
+    fs->groupShift = 0;
+    while(map && (((FAT_Group(fs, fs->clusters + 1) + 1 + 3) >> 2) > mapBytes))
+        fs->groupShift++;
+    fs->mapGroups = FAT_Group(fs, fs->clusters + 1) + 1;
+    if(map)
+    {
+        memset(map, 0, (fs->mapGroups + 3) >> 2);
+        fs->map = map;
+    }
+    /*Scan starts again with new groups*/
+    fs->scanGroup = 0;
+    fs->scanFree = 0;
+    return FAT_OK;
+}
+
+/** \brief Scan next groups of FAT, call it in idle time. Map states are set and free clusters are counted,
+  *        after the last group freeCount is exact and freeVerified is set
+  * \param  fs: pointer to volume structure
+  * \param  groups: number of groups to scan
+  * \retval FAT error number
+*/
+FAT_Error_t FAT_MapStep(FAT_FS_t * fs, uint32_t groups)
+{
+    FAT_Error_t error = FAT_OK;
+    uint32_t free = 0;
+    while(groups-- && (fs->scanGroup < fs->mapGroups))
+    {
+        error = FAT_MapGroup(fs, fs->scanGroup, &free);
+        if(error != FAT_OK)
+            return error;
+        fs->scanFree += free;
+        fs->scanGroup++;
+    }
+    if(!fs->freeVerified && (fs->scanGroup >= fs->mapGroups))
+    {
+        /*Wrong FSInfo count is fixed at unmount*/
+        if(fs->freeCount != fs->scanFree)
+            fs->freeValid = 0;
+        fs->freeCount = fs->scanFree;
+        fs->freeVerified = 1;
+    }
+    return FAT_OK;
+}
+
+/** \brief Use hash index for one directory, it is built at the first lookup in directory
+  * \param  fs: pointer to mounted volume structure
+  * \param  index: pointer to index structure, NULL turns index off
+  * \param  path: path of directory from root directory, "" is root directory
+  * \param  slots: pointer to table of slots, about 4/3 slots for every entry of directory
+  * \param  size: number of slots, it is rounded down to power of two
+  * \retval FAT error number
+*/
+FAT_Error_t FAT_IndexInit(FAT_FS_t * fs, FAT_DirIndex_t * index, const char * path, FAT_IndexSlot_t * slots, uint32_t size)
+{
+    FAT_Error_t error = FAT_OK;
+    fs->index = 0;
+    if(!index)
+        return FAT_OK;
+    if(!slots || (size < 2))
+        return FAT_DENIED;
+    error = FAT_OpenDir(fs, path, &index->dir);
+    if(error != FAT_OK)
+        return error;
+    while(size & (size - 1))
+        size &= size - 1;
+    index->slots = slots;
+    index->size = size;
+    index->used = 0;
+    index->state = FAT_INDEX_EMPTY;
+    index->tail = index->dir;
+    fs->index = index;
+    return FAT_OK;
+}
+
+/** \brief Write changed window, free cluster count and next free cluster hint to SD card
+  * \param  fs: pointer to volume structure
+  * \retval FAT error number
+*/
+FAT_Error_t FAT_Unmount(FAT_FS_t * fs)
+{
+    FAT_Error_t error = FAT_OK;
+    /*FSInfo is changed only if FAT is changed*/
+    if(fs->fsInfo && !fs->freeValid)
+    {
+        error = FAT_Move(fs, fs->fsInfo);
+        if(error != FAT_OK)
+            return error;
+        if((FAT_Load32(fs->buffer) == FAT_FSI_LEAD_SIG) && (FAT_Load32(fs->buffer + 484) == FAT_FSI_STRUCT_SIG))
+        {
+            FAT_Store32(fs->buffer + FAT_FSI_FREE_COUNT, fs->freeCount);
+            FAT_Store32(fs->buffer + FAT_FSI_NEXT_FREE, fs->nextFree);
+            fs->dirty = 1;
+        }
+    }
+    return FAT_Flush(fs);
+}
+
+/** \brief Open file
+  * \param  file: pointer to file structure
+  * \param  fs: pointer to mounted volume structure
+  * \param  path: path from root directory with 8.3 names, e.g. "LOGS/DATA.BIN"
+  * \param  mode: combination of FAT_Mode_t flags
+  * \retval FAT error number
+*/
+FAT_Error_t FAT_Open(FAT_File_t * file, FAT_FS_t * fs, const char * path, uint8_t mode)
+{
+    FAT_Error_t error = FAT_OK;
+    uint8_t name[FAT_NAME_LEN];
+    uint32_t dir = fs->rootCluster;
+    uint32_t block = 0;
+    uint16_t offset = 0;
+    uint8_t * entry = 0;
+    memset(file, 0, sizeof(FAT_File_t));
+    file->fs = fs;
+    file->mode = mode;
+    if(*path == '/')
+        path++;
+    while(1)
+    {
+        error = FAT_MakeName(&path, name);
+        if(error != FAT_OK)
+            return error;
+        error = FAT_FindEntry(fs, dir, name, &block, &offset);
+        /*The last component is file*/
+        if(!*path)
+            break;
+        if(error != FAT_OK)
+            return error;
+        entry = fs->buffer + offset;
+        if(!(entry[11] & FAT_ATTR_DIRECTORY))
+            return FAT_NOT_FOUND;
+        dir = FAT_EntryCluster(entry);
+        /*Zero cluster in entry means root directory*/
+        if(!dir)
+            dir = fs->rootCluster;
+    }
+    if((error == FAT_NOT_FOUND) && (mode & FAT_MODE_CREATE))
+    {
+        error = FAT_AddEntry(fs, dir, &block, &offset);
+        if(error != FAT_OK)
+            return error;
+        entry = fs->buffer + offset;
+        memset(entry, 0, FAT_DIR_ENTRY);
+        memcpy(entry, name, FAT_NAME_LEN);
+        entry[11] = FAT_ATTR_ARCHIVE;
+        fs->dirty = 1;
+        if(FAT_IndexReady(fs, dir) && !FAT_IndexInsert(fs->index, name, block, offset))
+            fs->index->state = FAT_INDEX_OVERFLOW;
+    }
+    else if(error != FAT_OK)
+        return error;
+    entry = fs->buffer + offset;
+    if(entry[11] & (FAT_ATTR_DIRECTORY | FAT_ATTR_VOLUME))
+        return FAT_DENIED;
+    file->firstCluster = FAT_EntryCluster(entry);
+    file->size = FAT_Load32(entry + 28);
+    file->entryBlock = block;
+    file->entryOffset = offset;
+    if((mode & FAT_MODE_TRUNCATE) && (mode & FAT_MODE_WRITE) && (file->firstCluster || file->size))
+    {
+        error = FAT_FreeChain(fs, file->firstCluster);
+        if(error != FAT_OK)
+            return error;
+        file->firstCluster = 0;
+        file->size = 0;
+        file->modified = 1;
+        /*Directory entry should not point to free clusters*/
+        error = FAT_Sync(file);
+        if(error != FAT_OK)
+            return error;
+    }
+    if(mode & FAT_MODE_APPEND)
+        file->position = file->size;
+    return FAT_OK;
+}
+
+/** \brief Delete file, its clusters are freed. Long name entries of file are left for disk checkers
+  * \param  fs: pointer to mounted volume structure
+  * \param  path: path from root directory with 8.3 names
+  * \retval FAT error number
+*/
+FAT_Error_t FAT_Remove(FAT_FS_t * fs, const char * path)
+{
+    FAT_Error_t error = FAT_OK;
+    FAT_File_t file;
+    uint8_t name[FAT_NAME_LEN];
+    error = FAT_Open(&file, fs, path, FAT_MODE_READ);
+    if(error != FAT_OK)
+        return error;
+    /*Entry is deleted first, lost clusters are safer than entry with free clusters*/
+    error = FAT_Move(fs, file.entryBlock);
+    if(error != FAT_OK)
+        return error;
+    memcpy(name, fs->buffer + file.entryOffset, FAT_NAME_LEN);
+    fs->buffer[file.entryOffset] = FAT_ENTRY_FREE;
+    fs->dirty = 1;
+    if(fs->index && (fs->index->state == FAT_INDEX_READY))
+        FAT_IndexRemove(fs->index, name, file.entryBlock, file.entryOffset);
+    if(file.firstCluster)
+        error = FAT_FreeChain(fs, file.firstCluster);
+    if(error != FAT_OK)
+        return error;
+    return FAT_Flush(fs);
+}
+
+/** \brief Read data from file. Whole blocks of contiguous clusters are read with one multiple read
+  * \param  file: pointer to file structure
+  * \param  data: pointer to buffer for data
+  * \param  len: number of bytes to read
+  * \param  read: pointer where to put number of bytes read
+  * \retval FAT error number
+*/
+FAT_Error_t FAT_Read(FAT_File_t * file, uint8_t * data, uint32_t len, uint32_t * read)
+{
+    FAT_FS_t * fs = file->fs;
+    FAT_Error_t error = FAT_OK;
+    uint32_t clusterBytes = fs->clusterBlocks * FAT_BLOCK_SIZE;
+    *read = 0;
+    if(!(file->mode & FAT_MODE_READ))
+        return FAT_DENIED;
+    if(len > file->size - file->position)
+        len = file->size - file->position;
+    while(len)
+    {
+        uint32_t inCluster = file->position % clusterBytes;
+        uint32_t offset = file->position % FAT_BLOCK_SIZE;
+        uint32_t cluster = 0;
+        uint32_t count = 0;
+        uint32_t part = 0;
+        /*Ask for all clusters the rest of read needs*/
+        error = FAT_MapCluster(file, file->position / clusterBytes, (inCluster + len + clusterBytes - 1) / clusterBytes,
+                               &cluster, &count);
+        if(error != FAT_OK)
+            return (error == FAT_NOT_FOUND) ? FAT_CORRUPT : error;
+        uint32_t block = FAT_ClusterBlock(fs, cluster) + inCluster / FAT_BLOCK_SIZE;
+        if(offset || (len < FAT_BLOCK_SIZE))
+        {
+            /*Part of block goes through window*/
+            part = FAT_BLOCK_SIZE - offset;
+            if(part > len)
+                part = len;
+            error = FAT_Move(fs, block);
+            if(error != FAT_OK)
+                return error;
+            memcpy(data, fs->buffer + offset, part);
+        }
+        else
+        {
+            uint32_t blocks = len / FAT_BLOCK_SIZE;
+            uint32_t limit = count * fs->clusterBlocks - inCluster / FAT_BLOCK_SIZE;
+            if(blocks > limit)
+                blocks = limit;
+            error = FAT_DropWindow(fs, block, blocks);
+            if(error == FAT_OK)
+                error = FAT_ReadBlocks(fs, block, data, blocks);
+            if(error != FAT_OK)
+                return error;
+            part = blocks * FAT_BLOCK_SIZE;
+        }
+        data += part;
+        len -= part;
+        file->position += part;
+        *read += part;
+    }
+    return FAT_OK;
+}
+
+/** \brief Write data to file. Cluster chain is extended before transfer,
+  *        whole blocks of contiguous clusters are written with one multiple write
+  * \param  file: pointer to file structure
+  * \param  data: pointer to data
+  * \param  len: number of bytes to write
+  * \param  written: pointer where to put number of bytes written
+  * \retval FAT error number
+*/
+FAT_Error_t FAT_Write(FAT_File_t * file, uint8_t * data, uint32_t len, uint32_t * written)
+{
+    FAT_FS_t * fs = file->fs;
+    FAT_Error_t error = FAT_OK;
+    uint32_t clusterBytes = fs->clusterBlocks * FAT_BLOCK_SIZE;
+    *written = 0;
+    if(!(file->mode & FAT_MODE_WRITE))
+        return FAT_DENIED;
+    /*File size is limited to 4 GiB - 1*/
+    if(len > 0xFFFFFFFF - file->position)
+        len = 0xFFFFFFFF - file->position;
+    if(!len)
+        return FAT_OK;
+    error = FAT_ExtendFile(file, (uint32_t)(((uint64_t)file->position + len + clusterBytes - 1) / clusterBytes));
+    if(error != FAT_OK)
+        return error;
+    while(len)
+    {
+        uint32_t inCluster = file->position % clusterBytes;
+        uint32_t offset = file->position % FAT_BLOCK_SIZE;
+        uint32_t cluster = 0;
+        uint32_t count = 0;
+        uint32_t part = 0;
+        error = FAT_MapCluster(file, file->position / clusterBytes, (inCluster + len + clusterBytes - 1) / clusterBytes,
+                               &cluster, &count);
+        if(error != FAT_OK)
+            return (error == FAT_NOT_FOUND) ? FAT_CORRUPT : error;
+        uint32_t block = FAT_ClusterBlock(fs, cluster) + inCluster / FAT_BLOCK_SIZE;
+        if(offset || (len < FAT_BLOCK_SIZE))
+        {
+            /*Part of block goes through window*/
+            part = FAT_BLOCK_SIZE - offset;
+            if(part > len)
+                part = len;
+            error = FAT_Move(fs, block);
+            if(error != FAT_OK)
+                return error;
+            memcpy(fs->buffer + offset, data, part);
+            fs->dirty = 1;
+        }
+        else
+        {
+            uint32_t blocks = len / FAT_BLOCK_SIZE;
+            uint32_t limit = count * fs->clusterBlocks - inCluster / FAT_BLOCK_SIZE;
+            if(blocks > limit)
+                blocks = limit;
+            error = FAT_DropWindow(fs, block, blocks);
+            if(error == FAT_OK)
+                error = FAT_WriteBlocks(fs, block, data, blocks);
+            if(error != FAT_OK)
+                return error;
+            part = blocks * FAT_BLOCK_SIZE;
+        }
+        data += part;
+        len -= part;
+        file->position += part;
+        *written += part;
+        if(file->position > file->size)
+        {
+            file->size = file->position;
+            file->modified = 1;
+        }
+    }
+    /*Write-through partition keeps no changed blocks in window between calls*/
+    if(fs->part->cache == SD_PARTITION_WRITE_THROUGH)
+        return FAT_Flush(fs);
+    return FAT_OK;
+}
+
+/** \brief Set position in file
+  * \param  file: pointer to file structure
+  * \param  position: position in bytes, it is limited by file size
+  * \retval FAT error number
+*/
+FAT_Error_t FAT_Seek(FAT_File_t * file, uint32_t position)
+{
+    if(position > file->size)
+        position = file->size;
+    file->position = position;
+    return FAT_OK;
+}
+
+/** \brief Update directory entry of file and write changed window to SD card
+  * \param  file: pointer to file structure
+  * \retval FAT error number
+*/
+FAT_Error_t FAT_Sync(FAT_File_t * file)
+{
+    FAT_FS_t * fs = file->fs;
+    FAT_Error_t error = FAT_OK;
+    if(file->modified)
+    {
+        error = FAT_Move(fs, file->entryBlock);
+        if(error != FAT_OK)
+            return error;
+        uint8_t * entry = fs->buffer + file->entryOffset;
+        FAT_Store16(entry + 20, (uint16_t)(file->firstCluster >> 16));
+        FAT_Store16(entry + 26, (uint16_t)file->firstCluster);
+        FAT_Store32(entry + 28, file->size);
+        fs->dirty = 1;
+        file->modified = 0;
+    }
+    return FAT_Flush(fs);
+}
+
+/** \brief Close file
+  * \param  file: pointer to file structure
+  * \retval FAT error number
+*/
+FAT_Error_t FAT_Close(FAT_File_t * file)
+{
+    FAT_Error_t error = FAT_Sync(file);
+    file->mode = 0;
+    return error;
+}
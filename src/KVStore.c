@@ -0,0 +1,944 @@
+/*MIT License
+
+Copyright (c) 2019 DoHelloWorld
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.*/
+
+
+#include <string.h>
+#include "KVStore.h"
+#include "Utils.h"
+
+#define KV_BLOCK_SIZE           512         /**< Size of store block */
+#define KV_NO_BLOCK             0xFFFFFFFF  /**< Window or stream without block */
+#define KV_SLOT_EMPTY           0xFFFFFFFF  /**< Block of index slot which was never used */
+#define KV_MAGIC                0x4753564B  /**< "KVSG" at the start of segment header block */
+#define KV_HEADER_SIZE          8           /**< Record header: key length, flags, value length, CRC32 */
+#define KV_FLAG_DELETED         0x01        /**< Record removes key */
+#define KV_ALL_BLOCKS           0xFFFFFFFF  /**< Compact whole segment */
+
+/*Get little-endian 16-bit value*/
+static uint16_t KV_Load16(const uint8_t * p);
+/*Get little-endian 32-bit value*/
+static uint32_t KV_Load32(const uint8_t * p);
+/*Put little-endian 32-bit value*/
+static void KV_Store32(uint8_t * p, uint32_t value);
+/*Calculate two independent hashes of key*/
+static uint32_t KV_Hash(const uint8_t * key, uint32_t keyLen, uint32_t * check);
+/*Bloom filter functions*/
+static void KV_BloomAdd(KV_t * kv, KV_Segment_t * segment, uint32_t hash, uint32_t check);
+static uint8_t KV_BloomTest(KV_t * kv, KV_Segment_t * segment, uint32_t hash, uint32_t check);
+/*Index functions*/
+static KV_Slot_t * KV_IndexFind(KV_t * kv, uint32_t hash, uint32_t check);
+static void KV_IndexSet(KV_t * kv, uint32_t hash, uint32_t check, uint32_t block, uint16_t offset);
+static void KV_IndexRemove(KV_t * kv, uint32_t hash, uint32_t check);
+/*Get block from staging buffer of stream or from window*/
+static KV_Error_t KV_LoadBlock(KV_t * kv, uint32_t block, uint8_t ** src);
+/*Get end of records of segment*/
+static void KV_SegmentEnd(KV_t * kv, uint32_t segment, uint32_t * block, uint32_t * offset);
+/*Find next valid record in segment*/
+static KV_Error_t KV_NextRecord(KV_t * kv, uint32_t * block, uint32_t * offset, uint32_t endBlock, uint32_t endOffset,
+                                uint8_t ** record);
+/*Find segment with the smallest sequence after given one*/
+static uint32_t KV_Newer(KV_t * kv, uint32_t sequence);
+/*Find segment with the biggest sequence before given one*/
+static uint32_t KV_Older(KV_t * kv, uint32_t sequence);
+/*Find the newest record of key by scan of segments*/
+static KV_Error_t KV_ScanKey(KV_t * kv, const uint8_t * key, uint32_t keyLen, uint32_t hash, uint32_t check,
+                             uint32_t * block, uint32_t * offset);
+/*Find the newest record of key*/
+static KV_Error_t KV_Locate(KV_t * kv, const uint8_t * key, uint32_t keyLen, uint32_t * block, uint32_t * offset);
+/*Add record to Bloom filter of segment and to index*/
+static void KV_Apply(KV_t * kv, uint32_t segment, const uint8_t * key, uint32_t keyLen, uint8_t flags,
+                     uint32_t block, uint32_t offset);
+/*Write zeros to stream*/
+static KV_Error_t KV_StreamZeros(KV_t * kv, uint32_t len);
+/*Erase free segment and start writing to it*/
+static KV_Error_t KV_OpenSegment(KV_t * kv);
+/*Append record to active segment and update index*/
+static KV_Error_t KV_Write(KV_t * kv, const uint8_t * key, uint32_t keyLen, const uint8_t * value, uint32_t len,
+                           uint8_t flags, uint32_t reserve);
+/*Compact blocks of the oldest segment*/
+static KV_Error_t KV_CompactStep(KV_t * kv, uint32_t blocks, uint8_t force);
+/*Append record, oldest segments are compacted when there is no free segment*/
+static KV_Error_t KV_WriteCompact(KV_t * kv, const uint8_t * key, uint32_t keyLen, const uint8_t * value, uint32_t len,
+                                  uint8_t flags);
+
+/** \brief Get little-endian 16-bit value
+  * \param  p: pointer to value
+  * \retval value
+*/
+static uint16_t KV_Load16(const uint8_t * p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+/** \brief Get little-endian 32-bit value
+  * \param  p: pointer to value
+  * \retval value
+*/
+static uint32_t KV_Load32(const uint8_t * p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/** \brief Put little-endian 32-bit value
+  * \param  p: pointer to value
+  * \param  value: value to store
+  * \retval None
+*/
+static void KV_Store32(uint8_t * p, uint32_t value)
+{
+    p[0] = value;
+    p[1] = value >> 8;
+    p[2] = value >> 16;
+    p[3] = value >> 24;
+}
+
+/** \brief Calculate FNV-1a and DJB2 hashes of key, index treats keys with both hashes equal as one key
+  * \param  key: pointer to key
+  * \param  keyLen: key length
+  * \param  check: pointer where to put second hash
+  * \retval first hash
+*/
+static uint32_t KV_Hash(const uint8_t * key, uint32_t keyLen, uint32_t * check)
+{
+    uint32_t hash = 2166136261u;
+    *check = 5381;
+    for(uint32_t i = 0; i < keyLen; ++i)
+    {
+        hash = (hash ^ key[i]) * 16777619u;
+        *check = *check * 33 + key[i];
+    }
+    return hash;
+}
+
+/** \brief Add key to Bloom filter of segment, key sets 3 bits hash + i * check
+  * \param  kv: pointer to store structure
+  * \param  segment: pointer to segment
+  * \param  hash: first key hash
+  * \param  check: second key hash
+  * \retval None
+*/
+static void KV_BloomAdd(KV_t * kv, KV_Segment_t * segment, uint32_t hash, uint32_t check)
+{
+    uint32_t bits = kv->bloomBytes * 8;
+    for(uint8_t i = 0; i < 3; ++i)
+    {
+        uint32_t bit = (hash + i * check) % bits;
+        segment->bloom[bit / 8] |= 1 << (bit % 8);
+    }
+}
+
+/** \brief Check if key can be in segment
+  * \param  kv: pointer to store structure
+  * \param  segment: pointer to segment
+  * \param  hash: first key hash
+  * \param  check: second key hash
+  * \retval 0 if segment has no records of key, 1 if it can have them
+*/
+static uint8_t KV_BloomTest(KV_t * kv, KV_Segment_t * segment, uint32_t hash, uint32_t check)
+{
+    uint32_t bits = kv->bloomBytes * 8;
+    for(uint8_t i = 0; i < 3; ++i)
+    {
+        uint32_t bit = (hash + i * check) % bits;
+        if(!(segment->bloom[bit / 8] & (1 << (bit % 8))))
+            return 0;
+    }
+    return 1;
+}
+
+/** \brief Find index slot of key
+  * \param  kv: pointer to store structure
+  * \param  hash: first key hash
+  * \param  check: second key hash
+  * \retval pointer to slot, NULL if key is not in index
+*/
+static KV_Slot_t * KV_IndexFind(KV_t * kv, uint32_t hash, uint32_t check)
+{
+    uint32_t mask = kv->size - 1;
+    for(uint32_t i = 0; i < kv->size; ++i)
+    {
+        KV_Slot_t * slot = &kv->slots[(hash + i) & mask];
+        if(slot->block == KV_SLOT_EMPTY)
+            return 0;
+        if((slot->hash == hash) && (slot->check == check))
+            return slot;
+    }
+    return 0;
+}
+
+/** \brief Set record of key in index, index goes to overflow when it has no slot for new key.
+  *        One slot is always empty so lookups stop
+  * \param  kv: pointer to store structure
+  * \param  hash: first key hash
+  * \param  check: second key hash
+  * \param  block: partition block of record
+  * \param  offset: offset of record in block
+  * \retval None
+*/
+static void KV_IndexSet(KV_t * kv, uint32_t hash, uint32_t check, uint32_t block, uint16_t offset)
+{
+    uint32_t mask = kv->size - 1;
+    KV_Slot_t * target = 0;
+    for(uint32_t i = 0; i < kv->size; ++i)
+    {
+        KV_Slot_t * slot = &kv->slots[(hash + i) & mask];
+        if(slot->block == KV_SLOT_EMPTY)
+        {
+            if(kv->used + 1 >= kv->size)
+            {
+                kv->overflow = 1;
+                return;
+            }
+            kv->used++;
+            target = slot;
+            break;
+        }
+        if((slot->hash == hash) && (slot->check == check))
+        {
+            target = slot;
+            break;
+        }
+    }
+    if(!target)
+    {
+        kv->overflow = 1;
+        return;
+    }
+    target->hash = hash;
+    target->check = check;
+    target->block = block;
+    target->offset = offset;
+}
+
+/** \brief Remove key from index. Following slots of probe sequence are shifted back to free slot,
+  *        so removed keys leave no marks and put/delete cycles do not fill index
+  * \param  kv: pointer to store structure
+  * \param  hash: first key hash
+  * \param  check: second key hash
+  * \retval None
+*/
+static void KV_IndexRemove(KV_t * kv, uint32_t hash, uint32_t check)
+{
+    uint32_t mask = kv->size - 1;
+    KV_Slot_t * slot = KV_IndexFind(kv, hash, check);
+    if(!slot)
+        return;
+    uint32_t hole = slot - kv->slots;
+    for(uint32_t i = (hole + 1) & mask; kv->slots[i].block != KV_SLOT_EMPTY; i = (i + 1) & mask)
+    {
+        /*key can move to hole when hole is between its home slot and its slot*/
+        uint32_t home = kv->slots[i].hash & mask;
+        if(((i - home) & mask) >= ((i - hole) & mask))
+        {
+            kv->slots[hole] = kv->slots[i];
+            hole = i;
+        }
+    }
+    kv->slots[hole].block = KV_SLOT_EMPTY;
+    kv->used--;
+}
+
+/** \brief Get block of partition. Blocks of active segment with data in staging buffer of stream are taken from it
+  * \param  kv: pointer to store structure
+  * \param  block: partition block
+  * \param  src: pointer where to put address of block data
+  * \retval store error number
+*/
+static KV_Error_t KV_LoadBlock(KV_t * kv, uint32_t block, uint8_t ** src)
+{
+    uint32_t address = kv->part->start + block;
+    uint32_t staged = (kv->stream.fill + KV_BLOCK_SIZE - 1) / KV_BLOCK_SIZE;
+    if((kv->stream.address != KV_NO_BLOCK) && (address >= kv->stream.address) && (address < kv->stream.address + staged))
+    {
+        *src = kv->stream.buffer + (address - kv->stream.address) * KV_BLOCK_SIZE;
+        return KV_OK;
+    }
+    *src = kv->buffer;
+    if(kv->window == block)
+        return KV_OK;
+    if(SD_PartitionRead(kv->part, block, kv->buffer, 1) != SD_OK)
+    {
+        kv->window = KV_NO_BLOCK;
+        return KV_DISK_ERROR;
+    }
+    kv->window = block;
+    return KV_OK;
+}
+
+/** \brief Get end of records of segment, active segment ends at write position
+  * \param  kv: pointer to store structure
+  * \param  segment: segment number
+  * \param  block: pointer where to put end block
+  * \param  offset: pointer where to put end offset
+  * \retval None
+*/
+static void KV_SegmentEnd(KV_t * kv, uint32_t segment, uint32_t * block, uint32_t * offset)
+{
+    if(segment == kv->active)
+    {
+        *block = kv->block;
+        *offset = kv->offset;
+        return;
+    }
+    *block = (segment + 1) * kv->segmentBlocks;
+    *offset = 0;
+}
+
+/** \brief Find next valid record from position. Zero key length pads block to its end,
+  *        damaged or erased record ends records of segment
+  * \param  kv: pointer to store structure
+  * \param  block: pointer to partition block of position, it is moved to record
+  * \param  offset: pointer to offset of position, it is moved to record
+  * \param  endBlock: block of segment end
+  * \param  endOffset: offset of segment end
+  * \param  record: pointer where to put address of record
+  * \retval store error number, KV_NOT_FOUND at the end of segment
+*/
+static KV_Error_t KV_NextRecord(KV_t * kv, uint32_t * block, uint32_t * offset, uint32_t endBlock, uint32_t endOffset,
+                                uint8_t ** record)
+{
+    KV_Error_t error = KV_OK;
+    uint8_t * src = 0;
+    while((*block < endBlock) || ((*block == endBlock) && (*offset < endOffset)))
+    {
+        if(*offset + KV_HEADER_SIZE > KV_BLOCK_SIZE)
+        {
+            (*block)++;
+            *offset = 0;
+            continue;
+        }
+        error = KV_LoadBlock(kv, *block, &src);
+        if(error != KV_OK)
+            return error;
+        uint8_t * p = src + *offset;
+        if(!p[0])
+        {
+            (*block)++;
+            *offset = 0;
+            continue;
+        }
+        uint32_t size = KV_HEADER_SIZE + p[0] + KV_Load16(p + 2);
+        if((*offset + size > KV_BLOCK_SIZE) || (p[1] & ~KV_FLAG_DELETED))
+            return KV_NOT_FOUND;
+        uint32_t crc = CRC32_Update(0, p, 4);
+        if(CRC32_Update(crc, p + KV_HEADER_SIZE, size - KV_HEADER_SIZE) != KV_Load32(p + 4))
+            return KV_NOT_FOUND;
+        *record = p;
+        return KV_OK;
+    }
+    return KV_NOT_FOUND;
+}
+
+/** \brief Find segment with the smallest sequence after given one
+  * \param  kv: pointer to store structure
+  * \param  sequence: sequence, 0 to find the oldest segment
+  * \retval segment number, segmentCount if there is no such segment
+*/
+static uint32_t KV_Newer(KV_t * kv, uint32_t sequence)
+{
+    uint32_t found = kv->segmentCount;
+    for(uint32_t i = 0; i < kv->segmentCount; ++i)
+    {
+        uint32_t s = kv->segments[i].sequence;
+        if(s && (s > sequence) && ((found == kv->segmentCount) || (s < kv->segments[found].sequence)))
+            found = i;
+    }
+    return found;
+}
+
+/** \brief Find segment with the biggest sequence before given one
+  * \param  kv: pointer to store structure
+  * \param  sequence: sequence, 0xFFFFFFFF to find the newest segment
+  * \retval segment number, segmentCount if there is no such segment
+*/
+static uint32_t KV_Older(KV_t * kv, uint32_t sequence)
+{
+    uint32_t found = kv->segmentCount;
+    for(uint32_t i = 0; i < kv->segmentCount; ++i)
+    {
+        uint32_t s = kv->segments[i].sequence;
+        if(s && (s < sequence) && ((found == kv->segmentCount) || (s > kv->segments[found].sequence)))
+            found = i;
+    }
+    return found;
+}
+
+/** \brief Find the newest record of key by scan of segments from the newest one,
+  *        segments without key in Bloom filter are not read
+  * \param  kv: pointer to store structure
+  * \param  key: pointer to key
+  * \param  keyLen: key length
+  * \param  hash: first key hash
+  * \param  check: second key hash
+  * \param  block: pointer where to put partition block of record
+  * \param  offset: pointer where to put offset of record
+  * \retval store error number, KV_NOT_FOUND if store has no records of key
+*/
+static KV_Error_t KV_ScanKey(KV_t * kv, const uint8_t * key, uint32_t keyLen, uint32_t hash, uint32_t check,
+                             uint32_t * block, uint32_t * offset)
+{
+    KV_Error_t error = KV_OK;
+    uint8_t * record = 0;
+    uint32_t segment = KV_Older(kv, 0xFFFFFFFF);
+    while(segment < kv->segmentCount)
+    {
+        uint8_t found = 0;
+        if(KV_BloomTest(kv, &kv->segments[segment], hash, check))
+        {
+            uint32_t b = segment * kv->segmentBlocks + 1;
+            uint32_t o = 0;
+            uint32_t endBlock = 0;
+            uint32_t endOffset = 0;
+            KV_SegmentEnd(kv, segment, &endBlock, &endOffset);
+            /*The last record of key in segment is the newest one*/
+            while((error = KV_NextRecord(kv, &b, &o, endBlock, endOffset, &record)) == KV_OK)
+            {
+                if((record[0] == keyLen) && !memcmp(record + KV_HEADER_SIZE, key, keyLen))
+                {
+                    *block = b;
+                    *offset = o;
+                    found = 1;
+                }
+                o += KV_HEADER_SIZE + record[0] + KV_Load16(record + 2);
+            }
+            if(error != KV_NOT_FOUND)
+                return error;
+        }
+        if(found)
+            return KV_OK;
+        segment = KV_Older(kv, kv->segments[segment].sequence);
+    }
+    return KV_NOT_FOUND;
+}
+
+/** \brief Find the newest record of key, removed key is not found
+  * \param  kv: pointer to store structure
+  * \param  key: pointer to key
+  * \param  keyLen: key length
+  * \param  block: pointer where to put partition block of record
+  * \param  offset: pointer where to put offset of record
+  * \retval store error number
+*/
+static KV_Error_t KV_Locate(KV_t * kv, const uint8_t * key, uint32_t keyLen, uint32_t * block, uint32_t * offset)
+{
+    KV_Error_t error = KV_OK;
+    uint8_t * src = 0;
+    uint32_t check = 0;
+    uint32_t hash = KV_Hash(key, keyLen, &check);
+    KV_Slot_t * slot = KV_IndexFind(kv, hash, check);
+    if(slot)
+    {
+        *block = slot->block;
+        *offset = slot->offset;
+        return KV_OK;
+    }
+    if(!kv->overflow)
+        return KV_NOT_FOUND;
+    error = KV_ScanKey(kv, key, keyLen, hash, check, block, offset);
+    if(error != KV_OK)
+        return error;
+    error = KV_LoadBlock(kv, *block, &src);
+    if(error != KV_OK)
+        return error;
+    return (src[*offset + 1] & KV_FLAG_DELETED) ? KV_NOT_FOUND : KV_OK;
+}
+
+/** \brief Add record to Bloom filter of segment, record sets key in index or removes it
+  * \param  kv: pointer to store structure
+  * \param  segment: segment of record
+  * \param  key: pointer to key
+  * \param  keyLen: key length
+  * \param  flags: record flags
+  * \param  block: partition block of record
+  * \param  offset: offset of record in block
+  * \retval None
+*/
+static void KV_Apply(KV_t * kv, uint32_t segment, const uint8_t * key, uint32_t keyLen, uint8_t flags,
+                     uint32_t block, uint32_t offset)
+{
+    uint32_t check = 0;
+    uint32_t hash = KV_Hash(key, keyLen, &check);
+    KV_BloomAdd(kv, &kv->segments[segment], hash, check);
+    if(flags & KV_FLAG_DELETED)
+        KV_IndexRemove(kv, hash, check);
+    else
+        KV_IndexSet(kv, hash, check, block, offset);
+}
+
+/** \brief Write zeros to stream
+  * \param  kv: pointer to store structure
+  * \param  len: number of bytes
+  * \retval store error number
+*/
+static KV_Error_t KV_StreamZeros(KV_t * kv, uint32_t len)
+{
+    uint8_t zeros[16] = {0};
+    while(len)
+    {
+        uint32_t part = (len > sizeof(zeros)) ? sizeof(zeros) : len;
+        if(SD_StreamWrite(&kv->stream, zeros, part) != SD_OK)
+            return KV_DISK_ERROR;
+        len -= part;
+    }
+    return KV_OK;
+}
+
+/** \brief Erase the next free segment after active one and write its header through stream
+  * \param  kv: pointer to store structure
+  * \retval store error number
+*/
+static KV_Error_t KV_OpenSegment(KV_t * kv)
+{
+    KV_Error_t error = KV_OK;
+    uint8_t header[16];
+    uint32_t segment = kv->active;
+    /*Segments are used round robin*/
+    do
+    {
+        segment = (segment + 1) % kv->segmentCount;
+    }
+    while(kv->segments[segment].sequence);
+    uint32_t start = segment * kv->segmentBlocks;
+    if(SD_StreamFlush(&kv->stream) != SD_OK)
+        return KV_DISK_ERROR;
+    if((kv->window >= start) && (kv->window < start + kv->segmentBlocks))
+        kv->window = KV_NO_BLOCK;
+    if(SD_PartitionErase(kv->part, start, kv->segmentBlocks) != SD_OK)
+        return KV_DISK_ERROR;
+    KV_Segment_t * s = &kv->segments[segment];
+    s->sequence = kv->sequence++;
+    memset(s->bloom, 0, kv->bloomBytes);
+    kv->freeCount--;
+    kv->active = segment;
+    SD_StreamInit(&kv->stream, kv->part->sd, kv->part->start + start, kv->stream.buffer, kv->stream.bufferBlocks);
+    kv->stream.auBlocks = kv->part->auBlocks;
+    KV_Store32(header, KV_MAGIC);
+    KV_Store32(header + 4, s->sequence);
+    KV_Store32(header + 8, kv->segmentBlocks);
+    KV_Store32(header + 12, CRC32_Update(0, header, 12));
+    if(SD_StreamWrite(&kv->stream, header, sizeof(header)) != SD_OK)
+        return KV_DISK_ERROR;
+    error = KV_StreamZeros(kv, KV_BLOCK_SIZE - sizeof(header));
+    kv->block = start + 1;
+    kv->offset = 0;
+    return error;
+}
+
+/** \brief Append record to active segment, record which does not fit in block starts next block.
+  *        Index and Bloom filter of segment get the record
+  * \param  kv: pointer to store structure
+  * \param  key: pointer to key
+  * \param  keyLen: key length
+  * \param  value: pointer to value
+  * \param  len: value length
+  * \param  flags: record flags
+  * \param  reserve: free segments which should stay after new segment is opened
+  * \retval store error number, KV_FULL if new segment would take reserved one
+*/
+static KV_Error_t KV_Write(KV_t * kv, const uint8_t * key, uint32_t keyLen, const uint8_t * value, uint32_t len,
+                           uint8_t flags, uint32_t reserve)
+{
+    KV_Error_t error = KV_OK;
+    uint8_t header[KV_HEADER_SIZE];
+    uint32_t size = KV_HEADER_SIZE + keyLen + len;
+    uint32_t end = (kv->active + 1) * kv->segmentBlocks;
+    uint32_t block = kv->block;
+    /*Stream can write block kept in window, data of window stays in buffer*/
+    kv->window = KV_NO_BLOCK;
+    if(kv->offset + size > KV_BLOCK_SIZE)
+        block++;
+    if(block >= end)
+    {
+        if(kv->freeCount <= reserve)
+            return KV_FULL;
+        error = KV_OpenSegment(kv);
+        if(error != KV_OK)
+            return error;
+    }
+    else if(block != kv->block)
+    {
+        error = KV_StreamZeros(kv, KV_BLOCK_SIZE - kv->offset);
+        if(error != KV_OK)
+            return error;
+        kv->block = block;
+        kv->offset = 0;
+    }
+    header[0] = keyLen;
+    header[1] = flags;
+    header[2] = len;
+    header[3] = len >> 8;
+    uint32_t crc = CRC32_Update(0, header, 4);
+    crc = CRC32_Update(crc, key, keyLen);
+    KV_Store32(header + 4, CRC32_Update(crc, value, len));
+    if((SD_StreamWrite(&kv->stream, header, KV_HEADER_SIZE) != SD_OK) ||
+       (SD_StreamWrite(&kv->stream, (uint8_t *)key, keyLen) != SD_OK) ||
+       (SD_StreamWrite(&kv->stream, (uint8_t *)value, len) != SD_OK))
+        return KV_DISK_ERROR;
+    KV_Apply(kv, kv->active, key, keyLen, flags, kv->block, kv->offset);
+    kv->offset += size;
+    if(kv->offset == KV_BLOCK_SIZE)
+    {
+        kv->block++;
+        kv->offset = 0;
+    }
+    return KV_OK;
+}
+
+/** \brief Compact blocks of the oldest segment. Live records are appended to active segment,
+  *        removals are dropped because segment has no older records. Segment is erased after its last block
+  * \param  kv: pointer to store structure
+  * \param  blocks: number of blocks to compact
+  * \param  force: 1 to compact even if there are enough free segments
+  * \retval store error number
+*/
+static KV_Error_t KV_CompactStep(KV_t * kv, uint32_t blocks, uint8_t force)
+{
+    KV_Error_t error = KV_OK;
+    uint8_t key[KV_MAX_KEY];
+    uint8_t * record = 0;
+    if(kv->victim == kv->segmentCount)
+    {
+        if(!force && (kv->freeCount > kv->minFree))
+            return KV_OK;
+        uint32_t victim = KV_Newer(kv, 0);
+        if((victim == kv->segmentCount) || (victim == kv->active))
+            return KV_OK;
+        kv->victim = victim;
+        kv->victimBlock = victim * kv->segmentBlocks + 1;
+    }
+    uint32_t end = (kv->victim + 1) * kv->segmentBlocks;
+    while(blocks-- && (kv->victimBlock < end))
+    {
+        uint32_t block = kv->victimBlock;
+        uint32_t offset = 0;
+        while((error = KV_NextRecord(kv, &block, &offset, kv->victimBlock + 1, 0, &record)) == KV_OK)
+        {
+            uint32_t keyLen = record[0];
+            uint32_t len = KV_Load16(record + 2);
+            uint32_t liveBlock = 0;
+            uint32_t liveOffset = 0;
+            if(!(record[1] & KV_FLAG_DELETED))
+            {
+                /*Lookup can use buffer, key is copied and record is loaded again*/
+                memcpy(key, record + KV_HEADER_SIZE, keyLen);
+                error = KV_Locate(kv, key, keyLen, &liveBlock, &liveOffset);
+                if((error != KV_OK) && (error != KV_NOT_FOUND))
+                    return error;
+                if((error == KV_OK) && (liveBlock == block) && (liveOffset == offset))
+                {
+                    error = KV_LoadBlock(kv, block, &record);
+                    if(error != KV_OK)
+                        return error;
+                    record += offset;
+                    error = KV_Write(kv, key, keyLen, record + KV_HEADER_SIZE + keyLen, len, 0, 0);
+                    if(error != KV_OK)
+                        return error;
+                }
+            }
+            offset += KV_HEADER_SIZE + keyLen + len;
+        }
+        if(error != KV_NOT_FOUND)
+            return error;
+        /*Damaged record ends segment*/
+        kv->victimBlock = (block > kv->victimBlock) ? kv->victimBlock + 1 : end;
+    }
+    if(kv->victimBlock < end)
+        return KV_OK;
+    /*Copies of live records should be on SD card before the only old copy is erased*/
+    if(SD_StreamFlush(&kv->stream) != SD_OK)
+        return KV_DISK_ERROR;
+    uint32_t start = kv->victim * kv->segmentBlocks;
+    if((kv->window >= start) && (kv->window < end))
+        kv->window = KV_NO_BLOCK;
+    if(SD_PartitionErase(kv->part, start, kv->segmentBlocks) != SD_OK)
+        return KV_DISK_ERROR;
+    kv->segments[kv->victim].sequence = 0;
+    kv->freeCount++;
+    kv->victim = kv->segmentCount;
+    return KV_OK;
+}
+
+/** \brief Append record, when there is no free segment except reserved one the oldest segments
+  *        are compacted in foreground
+  * \param  kv: pointer to store structure
+  * \param  key: pointer to key
+  * \param  keyLen: key length
+  * \param  value: pointer to value
+  * \param  len: value length
+  * \param  flags: record flags
+  * \retval store error number
+*/
+static KV_Error_t KV_WriteCompact(KV_t * kv, const uint8_t * key, uint32_t keyLen, const uint8_t * value, uint32_t len,
+                                  uint8_t flags)
+{
+    KV_Error_t error = KV_Write(kv, key, keyLen, value, len, flags, 1);
+    uint32_t tries = kv->segmentCount;
+    while((error == KV_FULL) && tries--)
+    {
+        error = KV_CompactStep(kv, KV_ALL_BLOCKS, 1);
+        if(error != KV_OK)
+            return error;
+        error = KV_Write(kv, key, keyLen, value, len, flags, 1);
+    }
+    return error;
+}
+
+/** \brief Set partition and RAM of store. Segment is allocation unit of partition, change auBlocks
+  *        of partition before init for other segment size
+  * \param  kv: pointer to store structure
+  * \param  part: pointer to partition for store
+  * \param  segments: array of segments, partition can have fewer segments
+  * \param  segmentCount: size of segment array, at least 3
+  * \param  bloom: RAM for Bloom filters, segmentCount * bloomBytes bytes
+  * \param  bloomBytes: Bloom filter size of one segment, about 1 byte per distinct key of segment
+  *         gives 3% false positives
+  * \param  slots: array of index slots
+  * \param  size: number of index slots, power of two. About 4/3 slots for every key keeps index out of overflow
+  * \param  buffer: pointer to staging buffer of write stream
+  * \param  bufferBlocks: size of staging buffer in blocks, at least 1
+  * \retval store error number
+*/
+KV_Error_t KV_Init(KV_t * kv, SD_Partition_t * part, KV_Segment_t * segments, uint32_t segmentCount,
+                   uint8_t * bloom, uint32_t bloomBytes, KV_Slot_t * slots, uint32_t size,
+                   uint8_t * buffer, uint32_t bufferBlocks)
+{
+    kv->part = part;
+    kv->segmentBlocks = part->auBlocks;
+    kv->segments = segments;
+    kv->bloomBytes = bloomBytes;
+    kv->slots = slots;
+    kv->size = size;
+    kv->minFree = 2;
+    kv->window = KV_NO_BLOCK;
+    SD_StreamInit(&kv->stream, part->sd, KV_NO_BLOCK, buffer, bufferBlocks);
+    if((kv->segmentBlocks < 2) || !size || (size & (size - 1)) || !bufferBlocks || !bloomBytes)
+        return KV_DENIED;
+    if(segmentCount > part->blocks / kv->segmentBlocks)
+        segmentCount = part->blocks / kv->segmentBlocks;
+    for(uint32_t i = 0; i < segmentCount; ++i)
+        segments[i].bloom = bloom + i * bloomBytes;
+    kv->segmentCount = segmentCount;
+    kv->victim = segmentCount;
+    kv->active = 0;
+    if(segmentCount < 3)
+        return KV_DENIED;
+    return KV_OK;
+}
+
+/** \brief Erase all segments and start empty store
+  * \param  kv: pointer to store structure
+  * \retval store error number
+*/
+KV_Error_t KV_Format(KV_t * kv)
+{
+    kv->window = KV_NO_BLOCK;
+    if(SD_PartitionErase(kv->part, 0, kv->segmentCount * kv->segmentBlocks) != SD_OK)
+        return KV_DISK_ERROR;
+    return KV_Mount(kv);
+}
+
+/** \brief Read all segments from the oldest one and build index and Bloom filters.
+  *        Write position is after the last valid record of the newest segment
+  * \param  kv: pointer to store structure
+  * \retval store error number
+*/
+KV_Error_t KV_Mount(KV_t * kv)
+{
+    KV_Error_t error = KV_OK;
+    uint8_t * src = 0;
+    uint32_t newest = kv->segmentCount;
+    uint32_t sequence = 0;
+    kv->stream.address = KV_NO_BLOCK;
+    kv->stream.fill = 0;
+    kv->window = KV_NO_BLOCK;
+    kv->freeCount = 0;
+    kv->sequence = 1;
+    kv->victim = kv->segmentCount;
+    kv->used = 0;
+    kv->overflow = 0;
+    for(uint32_t i = 0; i < kv->size; ++i)
+        kv->slots[i].block = KV_SLOT_EMPTY;
+    for(uint32_t i = 0; i < kv->segmentCount; ++i)
+    {
+        KV_Segment_t * s = &kv->segments[i];
+        error = KV_LoadBlock(kv, i * kv->segmentBlocks, &src);
+        if(error != KV_OK)
+            return error;
+        s->sequence = 0;
+        memset(s->bloom, 0, kv->bloomBytes);
+        if((KV_Load32(src) == KV_MAGIC) && (KV_Load32(src + 8) == kv->segmentBlocks) &&
+           (CRC32_Update(0, src, 12) == KV_Load32(src + 12)))
+            s->sequence = KV_Load32(src + 4);
+        if(!s->sequence)
+            kv->freeCount++;
+        else if(s->sequence >= kv->sequence)
+        {
+            kv->sequence = s->sequence + 1;
+            newest = i;
+        }
+    }
+    if(newest == kv->segmentCount)
+    {
+        /*Empty store starts at segment 0*/
+        kv->active = kv->segmentCount - 1;
+        return KV_OpenSegment(kv);
+    }
+    /*Replay segments from the oldest one, active segment is replayed up to its end*/
+    kv->active = kv->segmentCount;
+    uint32_t segment = KV_Newer(kv, 0);
+    while(segment < kv->segmentCount)
+    {
+        uint8_t * record = 0;
+        uint32_t endBlock = 0;
+        uint32_t endOffset = 0;
+        KV_SegmentEnd(kv, segment, &endBlock, &endOffset);
+        kv->block = segment * kv->segmentBlocks + 1;
+        kv->offset = 0;
+        uint32_t block = kv->block;
+        uint32_t offset = 0;
+        while((error = KV_NextRecord(kv, &block, &offset, endBlock, endOffset, &record)) == KV_OK)
+        {
+            KV_Apply(kv, segment, record + KV_HEADER_SIZE, record[0], record[1], block, offset);
+            offset += KV_HEADER_SIZE + record[0] + KV_Load16(record + 2);
+            kv->block = block;
+            kv->offset = offset;
+        }
+        if(error != KV_NOT_FOUND)
+            return error;
+        sequence = kv->segments[segment].sequence;
+        segment = KV_Newer(kv, sequence);
+    }
+    kv->active = newest;
+    if(kv->offset + KV_HEADER_SIZE > KV_BLOCK_SIZE)
+    {
+        kv->block++;
+        kv->offset = 0;
+    }
+    /*Full segment has no stream, next record opens new segment*/
+    if(kv->block >= (newest + 1) * kv->segmentBlocks)
+        return KV_OK;
+    if(kv->offset)
+    {
+        error = KV_LoadBlock(kv, kv->block, &src);
+        if(error != KV_OK)
+            return error;
+    }
+    SD_StreamInit(&kv->stream, kv->part->sd, kv->part->start + kv->block, kv->stream.buffer, kv->stream.bufferBlocks);
+    kv->stream.auBlocks = kv->part->auBlocks;
+    /*Records of last not full block are written again with new ones*/
+    if(kv->offset)
+    {
+        memcpy(kv->stream.buffer, src, kv->offset);
+        kv->stream.fill = kv->offset;
+    }
+    /*Replay can leave window on block written by stream later*/
+    kv->window = KV_NO_BLOCK;
+    return KV_OK;
+}
+
+/** \brief Write value of key. Record goes to staging buffer, it is on SD card after KV_Sync or
+  *        when buffer is full
+  * \param  kv: pointer to store structure
+  * \param  key: NULL-terminated key, up to KV_MAX_KEY characters
+  * \param  value: pointer to value
+  * \param  len: value length, record of 8 bytes header, key and value should fit in KV_MAX_RECORD
+  * \retval store error number
+*/
+KV_Error_t KV_Put(KV_t * kv, const char * key, const uint8_t * value, uint32_t len)
+{
+    uint32_t keyLen = strlen(key);
+    if(!keyLen || (keyLen > KV_MAX_KEY) || (len > KV_MAX_RECORD - KV_HEADER_SIZE - keyLen))
+        return KV_DENIED;
+    return KV_WriteCompact(kv, (const uint8_t *)key, keyLen, value, len, 0);
+}
+
+/** \brief Read value of key, key from index takes at most one block read
+  * \param  kv: pointer to store structure
+  * \param  key: NULL-terminated key
+  * \param  value: pointer to buffer for value
+  * \param  maxLen: size of buffer
+  * \param  len: pointer where to put value length
+  * \retval store error number, KV_DENIED if value is bigger than buffer
+*/
+KV_Error_t KV_Get(KV_t * kv, const char * key, uint8_t * value, uint32_t maxLen, uint32_t * len)
+{
+    KV_Error_t error = KV_OK;
+    uint8_t * src = 0;
+    uint32_t block = 0;
+    uint32_t offset = 0;
+    uint32_t keyLen = strlen(key);
+    if(!keyLen || (keyLen > KV_MAX_KEY))
+        return KV_DENIED;
+    error = KV_Locate(kv, (const uint8_t *)key, keyLen, &block, &offset);
+    if(error != KV_OK)
+        return error;
+    error = KV_LoadBlock(kv, block, &src);
+    if(error != KV_OK)
+        return error;
+    uint8_t * record = src + offset;
+    /*Other key with both hashes equal*/
+    if((record[0] != keyLen) || memcmp(record + KV_HEADER_SIZE, key, keyLen))
+        return KV_NOT_FOUND;
+    *len = KV_Load16(record + 2);
+    if(*len > maxLen)
+        return KV_DENIED;
+    memcpy(value, record + KV_HEADER_SIZE + keyLen, *len);
+    return KV_OK;
+}
+
+/** \brief Remove key, removal record is written only for existing key
+  * \param  kv: pointer to store structure
+  * \param  key: NULL-terminated key
+  * \retval store error number
+*/
+KV_Error_t KV_Delete(KV_t * kv, const char * key)
+{
+    uint32_t block = 0;
+    uint32_t offset = 0;
+    uint32_t keyLen = strlen(key);
+    if(!keyLen || (keyLen > KV_MAX_KEY))
+        return KV_DENIED;
+    KV_Error_t error = KV_Locate(kv, (const uint8_t *)key, keyLen, &block, &offset);
+    if(error != KV_OK)
+        return error;
+    return KV_WriteCompact(kv, (const uint8_t *)key, keyLen, 0, 0, KV_FLAG_DELETED);
+}
+
+/** \brief Write records from staging buffer to SD card, last not full block is padded with zeros
+  * \param  kv: pointer to store structure
+  * \retval store error number
+*/
+KV_Error_t KV_Sync(KV_t * kv)
+{
+    return (SD_StreamFlush(&kv->stream) == SD_OK) ? KV_OK : KV_DISK_ERROR;
+}
+
+/** \brief Compact the oldest segment when there are minFree or fewer free segments. Call it in idle time,
+  *        each call reads up to blocks blocks of segment, so its duration is bounded
+  * \param  kv: pointer to store structure
+  * \param  blocks: number of blocks to compact
+  * \retval store error number
+*/
+KV_Error_t KV_Compact(KV_t * kv, uint32_t blocks)
+{
+    return KV_CompactStep(kv, blocks, 0);
+}
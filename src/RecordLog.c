@@ -0,0 +1,512 @@
+/*MIT License
+
+Copyright (c) 2019 DoHelloWorld
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.*/
+
+
+#include <string.h>
+#include "RecordLog.h"
+#include "Utils.h"
+
+#define LOG_BLOCK_SIZE          512         /**< Block size of record area */
+#define LOG_NO_WINDOW           0xFFFFFFFF  /**< Window block when buffer is empty */
+#define LOG_HEADER_SIZE         12          /**< Record header: length, sequence, CRC32 */
+#define LOG_CHECKPOINT_SIZE     28          /**< Checkpoint fields covered by CRC32 and CRC32 itself */
+#define LOG_MAGIC               0x474F4C52  /**< "RLOG" at the start of checkpoint block */
+
+/*Get little-endian 32-bit value*/
+static uint32_t LOG_Load32(const uint8_t * p);
+/*Put little-endian 32-bit value*/
+static void LOG_Store32(uint8_t * p, uint32_t value);
+/*Get size of record area in bytes*/
+static uint64_t LOG_Capacity(LOG_t * log);
+/*Get number of bytes of record area which can be read from SD card*/
+static uint64_t LOG_Durable(LOG_t * log);
+/*Load partition block to buffer*/
+static LOG_Error_t LOG_Move(LOG_t * log, uint32_t block);
+/*Get block of record area from read-ahead buffer of reader or from log buffer*/
+static LOG_Error_t LOG_LoadBlock(LOG_t * log, LOG_Reader_t * reader, uint32_t block, uint8_t ** src);
+/*Read bytes of record area and continue CRC32 over them*/
+static LOG_Error_t LOG_ReadBytes(LOG_t * log, LOG_Reader_t * reader, uint64_t position, uint8_t * data, uint32_t len,
+                                 uint32_t * crc);
+/*Read and check record*/
+static LOG_Error_t LOG_ReadRecord(LOG_t * log, LOG_Reader_t * reader, uint64_t position, uint32_t sequence, uint64_t limit,
+                                  uint8_t * data, uint32_t maxLen, uint32_t * len);
+/*Set geometry of log on partition*/
+static LOG_Error_t LOG_Init(LOG_t * log, SD_Partition_t * part, uint32_t bufferBlocks);
+/*Read newest valid checkpoint*/
+static LOG_Error_t LOG_ReadCheckpoint(LOG_t * log, uint64_t * position);
+/*Write checkpoint with next generation*/
+static LOG_Error_t LOG_WriteCheckpoint(LOG_t * log);
+/*Start write stream at offset of record area*/
+static LOG_Error_t LOG_StartStream(LOG_t * log, uint64_t position, uint8_t * buffer, uint32_t bufferBlocks);
+
+/** \brief Get little-endian 32-bit value
+  * \param  p: pointer to value
+  * \retval value
+*/
+static uint32_t LOG_Load32(const uint8_t * p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/** \brief Put little-endian 32-bit value
+  * \param  p: pointer to value
+  * \param  value: value to store
+  * \retval None
+*/
+static void LOG_Store32(uint8_t * p, uint32_t value)
+{
+    p[0] = value;
+    p[1] = value >> 8;
+    p[2] = value >> 16;
+    p[3] = value >> 24;
+}
+
+/** \brief Get size of record area
+  * \param  log: pointer to log structure
+  * \retval size in bytes
+*/
+static uint64_t LOG_Capacity(LOG_t * log)
+{
+    return (uint64_t)(log->part->blocks - log->dataStart) * LOG_BLOCK_SIZE;
+}
+
+/** \brief Get number of bytes of record area which can be read from SD card. Full blocks leave staging
+  *        buffer when they are written, last synced block is on SD card padded with zeros
+  * \param  log: pointer to log structure
+  * \retval number of bytes from the start of record area
+*/
+static uint64_t LOG_Durable(LOG_t * log)
+{
+    uint64_t written = (uint64_t)(log->stream.address - log->part->start - log->dataStart) * LOG_BLOCK_SIZE;
+    return (written > log->synced) ? written : log->synced;
+}
+
+/** \brief Load partition block to buffer
+  * \param  log: pointer to log structure
+  * \param  block: block of partition
+  * \retval log error number
+*/
+static LOG_Error_t LOG_Move(LOG_t * log, uint32_t block)
+{
+    if(log->window == block)
+        return LOG_OK;
+    if(SD_PartitionRead(log->part, block, log->buffer, 1) != SD_OK)
+    {
+        log->window = LOG_NO_WINDOW;
+        return LOG_DISK_ERROR;
+    }
+    log->window = block;
+    return LOG_OK;
+}
+
+/** \brief Get block of record area. Blocks below durable end never change, reader with read-ahead buffer
+  *        loads them with one multiple read, other blocks go through log buffer
+  * \param  log: pointer to log structure
+  * \param  reader: pointer to reader structure, NULL to use log buffer
+  * \param  block: block of partition
+  * \param  src: pointer where to put address of block data
+  * \retval log error number
+*/
+static LOG_Error_t LOG_LoadBlock(LOG_t * log, LOG_Reader_t * reader, uint32_t block, uint8_t ** src)
+{
+    LOG_Error_t error = LOG_OK;
+    uint32_t end = log->dataStart + (uint32_t)(LOG_Durable(log) / LOG_BLOCK_SIZE);
+    if(reader && reader->buffer && (block < end))
+    {
+        if((block < reader->first) || (block >= reader->first + reader->loaded))
+        {
+            uint32_t blocks = end - block;
+            if(blocks > reader->bufferBlocks)
+                blocks = reader->bufferBlocks;
+            reader->loaded = 0;
+            if(SD_PartitionRead(log->part, block, reader->buffer, blocks) != SD_OK)
+                return LOG_DISK_ERROR;
+            reader->first = block;
+            reader->loaded = blocks;
+        }
+        *src = reader->buffer + (block - reader->first) * LOG_BLOCK_SIZE;
+        return LOG_OK;
+    }
+    error = LOG_Move(log, block);
+    *src = log->buffer;
+    return error;
+}
+
+/** \brief Read bytes of record area and continue CRC32 over them. Whole blocks go straight to data
+  *        with one multiple read, other bytes are taken from buffer
+  * \param  log: pointer to log structure
+  * \param  reader: pointer to reader structure, NULL to use log buffer
+  * \param  position: offset in record area
+  * \param  data: pointer to buffer for data, NULL to calculate CRC32 only
+  * \param  len: number of bytes
+  * \param  crc: pointer to CRC32 of previous bytes
+  * \retval log error number
+*/
+static LOG_Error_t LOG_ReadBytes(LOG_t * log, LOG_Reader_t * reader, uint64_t position, uint8_t * data, uint32_t len,
+                                 uint32_t * crc)
+{
+    LOG_Error_t error = LOG_OK;
+    while(len)
+    {
+        uint32_t block = log->dataStart + (uint32_t)(position / LOG_BLOCK_SIZE);
+        uint32_t offset = position % LOG_BLOCK_SIZE;
+        uint32_t part = 0;
+        if(data && !offset && (len >= LOG_BLOCK_SIZE))
+        {
+            uint32_t blocks = len / LOG_BLOCK_SIZE;
+            if(SD_PartitionRead(log->part, block, data, blocks) != SD_OK)
+                return LOG_DISK_ERROR;
+            part = blocks * LOG_BLOCK_SIZE;
+            *crc = CRC32_Update(*crc, data, part);
+        }
+        else
+        {
+            uint8_t * src = 0;
+            error = LOG_LoadBlock(log, reader, block, &src);
+            if(error != LOG_OK)
+                return error;
+            part = LOG_BLOCK_SIZE - offset;
+            if(part > len)
+                part = len;
+            *crc = CRC32_Update(*crc, src + offset, part);
+            if(data)
+                memcpy(data, src + offset, part);
+        }
+        if(data)
+            data += part;
+        position += part;
+        len -= part;
+    }
+    return LOG_OK;
+}
+
+/** \brief Read record and check its sequence and CRC32
+  * \param  log: pointer to log structure
+  * \param  reader: pointer to reader structure, NULL to use log buffer
+  * \param  position: offset of record in record area
+  * \param  sequence: expected sequence of record
+  * \param  limit: end of valid bytes in record area
+  * \param  data: pointer to buffer for record, NULL to check record only
+  * \param  maxLen: size of buffer
+  * \param  len: pointer where to put record length
+  * \retval log error number. LOG_END if record does not end before limit, LOG_DENIED if record is bigger than buffer
+*/
+static LOG_Error_t LOG_ReadRecord(LOG_t * log, LOG_Reader_t * reader, uint64_t position, uint32_t sequence, uint64_t limit,
+                                  uint8_t * data, uint32_t maxLen, uint32_t * len)
+{
+    LOG_Error_t error = LOG_OK;
+    uint8_t header[LOG_HEADER_SIZE];
+    uint8_t epoch[4];
+    uint32_t crc = 0;
+    if((position > limit) || (limit - position < LOG_HEADER_SIZE))
+        return LOG_END;
+    error = LOG_ReadBytes(log, reader, position, header, LOG_HEADER_SIZE, &crc);
+    if(error != LOG_OK)
+        return error;
+    *len = LOG_Load32(header);
+    if(LOG_Load32(header + 4) != sequence)
+        return LOG_CORRUPT;
+    if(*len > limit - position - LOG_HEADER_SIZE)
+        return LOG_END;
+    if(data && (*len > maxLen))
+        return LOG_DENIED;
+    /*Records of previous formats fail CRC32 because of epoch*/
+    LOG_Store32(epoch, log->epoch);
+    crc = CRC32_Update(0, epoch, 4);
+    crc = CRC32_Update(crc, header, 8);
+    error = LOG_ReadBytes(log, reader, position + LOG_HEADER_SIZE, data, *len, &crc);
+    if(error != LOG_OK)
+        return error;
+    return (crc == LOG_Load32(header + 8)) ? LOG_OK : LOG_CORRUPT;
+}
+
+/** \brief Set geometry of log on partition, two checkpoint blocks are in the first allocation unit
+  * \param  log: pointer to log structure
+  * \param  part: pointer to partition with log
+  * \param  bufferBlocks: size of staging buffer in blocks
+  * \retval log error number
+*/
+static LOG_Error_t LOG_Init(LOG_t * log, SD_Partition_t * part, uint32_t bufferBlocks)
+{
+    log->part = part;
+    log->dataStart = (part->auBlocks > 2) ? part->auBlocks : 2;
+    log->window = LOG_NO_WINDOW;
+    log->checkpointBytes = 0;
+    if(!bufferBlocks || (log->dataStart >= part->blocks))
+        return LOG_DENIED;
+    return LOG_OK;
+}
+
+/** \brief Read newest valid checkpoint, it sets epoch, generation and sequence of log
+  * \param  log: pointer to log structure
+  * \param  position: pointer where to put log end saved in checkpoint
+  * \retval log error number, LOG_NO_LOG if both checkpoints are not valid
+*/
+static LOG_Error_t LOG_ReadCheckpoint(LOG_t * log, uint64_t * position)
+{
+    LOG_Error_t error = LOG_NO_LOG;
+    for(uint32_t i = 0; i < 2; ++i)
+    {
+        if(LOG_Move(log, i) != LOG_OK)
+            return LOG_DISK_ERROR;
+        uint8_t * p = log->buffer;
+        uint32_t generation = LOG_Load32(p + 8);
+        if((LOG_Load32(p) != LOG_MAGIC) || (CRC32_Update(0, p, LOG_CHECKPOINT_SIZE - 4) != LOG_Load32(p + 24)))
+            continue;
+        /*Generation is compared with wrap-around*/
+        if((error == LOG_OK) && ((int32_t)(generation - log->generation) <= 0))
+            continue;
+        log->epoch = LOG_Load32(p + 4);
+        log->generation = generation;
+        log->sequence = LOG_Load32(p + 12);
+        *position = LOG_Load32(p + 16) | ((uint64_t)LOG_Load32(p + 20) << 32);
+        error = LOG_OK;
+    }
+    return error;
+}
+
+/** \brief Write checkpoint with log end and next generation, checkpoints alternate between
+  *        two blocks so the previous one stays valid if this write is interrupted
+  * \param  log: pointer to log structure
+  * \retval log error number
+*/
+static LOG_Error_t LOG_WriteCheckpoint(LOG_t * log)
+{
+    uint8_t * p = log->buffer;
+    uint32_t generation = log->generation + 1;
+    memset(p, 0, LOG_BLOCK_SIZE);
+    LOG_Store32(p, LOG_MAGIC);
+    LOG_Store32(p + 4, log->epoch);
+    LOG_Store32(p + 8, generation);
+    LOG_Store32(p + 12, log->sequence);
+    LOG_Store32(p + 16, (uint32_t)log->stream.position);
+    LOG_Store32(p + 20, (uint32_t)(log->stream.position >> 32));
+    LOG_Store32(p + 24, CRC32_Update(0, p, LOG_CHECKPOINT_SIZE - 4));
+    log->window = LOG_NO_WINDOW;
+    if(SD_PartitionWrite(log->part, generation & 1, p, 1) != SD_OK)
+        return LOG_DISK_ERROR;
+    log->window = generation & 1;
+    log->generation = generation;
+    log->checkpoint = log->stream.position;
+    return LOG_OK;
+}
+
+/** \brief Start write stream at offset of record area, bytes of last not full block are loaded to staging buffer
+  * \param  log: pointer to log structure
+  * \param  position: offset in record area
+  * \param  buffer: pointer to staging buffer
+  * \param  bufferBlocks: size of staging buffer in blocks
+  * \retval log error number
+*/
+static LOG_Error_t LOG_StartStream(LOG_t * log, uint64_t position, uint8_t * buffer, uint32_t bufferBlocks)
+{
+    LOG_Error_t error = LOG_OK;
+    uint32_t block = log->dataStart + (uint32_t)(position / LOG_BLOCK_SIZE);
+    uint32_t offset = position % LOG_BLOCK_SIZE;
+    SD_StreamInit(&log->stream, log->part->sd, log->part->start + block, buffer, bufferBlocks);
+    /*Bursts are aligned to allocation unit of partition, position counts bytes of record area*/
+    log->stream.auBlocks = log->part->auBlocks;
+    log->stream.position = position;
+    log->synced = position;
+    if(offset)
+    {
+        error = LOG_Move(log, block);
+        if(error != LOG_OK)
+            return error;
+        memcpy(buffer, log->buffer, offset);
+        log->stream.fill = offset;
+    }
+    return LOG_OK;
+}
+
+/** \brief Create empty log on partition. Records of previous log are dropped by new epoch, nothing is erased
+  * \param  log: pointer to log structure
+  * \param  part: pointer to partition for log
+  * \param  buffer: pointer to staging buffer of write stream
+  * \param  bufferBlocks: size of staging buffer in blocks, at least 1
+  * \retval log error number
+*/
+LOG_Error_t LOG_Format(LOG_t * log, SD_Partition_t * part, uint8_t * buffer, uint32_t bufferBlocks)
+{
+    uint64_t position = 0;
+    LOG_Error_t error = LOG_Init(log, part, bufferBlocks);
+    if(error != LOG_OK)
+        return error;
+    error = LOG_ReadCheckpoint(log, &position);
+    if(error == LOG_OK)
+        log->epoch++;
+    else if(error == LOG_NO_LOG)
+    {
+        /*Epoch of lost log is unknown, cycle counter makes reuse of it unlikely*/
+        log->epoch = DWT_GetCycle();
+        log->generation = 0;
+    }
+    else
+        return error;
+    log->sequence = LOG_FIRST_SEQUENCE;
+    error = LOG_StartStream(log, 0, buffer, bufferBlocks);
+    if(error != LOG_OK)
+        return error;
+    return LOG_WriteCheckpoint(log);
+}
+
+/** \brief Open log, records after the last checkpoint are checked one by one to find log end.
+  *        Recovery time depends only on data written after checkpoint
+  * \param  log: pointer to log structure
+  * \param  part: pointer to partition with log
+  * \param  buffer: pointer to staging buffer of write stream
+  * \param  bufferBlocks: size of staging buffer in blocks, at least 1
+  * \retval log error number
+*/
+LOG_Error_t LOG_Open(LOG_t * log, SD_Partition_t * part, uint8_t * buffer, uint32_t bufferBlocks)
+{
+    uint64_t position = 0;
+    uint32_t len = 0;
+    LOG_Error_t error = LOG_Init(log, part, bufferBlocks);
+    if(error != LOG_OK)
+        return error;
+    error = LOG_ReadCheckpoint(log, &position);
+    if(error != LOG_OK)
+        return error;
+    log->checkpoint = position;
+    /*The first damaged or missing record is log end, torn record is overwritten by next append*/
+    while(1)
+    {
+        error = LOG_ReadRecord(log, 0, position, log->sequence, LOG_Capacity(log), 0, 0, &len);
+        if(error == LOG_DISK_ERROR)
+            return error;
+        if(error != LOG_OK)
+            break;
+        position += LOG_HEADER_SIZE + len;
+        log->sequence++;
+    }
+    return LOG_StartStream(log, position, buffer, bufferBlocks);
+}
+
+/** \brief Append record to log. It stays in staging buffer until buffer is full or log is synced.
+  *        Log should be opened again after LOG_DISK_ERROR
+  * \param  log: pointer to log structure
+  * \param  data: pointer to record
+  * \param  len: record length in bytes
+  * \retval log error number
+*/
+LOG_Error_t LOG_Append(LOG_t * log, uint8_t * data, uint32_t len)
+{
+    uint8_t header[LOG_HEADER_SIZE];
+    uint32_t crc = 0;
+    if(log->stream.position + LOG_HEADER_SIZE + len > LOG_Capacity(log))
+        return LOG_FULL;
+    LOG_Store32(header, log->epoch);
+    crc = CRC32_Update(0, header, 4);
+    LOG_Store32(header, len);
+    LOG_Store32(header + 4, log->sequence);
+    crc = CRC32_Update(crc, header, 8);
+    LOG_Store32(header + 8, CRC32_Update(crc, data, len));
+    /*Stream can write blocks kept in buffer*/
+    log->window = LOG_NO_WINDOW;
+    if((SD_StreamWrite(&log->stream, header, LOG_HEADER_SIZE) != SD_OK) || (SD_StreamWrite(&log->stream, data, len) != SD_OK))
+        return LOG_DISK_ERROR;
+    log->sequence++;
+    if(log->checkpointBytes && (log->stream.position - log->checkpoint >= log->checkpointBytes))
+        return LOG_Checkpoint(log);
+    return LOG_OK;
+}
+
+/** \brief Write records from staging buffer to SD card, last not full block is padded with zeros
+  * \param  log: pointer to log structure
+  * \retval log error number
+*/
+LOG_Error_t LOG_Sync(LOG_t * log)
+{
+    log->window = LOG_NO_WINDOW;
+    if(SD_StreamFlush(&log->stream) != SD_OK)
+        return LOG_DISK_ERROR;
+    log->synced = log->stream.position;
+    return LOG_OK;
+}
+
+/** \brief Write records from staging buffer and save log end in checkpoint
+  * \param  log: pointer to log structure
+  * \retval log error number
+*/
+LOG_Error_t LOG_Checkpoint(LOG_t * log)
+{
+    LOG_Error_t error = LOG_Sync(log);
+    if(error != LOG_OK)
+        return error;
+    return LOG_WriteCheckpoint(log);
+}
+
+/** \brief Start reading from the first record of log
+  * \param  reader: pointer to reader structure
+  * \retval None
+*/
+void LOG_ReaderInit(LOG_Reader_t * reader)
+{
+    reader->position = 0;
+    reader->sequence = LOG_FIRST_SEQUENCE;
+    reader->buffer = 0;
+    reader->loaded = 0;
+}
+
+/** \brief Give read-ahead buffer to reader, synced blocks are then read with multiple reads of buffer size
+  * \param  reader: pointer to reader structure
+  * \param  buffer: pointer to buffer
+  * \param  bufferBlocks: size of buffer in blocks
+  * \retval None
+*/
+void LOG_ReaderBuffer(LOG_Reader_t * reader, uint8_t * buffer, uint32_t bufferBlocks)
+{
+    reader->buffer = bufferBlocks ? buffer : 0;
+    reader->bufferBlocks = bufferBlocks;
+    reader->loaded = 0;
+}
+
+/** \brief Move reader to record, read-ahead buffer is kept
+  * \param  reader: pointer to reader structure
+  * \param  position: offset of record in record area
+  * \param  sequence: sequence of record
+  * \retval None
+*/
+void LOG_ReaderSeek(LOG_Reader_t * reader, uint64_t position, uint32_t sequence)
+{
+    reader->position = position;
+    reader->sequence = sequence;
+}
+
+/** \brief Read next record. Records still in staging buffer are not visible until log is synced
+  * \param  log: pointer to log structure
+  * \param  reader: pointer to reader structure
+  * \param  data: pointer to buffer for record, NULL to skip record
+  * \param  maxLen: size of buffer
+  * \param  len: pointer where to put record length
+  * \retval log error number. LOG_END after the last record, LOG_DENIED if record is bigger than buffer
+*/
+LOG_Error_t LOG_ReadNext(LOG_t * log, LOG_Reader_t * reader, uint8_t * data, uint32_t maxLen, uint32_t * len)
+{
+    LOG_Error_t error = LOG_ReadRecord(log, reader, reader->position, reader->sequence, LOG_Durable(log), data, maxLen, len);
+    if(error != LOG_OK)
+        return error;
+    reader->position += LOG_HEADER_SIZE + *len;
+    reader->sequence++;
+    return LOG_OK;
+}
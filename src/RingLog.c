@@ -0,0 +1,278 @@
+/*MIT License
+
+Copyright (c) 2019 DoHelloWorld
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.*/
+
+
+#include <string.h>
+#include "RingLog.h"
+#include "Utils.h"
+
+#define RING_BLOCK_SIZE         512         /**< Size of ring block */
+#define RING_HEADER_SIZE        24          /**< Magic, epoch, sequence, length, reserved, CRC32 */
+#define RING_MAGIC              0x474E4952  /**< "RING" at the start of every block */
+#define RING_DEFAULT_ERASE      64          /**< Erase unit when card does not report allocation unit */
+
+/*Get little-endian 32-bit value*/
+static uint32_t RING_Load32(const uint8_t * p);
+/*Put little-endian 32-bit value*/
+static void RING_Store32(uint8_t * p, uint32_t value);
+/*Set ring geometry on partition*/
+static RING_Error_t RING_Init(RING_t * ring, SD_Partition_t * part, uint32_t eraseBlocks);
+/*Read ring block and check its structure*/
+static RING_Error_t RING_ReadBlock(RING_t * ring, uint32_t block);
+/*Get sequence of block in buffer*/
+static uint64_t RING_Sequence(RING_t * ring);
+/*Check that block in buffer keeps record with expected epoch and sequence*/
+static uint8_t RING_IsRecord(RING_t * ring, uint32_t epoch, uint64_t sequence);
+/*Update number of records after head change*/
+static void RING_UpdateCount(RING_t * ring);
+
+/** \brief Get little-endian 32-bit value
+  * \param  p: pointer to value
+  * \retval value
+*/
+static uint32_t RING_Load32(const uint8_t * p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/** \brief Put little-endian 32-bit value
+  * \param  p: pointer to value
+  * \param  value: value to store
+  * \retval None
+*/
+static void RING_Store32(uint8_t * p, uint32_t value)
+{
+    p[0] = value;
+    p[1] = value >> 8;
+    p[2] = value >> 16;
+    p[3] = value >> 24;
+}
+
+/** \brief Set ring geometry, ring takes whole erase units of partition
+  * \param  ring: pointer to ring structure
+  * \param  part: pointer to partition for ring
+  * \param  eraseBlocks: erase unit in blocks, 0 to take allocation unit of partition
+  * \retval ring error number
+*/
+static RING_Error_t RING_Init(RING_t * ring, SD_Partition_t * part, uint32_t eraseBlocks)
+{
+    if(!eraseBlocks)
+        eraseBlocks = part->auBlocks ? part->auBlocks : RING_DEFAULT_ERASE;
+    ring->part = part;
+    ring->eraseBlocks = eraseBlocks;
+    ring->blocks = (part->blocks / eraseBlocks) * eraseBlocks;
+    ring->probes = 0;
+    /*Unit with head, erased unit and at least one unit with old records*/
+    if(ring->blocks / eraseBlocks < 3)
+        return RING_DENIED;
+    return RING_OK;
+}
+
+/** \brief Read ring block to buffer and check magic, length, CRC32 and block number in sequence
+  * \param  ring: pointer to ring structure
+  * \param  block: block of ring
+  * \retval ring error number, RING_CORRUPT if block is erased or damaged
+*/
+static RING_Error_t RING_ReadBlock(RING_t * ring, uint32_t block)
+{
+    uint8_t * p = ring->buffer;
+    ring->probes++;
+    if(SD_PartitionRead(ring->part, block, p, 1) != SD_OK)
+        return RING_DISK_ERROR;
+    uint32_t len = p[16] | (p[17] << 8);
+    if((RING_Load32(p) != RING_MAGIC) || (len > RING_PAYLOAD_SIZE) || (RING_Sequence(ring) % ring->blocks != block))
+        return RING_CORRUPT;
+    uint32_t crc = CRC32_Update(0, p, RING_HEADER_SIZE - 4);
+    crc = CRC32_Update(crc, p + RING_HEADER_SIZE, len);
+    return (crc == RING_Load32(p + 20)) ? RING_OK : RING_CORRUPT;
+}
+
+/** \brief Get sequence of block in buffer
+  * \param  ring: pointer to ring structure
+  * \retval sequence
+*/
+static uint64_t RING_Sequence(RING_t * ring)
+{
+    return RING_Load32(ring->buffer + 8) | ((uint64_t)RING_Load32(ring->buffer + 12) << 32);
+}
+
+/** \brief Check that block in buffer keeps record with expected epoch and sequence
+  * \param  ring: pointer to ring structure
+  * \param  epoch: expected epoch
+  * \param  sequence: expected sequence
+  * \retval 1 if block is expected record, 0 if not
+*/
+static uint8_t RING_IsRecord(RING_t * ring, uint32_t epoch, uint64_t sequence)
+{
+    return (RING_Load32(ring->buffer + 4) == epoch) && (RING_Sequence(ring) == sequence);
+}
+
+/** \brief Update number of records. Old records start at the unit after erased one:
+  *        head unit is erased before its first block is written and the next unit is erased with it
+  * \param  ring: pointer to ring structure
+  * \retval None
+*/
+static void RING_UpdateCount(RING_t * ring)
+{
+    uint32_t unit = ring->eraseBlocks;
+    uint32_t oldStart = (((ring->head + unit - 1) / unit + 1) * unit) % ring->blocks;
+    uint32_t count = (ring->head + ring->blocks - oldStart) % ring->blocks;
+    ring->count = (ring->sequence < count) ? (uint32_t)ring->sequence : count;
+}
+
+/** \brief Drop all records and start new ring. Two first erase units are erased, other blocks
+  *        are left and rejected by new epoch
+  * \param  ring: pointer to ring structure
+  * \param  part: pointer to partition for ring
+  * \param  eraseBlocks: erase unit in blocks, 0 to take allocation unit of partition
+  * \retval ring error number
+*/
+RING_Error_t RING_Format(RING_t * ring, SD_Partition_t * part, uint32_t eraseBlocks)
+{
+    RING_Error_t error = RING_Init(ring, part, eraseBlocks);
+    if(error != RING_OK)
+        return error;
+    error = RING_ReadBlock(ring, 0);
+    if(error == RING_DISK_ERROR)
+        return error;
+    /*Epoch of lost ring is unknown, cycle counter makes reuse of it unlikely*/
+    ring->epoch = (error == RING_OK) ? RING_Load32(ring->buffer + 4) + 1 : DWT_GetCycle();
+    ring->head = 0;
+    ring->sequence = 0;
+    ring->count = 0;
+    if(SD_PartitionErase(part, 0, 2 * ring->eraseBlocks) != SD_OK)
+        return RING_DISK_ERROR;
+    return RING_OK;
+}
+
+/** \brief Find the newest record with binary search. Blocks from the first valid one up to head keep
+  *        growing sequences of one epoch, so mount reads about log2(blocks) + 2 blocks
+  * \param  ring: pointer to ring structure
+  * \param  part: pointer to partition with ring
+  * \param  eraseBlocks: erase unit in blocks, 0 to take allocation unit of partition. It should not change between mounts
+  * \retval ring error number
+*/
+RING_Error_t RING_Mount(RING_t * ring, SD_Partition_t * part, uint32_t eraseBlocks)
+{
+    uint32_t first = 0;
+    RING_Error_t error = RING_Init(ring, part, eraseBlocks);
+    if(error != RING_OK)
+        return error;
+    /*Block 0 is erased ahead only when ring wraps, then the first unit after it keeps records*/
+    error = RING_ReadBlock(ring, first);
+    if(error == RING_CORRUPT)
+    {
+        first = ring->eraseBlocks;
+        error = RING_ReadBlock(ring, first);
+    }
+    if(error == RING_DISK_ERROR)
+        return error;
+    if(error == RING_CORRUPT)
+    {
+        /*Empty ring*/
+        ring->epoch = DWT_GetCycle();
+        ring->head = 0;
+        ring->sequence = 0;
+        ring->count = 0;
+        return RING_OK;
+    }
+    ring->epoch = RING_Load32(ring->buffer + 4);
+    uint64_t sequence = RING_Sequence(ring);
+    uint32_t low = first;
+    uint32_t high = ring->blocks - 1;
+    /*Find the last block which continues sequence of the first one*/
+    while(low < high)
+    {
+        uint32_t middle = low + (high - low + 1) / 2;
+        error = RING_ReadBlock(ring, middle);
+        if(error == RING_DISK_ERROR)
+            return error;
+        if((error == RING_OK) && RING_IsRecord(ring, ring->epoch, sequence + (middle - first)))
+            low = middle;
+        else
+            high = middle - 1;
+    }
+    ring->head = (low + 1) % ring->blocks;
+    ring->sequence = sequence + (low - first) + 1;
+    RING_UpdateCount(ring);
+    return RING_OK;
+}
+
+/** \brief Write record to head block. Erase unit after the head one is erased when head enters new unit,
+  *        so the oldest records are dropped one unit at a time and writes go to erased blocks
+  * \param  ring: pointer to ring structure
+  * \param  data: pointer to record
+  * \param  len: record length, up to RING_PAYLOAD_SIZE bytes
+  * \retval ring error number
+*/
+RING_Error_t RING_Append(RING_t * ring, uint8_t * data, uint32_t len)
+{
+    uint8_t * p = ring->buffer;
+    if(len > RING_PAYLOAD_SIZE)
+        return RING_DENIED;
+    if(!(ring->head % ring->eraseBlocks))
+    {
+        uint32_t next = (ring->head + ring->eraseBlocks) % ring->blocks;
+        if(SD_PartitionErase(ring->part, next, ring->eraseBlocks) != SD_OK)
+            return RING_DISK_ERROR;
+    }
+    RING_Store32(p, RING_MAGIC);
+    RING_Store32(p + 4, ring->epoch);
+    RING_Store32(p + 8, (uint32_t)ring->sequence);
+    RING_Store32(p + 12, (uint32_t)(ring->sequence >> 32));
+    p[16] = len;
+    p[17] = len >> 8;
+    p[18] = 0;
+    p[19] = 0;
+    memcpy(p + RING_HEADER_SIZE, data, len);
+    memset(p + RING_HEADER_SIZE + len, 0, RING_PAYLOAD_SIZE - len);
+    uint32_t crc = CRC32_Update(0, p, RING_HEADER_SIZE - 4);
+    RING_Store32(p + 20, CRC32_Update(crc, p + RING_HEADER_SIZE, len));
+    if(SD_PartitionWrite(ring->part, ring->head, p, 1) != SD_OK)
+        return RING_DISK_ERROR;
+    ring->head = (ring->head + 1) % ring->blocks;
+    ring->sequence++;
+    RING_UpdateCount(ring);
+    return RING_OK;
+}
+
+/** \brief Read record by index
+  * \param  ring: pointer to ring structure
+  * \param  index: record index, 0 is the oldest record and count - 1 is the newest one
+  * \param  data: pointer to buffer for RING_PAYLOAD_SIZE bytes
+  * \param  len: pointer where to put record length
+  * \retval ring error number
+*/
+RING_Error_t RING_Read(RING_t * ring, uint32_t index, uint8_t * data, uint32_t * len)
+{
+    if(index >= ring->count)
+        return RING_NOT_FOUND;
+    uint32_t back = ring->count - index;
+    RING_Error_t error = RING_ReadBlock(ring, (ring->head + ring->blocks - back) % ring->blocks);
+    if(error != RING_OK)
+        return error;
+    if(!RING_IsRecord(ring, ring->epoch, ring->sequence - back))
+        return RING_CORRUPT;
+    *len = ring->buffer[16] | (ring->buffer[17] << 8);
+    memcpy(data, ring->buffer + RING_HEADER_SIZE, *len);
+    return RING_OK;
+}
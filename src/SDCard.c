@@ -20,12 +20,51 @@ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
 OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 SOFTWARE.*/
 
+#include <string.h>
 #include "SDCard.h"
 #include "SDCard_SPI.h"
 #include "Utils.h"
 
-/*SD timeout. 1000 ms*/
+/*SD initialization timeout. 1000 ms*/
 #define SD_TIMEOUT          1000
+/*Spec timeouts in microseconds. Timeouts from CSD are limited with them*/
+#define SD_READ_TIMEOUT_MAX         100000
+#define SD_WRITE_TIMEOUT_MAX        250000
+#define SD_WRITE_TIMEOUT_MAX_SDXC   500000
+/*Lowest timeout in microseconds, fast cards still need time to respond*/
+#define SD_TIMEOUT_MIN              1000
+/*Spec multiplier from typical access time to timeout*/
+#define SD_TIMEOUT_FACTOR           100
+/*Number of transfer repeats after recoverable error*/
+#define SD_RETRIES          3
+/*Number of CRC errors in a row to decrease SPI clock*/
+#define SD_DOWNSHIFT_ERRORS 2
+/*Number of blocks transferred without errors to try faster SPI clock*/
+#define SD_UPSHIFT_BLOCKS   4096
+/*Number of measurements for every transfer size in probe*/
+#define SD_PROBE_REPEATS    4
+/*Chunk size is the smallest one with throughput not less than this percent of maximum*/
+#define SD_PROBE_EFFICIENCY 90
+/*Number of CID, CSD and test block reads which should pass at every SPI clock*/
+#define SD_CLOCK_PROBE_READS 4
+/*Block read to test SPI clock, it is always present*/
+#define SD_CLOCK_TEST_BLOCK 0
+/*Number of SPI clock steps below the fastest failed one, 1 takes the first passing clock*/
+#define SD_CLOCK_MARGIN     2
+/*Biggest number of blocks for CMD23, longer transfers are stopped with CMD12*/
+#define SD_CMD23_MAX_BLOCKS 0xFFFF
+/*Number of blocks with CRC error which CMD18 stream skips and reads again with CMD17*/
+#define SD_READ_REPAIR_BLOCKS   8
+/*CMD6 arguments to check and to switch access mode (function group 1) to high speed*/
+#define SD_SWITCH_CHECK_HS  0x00FFFFF1
+#define SD_SWITCH_SET_HS    0x80FFFFF1
+/*Highest clock in default and high speed modes*/
+#define SD_DEFAULT_SPEED_CLOCK  25000000
+#define SD_HIGH_SPEED_CLOCK     50000000
+/*Longest busy time of one erase command in microseconds and the longest DWT wait window, it fits DWT cycle counter*/
+#define SD_ERASE_TIMEOUT_MAX    30000000
+/*Longest erase time of one allocation unit in microseconds, ERASE_TIMEOUT of SD status is up to 63 seconds*/
+#define SD_ERASE_AU_TIMEOUT_MAX 63000000
 
 static uint8_t SD_CRC7_Table[256];
 
@@ -49,8 +88,12 @@ static SD_Error_t SD_GetToken(SD_Parameters_t * sd, SD_Block_Token_t token);
 static SD_Error_t SD_ReadData(SD_Parameters_t * sd, uint8_t * data, uint32_t len);
 /*Read Data from SD. Always send CRC16 after data. Len is always even, because data blocks is SD card are always even*/
 static SD_Error_t SD_WriteData(SD_Parameters_t * sd, uint8_t * data, uint32_t len);
+/*Write block of data and get data response, card stays busy after it*/
+static SD_Error_t SD_SendData(SD_Parameters_t * sd, uint8_t * data, uint32_t len);
 /*Wait while MISO line is pulled to zero*/
 static SD_Error_t SD_WaitForBusy(SD_Parameters_t * sd);
+/*Add busy time to statistics*/
+static void SD_CountBusy(SD_Parameters_t * sd, uint32_t timestamp);
 /*Send dummy 8 clocks on SCK line*/
 static SD_Error_t SD_SendDummyByte(SD_Parameters_t * sd, uint32_t num);
 /*Stop transfer when reading multiple blocks is done or when write error occurred in multiple write mode*/
@@ -63,14 +106,83 @@ static SD_Error_t SD_GoToTransferMode(SD_Parameters_t * sd);
 static SD_Error_t SD_CheckVoltage(SD_Parameters_t * sd);
 /*read OCR register and checks is the SD card is type of SDSC*/
 static SD_Error_t SD_ReadOCR(SD_Parameters_t * sd);
+/*Read 16-byte CID or CSD register*/
+static SD_Error_t SD_TryReadRegister(SD_Parameters_t * sd, SD_Command_t cmd, uint8_t * data);
 /*Read CID register*/
 static SD_Error_t SD_ReadCID(SD_Parameters_t * sd);
 /*Read CSD register*/
 static SD_Error_t SD_ReadCSD(SD_Parameters_t * sd);
+/*Calculate read, write and erase timeouts from CSD*/
+static void SD_CalcTimeouts(SD_Parameters_t * sd);
+/*Erase timeout of allocation unit from write timeout*/
+static uint32_t SD_EraseFallback(SD_Parameters_t * sd);
+/*Get highest SPI clock allowed by TRAN_SPEED field of CSD*/
+static uint32_t SD_GetMaxClock(SD_Parameters_t * sd);
+/*Simple checksum to compare data read on different SPI clocks*/
+static uint32_t SD_Checksum(uint8_t * data, uint32_t len);
+/*Check if CID, CSD and test block are read correctly several times*/
+static SD_Error_t SD_CheckClock(SD_Parameters_t * sd, uint8_t * block, uint32_t reference);
+/*Find the fastest SPI clock which holds on the link*/
+static SD_Error_t SD_DiscoverClock(SD_Parameters_t * sd);
+/*Fit transfer times with overhead + blocks * blockTime*/
+static void SD_ProbeFit(uint32_t * blocks, uint32_t * times, uint32_t points, uint32_t * overhead, uint32_t * blockTime);
+/*Read SD status register and take allocation unit and erase parameters from it*/
+static SD_Error_t SD_TryReadSDStatus(SD_Parameters_t * sd);
+/*Read SCR register and check supported commands*/
+static SD_Error_t SD_TryReadSCR(SD_Parameters_t * sd);
+/*Send CMD6 and read switch function status*/
+static SD_Error_t SD_TrySwitchFunction(SD_Parameters_t * sd, uint32_t argument, uint8_t * status);
+/*Switch SD card to high speed mode if it supports it*/
+static SD_Error_t SD_SwitchHighSpeed(SD_Parameters_t * sd);
+/*Set number of blocks for next multiple transfer if card supports CMD23*/
+static SD_Error_t SD_SetBlockCount(SD_Parameters_t * sd, uint32_t num, uint8_t * predefined);
+/*Pre-erase blocks if card profile asks for it and set number of blocks for next multiple write*/
+static SD_Error_t SD_SetWriteCount(SD_Parameters_t * sd, uint32_t num, uint8_t * predefined);
+/*Wait after write function if card profile asks for it*/
+static void SD_WriteDelay(SD_Parameters_t * sd);
 /*Set block length for SDSC cards*/
 static SD_Error_t SD_SetBlockLength(SD_Parameters_t *sd, uint16_t blockLen);
 /*Handle error state of SD card, pulls CS to VDD and set state to inactive*/
 static void SD_ErrorHandler(SD_Parameters_t * sd);
+/*Pull CS low and apply SPI clock of SD card*/
+static SD_Error_t SD_Select(SD_Parameters_t * sd);
+/*Select SD card for multiple transfer which deadline and cancel can stop*/
+static SD_Error_t SD_SelectAbortable(SD_Parameters_t * sd);
+/*Pull CS high and set standby state*/
+static void SD_Deselect(SD_Parameters_t * sd);
+/*Convert block number to command argument, SDSC has absolute address*/
+static uint32_t SD_BlockAddress(SD_Parameters_t * sd, uint32_t block);
+/*Checks if transfer can be repeated after error*/
+static uint8_t SD_IsRecoverable(SD_Parameters_t * sd, SD_Error_t error);
+/*Update transfer statistics and SPI clock after transfer*/
+static void SD_LinkUpdate(SD_Parameters_t * sd, SD_Error_t error, uint32_t blocks);
+/*Resynchronize with SD card after failed transfer*/
+static SD_Error_t SD_Recover(SD_Parameters_t * sd);
+/*Check if transfer should be stopped by deadline or cancel request*/
+static uint8_t SD_Aborted(SD_Parameters_t * sd);
+/*Stop multiple write after abort without waiting for busy card*/
+static SD_Error_t SD_AbortWrite(SD_Parameters_t * sd);
+/*Wait while card programs block of multiple write, abort leaves stop token to the next transfer*/
+static SD_Error_t SD_WaitForBlock(SD_Parameters_t * sd, uint32_t * accepted);
+/*Transfer functions without error handling, used for retries*/
+static SD_Error_t SD_TryReadBlock(SD_Parameters_t * sd, uint32_t address, uint8_t * data);
+static SD_Error_t SD_TryReadBlocks(SD_Parameters_t * sd, uint32_t address, uint8_t * data, uint32_t num, uint32_t * done);
+static SD_Error_t SD_TryReadBlocksSink(SD_Parameters_t * sd, uint32_t address, uint32_t num, uint32_t index, SD_BlockSink_t sink,
+                                       void * context, uint8_t * buffer, uint8_t buffers, uint32_t * done, uint8_t * stop);
+static SD_Error_t SD_TryWriteBlock(SD_Parameters_t * sd, uint32_t address, uint8_t * data);
+static SD_Error_t SD_TryWriteBlocks(SD_Parameters_t * sd, uint32_t address, uint8_t * data, uint32_t num, uint32_t * accepted);
+static SD_Error_t SD_TryWriteBlocksSource(SD_Parameters_t * sd, uint32_t address, uint32_t num, uint32_t index, SD_BlockSource_t source,
+                                          void * context, uint8_t * buffer, uint8_t * filled, uint32_t * accepted);
+/*Convert received block to byte order and give it to sink*/
+static uint8_t SD_SinkBlock(SD_Parameters_t * sd, SD_BlockSink_t sink, void * context, uint32_t index, uint8_t * block);
+/*Read number of written blocks with ACMD22 without error handling*/
+static SD_Error_t SD_TryGetWrittenBlocks(SD_Parameters_t * sd, uint32_t * count);
+/*Make one step of write job on selected SD card, never waits for busy card*/
+static void SD_BusJobStep(SD_BusJob_t * job);
+/*Erase range of blocks with CMD32, CMD33 and CMD38*/
+static SD_Error_t SD_TryErase(SD_Parameters_t * sd, uint32_t address, uint32_t num);
+/*Update SD card after write job is finished*/
+static void SD_BusJobFinish(SD_BusJob_t * job);
 
 /** \brief Generate CRC7 lookup table
   * \param  None
@@ -159,7 +271,7 @@ static SD_Error_t SD_SendACMD(SD_Parameters_t * sd, SD_ACommand_t acmd, uint32_t
 static SD_Error_t SD_GetR1(SD_Parameters_t * sd,  SD_R1_t correctResponse)
 {
     uint8_t response = 0xFF;
-    /*try to get R1 for 10 times*/
+    /*try to get R1 for 10 times, card responds in 8 bytes at most (NCR)*/
     uint8_t repeats = 10;
     /*R1 response always has zero at 7 bit*/
     while((response & SD_R1_ALWAYS_ZERO) && repeats)
@@ -173,6 +285,7 @@ static SD_Error_t SD_GetR1(SD_Parameters_t * sd,  SD_R1_t correctResponse)
         return SD_ERROR;
     /*Save last R1 response and check with expected response*/
     sd->lastR1 = response;
+    sd->lastDataError = 0;
     if(response != correctResponse)
         return SD_INCORRECT_RESPONSE;
     return SD_OK;
@@ -206,34 +319,45 @@ static SD_Error_t SD_SendToken(SD_Parameters_t * sd, SD_Block_Token_t token)
 /** \brief Receive token from SD card
   * \param  sd: pointer to SD card parameters structure
   * \param  token: token from SD_Block_Token_t enum
-  * \retval SD error number
+  * \retval SD error number, SD_INCORRECT_RESPONSE if data error token received, SD_ABORTED if
+  *         deadline or cancel stopped waiting
 */
 static SD_Error_t SD_GetToken(SD_Parameters_t * sd, SD_Block_Token_t token)
 {
-    /*Try to receive for 100 times*/
-    uint8_t repeats = 100;
-    SD_Block_Token_t response = 0xFF;
-    while((response & (~token)) && repeats)
+    uint8_t response = 0xFF;
+    /*Card sends data token after read access time*/
+    uint32_t timestamp = DWT_GetCycle();
+    while(!DWT_TimeoutUs(sd->readTimeout, timestamp))
     {
-        repeats--;
         if(SD_SPI_Receive8Data(sd->SPIx, &response, 1) == SD_SPI_ERROR)
             return SD_ERROR;
+        if(response == token)
+            return SD_OK;
+        /*Data error token has four high bits cleared*/
+        if(!(response & 0xF0))
+        {
+            sd->lastDataError = response;
+            return SD_INCORRECT_RESPONSE;
+        }
+        if(SD_Aborted(sd))
+            return SD_ABORTED;
     }
-    if(repeats == 0)
-        return SD_ERROR;
-    return SD_OK;
+    return SD_ERROR;
 }
 
 /** \brief Read data block from SD card
   * \param  sd: pointer to SD card parameters structure
   * \param  data: pointer to buffer for response data
   * \param  len: length of expected response
-  * \retval SD error number
+  * \retval SD error number, SD_CRC_ERROR if received CRC16 is wrong
 */
 static SD_Error_t SD_ReadData(SD_Parameters_t * sd, uint8_t * data, uint32_t len)
 {
     /*to faster transfer, read data in 16-bit mode. CRC16 is ENABLED*/
-    if(SD_SPI_Receive16Data(sd->SPIx, (uint16_t*)data, len >> 1, ENABLE) == SD_SPI_ERROR)
+    SD_SPI_Status_t status = SD_SPI_Receive16Data(sd->SPIx, (uint16_t*)data, len >> 1, ENABLE);
+    if(status == SD_SPI_CRC_ERROR)
+        return SD_CRC_ERROR;
+    else if(status != SD_SPI_OK)
         return SD_ERROR;
     return SD_OK;
 }
@@ -245,6 +369,20 @@ static SD_Error_t SD_ReadData(SD_Parameters_t * sd, uint8_t * data, uint32_t len
   * \retval SD error number
 */
 static SD_Error_t SD_WriteData(SD_Parameters_t * sd, uint8_t * data, uint32_t len)
+{
+    SD_Error_t error = SD_SendData(sd, data, len);
+    if(error != SD_OK)
+        return error;
+    return SD_WaitForBusy(sd);
+}
+
+/** \brief Write block of data to SD card and get data response without waiting for busy state end
+  * \param  sd: pointer to SD card parameters structure
+  * \param  data: pointer to buffer with data
+  * \param  len: length of data
+  * \retval SD error number
+*/
+static SD_Error_t SD_SendData(SD_Parameters_t * sd, uint8_t * data, uint32_t len)
 {
     uint8_t token = 0xFF;
     /*to faster transfer, write data in 16-bit mode. CRC16 is ENABLED*/
@@ -256,7 +394,7 @@ static SD_Error_t SD_WriteData(SD_Parameters_t * sd, uint8_t * data, uint32_t le
     {
         if(SD_SPI_Receive8Data(sd->SPIx, &token, 1) == SD_SPI_ERROR)
             return SD_ERROR;
-        if(DWT_Timeout(SD_TIMEOUT, timestamp))
+        if(DWT_TimeoutUs(sd->writeTimeout, timestamp))
             return SD_ERROR;
         token &= 0x1F;
     }
@@ -265,31 +403,51 @@ static SD_Error_t SD_WriteData(SD_Parameters_t * sd, uint8_t * data, uint32_t le
         return SD_CRC_ERROR;
     else if(token == SD_DATA_WRITE_ERROR)
         return SD_WRITE_ERROR;
-    if(SD_WaitForBusy(sd) != SD_OK)
-        return SD_ERROR;
     return SD_OK;
 }
 
 /** \brief Wait while SD card is busy
   * \param  sd: pointer to SD card parameters structure
-  * \retval SD error number
+  * \retval SD error number, SD_ABORTED if deadline or cancel stopped waiting. Next transfer waits
+  *         for the rest of busy state then
 */
 static SD_Error_t SD_WaitForBusy(SD_Parameters_t * sd)
 {
     /*At busy state MISO is pulled to zero and all responses are zeros*/
     uint8_t busy = 0;
-    /*If card is busy more than 1000 ms - return SD_ERROR*/
+    /*If card is busy more than write timeout - return SD_ERROR*/
     uint32_t timestamp = DWT_GetCycle();
     while(busy != 0xFF)
     {
         if(SD_SPI_Receive8Data(sd->SPIx, &busy, 1) == SD_SPI_ERROR)
             return SD_ERROR;
-        if(DWT_Timeout(SD_TIMEOUT, timestamp))
+        if(DWT_TimeoutUs(sd->writeTimeout, timestamp))
             return SD_ERROR;
+        if((busy != 0xFF) && SD_Aborted(sd))
+        {
+            sd->pendingBusy = 1;
+            return SD_ABORTED;
+        }
     }
+    SD_CountBusy(sd, timestamp);
     return SD_OK;
 }
 
+/** \brief Add busy time to statistics
+  * \param  sd: pointer to SD card parameters structure
+  * \param  timestamp: start of busy state in DWT cycles
+  * \retval None
+*/
+static void SD_CountBusy(SD_Parameters_t * sd, uint32_t timestamp)
+{
+    /*Collect busy profile*/
+    uint32_t cycles = DWT_GetCycle() - timestamp;
+    sd->stats.busyWaits++;
+    sd->stats.busyCycles += cycles;
+    if(cycles > sd->stats.busyMaxCycles)
+        sd->stats.busyMaxCycles = cycles;
+}
+
 /** \brief Send dummy clocks to SCK line
   * \param  sd: pointer to SD card parameters structure
   * \param  num: number of 8 bits packets to send
@@ -308,7 +466,7 @@ static SD_Error_t SD_SendDummyByte(SD_Parameters_t * sd, uint32_t num)
 
 /** \brief Send stop transfer command to SD card
   * \param  sd: pointer to SD card parameters structure
-  * \retval SD error number
+  * \retval SD error number, SD_ABORTED if deadline or cancel stopped waiting for busy state
 */
 static SD_Error_t SD_StopTransfer(SD_Parameters_t * sd)
 {
@@ -316,12 +474,18 @@ static SD_Error_t SD_StopTransfer(SD_Parameters_t * sd)
     /*Send CMD12 command*/
     SD_SendCMD(sd, SD_CMD_12, 0, SD_R1_NORMAL_STATE);
     uint32_t timestamp = DWT_GetCycle();
+    /*Card can be busy with programming after stopped write*/
     while(token != 0xFF)
     {
         if(SD_SPI_Receive8Data(sd->SPIx, &token, 1) == SD_SPI_ERROR)
             return SD_ERROR;
-        if(DWT_Timeout(SD_TIMEOUT, timestamp))
+        if(DWT_TimeoutUs(sd->writeTimeout, timestamp))
             return SD_ERROR;
+        if((token != 0xFF) && SD_Aborted(sd))
+        {
+            sd->pendingBusy = 1;
+            return SD_ABORTED;
+        }
     }
     return SD_OK;
 }
@@ -411,17 +575,32 @@ static SD_Error_t SD_ReadOCR(SD_Parameters_t * sd)
     return SD_OK;
 }
 
+/** \brief Read 16-byte register with data token
+  * \param  sd: pointer to SD card parameters structure
+  * \param  cmd: command to read CID or CSD
+  * \param  data: pointer to buffer for register
+  * \retval SD error number
+*/
+static SD_Error_t SD_TryReadRegister(SD_Parameters_t * sd, SD_Command_t cmd, uint8_t * data)
+{
+    SD_Error_t error = SD_SendCMD(sd, cmd, 0, SD_R1_NORMAL_STATE);
+    if(error != SD_OK)
+        return error;
+    error = SD_GetToken(sd, SD_START_RMW_BLOCK_TOKEN);
+    if(error != SD_OK)
+        return error;
+    return SD_ReadData(sd, data, 16);
+}
+
 /** \brief Read CID register
   * \param  sd: pointer to SD card parameters structure
   * \retval SD error number
 */
 static SD_Error_t SD_ReadCID(SD_Parameters_t * sd)
 {
-    if(SD_SendCMD(sd, SD_CMD_10, 0, SD_R1_NORMAL_STATE) != SD_OK)
-        return SD_ERROR;
-    if(SD_GetToken(sd, SD_START_RMW_BLOCK_TOKEN) == SD_ERROR)
+    if(SD_TryReadRegister(sd, SD_CMD_10, sd->rawCID) != SD_OK)
         return SD_ERROR;
-    return SD_ReadData(sd, sd->rawCID, 16);
+    return SD_OK;
 }
 
 /** \brief Read CSD register
@@ -431,11 +610,7 @@ static SD_Error_t SD_ReadCID(SD_Parameters_t * sd)
 static SD_Error_t SD_ReadCSD(SD_Parameters_t * sd)
 {
     /*Send command to get CSD*/
-    if(SD_SendCMD(sd, SD_CMD_9, 0, SD_R1_NORMAL_STATE) != SD_OK)
-        return SD_ERROR;
-    if(SD_GetToken(sd, SD_START_RMW_BLOCK_TOKEN) == SD_ERROR)
-        return SD_ERROR;
-    if(SD_ReadData(sd, sd->rawCSD, 16) == SD_ERROR)
+    if(SD_TryReadRegister(sd, SD_CMD_9, sd->rawCSD) != SD_OK)
         return SD_ERROR;
     /*if SD speck version is 2 or higher - it is HC or XC cards*/
     if(sd->version == 2)
@@ -461,6 +636,177 @@ static SD_Error_t SD_ReadCSD(SD_Parameters_t * sd)
     return SD_OK;
 }
 
+/** \brief Erase timeout of allocation unit when SD status has no erase parameters
+  * \param  sd: pointer to SD card parameters structure
+  * \retval write timeout of every block in allocation unit, up to SD_ERASE_AU_TIMEOUT_MAX microseconds
+*/
+static uint32_t SD_EraseFallback(SD_Parameters_t * sd)
+{
+    if(sd->writeTimeout > SD_ERASE_AU_TIMEOUT_MAX / sd->auBlocks)
+        return SD_ERASE_AU_TIMEOUT_MAX;
+    return sd->writeTimeout * sd->auBlocks;
+}
+
+/** \brief Calculate read, write and erase timeouts from TAAC, NSAC and R2W_FACTOR fields of CSD
+  * \param  sd: pointer to SD card parameters structure
+  * \retval None
+*/
+static void SD_CalcTimeouts(SD_Parameters_t * sd)
+{
+    /*TAAC time unit in ns and time value multiplied by 10*/
+    static const uint32_t taacUnit[8] = {1, 10, 100, 1000, 10000, 100000, 1000000, 10000000};
+    static const uint8_t taacValue[16] = {0, 10, 12, 13, 15, 20, 25, 30, 35, 40, 45, 50, 55, 60, 70, 80};
+    uint8_t taac = sd->rawCSD[1];
+    uint8_t nsac = sd->rawCSD[2];
+    uint8_t r2w = (sd->rawCSD[12] >> 2) & 0x7;
+    /*SPI clock in kHz, NSAC is counted in units of 100 clocks*/
+    uint32_t clk = (sd->SPIx_Clk >> (sd->prescalerLimit + 1)) / 1000;
+    /*Typical read access time in microseconds*/
+    uint32_t access = (taacUnit[taac & 0x7] / 10 * taacValue[(taac >> 3) & 0xF]) / 1000;
+    if(clk)
+        access += (nsac * 100000) / clk;
+    uint32_t writeMax = (sd->type == SD_TYPE_SDXC) ? SD_WRITE_TIMEOUT_MAX_SDXC : SD_WRITE_TIMEOUT_MAX;
+    /*Timeout is 100 times more than typical time but not more than spec limits*/
+    sd->readTimeout = access * SD_TIMEOUT_FACTOR;
+    if(sd->readTimeout > SD_READ_TIMEOUT_MAX)
+        sd->readTimeout = SD_READ_TIMEOUT_MAX;
+    if(sd->readTimeout < SD_TIMEOUT_MIN)
+        sd->readTimeout = SD_TIMEOUT_MIN;
+    /*Write access time is R2W_FACTOR times longer*/
+    sd->writeTimeout = (access << r2w) * SD_TIMEOUT_FACTOR;
+    if(sd->writeTimeout > writeMax)
+        sd->writeTimeout = writeMax;
+    if(sd->writeTimeout < SD_TIMEOUT_MIN)
+        sd->writeTimeout = SD_TIMEOUT_MIN;
+    /*Allocation unit is an erase sector from CSD until SD status is read*/
+    sd->auBlocks = (((sd->rawCSD[10] & 0x3F) << 1) | ((sd->rawCSD[11] >> 7) & 0x1)) + 1;
+    /*Card profile knows timeouts better than CSD*/
+    if(sd->profile && sd->profile->readTimeout)
+        sd->readTimeout = sd->profile->readTimeout;
+    if(sd->profile && sd->profile->writeTimeout)
+        sd->writeTimeout = sd->profile->writeTimeout;
+    /*Without SD status erase of one block takes as much as write*/
+    sd->eraseTimeout = SD_EraseFallback(sd);
+    sd->eraseOffset = 0;
+}
+
+/** \brief Send CMD6 and read 64-byte switch function status
+  * \param  sd: pointer to SD card parameters structure
+  * \param  argument: mode and functions of every group
+  * \param  status: pointer to 64-byte buffer for switch function status
+  * \retval SD error number
+*/
+static SD_Error_t SD_TrySwitchFunction(SD_Parameters_t * sd, uint32_t argument, uint8_t * status)
+{
+    SD_Error_t error = SD_SendCMD(sd, SD_CMD_6, argument, SD_R1_NORMAL_STATE);
+    if(error != SD_OK)
+        return error;
+    error = SD_GetToken(sd, SD_START_RMW_BLOCK_TOKEN);
+    if(error != SD_OK)
+        return error;
+    return SD_ReadData(sd, status, 64);
+}
+
+/** \brief Switch SD card to high speed mode with CMD6 if it supports it
+  * \param  sd: pointer to SD card parameters structure
+  * \retval SD error number
+*/
+static SD_Error_t SD_SwitchHighSpeed(SD_Parameters_t * sd)
+{
+    uint8_t status[64];
+    SD_Error_t error = SD_OK;
+    /*Command class 10 of CCC*/
+    uint16_t ccc = (sd->rawCSD[4] << 4) | (sd->rawCSD[5] >> 4);
+    sd->highSpeed = 0;
+    /*CMD6 is supported since spec version 1.10*/
+    if(!(ccc & (1 << 10)) || !(sd->rawSCR[0] & 0xF))
+        return SD_OK;
+    error = SD_TrySwitchFunction(sd, SD_SWITCH_CHECK_HS, status);
+    if(error != SD_OK)
+        return error;
+    /*Function 1 of group 1 support is bit 401, result of check is bits 379:376*/
+    if(!(status[13] & 0x02) || ((status[16] & 0xF) != 0x1))
+        return SD_OK;
+    error = SD_TrySwitchFunction(sd, SD_SWITCH_SET_HS, status);
+    if(error != SD_OK)
+        return error;
+    /*Card switches function in 8 clocks after status*/
+    if(SD_SendDummyByte(sd, 1) != SD_OK)
+        return SD_ERROR;
+    if((status[16] & 0xF) == 0x1)
+        sd->highSpeed = 1;
+    return SD_OK;
+}
+
+/** \brief Read SCR register with ACMD51 and check if CMD23 is supported
+  * \param  sd: pointer to SD card parameters structure
+  * \retval SD error number
+*/
+static SD_Error_t SD_TryReadSCR(SD_Parameters_t * sd)
+{
+    SD_Error_t error = SD_OK;
+    sd->cmd23 = 0;
+    /*Card without SCR has no bus widths, security and commands support*/
+    memset(sd->rawSCR, 0, sizeof(sd->rawSCR));
+    error = SD_SendACMD(sd, SD_ACMD_51, 0, SD_R1_NORMAL_STATE);
+    if(error != SD_OK)
+        return error;
+    error = SD_GetToken(sd, SD_START_RMW_BLOCK_TOKEN);
+    if(error != SD_OK)
+        return error;
+    error = SD_ReadData(sd, sd->rawSCR, 8);
+    if(error != SD_OK)
+    {
+        memset(sd->rawSCR, 0, sizeof(sd->rawSCR));
+        return error;
+    }
+    /*CMD_SUPPORT bit 33 of SCR*/
+    sd->cmd23 = (sd->rawSCR[3] >> 1) & 0x1;
+    return SD_OK;
+}
+
+/** \brief Read SD status register with ACMD13 and take allocation unit and erase parameters from it
+  * \param  sd: pointer to SD card parameters structure
+  * \retval SD error number
+*/
+static SD_Error_t SD_TryReadSDStatus(SD_Parameters_t * sd)
+{
+    /*AU size in 16 KiB units: 1..9 are powers of two, A..F are listed in spec*/
+    static const uint16_t auSize[16] = {0, 1, 2, 4, 8, 16, 32, 64, 128, 256, 512, 768, 1024, 1536, 2048, 4096};
+    SD_Error_t error = SD_OK;
+    uint8_t r2 = 0;
+    /*ACMD13 has R2 response, R1 is followed by status byte*/
+    error = SD_SendACMD(sd, SD_ACMD_13, 0, SD_R1_NORMAL_STATE);
+    if(error != SD_OK)
+        return error;
+    if(SD_GetResponse(sd, &r2, 1) != SD_OK)
+        return SD_ERROR;
+    error = SD_GetToken(sd, SD_START_RMW_BLOCK_TOKEN);
+    if(error != SD_OK)
+        return error;
+    error = SD_ReadData(sd, sd->rawSDStatus, 64);
+    if(error != SD_OK)
+        return error;
+    uint8_t au = sd->rawSDStatus[10] >> 4;
+    uint16_t eraseSize = (sd->rawSDStatus[11] << 8) | sd->rawSDStatus[12];
+    uint8_t eraseTimeout = sd->rawSDStatus[13] >> 2;
+    if(au)
+        sd->auBlocks = auSize[au] * (16384 / sd->blockSize);
+    /*Erase of ERASE_SIZE allocation units takes ERASE_TIMEOUT seconds*/
+    if(eraseSize && eraseTimeout)
+    {
+        sd->eraseTimeout = (eraseTimeout * 1000000) / eraseSize;
+        sd->eraseOffset = (sd->rawSDStatus[13] & 0x3) * 1000000;
+    }
+    else if(au)
+    {
+        /*Timeout from CSD is for erase sector, allocation unit has other size*/
+        sd->eraseTimeout = SD_EraseFallback(sd);
+        sd->eraseOffset = 0;
+    }
+    return SD_OK;
+}
+
 /** \brief Set SDSC card block length
   * \param  sd: pointer to SD card parameters structure
   * \param  blockLen: number of bytes in block (should be even)
@@ -480,265 +826,1398 @@ static void SD_ErrorHandler(SD_Parameters_t * sd)
     /*Set inactive mode and state*/
     sd->state = SD_STATE_INACTIVE;
     sd->mode = SD_MODE_INACTIVE;
+    /*Cancel request ends with transfer*/
+    sd->abortable = 0;
+    sd->cancel = 0;
     /*Pull CS to high*/
     SD_SPI_CS_Set(sd->CS_Port, sd->CS_Pin);
 }
 
-/** \brief Init SD card
+/** \brief Select SD card and set its SPI clock
   * \param  sd: pointer to SD card parameters structure
-  * \retval SD error number
+  * \retval SD_OK, SD_ABORTED if deadline or cancel stopped waiting for card busy with aborted write
 */
-SD_Error_t SD_Init(SD_Parameters_t * sd)
+static SD_Error_t SD_Select(SD_Parameters_t * sd)
 {
-    /*Generate CRC7 table*/
-    SD_CRC7_GenTable();
-    /*Configure SPIx*/
-    SD_SPI_Config(sd->SPIx, sd->CS_Pin, sd->CS_Port);
-    /*Set SPI clocks < 400 kHz*/
-    SD_SPI_SetSpeed(sd->SPIx, sd->SPIx_Clk, SD_SPI_INIT_SPEED);
-
-    /*Semd 72 dummy clocks to SD*/
-    if(SD_SendDummyByte(sd, 9) != SD_OK)
-    {
-        SD_ErrorHandler(sd);
-        return SD_ERROR;
-    }
-
-    sd->type = SD_TYPE_SDSC;
-    sd->state = SD_STATE_READY;                         //set start state
-    sd->mode = SD_MODE_IDENTIFICATION;                  //set start mode
-    /*Pull CS low*/
+    /*Several cards on one SPIx can work on different clocks*/
+    if(SD_SPI_GetPrescaler(sd->SPIx) != sd->prescaler)
+        SD_SPI_SetPrescaler(sd->SPIx, sd->prescaler);
     SD_SPI_CS_Reset(sd->CS_Port, sd->CS_Pin);
-
-    /*Put S in identification mode*/
-    if(SD_GoToIdleMode(sd) != SD_OK)
-    {
-        SD_ErrorHandler(sd);
-        return SD_ERROR;
-    }
-    /*Check for host voltage supply and spec version*/
-    if(SD_CheckVoltage(sd) != SD_OK)
+    /*Aborted write left card busy, broken card fails on the next command*/
+    if(sd->pendingBusy)
     {
-        SD_ErrorHandler(sd);
-        return SD_ERROR;
+        sd->pendingBusy = 0;
+        if(SD_WaitForBusy(sd) == SD_ABORTED)
+            return SD_ABORTED;
     }
-    /*Put SD in transfer mode*/
-    if(SD_GoToTransferMode(sd) != SD_OK)
+    /*Write aborted while card programmed block is stopped when card is ready*/
+    if(sd->pendingStop)
     {
-        SD_ErrorHandler(sd);
-        return SD_ERROR;
+        sd->pendingStop = 0;
+        SD_SendToken(sd, SD_STOP_WE_BLOCK_TOKEN);
+        SD_SendDummyByte(sd, 1);
+        if(SD_WaitForBusy(sd) == SD_ABORTED)
+            return SD_ABORTED;
     }
-    /*Read OCR register*/
-    if(sd->version == 2)
+    return SD_OK;
+}
+
+/** \brief Select SD card for multiple transfer, deadline and cancel stop it
+  * \param  sd: pointer to SD card parameters structure
+  * \retval SD_OK, SD_ABORTED if card is still busy with aborted write. Card is deselected then
+*/
+static SD_Error_t SD_SelectAbortable(SD_Parameters_t * sd)
+{
+    /*Cancel requested before transfer is not for it*/
+    sd->cancel = 0;
+    sd->abortable = 1;
+    if(SD_Select(sd) == SD_OK)
+        return SD_OK;
+    SD_Deselect(sd);
+    return SD_ABORTED;
+}
+
+/** \brief Deselect SD card after transfer
+  * \param  sd: pointer to SD card parameters structure
+  * \retval None
+*/
+static void SD_Deselect(SD_Parameters_t * sd)
+{
+    sd->state = SD_STATE_STANDBY;
+    /*Cancel request ends with transfer*/
+    sd->abortable = 0;
+    sd->cancel = 0;
+    SD_SPI_CS_Set(sd->CS_Port, sd->CS_Pin);
+}
+
+/** \brief Convert block number to command argument
+  * \param  sd: pointer to SD card parameters structure
+  * \param  block: number of SD data block
+  * \retval address for read and write commands
+*/
+static uint32_t SD_BlockAddress(SD_Parameters_t * sd, uint32_t block)
+{
+    /*SDSC has absolute address*/
+    if(sd->type == SD_TYPE_SDSC)
+        return block * sd->blockSize;
+    return block;
+}
+
+/** \brief Checks if transfer can be repeated after error
+  * \param  sd: pointer to SD card parameters structure
+  * \param  error: error returned by transfer
+  * \retval 1 if transfer can be repeated, 0 if not
+*/
+static uint8_t SD_IsRecoverable(SD_Parameters_t * sd, SD_Error_t error)
+{
+    /*CRC errors and broken responses are caused by the link, not by the card*/
+    if(error == SD_CRC_ERROR)
+        return 1;
+    if(error != SD_INCORRECT_RESPONSE)
+        return 0;
+    /*Wrong address or argument fails again on every retry*/
+    if(sd->lastR1 & (SD_R1_ILLEGAL_CMD | SD_R1_ADDRESS_ERROR | SD_R1_PARAMETER_ERROR))
+        return 0;
+    if(sd->lastDataError & SD_RANGE_ERROR_TOKEN)
+        return 0;
+    return 1;
+}
+
+/** \brief Update transfer statistics and adapt SPI clock to link quality
+  * \param  sd: pointer to SD card parameters structure
+  * \param  error: result of transfer
+  * \param  blocks: number of blocks transferred successfully before error
+  * \retval None
+*/
+static void SD_LinkUpdate(SD_Parameters_t * sd, SD_Error_t error, uint32_t blocks)
+{
+    sd->stats.blocks += blocks;
+    sd->cleanRun += blocks;
+    /*Abort and wrong address or argument say nothing about link quality*/
+    if((error == SD_ABORTED) || ((error == SD_INCORRECT_RESPONSE) && !SD_IsRecoverable(sd, error)))
+        return;
+    if(error == SD_OK)
     {
-        if(SD_ReadOCR(sd) != SD_OK)
+        sd->crcErrorRun = 0;
+        /*Link is clean for a long time - try faster clock*/
+        if((sd->cleanRun >= SD_UPSHIFT_BLOCKS) && (sd->prescaler > sd->prescalerLimit))
         {
-            SD_ErrorHandler(sd);
-            return SD_ERROR;
+            sd->prescaler--;
+            sd->stats.upshifts++;
+            sd->cleanRun = 0;
+            SD_SPI_SetPrescaler(sd->SPIx, sd->prescaler);
         }
+        return;
     }
-    /*Now set SPI speed to transfer mode < 50 MHz*/
-    SD_SPI_SetSpeed(sd->SPIx, sd->SPIx_Clk, SD_SPI_TRANSFER_SPEED);
-    /*Read CID*/
-    if(SD_ReadCID(sd) != SD_OK)
+    sd->cleanRun = 0;
+    if(error == SD_CRC_ERROR)
     {
-        SD_ErrorHandler(sd);
-        return SD_ERROR;
+        sd->stats.crcErrors++;
+        sd->crcErrorRun++;
     }
-    /*Read CSD*/
-    if(SD_ReadCSD(sd) != SD_OK)
+    else if(error == SD_INCORRECT_RESPONSE)
+        sd->stats.responseErrors++;
+    /*Repeated CRC errors - link does not hold current clock*/
+    if((sd->crcErrorRun >= SD_DOWNSHIFT_ERRORS) && (sd->prescaler < SD_SPI_PRESCALER_256))
     {
-        SD_ErrorHandler(sd);
-        return SD_ERROR;
+        sd->prescaler++;
+        sd->stats.downshifts++;
+        sd->crcErrorRun = 0;
+        SD_SPI_SetPrescaler(sd->SPIx, sd->prescaler);
     }
-    /*Pull CS high*/
-    SD_SPI_CS_Set(sd->CS_Port, sd->CS_Pin);
-    /*Card is ready for work*/
-    return SD_OK;
 }
 
-/** \brief Set read SD status
+/** \brief Resynchronize with SD card after failed transfer
   * \param  sd: pointer to SD card parameters structure
   * \retval SD error number
 */
-SD_Error_t SD_ReadStatus(SD_Parameters_t * sd)
+static SD_Error_t SD_Recover(SD_Parameters_t * sd)
 {
-    SD_SPI_CS_Reset(sd->CS_Port, sd->CS_Pin);
-    /*Send CMD13*/
-    if(SD_SendCMD(sd, SD_CMD_13, 0, SD_R1_NORMAL_STATE) != SD_OK)
-    {
-        SD_ErrorHandler(sd);
-        return SD_ERROR;
-    }
-    /*Get response in lastR2 */
-    if(SD_GetResponse(sd, &sd->lastR2, 1) != SD_OK)
-    {
-        SD_ErrorHandler(sd);
-        return SD_ERROR;
-    }
+    /*Release card and give it 8 clocks to free MISO line*/
     SD_SPI_CS_Set(sd->CS_Port, sd->CS_Pin);
-    return SD_OK;
+    if(SD_SendDummyByte(sd, 1) != SD_OK)
+        return SD_ERROR;
+    /*Select card again with new SPI clock*/
+    if(SD_Select(sd) != SD_OK)
+        return SD_ABORTED;
+    /*Card can still program data of failed transfer*/
+    return SD_WaitForBusy(sd);
 }
 
-/** \brief Get number of successfully written blocks
+/** \brief Check if transfer should be stopped
   * \param  sd: pointer to SD card parameters structure
-  * \retval SD error number
+  * \retval 1 if deadline is passed or cancel is requested during multiple transfer, 0 if not
 */
-SD_Error_t SD_GetWrittenBlocks(SD_Parameters_t * sd)
+static uint8_t SD_Aborted(SD_Parameters_t * sd)
 {
-    /*You can check number of written blocks after using multiple write function*/
-    uint8_t temp[4];
-    SD_SPI_CS_Reset(sd->CS_Port, sd->CS_Pin);
-    if(SD_SendACMD(sd, SD_ACMD_22, 0, SD_R1_NORMAL_STATE) != SD_OK)
-    {
-        SD_ErrorHandler(sd);
+    if(!sd->abortable)
+        return 0;
+    if(sd->cancel)
+        return 1;
+    return sd->useDeadline && DWT_Expired(sd->deadline);
+}
+
+/** \brief Stop multiple write after abort. Card is left busy and deselected
+  * \param  sd: pointer to SD card parameters structure
+  * \retval SD_ABORTED or SD_ERROR if card does not answer
+*/
+static SD_Error_t SD_AbortWrite(SD_Parameters_t * sd)
+{
+    /*Stop token also ends pre-defined transfer*/
+    if(SD_SendToken(sd, SD_STOP_WE_BLOCK_TOKEN) != SD_OK)
         return SD_ERROR;
-    }
-    if(SD_GetToken(sd, SD_START_RMW_BLOCK_TOKEN) != SD_OK)
-    {
-        SD_ErrorHandler(sd);
+    if(SD_SendDummyByte(sd, 1) != SD_OK)
         return SD_ERROR;
-    }
-    if(SD_ReadData(sd, temp, 4) != SD_OK)
+    /*Busy state after stop token is waited by the next transfer*/
+    sd->pendingBusy = 1;
+    return SD_ABORTED;
+}
+
+/** \brief Wait while SD card programs block of multiple write
+  * \param  sd: pointer to SD card parameters structure
+  * \param  accepted: pointer to number of accepted blocks, block in programming is not counted after abort
+  * \retval SD error number, SD_ABORTED if deadline or cancel stopped waiting. Stop token is sent
+  *         by the next transfer when card is ready
+*/
+static SD_Error_t SD_WaitForBlock(SD_Parameters_t * sd, uint32_t * accepted)
+{
+    SD_Error_t error = SD_WaitForBusy(sd);
+    if(error == SD_ABORTED)
     {
-        SD_ErrorHandler(sd);
-        return SD_ERROR;
+        sd->pendingStop = 1;
+        (*accepted)--;
+        return SD_ABORTED;
     }
-    sd->writtenBlocks = (temp[0] << 24) | (temp[1] << 16) | (temp[2] << 8) | temp[3];
-    SD_SPI_CS_Set(sd->CS_Port, sd->CS_Pin);
+    if(error != SD_OK)
+        return SD_ERROR;
     return SD_OK;
 }
 
-/** \brief Read data block from SD
+/** \brief Read data block from SD once
   * \param  sd: pointer to SD card parameters structure
-  * \param  address: address of SD data block from where to read
+  * \param  address: number of SD data block from where to read
   * \param  data: pointer to buffer where to put data
   * \retval SD error number
 */
-SD_Error_t SD_ReadBlock(SD_Parameters_t * sd, uint32_t address, uint8_t * data)
+static SD_Error_t SD_TryReadBlock(SD_Parameters_t * sd, uint32_t address, uint8_t * data)
 {
-    SD_SPI_CS_Reset(sd->CS_Port, sd->CS_Pin);
-    sd->state = SD_STATE_RECEIVE;
-    /*SDSC has absolute address*/
-    if(sd->type == SD_TYPE_SDSC)
-        address *= sd->blockSize;
+    SD_Error_t error = SD_OK;
     /*Send CMD17*/
-    if(SD_SendCMD(sd, SD_CMD_17, address, SD_R1_NORMAL_STATE) != SD_OK)
-    {
-        SD_ErrorHandler(sd);
-        return SD_ERROR;
-    }
+    error = SD_SendCMD(sd, SD_CMD_17, SD_BlockAddress(sd, address), SD_R1_NORMAL_STATE);
+    if(error != SD_OK)
+        return error;
     /*Try to get read data token*/
-    if(SD_GetToken(sd, SD_START_RMW_BLOCK_TOKEN) != SD_OK)
-    {
-        SD_ErrorHandler(sd);
-        return SD_ERROR;
-    }
+    error = SD_GetToken(sd, SD_START_RMW_BLOCK_TOKEN);
+    if(error != SD_OK)
+        return error;
     /*Read block with CRC16*/
-    if(SD_ReadData(sd, data, sd->blockSize) != SD_OK)
+    return SD_ReadData(sd, data, sd->blockSize);
+}
+
+/** \brief Set number of blocks for next multiple read or write with CMD23
+  * \param  sd: pointer to SD card parameters structure
+  * \param  num: number of blocks
+  * \param  predefined: pointer where to put 1 if transfer stops by itself, 0 if it should be stopped
+  * \retval SD error number
+*/
+static SD_Error_t SD_SetBlockCount(SD_Parameters_t * sd, uint32_t num, uint8_t * predefined)
+{
+    SD_Error_t error = SD_OK;
+    *predefined = 0;
+    if(!sd->cmd23 || (num > SD_CMD23_MAX_BLOCKS))
+        return SD_OK;
+    error = SD_SendCMD(sd, SD_CMD_23, num, SD_R1_NORMAL_STATE);
+    /*Card does not know CMD23 - use open-ended transfers*/
+    if((error == SD_INCORRECT_RESPONSE) && (sd->lastR1 & SD_R1_ILLEGAL_CMD))
     {
-        SD_ErrorHandler(sd);
-        return SD_ERROR;
+        sd->cmd23 = 0;
+        return SD_OK;
     }
-    sd->state == SD_STATE_STANDBY;
-    SD_SPI_CS_Set(sd->CS_Port, sd->CS_Pin);
+    if(error != SD_OK)
+        return error;
+    *predefined = 1;
     return SD_OK;
 }
 
-/** \brief Read multiple data blocks from SD
+/** \brief Pre-erase blocks with ACMD23 if card profile asks for it and set number of blocks with CMD23
   * \param  sd: pointer to SD card parameters structure
-  * \param  address: address of SD data block from where to read
-  * \param  data: pointer to buffer where to put data
-  * \param  num: number of blocks to read
+  * \param  num: number of blocks
+  * \param  predefined: pointer where to put 1 if transfer stops by itself, 0 if it should be stopped
   * \retval SD error number
 */
-SD_Error_t SD_ReadMultipleBlock(SD_Parameters_t * sd, uint32_t address, uint8_t * data, uint32_t num)
+static SD_Error_t SD_SetWriteCount(SD_Parameters_t * sd, uint32_t num, uint8_t * predefined)
 {
-    SD_SPI_CS_Reset(sd->CS_Port, sd->CS_Pin);
-    sd->state = SD_STATE_RECEIVE;
-    /*SDSC has absolute address*/
-    if(sd->type == SD_TYPE_SDSC)
-        address *= sd->blockSize;
+    /*ACMD23 argument has 23 bits*/
+    if(sd->profile && sd->profile->preErase && (num <= 0x7FFFFF))
+    {
+        SD_Error_t error = SD_SendACMD(sd, SD_ACMD_23, num, SD_R1_NORMAL_STATE);
+        if(error != SD_OK)
+            return error;
+    }
+    return SD_SetBlockCount(sd, num, predefined);
+}
+
+/** \brief Wait after write function if card profile asks for it
+  * \param  sd: pointer to SD card parameters structure
+  * \retval None
+*/
+static void SD_WriteDelay(SD_Parameters_t * sd)
+{
+    if(!sd->profile || !sd->profile->writeDelay)
+        return;
+    uint32_t timestamp = DWT_GetCycle();
+    while(!DWT_TimeoutUs(sd->profile->writeDelay, timestamp));
+}
+
+/** \brief Read multiple data blocks from SD once. Next block is received while previous one is
+  *         converted to byte order, blocks with CRC error are read again after stream with CMD17
+  * \param  sd: pointer to SD card parameters structure
+  * \param  address: number of SD data block from where to read
+  * \param  data: pointer to buffer where to put data
+  * \param  num: number of blocks to read
+  * \param  done: pointer where to put number of blocks read successfully
+  * \retval SD error number
+*/
+static SD_Error_t SD_TryReadBlocks(SD_Parameters_t * sd, uint32_t address, uint8_t * data, uint32_t num, uint32_t * done)
+{
+    SD_Error_t error = SD_OK;
+    SD_SPI_Status_t status = SD_SPI_OK;
+    uint8_t predefined = 0;
+    uint32_t words = sd->blockSize >> 1;
+    uint32_t received = 0;
+    /*Block which is received but not converted to byte order yet*/
+    uint8_t * pending = 0;
+    /*Blocks with CRC error, they are read again after stream*/
+    uint32_t failed[SD_READ_REPAIR_BLOCKS];
+    uint32_t failedNum = 0;
+    *done = 0;
+    error = SD_SetBlockCount(sd, num, &predefined);
+    if(error != SD_OK)
+        return error;
+    /*Send CMD18*/
+    error = SD_SendCMD(sd, SD_CMD_18, SD_BlockAddress(sd, address), SD_R1_NORMAL_STATE);
+    if(error != SD_OK)
+        return error;
+    while(received < num)
+    {
+        uint8_t * block = data + received * sd->blockSize;
+        /*Deadline and cancel are checked between blocks*/
+        if(SD_Aborted(sd))
+        {
+            error = SD_ABORTED;
+            break;
+        }
+        /*Try to get read data token*/
+        error = SD_GetToken(sd, SD_START_RMW_BLOCK_TOKEN);
+        if(error != SD_OK)
+            break;
+        if(SD_SPI_StartReceive16Data(sd->SPIx, (uint16_t*)block, words) != SD_SPI_OK)
+        {
+            error = SD_ERROR;
+            break;
+        }
+        /*Previous block is handled while this one is on the wire*/
+        if(pending)
+            SD_SPI_Swap16Data((uint16_t*)pending, words);
+        pending = 0;
+        status = SD_SPI_WaitReceive16Data(sd->SPIx);
+        if(status == SD_SPI_ERROR)
+        {
+            error = SD_ERROR;
+            break;
+        }
+        /*Keep stream going after CRC error, only this block is read again*/
+        if(status == SD_SPI_CRC_ERROR)
+        {
+            if(failedNum == SD_READ_REPAIR_BLOCKS)
+            {
+                error = SD_CRC_ERROR;
+                break;
+            }
+            failed[failedNum++] = received;
+        }
+        else
+            pending = block;
+        received++;
+    }
+    if(pending)
+        SD_SPI_Swap16Data((uint16_t*)pending, words);
+    /*Blocks up to the first failed one are read*/
+    *done = failedNum ? failed[0] : received;
+    /*Pre-defined transfer stops by itself after last block, stop tranfer after last block or after error*/
+    if(!predefined || (error != SD_OK))
+    {
+        SD_Error_t stop = SD_StopTransfer(sd);
+        if(stop != SD_OK)
+            return stop;
+    }
+    if((error == SD_ERROR) || (error == SD_ABORTED))
+        return error;
+    for(uint32_t i = 0; i < failedNum; ++i)
+    {
+        SD_Error_t repair = SD_OK;
+        if(SD_Aborted(sd))
+        {
+            *done = failed[i];
+            return SD_ABORTED;
+        }
+        SD_LinkUpdate(sd, SD_CRC_ERROR, 0);
+        sd->stats.retries++;
+        repair = SD_TryReadBlock(sd, address + failed[i], data + failed[i] * sd->blockSize);
+        if(repair != SD_OK)
+        {
+            *done = failed[i];
+            return repair;
+        }
+    }
+    *done = received;
+    return error;
+}
+
+/** \brief Convert received block to byte order and give it to sink
+  * \param  sd: pointer to SD card parameters structure
+  * \param  sink: callback which gets blocks
+  * \param  context: user pointer for sink
+  * \param  index: number of block from the start of read
+  * \param  block: pointer to received block
+  * \retval 1 to continue reading, 0 to stop
+*/
+static uint8_t SD_SinkBlock(SD_Parameters_t * sd, SD_BlockSink_t sink, void * context, uint32_t index, uint8_t * block)
+{
+    SD_SPI_Swap16Data((uint16_t*)block, sd->blockSize >> 1);
+    return sink(context, index, block);
+}
+
+/** \brief Read multiple data blocks from SD once and give them to sink in order.
+  *         With two buffers sink handles previous block while the next one is received
+  * \param  sd: pointer to SD card parameters structure
+  * \param  address: number of SD data block from where to read
+  * \param  num: number of blocks to read
+  * \param  index: number of the first block from the start of read, passed to sink
+  * \param  sink: callback which gets blocks
+  * \param  context: user pointer for sink
+  * \param  buffer: pointer to one or two block buffers
+  * \param  buffers: number of block buffers: 1 or 2
+  * \param  done: pointer where to put number of blocks given to sink
+  * \param  stop: pointer where to put 1 if sink stopped reading
+  * \retval SD error number
+*/
+static SD_Error_t SD_TryReadBlocksSink(SD_Parameters_t * sd, uint32_t address, uint32_t num, uint32_t index, SD_BlockSink_t sink,
+                                       void * context, uint8_t * buffer, uint8_t buffers, uint32_t * done, uint8_t * stop)
+{
+    SD_Error_t error = SD_OK;
+    SD_SPI_Status_t status = SD_SPI_OK;
+    uint8_t predefined = 0;
+    uint32_t received = 0;
+    /*Block which is received but not given to sink yet*/
+    uint8_t * pending = 0;
+    *done = 0;
+    *stop = 0;
+    error = SD_SetBlockCount(sd, num, &predefined);
+    if(error != SD_OK)
+        return error;
     /*Send CMD18*/
-    if(SD_SendCMD(sd, SD_CMD_18, address, SD_R1_NORMAL_STATE) != SD_OK)
+    error = SD_SendCMD(sd, SD_CMD_18, SD_BlockAddress(sd, address), SD_R1_NORMAL_STATE);
+    if(error != SD_OK)
+        return error;
+    while(received < num)
+    {
+        uint8_t * block = buffer + (received % buffers) * sd->blockSize;
+        /*Deadline and cancel are checked between blocks*/
+        if(SD_Aborted(sd))
+        {
+            error = SD_ABORTED;
+            break;
+        }
+        /*Try to get read data token*/
+        error = SD_GetToken(sd, SD_START_RMW_BLOCK_TOKEN);
+        if(error != SD_OK)
+            break;
+        if(SD_SPI_StartReceive16Data(sd->SPIx, (uint16_t*)block, sd->blockSize >> 1) != SD_SPI_OK)
+        {
+            error = SD_ERROR;
+            break;
+        }
+        /*Previous block goes to sink while this one is on the wire*/
+        if(pending)
+        {
+            *stop = !SD_SinkBlock(sd, sink, context, index + *done, pending);
+            (*done)++;
+            pending = 0;
+        }
+        status = SD_SPI_WaitReceive16Data(sd->SPIx);
+        if(status == SD_SPI_ERROR)
+        {
+            error = SD_ERROR;
+            break;
+        }
+        /*Block after stop request is dropped*/
+        if(*stop)
+            break;
+        if(status == SD_SPI_CRC_ERROR)
+        {
+            error = SD_CRC_ERROR;
+            break;
+        }
+        received++;
+        pending = block;
+        /*With one buffer block goes to sink before the next one is received*/
+        if(buffers == 1)
+        {
+            *stop = !SD_SinkBlock(sd, sink, context, index + *done, pending);
+            (*done)++;
+            pending = 0;
+            if(*stop)
+                break;
+        }
+    }
+    /*Last received block, it is valid even if the next one failed*/
+    if(pending)
+    {
+        *stop = !SD_SinkBlock(sd, sink, context, index + *done, pending);
+        (*done)++;
+    }
+    if(*stop)
+        error = SD_OK;
+    /*Pre-defined transfer stops by itself after last block, stop tranfer after error or early stop*/
+    if(!predefined || (error != SD_OK) || (received < num))
+    {
+        SD_Error_t stop = SD_StopTransfer(sd);
+        if(stop != SD_OK)
+            return stop;
+    }
+    return error;
+}
+
+/** \brief Write block of data to SD card once
+  * \param  sd: pointer to SD card parameters structure
+  * \param  address: number of SD data block where to write
+  * \param  data: pointer to buffer from where we get data
+  * \retval SD error number
+*/
+static SD_Error_t SD_TryWriteBlock(SD_Parameters_t * sd, uint32_t address, uint8_t * data)
+{
+    SD_Error_t error = SD_OK;
+    /*Send CMD24*/
+    error = SD_SendCMD(sd, SD_CMD_24, SD_BlockAddress(sd, address), SD_R1_NORMAL_STATE);
+    if(error != SD_OK)
+        return error;
+    /*Send write data token*/
+    if(SD_SendToken(sd, SD_START_RMW_BLOCK_TOKEN) != SD_OK)
+        return SD_ERROR;
+    /*Write data block with CRC16 and wait while busy state*/
+    return SD_WriteData(sd, data, sd->blockSize);
+}
+
+/** \brief Write multiple data blocks to SD once
+  * \param  sd: pointer to SD card parameters structure
+  * \param  address: number of SD data block where to write
+  * \param  data: pointer to buffer where we get data
+  * \param  num: number of blocks to write
+  * \param  accepted: pointer where to put number of blocks accepted by SD card
+  * \retval SD error number
+*/
+static SD_Error_t SD_TryWriteBlocks(SD_Parameters_t * sd, uint32_t address, uint8_t * data, uint32_t num, uint32_t * accepted)
+{
+    SD_Error_t error = SD_OK;
+    uint8_t predefined = 0;
+    *accepted = 0;
+    error = SD_SetWriteCount(sd, num, &predefined);
+    if(error != SD_OK)
+        return error;
+    /*Send CMD25*/
+    error = SD_SendCMD(sd, SD_CMD_25, SD_BlockAddress(sd, address), SD_R1_NORMAL_STATE);
+    if(error != SD_OK)
+        return error;
+    /*Send dummy byte*/
+    if(SD_SendDummyByte(sd, 1) != SD_OK)
+        return SD_ERROR;
+    while(num--)
+    {
+        /*Deadline and cancel are checked between blocks*/
+        if(SD_Aborted(sd))
+            return SD_AbortWrite(sd);
+        /*Send multiple write token*/
+        if(SD_SendToken(sd, SD_START_WM_BLOCK_TOKEN) != SD_OK)
+            return SD_ERROR;
+        /*Write data with CRC16*/
+        error = SD_WriteData(sd, data, sd->blockSize);
+        if(error == SD_ERROR)
+            return SD_ERROR;
+        /*Block in programming is written again, stop token is sent by the next transfer*/
+        else if(error == SD_ABORTED)
+        {
+            sd->pendingStop = 1;
+            return SD_ABORTED;
+        }
+        /*if write error or crc error occurred - stop transfer*/
+        else if(error != SD_OK)
+        {
+            SD_Error_t stop = SD_StopTransfer(sd);
+            if(stop != SD_OK)
+                return stop;
+            return error;
+        }
+        data += sd->blockSize;
+        (*accepted)++;
+    }
+    /*Pre-defined transfer needs no stop token, last block is already programmed*/
+    if(predefined)
+        return SD_OK;
+    /*Send stop transmission token*/
+    if(SD_SendToken(sd, SD_STOP_WE_BLOCK_TOKEN) != SD_OK)
+        return SD_ERROR;
+    /*Send dummy byte*/
+    if(SD_SendDummyByte(sd, 1) != SD_OK)
+        return SD_ERROR;
+    /*Weit while card is busy*/
+    return SD_WaitForBusy(sd);
+}
+
+/** \brief Write multiple data blocks from producer to SD once. Producer fills the next block while
+  *         card is busy with the previous one
+  * \param  sd: pointer to SD card parameters structure
+  * \param  address: number of SD data block where to write
+  * \param  num: number of blocks to write
+  * \param  index: number of the first block from the start of write, passed to producer
+  * \param  source: callback which fills blocks
+  * \param  context: user pointer for source
+  * \param  buffer: pointer to block buffer
+  * \param  filled: pointer to flag, 1 if buffer keeps not written block
+  * \param  accepted: pointer where to put number of blocks accepted by SD card
+  * \retval SD error number. SD_OK with accepted less than num if producer stopped write
+*/
+static SD_Error_t SD_TryWriteBlocksSource(SD_Parameters_t * sd, uint32_t address, uint32_t num, uint32_t index, SD_BlockSource_t source,
+                                          void * context, uint8_t * buffer, uint8_t * filled, uint32_t * accepted)
+{
+    SD_Error_t error = SD_OK;
+    uint8_t predefined = 0;
+    *accepted = 0;
+    error = SD_SetWriteCount(sd, num, &predefined);
+    if(error != SD_OK)
+        return error;
+    /*Send CMD25*/
+    error = SD_SendCMD(sd, SD_CMD_25, SD_BlockAddress(sd, address), SD_R1_NORMAL_STATE);
+    if(error != SD_OK)
+        return error;
+    /*Send dummy byte*/
+    if(SD_SendDummyByte(sd, 1) != SD_OK)
+        return SD_ERROR;
+    while(*accepted < num)
+    {
+        /*Deadline and cancel are checked between blocks, stop token waits for the last block*/
+        if(SD_Aborted(sd))
+        {
+            if(*accepted)
+            {
+                error = SD_WaitForBlock(sd, accepted);
+                if(error != SD_OK)
+                    return error;
+            }
+            return SD_AbortWrite(sd);
+        }
+        /*Card programs previous block while producer fills the next one*/
+        if(!*filled)
+        {
+            if(!source(context, index + *accepted, buffer))
+                break;
+            *filled = 1;
+        }
+        if(*accepted)
+        {
+            error = SD_WaitForBlock(sd, accepted);
+            if(error != SD_OK)
+                return error;
+        }
+        /*Send multiple write token*/
+        if(SD_SendToken(sd, SD_START_WM_BLOCK_TOKEN) != SD_OK)
+            return SD_ERROR;
+        /*Write data with CRC16*/
+        error = SD_SendData(sd, buffer, sd->blockSize);
+        if(error == SD_ERROR)
+            return SD_ERROR;
+        /*if write error or crc error occurred - stop transfer, block stays in buffer*/
+        else if(error != SD_OK)
+        {
+            SD_Error_t stop = SD_StopTransfer(sd);
+            if(stop != SD_OK)
+                return stop;
+            return error;
+        }
+        *filled = 0;
+        (*accepted)++;
+    }
+    if(*accepted)
+    {
+        error = SD_WaitForBlock(sd, accepted);
+        if(error != SD_OK)
+            return error;
+    }
+    /*Pre-defined transfer needs no stop token, last block is already programmed*/
+    if(predefined && (*accepted == num))
+        return SD_OK;
+    /*Send stop transmission token, it also ends pre-defined transfer stopped by producer*/
+    if(SD_SendToken(sd, SD_STOP_WE_BLOCK_TOKEN) != SD_OK)
+        return SD_ERROR;
+    /*Send dummy byte*/
+    if(SD_SendDummyByte(sd, 1) != SD_OK)
+        return SD_ERROR;
+    /*Weit while card is busy*/
+    return SD_WaitForBusy(sd);
+}
+
+/** \brief Make one step of write job on selected SD card. Busy card is polled once and left busy
+  * \param  job: pointer to write job
+  * \retval None
+*/
+static void SD_BusJobStep(SD_BusJob_t * job)
+{
+    SD_Parameters_t * sd = job->sd;
+    SD_Error_t error = SD_OK;
+    uint8_t busy = 0;
+    switch(job->state)
+    {
+    case SD_JOB_START:
+        job->accepted = 0;
+        if(!job->num)
+        {
+            job->state = SD_JOB_DONE;
+            break;
+        }
+        error = SD_SetWriteCount(sd, job->num, &job->predefined);
+        /*Send CMD25*/
+        if(error == SD_OK)
+            error = SD_SendCMD(sd, SD_CMD_25, SD_BlockAddress(sd, job->address), SD_R1_NORMAL_STATE);
+        if((error == SD_OK) && (SD_SendDummyByte(sd, 1) != SD_OK))
+            error = SD_ERROR;
+        job->state = SD_JOB_DATA;
+        break;
+    case SD_JOB_DATA:
+        /*Send multiple write token and data with CRC16*/
+        if(SD_SendToken(sd, SD_START_WM_BLOCK_TOKEN) != SD_OK)
+        {
+            error = SD_ERROR;
+            break;
+        }
+        error = SD_SendData(sd, job->data + job->accepted * sd->blockSize, sd->blockSize);
+        if(error == SD_OK)
+        {
+            job->accepted++;
+            job->timestamp = DWT_GetCycle();
+            job->state = SD_JOB_BUSY;
+        }
+        /*if write error or crc error occurred - stop transfer*/
+        else if((error != SD_ERROR) && (SD_StopTransfer(sd) != SD_OK))
+            error = SD_ERROR;
+        break;
+    case SD_JOB_BUSY:
+    case SD_JOB_CLOSE:
+        /*At busy state MISO is pulled to zero*/
+        if(SD_SPI_Receive8Data(sd->SPIx, &busy, 1) == SD_SPI_ERROR)
+        {
+            error = SD_ERROR;
+            break;
+        }
+        if(busy != 0xFF)
+        {
+            if(DWT_TimeoutUs(sd->writeTimeout, job->timestamp))
+                error = SD_ERROR;
+            break;
+        }
+        SD_CountBusy(sd, job->timestamp);
+        if((job->state == SD_JOB_CLOSE) || ((job->accepted == job->num) && job->predefined))
+            job->state = SD_JOB_DONE;
+        else if(job->accepted < job->num)
+            job->state = SD_JOB_DATA;
+        /*Send stop transmission token and dummy byte, card is busy after it*/
+        else if((SD_SendToken(sd, SD_STOP_WE_BLOCK_TOKEN) != SD_OK) || (SD_SendDummyByte(sd, 1) != SD_OK))
+            error = SD_ERROR;
+        else
+        {
+            job->timestamp = DWT_GetCycle();
+            job->state = SD_JOB_CLOSE;
+        }
+        break;
+    default:
+        break;
+    }
+    if(error != SD_OK)
+    {
+        job->error = error;
+        job->state = SD_JOB_DONE;
+    }
+}
+
+/** \brief Update SD card after write job is finished
+  * \param  job: pointer to finished write job
+  * \retval None
+*/
+static void SD_BusJobFinish(SD_BusJob_t * job)
+{
+    SD_Parameters_t * sd = job->sd;
+    uint32_t done = job->accepted;
+    /*Ask card how many accepted blocks are programmed*/
+    if((job->error != SD_OK) && (job->error != SD_ERROR) && job->accepted)
+    {
+        SD_Select(sd);
+        if(SD_TryGetWrittenBlocks(sd, &done) == SD_ERROR)
+            job->error = SD_ERROR;
+        if(done > job->accepted)
+            done = job->accepted;
+    }
+    SD_LinkUpdate(sd, job->error, done);
+    sd->writtenBlocks = done;
+    if(job->error == SD_ERROR)
+    {
+        SD_ErrorHandler(sd);
+        return;
+    }
+    SD_Deselect(sd);
+    SD_WriteDelay(sd);
+    /*Read status*/
+    if(SD_ReadStatus(sd) != SD_OK)
+        job->error = SD_ERROR;
+}
+
+/** \brief Init SD card
+  * \param  sd: pointer to SD card parameters structure
+  * \retval SD error number
+*/
+SD_Error_t SD_Init(SD_Parameters_t * sd)
+{
+    /*Generate CRC7 table*/
+    SD_CRC7_GenTable();
+    /*Use spec timeouts until CSD is read*/
+    sd->readTimeout = SD_READ_TIMEOUT_MAX;
+    sd->writeTimeout = SD_WRITE_TIMEOUT_MAX_SDXC;
+    sd->eraseTimeout = SD_WRITE_TIMEOUT_MAX_SDXC;
+    /*No deadline and no aborted transfer*/
+    sd->useDeadline = 0;
+    sd->cancel = 0;
+    sd->pendingBusy = 0;
+    sd->pendingStop = 0;
+    sd->abortable = 0;
+    /*Characterization of previous card is not valid for new one*/
+    memset(&sd->probe, 0, sizeof(sd->probe));
+    /*Clear link quality counters*/
+    sd->crcErrorRun = 0;
+    sd->cleanRun = 0;
+    SD_ResetStats(sd);
+    /*Configure SPIx*/
+    SD_SPI_Config(sd->SPIx, sd->CS_Pin, sd->CS_Port);
+    /*Set SPI clocks < 400 kHz*/
+    SD_SPI_SetSpeed(sd->SPIx, sd->SPIx_Clk, SD_SPI_INIT_SPEED);
+
+    /*Semd 72 dummy clocks to SD*/
+    if(SD_SendDummyByte(sd, 9) != SD_OK)
+    {
+        SD_ErrorHandler(sd);
+        return SD_ERROR;
+    }
+
+    sd->type = SD_TYPE_SDSC;
+    sd->state = SD_STATE_READY;                         //set start state
+    sd->mode = SD_MODE_IDENTIFICATION;                  //set start mode
+    /*Pull CS low*/
+    SD_SPI_CS_Reset(sd->CS_Port, sd->CS_Pin);
+
+    /*Put S in identification mode*/
+    if(SD_GoToIdleMode(sd) != SD_OK)
+    {
+        SD_ErrorHandler(sd);
+        return SD_ERROR;
+    }
+    /*Check for host voltage supply and spec version*/
+    if(SD_CheckVoltage(sd) != SD_OK)
+    {
+        SD_ErrorHandler(sd);
+        return SD_ERROR;
+    }
+    /*Put SD in transfer mode*/
+    if(SD_GoToTransferMode(sd) != SD_OK)
+    {
+        SD_ErrorHandler(sd);
+        return SD_ERROR;
+    }
+    /*Read OCR register*/
+    if(sd->version == 2)
+    {
+        if(SD_ReadOCR(sd) != SD_OK)
+        {
+            SD_ErrorHandler(sd);
+            return SD_ERROR;
+        }
+    }
+    /*CID and CSD are read on initialization clock, they are reference for faster clocks*/
+    sd->prescalerLimit = SD_SPI_GetPrescaler(sd->SPIx);
+    sd->prescaler = sd->prescalerLimit;
+    /*Read CID*/
+    if(SD_ReadCID(sd) != SD_OK)
+    {
+        SD_ErrorHandler(sd);
+        return SD_ERROR;
+    }
+    /*Known cards get their tuning from profile table*/
+    sd->profile = SD_FindProfile(sd->rawCID);
+    if(sd->profile && sd->profile->chunkBlocks)
+        sd->probe.chunkBlocks = sd->profile->chunkBlocks;
+    /*Read CSD*/
+    if(SD_ReadCSD(sd) != SD_OK)
+    {
+        SD_ErrorHandler(sd);
+        return SD_ERROR;
+    }
+    /*Read SCR, without it multiple transfers are open-ended*/
+    if(SD_TryReadSCR(sd) == SD_ERROR)
+    {
+        SD_ErrorHandler(sd);
+        return SD_ERROR;
+    }
+    /*Switch to high speed mode, card clock limit goes up to 50 MHz*/
+    if(SD_SwitchHighSpeed(sd) == SD_ERROR)
+    {
+        SD_ErrorHandler(sd);
+        return SD_ERROR;
+    }
+    /*Choose the fastest transfer clock which holds on the link*/
+    if(SD_DiscoverClock(sd) != SD_OK)
+    {
+        SD_ErrorHandler(sd);
+        return SD_ERROR;
+    }
+    SD_CalcTimeouts(sd);
+    /*Read SD status, without it allocation unit is taken from CSD*/
+    if(SD_TryReadSDStatus(sd) == SD_ERROR)
+    {
+        SD_ErrorHandler(sd);
+        return SD_ERROR;
+    }
+    /*Pull CS high*/
+    SD_SPI_CS_Set(sd->CS_Port, sd->CS_Pin);
+    /*Card is ready for work*/
+    return SD_OK;
+}
+
+/** \brief Set read SD status
+  * \param  sd: pointer to SD card parameters structure
+  * \retval SD error number
+*/
+SD_Error_t SD_ReadStatus(SD_Parameters_t * sd)
+{
+    SD_Select(sd);
+    /*Send CMD13*/
+    if(SD_SendCMD(sd, SD_CMD_13, 0, SD_R1_NORMAL_STATE) != SD_OK)
+    {
+        SD_ErrorHandler(sd);
+        return SD_ERROR;
+    }
+    /*Get response in lastR2 */
+    if(SD_GetResponse(sd, &sd->lastR2, 1) != SD_OK)
+    {
+        SD_ErrorHandler(sd);
+        return SD_ERROR;
+    }
+    SD_SPI_CS_Set(sd->CS_Port, sd->CS_Pin);
+    return SD_OK;
+}
+
+/** \brief Read number of successfully written blocks with ACMD22
+  * \param  sd: pointer to SD card parameters structure
+  * \param  count: pointer where to put number of written blocks
+  * \retval SD error number
+*/
+static SD_Error_t SD_TryGetWrittenBlocks(SD_Parameters_t * sd, uint32_t * count)
+{
+    SD_Error_t error = SD_OK;
+    uint8_t temp[4];
+    error = SD_SendACMD(sd, SD_ACMD_22, 0, SD_R1_NORMAL_STATE);
+    if(error != SD_OK)
+        return error;
+    error = SD_GetToken(sd, SD_START_RMW_BLOCK_TOKEN);
+    if(error != SD_OK)
+        return error;
+    error = SD_ReadData(sd, temp, 4);
+    if(error != SD_OK)
+        return error;
+    *count = (temp[0] << 24) | (temp[1] << 16) | (temp[2] << 8) | temp[3];
+    return SD_OK;
+}
+
+/** \brief Get number of successfully written blocks
+  * \param  sd: pointer to SD card parameters structure
+  * \retval SD error number
+*/
+SD_Error_t SD_GetWrittenBlocks(SD_Parameters_t * sd)
+{
+    /*You can check number of written blocks after using multiple write function*/
+    SD_Select(sd);
+    if(SD_TryGetWrittenBlocks(sd, &sd->writtenBlocks) != SD_OK)
+    {
+        SD_ErrorHandler(sd);
+        return SD_ERROR;
+    }
+    SD_SPI_CS_Set(sd->CS_Port, sd->CS_Pin);
+    return SD_OK;
+}
+
+/** \brief Read SD status register
+  * \param  sd: pointer to SD card parameters structure
+  * \retval SD error number
+*/
+SD_Error_t SD_ReadSDStatus(SD_Parameters_t * sd)
+{
+    SD_Error_t error = SD_OK;
+    SD_Select(sd);
+    error = SD_TryReadSDStatus(sd);
+    if(error == SD_ERROR)
     {
         SD_ErrorHandler(sd);
         return SD_ERROR;
     }
-    while(num--)
+    SD_SPI_CS_Set(sd->CS_Port, sd->CS_Pin);
+    return error;
+}
+
+/** \brief Clear transfer statistics
+  * \param  sd: pointer to SD card parameters structure
+  * \retval None
+*/
+void SD_ResetStats(SD_Parameters_t * sd)
+{
+    sd->stats.blocks = 0;
+    sd->stats.crcErrors = 0;
+    sd->stats.responseErrors = 0;
+    sd->stats.retries = 0;
+    sd->stats.downshifts = 0;
+    sd->stats.upshifts = 0;
+    sd->stats.busyWaits = 0;
+    sd->stats.busyCycles = 0;
+    sd->stats.busyMaxCycles = 0;
+}
+
+/** \brief Get highest SPI clock allowed by TRAN_SPEED field of CSD
+  * \param  sd: pointer to SD card parameters structure
+  * \retval clock in Hz
+*/
+static uint32_t SD_GetMaxClock(SD_Parameters_t * sd)
+{
+    /*Transfer rate unit in 10 kbit/s and time value multiplied by 10*/
+    static const uint32_t rateUnit[4] = {10, 100, 1000, 10000};
+    static const uint8_t rateValue[16] = {0, 10, 12, 13, 15, 20, 25, 30, 35, 40, 45, 50, 55, 60, 70, 80};
+    uint8_t speed = sd->rawCSD[3];
+    uint32_t clk = rateUnit[speed & 0x3] * rateValue[(speed >> 3) & 0xF] * 1000;
+    /*Card in high speed mode works up to 50 MHz even if CSD is not updated*/
+    if(sd->highSpeed)
+        clk = SD_HIGH_SPEED_CLOCK;
+    /*Unknown value - use default speed 25 MHz*/
+    else if((speed & 0x4) || !clk)
+        clk = SD_DEFAULT_SPEED_CLOCK;
+    /*Card profile can limit clock*/
+    if(sd->profile && sd->profile->maxClock && (sd->profile->maxClock < clk))
+        clk = sd->profile->maxClock;
+    return clk;
+}
+
+/** \brief Calculate simple checksum to compare data read on different SPI clocks
+  * \param  data: pointer to data buffer
+  * \param  len: number of bytes
+  * \retval checksum
+*/
+static uint32_t SD_Checksum(uint8_t * data, uint32_t len)
+{
+    uint32_t sum = 0;
+    for(uint32_t i = 0; i < len; ++i)
+        sum = ((sum << 5) | (sum >> 27)) ^ data[i];
+    return sum;
+}
+
+/** \brief Check if CID, CSD and test block are read correctly on current SPI clock
+  * \param  sd: pointer to SD card parameters structure
+  * \param  block: pointer to buffer for test block
+  * \param  reference: checksum of test block read on initialization clock
+  * \retval SD error number
+*/
+static SD_Error_t SD_CheckClock(SD_Parameters_t * sd, uint8_t * block, uint32_t reference)
+{
+    uint8_t reg[16];
+    for(uint32_t i = 0; i < SD_CLOCK_PROBE_READS; ++i)
     {
-        /*Try to get read data token*/
-        if(SD_GetToken(sd, SD_START_RMW_BLOCK_TOKEN) != SD_OK)
-        {
-            SD_ErrorHandler(sd);
+        if(SD_TryReadRegister(sd, SD_CMD_10, reg) != SD_OK)
+            return SD_ERROR;
+        for(uint32_t j = 0; j < 16; ++j)
+            if(reg[j] != sd->rawCID[j])
+                return SD_ERROR;
+        if(SD_TryReadRegister(sd, SD_CMD_9, reg) != SD_OK)
+            return SD_ERROR;
+        for(uint32_t j = 0; j < 16; ++j)
+            if(reg[j] != sd->rawCSD[j])
+                return SD_ERROR;
+        if(SD_TryReadBlock(sd, SD_CLOCK_TEST_BLOCK, block) != SD_OK)
+            return SD_ERROR;
+        if(SD_Checksum(block, sd->blockSize) != reference)
+            return SD_ERROR;
+    }
+    return SD_OK;
+}
+
+/** \brief Find the fastest SPI clock which reads CID, CSD and test block correctly.
+  *        Clocks are checked from the fastest allowed by card to initialization clock.
+  * \param  sd: pointer to SD card parameters structure
+  * \retval SD error number
+*/
+static SD_Error_t SD_DiscoverClock(SD_Parameters_t * sd)
+{
+    uint8_t block[512];
+    SD_SPI_Prescaler_t slowest = SD_SPI_GetPrescaler(sd->SPIx);
+    SD_SPI_Prescaler_t fastest = SD_SPI_GetPrescalerFor(sd->SPIx_Clk, SD_GetMaxClock(sd));
+    SD_SPI_Prescaler_t prescaler = fastest;
+    /*Reference test block is read on initialization clock*/
+    SD_Error_t error = SD_TryReadBlock(sd, SD_CLOCK_TEST_BLOCK, block);
+    if(error != SD_OK)
+        return error;
+    uint32_t reference = SD_Checksum(block, sd->blockSize);
+    for(; prescaler < slowest; prescaler++)
+    {
+        sd->prescaler = prescaler;
+        SD_SPI_SetPrescaler(sd->SPIx, prescaler);
+        if(SD_CheckClock(sd, block, reference) == SD_OK)
+            break;
+        /*Card can still send data of failed read*/
+        if(SD_Recover(sd) != SD_OK)
             return SD_ERROR;
+    }
+    /*Link limits the clock - keep margin from failed clock, it is one step faster than the passing one*/
+    if(prescaler != fastest)
+        prescaler = prescaler - 1 + SD_CLOCK_MARGIN;
+    if(prescaler > slowest)
+        prescaler = slowest;
+    sd->prescalerLimit = prescaler;
+    sd->prescaler = prescaler;
+    SD_SPI_SetPrescaler(sd->SPIx, prescaler);
+    return SD_OK;
+}
+
+/** \brief Fit transfer times with line overhead + blocks * blockTime by least squares
+  * \param  blocks: array of transfer sizes
+  * \param  times: array of transfer times
+  * \param  points: number of measurements
+  * \param  overhead: pointer where to put time of transfer without data
+  * \param  blockTime: pointer where to put time of one block
+  * \retval None
+*/
+static void SD_ProbeFit(uint32_t * blocks, uint32_t * times, uint32_t points, uint32_t * overhead, uint32_t * blockTime)
+{
+    int64_t sumX = 0, sumY = 0, sumXX = 0, sumXY = 0;
+    for(uint32_t i = 0; i < points; ++i)
+    {
+        sumX += blocks[i];
+        sumY += times[i];
+        sumXX += (int64_t)blocks[i] * blocks[i];
+        sumXY += (int64_t)blocks[i] * times[i];
+    }
+    int64_t det = points * sumXX - sumX * sumX;
+    int64_t slope = det ? (points * sumXY - sumX * sumY) / det : 0;
+    int64_t intercept = (sumY - slope * sumX) / points;
+    *blockTime = (slope > 0) ? (uint32_t)slope : 0;
+    *overhead = (intercept > 0) ? (uint32_t)intercept : 0;
+}
+
+/** \brief Measure multiple write and read times for 1, 2, 4 .. maxBlocks blocks
+  *        and put card characterization in probe member of sd struct
+  * \param  sd: pointer to SD card parameters structure
+  * \param  address: SD data block of scratch region, data in it is lost
+  * \param  buffer: pointer to buffer of maxBlocks blocks
+  * \param  maxBlocks: biggest transfer size, should be power of two not more than 1024
+  * \retval SD error number
+*/
+SD_Error_t SD_Probe(SD_Parameters_t * sd, uint32_t address, uint8_t * buffer, uint32_t maxBlocks)
+{
+    uint32_t blocks[11];
+    uint32_t writeTimes[11];
+    uint32_t readTimes[11];
+    uint32_t points = 0;
+    SD_Error_t error = SD_OK;
+    SD_Stats_t stats = sd->stats;
+    sd->stats.busyWaits = 0;
+    sd->stats.busyCycles = 0;
+    sd->stats.busyMaxCycles = 0;
+    for(uint32_t num = 1; (num <= maxBlocks) && (points < 11); num <<= 1, points++)
+    {
+        blocks[points] = num;
+        writeTimes[points] = 0xFFFFFFFF;
+        readTimes[points] = 0xFFFFFFFF;
+        /*The fastest of repeated transfers is taken, others are disturbed by card housekeeping*/
+        for(uint32_t i = 0; i < SD_PROBE_REPEATS; ++i)
+        {
+            uint32_t timestamp = DWT_GetCycle();
+            error = SD_WriteMultipleBlock(sd, address, buffer, num);
+            uint32_t cycles = DWT_GetCycle() - timestamp;
+            if(error != SD_OK)
+                break;
+            if(cycles < writeTimes[points])
+                writeTimes[points] = cycles;
+            timestamp = DWT_GetCycle();
+            error = SD_ReadMultipleBlock(sd, address, buffer, num);
+            cycles = DWT_GetCycle() - timestamp;
+            if(error != SD_OK)
+                break;
+            if(cycles < readTimes[points])
+                readTimes[points] = cycles;
         }
-        /*Read data with CRC16*/
-        if(SD_ReadData(sd, data, sd->blockSize) != SD_OK)
+        if(error != SD_OK)
+            break;
+        writeTimes[points] = DWT_CyclesToUs(writeTimes[points]);
+        readTimes[points] = DWT_CyclesToUs(readTimes[points]);
+    }
+    if(error == SD_OK)
+    {
+        /*Throughput of chunk is num / time, choose the smallest chunk close to the best one*/
+        uint32_t best = 0;
+        for(uint32_t i = 1; i < points; ++i)
         {
-            SD_ErrorHandler(sd);
-            return SD_ERROR;
+            if((uint64_t)blocks[i] * writeTimes[best] > (uint64_t)blocks[best] * writeTimes[i])
+                best = i;
+        }
+        sd->probe.chunkBlocks = blocks[best];
+        for(uint32_t i = 0; i < best; ++i)
+        {
+            if((uint64_t)blocks[i] * writeTimes[best] * 100 >= (uint64_t)blocks[best] * writeTimes[i] * SD_PROBE_EFFICIENCY)
+            {
+                sd->probe.chunkBlocks = blocks[i];
+                break;
+            }
+        }
+        SD_ProbeFit(blocks, writeTimes, points, &sd->probe.writeOverhead, &sd->probe.writeBlockTime);
+        SD_ProbeFit(blocks, readTimes, points, &sd->probe.readOverhead, &sd->probe.readBlockTime);
+        sd->probe.busyAverage = sd->stats.busyWaits ? DWT_CyclesToUs(sd->stats.busyCycles / sd->stats.busyWaits) : 0;
+        sd->probe.busyMax = DWT_CyclesToUs(sd->stats.busyMaxCycles);
+    }
+    /*Probe does not change busy statistics of normal work*/
+    sd->stats.busyWaits = stats.busyWaits;
+    sd->stats.busyCycles = stats.busyCycles;
+    sd->stats.busyMaxCycles = stats.busyMaxCycles;
+    return error;
+}
+
+/** \brief Read data block from SD
+  * \param  sd: pointer to SD card parameters structure
+  * \param  address: address of SD data block from where to read
+  * \param  data: pointer to buffer where to put data
+  * \retval SD error number
+*/
+SD_Error_t SD_ReadBlock(SD_Parameters_t * sd, uint32_t address, uint8_t * data)
+{
+    SD_Error_t error = SD_OK;
+    uint8_t retries = SD_RETRIES;
+    SD_Select(sd);
+    sd->state = SD_STATE_RECEIVE;
+    while(1)
+    {
+        error = SD_TryReadBlock(sd, address, data);
+        SD_LinkUpdate(sd, error, (error == SD_OK) ? 1 : 0);
+        if((error == SD_OK) || !SD_IsRecoverable(sd, error) || !retries)
+            break;
+        /*Link error - read block again, maybe on lower clock*/
+        retries--;
+        sd->stats.retries++;
+        if(SD_Recover(sd) != SD_OK)
+        {
+            error = SD_ERROR;
+            break;
         }
-        /*increment data pointer*/
-        data += sd->blockSize;
     }
-    /*Stop tranfer after last block*/
-    if(SD_StopTransfer(sd) != SD_OK)
+    if(error == SD_ERROR)
     {
         SD_ErrorHandler(sd);
         return SD_ERROR;
     }
-    sd->state = SD_STATE_STANDBY;
-    SD_SPI_CS_Set(sd->CS_Port, sd->CS_Pin);
-    return SD_OK;
+    SD_Deselect(sd);
+    return error;
 }
 
-/** \brief Write block of data to SD card
+/** \brief Read multiple data blocks from SD
   * \param  sd: pointer to SD card parameters structure
-  * \param  address: address of SD data block where to write
-  * \param  data: pointer to buffer from where we get data
+  * \param  address: address of SD data block from where to read
+  * \param  data: pointer to buffer where to put data
+  * \param  num: number of blocks to read
   * \retval SD error number
 */
-SD_Error_t SD_WriteBlock(SD_Parameters_t * sd, uint32_t address, uint8_t * data)
+SD_Error_t SD_ReadMultipleBlock(SD_Parameters_t * sd, uint32_t address, uint8_t * data, uint32_t num)
 {
-    SD_SPI_CS_Reset(sd->CS_Port, sd->CS_Pin);
-    /*SDSC has absolute address*/
-    sd->state = SD_STATE_SENDING;
-    if(sd->type == SD_TYPE_SDSC)
-        address *= sd->blockSize;
-    /*Send CMD24*/
-    if(SD_SendCMD(sd, SD_CMD_24, address, SD_R1_NORMAL_STATE) != SD_OK)
+    SD_Error_t error = SD_OK;
+    uint8_t retries = SD_RETRIES;
+    sd->readBlocks = 0;
+    /*Card can be still busy with aborted write*/
+    if(SD_SelectAbortable(sd) != SD_OK)
+        return SD_ABORTED;
+    sd->state = SD_STATE_RECEIVE;
+    while(1)
     {
-        SD_ErrorHandler(sd);
-        return SD_ERROR;
+        uint32_t done = 0;
+        error = SD_TryReadBlocks(sd, address, data, num, &done);
+        SD_LinkUpdate(sd, error, done);
+        sd->readBlocks += done;
+        /*Continue from the first failed block*/
+        address += done;
+        data += done * sd->blockSize;
+        num -= done;
+        if(done)
+            retries = SD_RETRIES;
+        if((error == SD_OK) || !SD_IsRecoverable(sd, error) || !retries)
+            break;
+        retries--;
+        sd->stats.retries++;
+        error = SD_Recover(sd);
+        if(error != SD_OK)
+            break;
     }
-    /*Send write data token*/
-    if(SD_SendToken(sd, SD_START_RMW_BLOCK_TOKEN) == SD_SPI_ERROR)
+    if(error == SD_ERROR)
     {
         SD_ErrorHandler(sd);
         return SD_ERROR;
     }
-    /*Write data block with CRC16*/
-    if(SD_WriteData(sd, data, sd->blockSize) != SD_OK)
+    SD_Deselect(sd);
+    return error;
+}
+
+/** \brief Read multiple blocks from SD card without buffer for all of them.
+  *         Every block is given to sink as soon as its CRC16 is checked
+  * \param  sd: pointer to SD card parameters structure
+  * \param  address: address of the first SD data block
+  * \param  num: number of blocks to read
+  * \param  sink: callback which gets blocks in order, returns 0 to stop reading
+  * \param  context: user pointer for sink
+  * \param  buffer: pointer to one or two block buffers
+  * \param  buffers: number of block buffers: 1 or 2, with 2 sink works while the next block is received
+  * \retval SD error number
+*/
+SD_Error_t SD_ReadMultipleBlockSink(SD_Parameters_t * sd, uint32_t address, uint32_t num, SD_BlockSink_t sink, void * context,
+                                    uint8_t * buffer, uint8_t buffers)
+{
+    SD_Error_t error = SD_OK;
+    uint8_t retries = SD_RETRIES;
+    uint32_t index = 0;
+    sd->readBlocks = 0;
+    if(!buffers)
+        buffers = 1;
+    else if(buffers > 2)
+        buffers = 2;
+    /*Card can be still busy with aborted write*/
+    if(SD_SelectAbortable(sd) != SD_OK)
+        return SD_ABORTED;
+    sd->state = SD_STATE_RECEIVE;
+    while(1)
+    {
+        uint32_t done = 0;
+        uint8_t stop = 0;
+        error = SD_TryReadBlocksSink(sd, address + index, num - index, index, sink, context, buffer, buffers, &done, &stop);
+        SD_LinkUpdate(sd, error, done);
+        /*Continue from the first block sink did not get*/
+        index += done;
+        sd->readBlocks = index;
+        if(done)
+            retries = SD_RETRIES;
+        if(stop || (error == SD_OK) || !SD_IsRecoverable(sd, error) || !retries)
+            break;
+        retries--;
+        sd->stats.retries++;
+        error = SD_Recover(sd);
+        if(error != SD_OK)
+            break;
+    }
+    if(error == SD_ERROR)
     {
-        SD_ReadStatus(sd);
         SD_ErrorHandler(sd);
         return SD_ERROR;
     }
-    /*Wait while busy state*/
-    if(SD_WaitForBusy(sd) != SD_OK)
+    SD_Deselect(sd);
+    return error;
+}
+
+/** \brief Write block of data to SD card
+  * \param  sd: pointer to SD card parameters structure
+  * \param  address: address of SD data block where to write
+  * \param  data: pointer to buffer from where we get data
+  * \retval SD error number. writtenBlocks member of sd struct is 1 if block is written
+*/
+SD_Error_t SD_WriteBlock(SD_Parameters_t * sd, uint32_t address, uint8_t * data)
+{
+    SD_Error_t error = SD_OK;
+    uint8_t retries = SD_RETRIES;
+    sd->writtenBlocks = 0;
+    SD_Select(sd);
+    sd->state = SD_STATE_SENDING;
+    while(1)
+    {
+        error = SD_TryWriteBlock(sd, address, data);
+        SD_LinkUpdate(sd, error, (error == SD_OK) ? 1 : 0);
+        if((error == SD_OK) || !SD_IsRecoverable(sd, error) || !retries)
+            break;
+        /*Card rejected data - write block again, maybe on lower clock*/
+        retries--;
+        sd->stats.retries++;
+        if(SD_Recover(sd) != SD_OK)
+        {
+            error = SD_ERROR;
+            break;
+        }
+    }
+    if(error == SD_ERROR)
     {
         SD_ErrorHandler(sd);
         return SD_ERROR;
     }
-    /*Read status after writing block*/
+    SD_Deselect(sd);
+    SD_WriteDelay(sd);
+    /*Read status after writing block, it keeps reason of write error*/
     if(SD_ReadStatus(sd) != SD_OK)
     {
         SD_ErrorHandler(sd);
         return SD_ERROR;
     }
-    sd->state = SD_STATE_STANDBY;
-    SD_SPI_CS_Set(sd->CS_Port, sd->CS_Pin);
+    if(error != SD_OK)
+        return error;
+    sd->writtenBlocks = 1;
     return SD_OK;
 }
 
@@ -748,82 +2227,356 @@ SD_Error_t SD_WriteBlock(SD_Parameters_t * sd, uint32_t address, uint8_t * data)
   * \param  address: address of SD data block where to write
   * \param  data: pointer to buffer where we get data
   * \param  num: number of blocks to write
-  * \retval SD error number
+  * \retval SD error number. writtenBlocks member of sd struct keeps number of blocks
+  *         confirmed by SD card, write can be continued with SD_ResumeMultipleBlock
 */
 SD_Error_t SD_WriteMultipleBlock(SD_Parameters_t * sd, uint32_t address, uint8_t * data, uint32_t num)
 {
-    SD_SPI_CS_Reset(sd->CS_Port, sd->CS_Pin);
+    SD_Error_t error = SD_OK;
+    uint8_t retries = SD_RETRIES;
+    sd->writtenBlocks = 0;
+    /*Card can be still busy with aborted write*/
+    if(SD_SelectAbortable(sd) != SD_OK)
+        return SD_ABORTED;
     sd->state = SD_STATE_SENDING;
-    /*SDSC has absolute address*/
-    if(sd->type == SD_TYPE_SDSC)
-        address *= sd->blockSize;
-    /*Send CMD25*/
-    if(SD_SendCMD(sd, SD_CMD_25, address, SD_R1_NORMAL_STATE) != SD_OK)
+    while(num)
     {
-        SD_ErrorHandler(sd);
-        return SD_ERROR;
+        uint32_t done = 0;
+        uint32_t accepted = 0;
+        error = SD_TryWriteBlocks(sd, address, data, num, &accepted);
+        if(error == SD_OK)
+            done = num;
+        /*Every accepted block is programmed before abort*/
+        else if(error == SD_ABORTED)
+            done = accepted;
+        /*Ask card how many accepted blocks are programmed, if card does not answer - write them again*/
+        else if((error != SD_ERROR) && accepted && (SD_TryGetWrittenBlocks(sd, &done) == SD_ERROR))
+            error = SD_ERROR;
+        if(done > accepted)
+            done = accepted;
+        SD_LinkUpdate(sd, error, done);
+        /*Continue from the first unconfirmed block*/
+        sd->writtenBlocks += done;
+        address += done;
+        data += done * sd->blockSize;
+        num -= done;
+        if(done)
+            retries = SD_RETRIES;
+        if((error == SD_OK) || !SD_IsRecoverable(sd, error) || !retries)
+            break;
+        retries--;
+        sd->stats.retries++;
+        error = SD_Recover(sd);
+        if(error != SD_OK)
+            break;
     }
-    /*Send dummy byte*/
-    if(SD_SendDummyByte(sd, 1) != SD_OK)
+    /*Card is torn down only when it does not answer*/
+    if(error == SD_ERROR)
     {
         SD_ErrorHandler(sd);
         return SD_ERROR;
     }
-    while(num--)
+    /*Card is left busy after abort, status is read by the next transfer*/
+    if(error == SD_ABORTED)
     {
-        SD_Error_t error = SD_OK;
-        /*Send multiple write token*/
-        if(SD_SendToken(sd, SD_START_WM_BLOCK_TOKEN) != SD_OK)
-        {
-            SD_ErrorHandler(sd);
-            return SD_ERROR;
-        }
-        /*Write data with CRC16*/
-        error = SD_WriteData(sd, data, sd->blockSize);
-        if(error == SD_ERROR)
-        {
-            SD_ErrorHandler(sd);
-            return SD_ERROR;
-        }
-        /*if write error or crc error occurred - get number of written blocks*/
-        else if((error == SD_CRC_ERROR) || (error == SD_WRITE_ERROR))
-        {
-            SD_StopTransfer(sd);
-            SD_GetWrittenBlocks(sd);
-            SD_ErrorHandler(sd);
-            return SD_ERROR;
-        }
-        data += sd->blockSize;
+        SD_Deselect(sd);
+        return SD_ABORTED;
     }
-    /*Send stop transmission token*/
-    if(SD_SendToken(sd, SD_STOP_WE_BLOCK_TOKEN) != SD_OK)
+    SD_Deselect(sd);
+    SD_WriteDelay(sd);
+    /*Read status*/
+    if(SD_ReadStatus(sd) != SD_OK)
     {
         SD_ErrorHandler(sd);
         return SD_ERROR;
     }
-    /*Send dummy byte*/
-    if(SD_SendDummyByte(sd, 1) != SD_OK)
+    /*All blocks confirmed, error was at the end of transfer*/
+    if(!num)
+        return SD_OK;
+    return error;
+}
+
+/** \brief Write multiple blocks to SD card from producer callback through one block buffer
+  * \param  sd: pointer to SD card parameters structure
+  * \param  address: address of the first SD data block
+  * \param  num: number of blocks to write
+  * \param  source: callback which fills blocks in order while card is busy, returns 0 to stop writing
+  * \param  context: user pointer for source
+  * \param  buffer: pointer to block buffer
+  * \retval SD error number. writtenBlocks member of sd struct keeps number of blocks
+  *         confirmed by SD card, producer is asked again from this block after error
+*/
+SD_Error_t SD_WriteMultipleBlockSource(SD_Parameters_t * sd, uint32_t address, uint32_t num, SD_BlockSource_t source, void * context,
+                                       uint8_t * buffer)
+{
+    SD_Error_t error = SD_OK;
+    uint8_t retries = SD_RETRIES;
+    uint8_t filled = 0;
+    sd->writtenBlocks = 0;
+    /*Card can be still busy with aborted write*/
+    if(SD_SelectAbortable(sd) != SD_OK)
+        return SD_ABORTED;
+    sd->state = SD_STATE_SENDING;
+    while(sd->writtenBlocks < num)
     {
-        SD_ErrorHandler(sd);
-        return SD_ERROR;
+        uint32_t done = 0;
+        uint32_t accepted = 0;
+        error = SD_TryWriteBlocksSource(sd, address + sd->writtenBlocks, num - sd->writtenBlocks, sd->writtenBlocks,
+                                        source, context, buffer, &filled, &accepted);
+        if((error == SD_OK) || (error == SD_ABORTED))
+            done = accepted;
+        /*Ask card how many accepted blocks are programmed*/
+        else if((error != SD_ERROR) && accepted && (SD_TryGetWrittenBlocks(sd, &done) == SD_ERROR))
+            error = SD_ERROR;
+        if(done > accepted)
+            done = accepted;
+        SD_LinkUpdate(sd, error, done);
+        sd->writtenBlocks += done;
+        if(done)
+            retries = SD_RETRIES;
+        /*Write is done or stopped by producer*/
+        if((error == SD_OK) || !SD_IsRecoverable(sd, error) || !retries)
+            break;
+        /*Only the failed block is kept in buffer, earlier unconfirmed blocks can not be written again*/
+        if(done < accepted)
+            break;
+        retries--;
+        sd->stats.retries++;
+        error = SD_Recover(sd);
+        if(error != SD_OK)
+            break;
     }
-    /*Weit while card is busy*/
-    if(SD_WaitForBusy(sd) != SD_OK)
+    /*Card is torn down only when it does not answer*/
+    if(error == SD_ERROR)
     {
         SD_ErrorHandler(sd);
         return SD_ERROR;
     }
-    sd->state = SD_STATE_STANDBY;
-    SD_SPI_CS_Set(sd->CS_Port, sd->CS_Pin);
+    /*Card is left busy after abort, status is read by the next transfer*/
+    if(error == SD_ABORTED)
+    {
+        SD_Deselect(sd);
+        return SD_ABORTED;
+    }
+    SD_Deselect(sd);
+    SD_WriteDelay(sd);
     /*Read status*/
     if(SD_ReadStatus(sd) != SD_OK)
     {
         SD_ErrorHandler(sd);
         return SD_ERROR;
     }
+    return error;
+}
+
+/** \brief Write blocks to several SD cards on one SPIx. Busy card is deselected and bus goes to
+  *         other cards until it is ready, so cards program blocks in parallel
+  * \param  jobs: array of write jobs, one job for every SD card
+  * \param  num: number of jobs
+  * \retval SD error number, the first error of jobs. Result of every job is in its error member,
+  *         writtenBlocks member of sd struct keeps number of blocks confirmed by SD card
+*/
+SD_Error_t SD_WriteInterleaved(SD_BusJob_t * jobs, uint32_t num)
+{
+    SD_Error_t error = SD_OK;
+    uint32_t active = num;
+    for(uint32_t i = 0; i < num; ++i)
+    {
+        jobs[i].state = SD_JOB_START;
+        jobs[i].error = SD_OK;
+        jobs[i].accepted = 0;
+        jobs[i].sd->writtenBlocks = 0;
+        jobs[i].sd->state = SD_STATE_SENDING;
+    }
+    while(active)
+    {
+        for(uint32_t i = 0; i < num; ++i)
+        {
+            SD_BusJob_t * job = &jobs[i];
+            SD_JobState_t last;
+            if(job->state == SD_JOB_DONE)
+                continue;
+            SD_Select(job->sd);
+            /*Ready card gets its next block at once*/
+            do
+            {
+                last = job->state;
+                SD_BusJobStep(job);
+            }while((job->state == SD_JOB_DATA) && (last != SD_JOB_DATA));
+            /*Release bus, card keeps programming without CS and drives busy again when selected*/
+            SD_SPI_CS_Set(job->sd->CS_Port, job->sd->CS_Pin);
+            if(SD_SendDummyByte(job->sd, 1) != SD_OK)
+            {
+                job->error = SD_ERROR;
+                job->state = SD_JOB_DONE;
+            }
+            if(job->state == SD_JOB_DONE)
+            {
+                SD_BusJobFinish(job);
+                active--;
+                if(error == SD_OK)
+                    error = job->error;
+            }
+        }
+    }
+    return error;
+}
+
+/** \brief Read multiple blocks from SD card until deadline
+  * \param  sd: pointer to SD card parameters structure
+  * \param  address: address of the first SD data block
+  * \param  data: pointer to buffer where to put data
+  * \param  num: number of blocks to read
+  * \param  deadline: DWT cycle number, read stops at the next block boundary or in wait for card after it
+  * \retval SD error number, SD_ABORTED if deadline is passed. readBlocks member of sd struct
+  *         keeps number of blocks read
+*/
+SD_Error_t SD_ReadMultipleBlockUntil(SD_Parameters_t * sd, uint32_t address, uint8_t * data, uint32_t num, uint32_t deadline)
+{
+    SD_Error_t error = SD_OK;
+    sd->deadline = deadline;
+    sd->useDeadline = 1;
+    error = SD_ReadMultipleBlock(sd, address, data, num);
+    sd->useDeadline = 0;
+    return error;
+}
+
+/** \brief Write multiple blocks to SD card until deadline
+  * \param  sd: pointer to SD card parameters structure
+  * \param  address: address of the first SD data block
+  * \param  data: pointer to buffer from where we get data
+  * \param  num: number of blocks to write
+  * \param  deadline: DWT cycle number, write stops at the next block boundary or in wait for busy card after it
+  * \retval SD error number, SD_ABORTED if deadline is passed. writtenBlocks member of sd struct
+  *         keeps number of blocks written, continue with SD_ResumeMultipleBlock
+*/
+SD_Error_t SD_WriteMultipleBlockUntil(SD_Parameters_t * sd, uint32_t address, uint8_t * data, uint32_t num, uint32_t deadline)
+{
+    SD_Error_t error = SD_OK;
+    sd->deadline = deadline;
+    sd->useDeadline = 1;
+    error = SD_WriteMultipleBlock(sd, address, data, num);
+    sd->useDeadline = 0;
+    return error;
+}
+
+/** \brief Stop running multiple transfer of SD card at the next block boundary or in wait for card.
+  *         Transfer returns SD_ABORTED. Request applies only to transfer in flight, it is dropped
+  *         when no multiple transfer runs and when transfer ends
+  * \param  sd: pointer to SD card parameters structure
+  * \retval None
+*/
+void SD_Cancel(SD_Parameters_t * sd)
+{
+    if(sd->abortable)
+        sd->cancel = 1;
+}
+
+/** \brief Continue multiple blocks write from the first unconfirmed block
+  * \param  sd: pointer to SD card parameters structure
+  * \param  address: address of SD data block given to failed write
+  * \param  data: pointer to buffer given to failed write
+  * \param  num: number of blocks given to failed write
+  * \retval SD error number. writtenBlocks member of sd struct keeps number of blocks
+  *         confirmed by both writes
+*/
+SD_Error_t SD_ResumeMultipleBlock(SD_Parameters_t * sd, uint32_t address, uint8_t * data, uint32_t num)
+{
+    SD_Error_t error = SD_OK;
+    uint32_t written = sd->writtenBlocks;
+    if(written > num)
+        written = num;
+    error = SD_WriteMultipleBlock(sd, address + written, data + written * sd->blockSize, num - written);
+    sd->writtenBlocks += written;
+    return error;
+}
+
+/** \brief Erase range of blocks with one erase command and wait until card is ready
+  * \param  sd: pointer to SD card parameters structure
+  * \param  address: address of the first SD data block
+  * \param  num: number of blocks
+  * \retval SD error number
+*/
+static SD_Error_t SD_TryErase(SD_Parameters_t * sd, uint32_t address, uint32_t num)
+{
+    SD_Error_t error = SD_OK;
+    uint8_t busy = 0;
+    uint32_t aus = (num + sd->auBlocks - 1) / sd->auBlocks;
+    uint32_t timeout = sd->eraseOffset + aus * sd->eraseTimeout;
+    if(timeout < sd->writeTimeout)
+        timeout = sd->writeTimeout;
+    error = SD_SendCMD(sd, SD_CMD_32, SD_BlockAddress(sd, address), SD_R1_NORMAL_STATE);
+    if(error != SD_OK)
+        return error;
+    error = SD_SendCMD(sd, SD_CMD_33, SD_BlockAddress(sd, address + num - 1), SD_R1_NORMAL_STATE);
+    if(error != SD_OK)
+        return error;
+    error = SD_SendCMD(sd, SD_CMD_38, 0, SD_R1_NORMAL_STATE);
+    if(error != SD_OK)
+        return error;
+    /*R1b response, card keeps MISO low while erasing*/
+    uint32_t timestamp = DWT_GetCycle();
+    uint32_t window = (timeout > SD_ERASE_TIMEOUT_MAX) ? SD_ERASE_TIMEOUT_MAX : timeout;
+    while(busy != 0xFF)
+    {
+        if(SD_SPI_Receive8Data(sd->SPIx, &busy, 1) == SD_SPI_ERROR)
+            return SD_ERROR;
+        if((busy != 0xFF) && DWT_TimeoutUs(window, timestamp))
+        {
+            /*Timeout longer than DWT counter range is waited in several windows*/
+            timeout -= window;
+            if(!timeout)
+                return SD_ERROR;
+            window = (timeout > SD_ERASE_TIMEOUT_MAX) ? SD_ERASE_TIMEOUT_MAX : timeout;
+            timestamp = DWT_GetCycle();
+        }
+    }
     return SD_OK;
 }
 
+/** \brief Erase blocks. Range is split in parts of whole allocation units whose
+  *         erase timeout from SD status fits SD_ERASE_TIMEOUT_MAX, part of one allocation unit
+  *         can take longer and its busy time is polled in several DWT windows
+  * \param  sd: pointer to SD card parameters structure
+  * \param  address: address of the first SD data block
+  * \param  num: number of blocks
+  * \retval SD error number. Erased blocks read as all zeros or all ones, see SCR
+*/
+SD_Error_t SD_Erase(SD_Parameters_t * sd, uint32_t address, uint32_t num)
+{
+    SD_Error_t error = SD_OK;
+    uint32_t part = SD_ERASE_TIMEOUT_MAX;
+    if(!num)
+        return SD_OK;
+    /*Number of allocation units in one erase command*/
+    if(sd->eraseTimeout)
+        part = (sd->eraseOffset < SD_ERASE_TIMEOUT_MAX) ? (SD_ERASE_TIMEOUT_MAX - sd->eraseOffset) / sd->eraseTimeout : 0;
+    if(!part)
+        part = 1;
+    part = (part > 0xFFFFFFFF / sd->auBlocks) ? 0xFFFFFFFF : part * sd->auBlocks;
+    SD_Select(sd);
+    sd->state = SD_STATE_SENDING;
+    while(num)
+    {
+        /*Parts end on allocation unit boundary*/
+        uint32_t len = part - (address % sd->auBlocks);
+        if(len > num)
+            len = num;
+        error = SD_TryErase(sd, address, len);
+        if(error != SD_OK)
+            break;
+        address += len;
+        num -= len;
+    }
+    if(error == SD_ERROR)
+    {
+        SD_ErrorHandler(sd);
+        return SD_ERROR;
+    }
+    SD_Deselect(sd);
+    return error;
+}
+
 /** \brief Parse raw OCR to OCR struct
   * \param  sd: pointer to SD card parameters structure
   * \retval SD error number
@@ -959,3 +2712,52 @@ SD_CSDv2_t SD_GetCSD_v2(SD_Parameters_t * sd)
     CSD.CSDStructure = (sd->rawCSD[0] >> 6) & 0x3;
     return CSD;
 }
+
+/** \brief Parse raw SD status to SD status struct
+  * \param  sd: pointer to SD card parameters structure
+  * \retval SD status struct
+*/
+SD_SDStatus_t SD_GetSDStatus(SD_Parameters_t * sd)
+{
+    SD_SDStatus_t status;
+    status.busWidth = sd->rawSDStatus[0] >> 6;
+    status.securedMode = (sd->rawSDStatus[0] >> 5) & 0x1;
+    status.reserved = 0;
+    status.cardType = (sd->rawSDStatus[2] << 8) | sd->rawSDStatus[3];
+    status.protectedAreaSize = (sd->rawSDStatus[4] << 24) | (sd->rawSDStatus[5] << 16) | (sd->rawSDStatus[6] << 8) | sd->rawSDStatus[7];
+    status.speedClass = sd->rawSDStatus[8];
+    status.performanceMove = sd->rawSDStatus[9];
+    status.AUSize = sd->rawSDStatus[10] >> 4;
+    status.reserved1 = 0;
+    status.eraseSize = (sd->rawSDStatus[11] << 8) | sd->rawSDStatus[12];
+    status.eraseTimeout = sd->rawSDStatus[13] >> 2;
+    status.eraseOffset = sd->rawSDStatus[13] & 0x3;
+    status.UHSSpeedGrade = sd->rawSDStatus[14] >> 4;
+    status.UHSAUSize = sd->rawSDStatus[14] & 0xF;
+    status.videoSpeedClass = sd->rawSDStatus[15];
+    status.VSCAUSize = ((sd->rawSDStatus[16] & 0x3) << 8) | sd->rawSDStatus[17];
+    status.reserved2 = 0;
+    return status;
+}
+
+/** \brief Parse raw SCR to SCR struct
+  * \param  sd: pointer to SD card parameters structure
+  * \retval SCR struct
+*/
+SD_SCR_t SD_GetSCR(SD_Parameters_t * sd)
+{
+    SD_SCR_t SCR;
+    SCR.reserved = 0;
+    SCR.cmdSupport = sd->rawSCR[3] & 0xF;
+    SCR.reserved1 = 0;
+    SCR.specX = ((sd->rawSCR[2] & 0x3) << 2) | (sd->rawSCR[3] >> 6);
+    SCR.spec4 = (sd->rawSCR[2] >> 2) & 0x1;
+    SCR.exSecurity = (sd->rawSCR[2] >> 3) & 0xF;
+    SCR.spec3 = sd->rawSCR[2] >> 7;
+    SCR.busWidths = sd->rawSCR[1] & 0xF;
+    SCR.security = (sd->rawSCR[1] >> 4) & 0x7;
+    SCR.dataStatAfterErase = sd->rawSCR[1] >> 7;
+    SCR.spec = sd->rawSCR[0] & 0xF;
+    SCR.SCRStructure = sd->rawSCR[0] >> 4;
+    return SCR;
+}
@@ -0,0 +1,344 @@
+/*MIT License
+
+Copyright (c) 2019 DoHelloWorld
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.*/
+
+
+#include <string.h>
+#include "SDCard_Partition.h"
+#include "Utils.h"
+
+/*Block size of partition tables*/
+#define SD_PARTITION_BLOCK      512
+/*Offset of first MBR partition entry*/
+#define SD_MBR_ENTRIES          446
+/*MBR type of protective partition which covers GPT disk*/
+#define SD_MBR_TYPE_GPT         0xEE
+
+/*Get little-endian 16-bit value*/
+static uint16_t SD_PartitionLoad16(const uint8_t * p);
+/*Get little-endian 32-bit value*/
+static uint32_t SD_PartitionLoad32(const uint8_t * p);
+/*Check that range of blocks is inside partition*/
+static uint8_t SD_PartitionInRange(SD_Partition_t * part, uint32_t address, uint32_t num);
+/*Check if MBR type is extended partition*/
+static uint8_t SD_PartitionIsExtended(uint8_t type);
+/*Add found partition to list*/
+static void SD_PartitionAdd(SD_Parameters_t * sd, SD_Partition_t * parts, uint8_t maxParts, uint8_t * count,
+                            uint32_t start, uint32_t blocks, uint8_t type, const uint8_t * typeGUID);
+/*Read partitions from GPT with header in block headerBlock*/
+static SD_Error_t SD_PartitionReadGPT(SD_Parameters_t * sd, uint8_t * buffer, uint32_t headerBlock,
+                                      SD_Partition_t * parts, uint8_t maxParts, uint8_t * count);
+
+/** \brief Get little-endian 16-bit value
+  * \param  p: pointer to value
+  * \retval value
+*/
+static uint16_t SD_PartitionLoad16(const uint8_t * p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+/** \brief Get little-endian 32-bit value
+  * \param  p: pointer to value
+  * \retval value
+*/
+static uint32_t SD_PartitionLoad32(const uint8_t * p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/** \brief Check that range of blocks is inside partition, wrong range is counted in statistics
+  * \param  part: pointer to partition structure
+  * \param  address: first block inside partition
+  * \param  num: number of blocks
+  * \retval 1 if range is inside partition, 0 if not
+*/
+static uint8_t SD_PartitionInRange(SD_Partition_t * part, uint32_t address, uint32_t num)
+{
+    if((address < part->blocks) && (num <= part->blocks - address))
+        return 1;
+    part->stats.rangeErrors++;
+    return 0;
+}
+
+/** \brief Check if MBR type is extended partition
+  * \param  type: MBR partition type
+  * \retval 1 if extended partition, 0 if not
+*/
+static uint8_t SD_PartitionIsExtended(uint8_t type)
+{
+    return (type == 0x05) || (type == 0x0F) || (type == 0x85);
+}
+
+/** \brief Add found partition to list, partitions which do not fit are counted only
+  * \param  sd: pointer to SD card parameters structure
+  * \param  parts: partition list
+  * \param  maxParts: size of partition list
+  * \param  count: number of found partitions, increased by one
+  * \param  start: first SD data block of partition
+  * \param  blocks: partition size in blocks
+  * \param  type: MBR partition type
+  * \param  typeGUID: GPT partition type GUID, NULL for MBR partitions
+  * \retval None
+*/
+static void SD_PartitionAdd(SD_Parameters_t * sd, SD_Partition_t * parts, uint8_t maxParts, uint8_t * count,
+                            uint32_t start, uint32_t blocks, uint8_t type, const uint8_t * typeGUID)
+{
+    if(*count < maxParts)
+    {
+        SD_Partition_t * part = &parts[*count];
+        SD_PartitionInit(part, sd, start, blocks);
+        part->type = type;
+        if(typeGUID)
+            memcpy(part->typeGUID, typeGUID, sizeof(part->typeGUID));
+    }
+    (*count)++;
+}
+
+/** \brief Read partitions from GPT, header and entry array are checked with CRC32
+  * \param  sd: pointer to SD card parameters structure
+  * \param  buffer: pointer to buffer for 1 block
+  * \param  headerBlock: SD data block with GPT header
+  * \param  parts: partition list
+  * \param  maxParts: size of partition list
+  * \param  count: number of found partitions
+  * \retval SD error number, SD_CRC_ERROR if header or entries are damaged
+*/
+static SD_Error_t SD_PartitionReadGPT(SD_Parameters_t * sd, uint8_t * buffer, uint32_t headerBlock,
+                                      SD_Partition_t * parts, uint8_t maxParts, uint8_t * count)
+{
+    uint32_t cardBlocks = (uint32_t)(sd->capacity / SD_PARTITION_BLOCK);
+    SD_Error_t error = SD_ReadBlock(sd, headerBlock, buffer);
+    if(error != SD_OK)
+        return error;
+    uint32_t headerSize = SD_PartitionLoad32(buffer + 12);
+    if(memcmp(buffer, "EFI PART", 8) || (headerSize < 92) || (headerSize > SD_PARTITION_BLOCK))
+        return SD_CRC_ERROR;
+    uint32_t headerCRC = SD_PartitionLoad32(buffer + 16);
+    memset(buffer + 16, 0, 4);
+    if(CRC32_Update(0, buffer, headerSize) != headerCRC)
+        return SD_CRC_ERROR;
+    /*SD cards are addressed with 32-bit block numbers*/
+    uint32_t entryBlock = SD_PartitionLoad32(buffer + 72);
+    uint32_t entries = SD_PartitionLoad32(buffer + 80);
+    uint32_t entrySize = SD_PartitionLoad32(buffer + 84);
+    uint32_t entriesCRC = SD_PartitionLoad32(buffer + 88);
+    if(SD_PartitionLoad32(buffer + 76) || (entries > SD_PARTITION_GPT_MAX_ENTRIES) || (entrySize < 128) ||
+       (entrySize > SD_PARTITION_BLOCK) || (SD_PARTITION_BLOCK % entrySize))
+        return SD_CRC_ERROR;
+    uint32_t crc = 0;
+    uint8_t found = 0;
+    for(uint32_t i = 0; i < entries; ++i)
+    {
+        uint32_t offset = (i * entrySize) % SD_PARTITION_BLOCK;
+        if(!offset)
+        {
+            error = SD_ReadBlock(sd, entryBlock + (i * entrySize) / SD_PARTITION_BLOCK, buffer);
+            if(error != SD_OK)
+                return error;
+        }
+        uint8_t * entry = buffer + offset;
+        crc = CRC32_Update(crc, entry, entrySize);
+        uint8_t used = 0;
+        for(uint8_t j = 0; j < 16; ++j)
+            used |= entry[j];
+        uint32_t first = SD_PartitionLoad32(entry + 32);
+        uint32_t last = SD_PartitionLoad32(entry + 40);
+        /*Partitions above 2 TiB can not be addressed*/
+        if(!used || SD_PartitionLoad32(entry + 36) || SD_PartitionLoad32(entry + 44) || (last < first) ||
+           (last >= cardBlocks))
+            continue;
+        SD_PartitionAdd(sd, parts, maxParts, &found, first, last - first + 1, SD_MBR_TYPE_GPT, entry);
+    }
+    if(crc != entriesCRC)
+        return SD_CRC_ERROR;
+    *count = found;
+    return SD_OK;
+}
+
+/** \brief Find partitions of SD card. MBR primary partitions and GPT partitions are supported,
+  *        backup GPT is used when primary one is damaged. Card without partition table
+  *        (volume starts at block 0) is returned as one partition of type 0
+  * \param  sd: pointer to initialized SD card parameters structure
+  * \param  buffer: pointer to buffer for 1 block
+  * \param  parts: partition list
+  * \param  maxParts: size of partition list
+  * \param  count: number of found partitions, it can be bigger than maxParts
+  * \retval SD error number, SD_CRC_ERROR if both GPT copies are damaged
+*/
+SD_Error_t SD_PartitionScan(SD_Parameters_t * sd, uint8_t * buffer, SD_Partition_t * parts, uint8_t maxParts, uint8_t * count)
+{
+    uint32_t cardBlocks = (uint32_t)(sd->capacity / SD_PARTITION_BLOCK);
+    uint8_t isGPT = 0;
+    *count = 0;
+    SD_Error_t error = SD_ReadBlock(sd, 0, buffer);
+    if(error != SD_OK)
+        return error;
+    if(SD_PartitionLoad16(buffer + 510) == 0xAA55)
+    {
+        for(uint8_t i = 0; i < 4; ++i)
+        {
+            uint8_t * entry = buffer + SD_MBR_ENTRIES + i * 16;
+            uint8_t type = entry[4];
+            uint32_t start = SD_PartitionLoad32(entry + 8);
+            uint32_t blocks = SD_PartitionLoad32(entry + 12);
+            /*Boot sector of volume without MBR has no valid status bytes here*/
+            if((entry[0] != 0x00) && (entry[0] != 0x80))
+            {
+                *count = 0;
+                isGPT = 0;
+                break;
+            }
+            if(type == SD_MBR_TYPE_GPT)
+                isGPT = 1;
+            if(!type || SD_PartitionIsExtended(type) || !start || !blocks || (start >= cardBlocks) ||
+               (blocks > cardBlocks - start))
+                continue;
+            SD_PartitionAdd(sd, parts, maxParts, count, start, blocks, type, 0);
+        }
+    }
+    if(isGPT)
+    {
+        error = SD_PartitionReadGPT(sd, buffer, 1, parts, maxParts, count);
+        if(error != SD_CRC_ERROR)
+            return error;
+        /*Primary header can not be trusted, backup header is in the last block of card*/
+        return SD_PartitionReadGPT(sd, buffer, cardBlocks - 1, parts, maxParts, count);
+    }
+    if(!*count)
+    {
+        if(maxParts)
+            SD_PartitionInit(&parts[0], sd, 0, cardBlocks);
+        *count = 1;
+    }
+    return SD_OK;
+}
+
+/** \brief Make partition from range of SD data blocks. Partition takes allocation unit of card
+  *        and write-back cache policy, they can be changed after init
+  * \param  part: pointer to partition structure
+  * \param  sd: pointer to initialized SD card parameters structure
+  * \param  start: first SD data block of partition
+  * \param  blocks: partition size in blocks
+  * \retval None
+*/
+void SD_PartitionInit(SD_Partition_t * part, SD_Parameters_t * sd, uint32_t start, uint32_t blocks)
+{
+    part->sd = sd;
+    part->start = start;
+    part->blocks = blocks;
+    part->type = 0;
+    memset(part->typeGUID, 0, sizeof(part->typeGUID));
+    part->auBlocks = sd->auBlocks;
+    part->cache = SD_PARTITION_WRITE_BACK;
+    SD_PartitionResetStats(part);
+}
+
+/** \brief Clear partition statistics
+  * \param  part: pointer to partition structure
+  * \retval None
+*/
+void SD_PartitionResetStats(SD_Partition_t * part)
+{
+    memset(&part->stats, 0, sizeof(part->stats));
+}
+
+/** \brief Read blocks of partition, several blocks are read with one multiple read
+  * \param  part: pointer to partition structure
+  * \param  address: first block inside partition
+  * \param  data: pointer to buffer for data
+  * \param  num: number of blocks
+  * \retval SD error number, SD_OUT_OF_RANGE if blocks are outside of partition
+*/
+SD_Error_t SD_PartitionRead(SD_Partition_t * part, uint32_t address, uint8_t * data, uint32_t num)
+{
+    SD_Error_t error = SD_OK;
+    if(!num)
+        return SD_OK;
+    if(!SD_PartitionInRange(part, address, num))
+        return SD_OUT_OF_RANGE;
+    part->stats.reads++;
+    if(num == 1)
+    {
+        error = SD_ReadBlock(part->sd, part->start + address, data);
+        part->stats.blocksRead += (error == SD_OK) ? 1 : 0;
+    }
+    else
+    {
+        error = SD_ReadMultipleBlock(part->sd, part->start + address, data, num);
+        part->stats.blocksRead += part->sd->readBlocks;
+    }
+    if(error != SD_OK)
+        part->stats.errors++;
+    return error;
+}
+
+/** \brief Write blocks of partition, several blocks are written with one multiple write
+  * \param  part: pointer to partition structure
+  * \param  address: first block inside partition
+  * \param  data: pointer to data
+  * \param  num: number of blocks
+  * \retval SD error number, SD_OUT_OF_RANGE if blocks are outside of partition
+*/
+SD_Error_t SD_PartitionWrite(SD_Partition_t * part, uint32_t address, uint8_t * data, uint32_t num)
+{
+    SD_Error_t error = SD_OK;
+    if(!num)
+        return SD_OK;
+    if(!SD_PartitionInRange(part, address, num))
+        return SD_OUT_OF_RANGE;
+    part->stats.writes++;
+    if(num == 1)
+    {
+        error = SD_WriteBlock(part->sd, part->start + address, data);
+        part->stats.blocksWritten += (error == SD_OK) ? 1 : 0;
+    }
+    else
+    {
+        error = SD_WriteMultipleBlock(part->sd, part->start + address, data, num);
+        part->stats.blocksWritten += part->sd->writtenBlocks;
+    }
+    if(error != SD_OK)
+        part->stats.errors++;
+    return error;
+}
+
+/** \brief Erase blocks of partition
+  * \param  part: pointer to partition structure
+  * \param  address: first block inside partition
+  * \param  num: number of blocks
+  * \retval SD error number, SD_OUT_OF_RANGE if blocks are outside of partition
+*/
+SD_Error_t SD_PartitionErase(SD_Partition_t * part, uint32_t address, uint32_t num)
+{
+    SD_Error_t error = SD_OK;
+    if(!num)
+        return SD_OK;
+    if(!SD_PartitionInRange(part, address, num))
+        return SD_OUT_OF_RANGE;
+    part->stats.erases++;
+    error = SD_Erase(part->sd, part->start + address, num);
+    if(error == SD_OK)
+        part->stats.blocksErased += num;
+    else
+        part->stats.errors++;
+    return error;
+}
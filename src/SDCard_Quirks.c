@@ -0,0 +1,79 @@
+/*MIT License
+
+Copyright (c) 2019 DoHelloWorld
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.*/
+
+
+#include <stddef.h>
+#include "SDCard_Quirks.h"
+
+/*Profiles are added at compile time, e.g. in project settings or before this file is compiled:
+    #define SD_USER_PROFILES {"Slow card", 0x27, "PH", "SD08G", 0, 12000000, 0, 0, 0, 0, 1000},
+*/
+#ifndef SD_USER_PROFILES
+#define SD_USER_PROFILES
+#endif
+
+/*Profile table, the first matching profile is used*/
+static const SD_Profile_t SD_Profiles[] =
+{
+    SD_USER_PROFILES
+    /*End of table*/
+    {NULL}
+};
+
+/*Check if text field of profile matches CID*/
+static uint8_t SD_MatchText(const char * pattern, const uint8_t * field, uint32_t len);
+
+/** \brief Check if text field of profile matches CID
+  * \param  pattern: text field of profile, zero characters match any
+  * \param  field: text field of CID
+  * \param  len: length of field
+  * \retval 1 if field matches, 0 if not
+*/
+static uint8_t SD_MatchText(const char * pattern, const uint8_t * field, uint32_t len)
+{
+    for(uint32_t i = 0; i < len; ++i)
+    {
+        if(pattern[i] && ((uint8_t)pattern[i] != field[i]))
+            return 0;
+    }
+    return 1;
+}
+
+/** \brief Find profile for SD card
+  * \param  rawCID: pointer to raw CID register
+  * \retval pointer to profile, NULL if no profile matches
+*/
+const SD_Profile_t * SD_FindProfile(const uint8_t * rawCID)
+{
+    for(const SD_Profile_t * profile = SD_Profiles; profile->name; ++profile)
+    {
+        /*CID: MID - byte 0, OID - bytes 1..2, PNM - bytes 3..7, PRV - byte 8*/
+        if(profile->MID && (profile->MID != rawCID[0]))
+            continue;
+        if(!SD_MatchText(profile->OID, &rawCID[1], 2) || !SD_MatchText(profile->PNM, &rawCID[3], 5))
+            continue;
+        if(profile->PRV && (profile->PRV != rawCID[8]))
+            continue;
+        return profile;
+    }
+    return NULL;
+}
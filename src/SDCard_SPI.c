@@ -23,7 +23,7 @@ SOFTWARE.*/
 #include "SDCard_SPI.h"
 #include "Utils.h"
 
-#define SD_SPI_TIMEOUT      100     /**< SPI timeout in milliseconds */
+#define SD_SPI_TIMEOUT      1       /**< SPI timeout in milliseconds, one byte takes < 60 us at init clock */
 #define SD_SPI_CRC16_POL    0x1021  /**< Polynomial for CRC-16-CCITT */
 
 /// Specifies SPI working mode
@@ -41,10 +41,30 @@ static void SD_SPI_CRC_Cmd(SPI_TypeDef * SPIx, uint16_t polynomial, FunctionalSt
 static void SD_SPI_CRC_Reset(SPI_TypeDef * SPIx);
 static SD_SPI_Status_t SD_SPI_CRC_Check(SPI_TypeDef * SPIx);
 
+/*Receive CRC16 after data block and check it*/
+static SD_SPI_Status_t SD_SPI_Receive16CRC(SPI_TypeDef * SPIx);
+
 /*RCC configuration functions*/
 static void SD_SPI_SetSPI_RCC(SPI_TypeDef * SPIx);
 static void SD_SPI_SetGPIO_RCC(GPIO_TypeDef * GPIOx);
 
+#ifdef SD_SPI_DMA
+/// DMA channels which serve SPIx
+typedef struct
+{
+    DMA_TypeDef * DMAx;             ///< DMA controller
+    DMA_Channel_TypeDef * rx;       ///< Receive channel
+    DMA_Channel_TypeDef * tx;       ///< Transmit channel
+    uint8_t rxShift;                ///< Position of receive channel flags in ISR and IFCR registers
+    uint8_t txShift;                ///< Position of transmit channel flags in ISR and IFCR registers
+}SD_SPI_DMA_t;
+
+/*Get DMA channels for SPIx and enable DMA clock*/
+static void SD_SPI_GetDMA(SPI_TypeDef * SPIx, SD_SPI_DMA_t * dma);
+/*Stop DMA channels and DMA requests of SPIx*/
+static void SD_SPI_StopDMA(SPI_TypeDef * SPIx, SD_SPI_DMA_t * dma);
+#endif
+
 /** \brief Configure transfer data size for SPIx
   * \param  SPIx: where x can be 1, 2 or 3 to select the SPI peripheral.
   * \param  bitnum: specifies the transfer data size.
@@ -120,15 +140,97 @@ static void SD_SPI_CRC_Reset(SPI_TypeDef * SPIx)
 
 /** \brief Checks CRC16 validity for received data.
   * \param  SPIx: where x can be 1, 2 or 3 to select the SPI peripheral.
-  * \retval None
+  * \retval SD_SPI_CRC_ERROR if received CRC16 is wrong
 */
 static SD_SPI_Status_t SD_SPI_CRC_Check(SPI_TypeDef * SPIx)
 {
     if(SPIx->RXCRCR != 0)
-        return SD_SPI_ERROR;
+        return SD_SPI_CRC_ERROR;
     return SD_SPI_OK;
 }
 
+/** \brief Receive CRC16 after data block and check it.
+  * \param  SPIx: where x can be 1, 2 or 3 to select the SPI peripheral.
+  * \retval SPIx state, SD_SPI_CRC_ERROR if received CRC16 is wrong
+*/
+static SD_SPI_Status_t SD_SPI_Receive16CRC(SPI_TypeDef * SPIx)
+{
+    uint32_t timestamp = DWT_GetCycle();
+    while(!(SPIx->SR & SPI_SR_TXE))
+    {
+        if(DWT_Timeout(SD_SPI_TIMEOUT, timestamp))
+            return SD_SPI_ERROR;
+    }
+    /*Send 16 clocks on SCK line*/
+    SPIx->DR = 0xFFFF;
+    timestamp = DWT_GetCycle();
+    while(!(SPIx->SR & SPI_SR_RXNE))
+    {
+        if(DWT_Timeout(SD_SPI_TIMEOUT, timestamp))
+            return SD_SPI_ERROR;
+    }
+    /*Clear receive FIFO*/
+    SPIx->DR;
+    while((SPIx->SR & SPI_SR_BSY))
+    {
+        if(DWT_Timeout(SD_SPI_TIMEOUT, timestamp))
+            return SD_SPI_ERROR;
+    }
+    /*Check for received crc validation*/
+    return SD_SPI_CRC_Check(SPIx);
+}
+
+#ifdef SD_SPI_DMA
+/** \brief Get DMA channels for SPIx and enable DMA clock.
+  * \param  SPIx: where x can be 1, 2 or 3 to select the SPI peripheral.
+  * \param  dma: pointer to structure where to put DMA channels
+  * \retval None
+*/
+static void SD_SPI_GetDMA(SPI_TypeDef * SPIx, SD_SPI_DMA_t * dma)
+{
+    /*SPI1: DMA1 channels 2/3, SPI2: DMA1 channels 4/5, SPI3: DMA2 channels 1/2*/
+    if(SPIx == SPI1)
+    {
+        RCC->AHBENR |= RCC_AHBENR_DMA1EN;
+        dma->DMAx = DMA1;
+        dma->rx = DMA1_Channel2;
+        dma->tx = DMA1_Channel3;
+        dma->rxShift = 4;
+    }
+    else if(SPIx == SPI2)
+    {
+        RCC->AHBENR |= RCC_AHBENR_DMA1EN;
+        dma->DMAx = DMA1;
+        dma->rx = DMA1_Channel4;
+        dma->tx = DMA1_Channel5;
+        dma->rxShift = 12;
+    }
+    else
+    {
+        RCC->AHBENR |= RCC_AHBENR_DMA2EN;
+        dma->DMAx = DMA2;
+        dma->rx = DMA2_Channel1;
+        dma->tx = DMA2_Channel2;
+        dma->rxShift = 0;
+    }
+    /*Transmit channel always follows receive channel*/
+    dma->txShift = dma->rxShift + 4;
+}
+
+/** \brief Stop DMA channels and DMA requests of SPIx.
+  * \param  SPIx: where x can be 1, 2 or 3 to select the SPI peripheral.
+  * \param  dma: pointer to structure with DMA channels
+  * \retval None
+*/
+static void SD_SPI_StopDMA(SPI_TypeDef * SPIx, SD_SPI_DMA_t * dma)
+{
+    dma->tx->CCR &= ~(DMA_CCR_EN);
+    dma->rx->CCR &= ~(DMA_CCR_EN);
+    SPIx->CR2 &= ~(SPI_CR2_RXDMAEN | SPI_CR2_TXDMAEN);
+    dma->DMAx->IFCR = (DMA_IFCR_CGIF1 << dma->rxShift) | (DMA_IFCR_CGIF1 << dma->txShift);
+}
+#endif
+
 /** \brief Enabled RCC for SPix.
   * \param  SPIx: where x can be 1, 2 or 3 to select the SPI peripheral.
   * \retval None
@@ -264,6 +366,41 @@ void SD_SPI_SetSpeed(SPI_TypeDef * SPIx, uint32_t clk, SD_SPI_Speed_t speed)
     }
 }
 
+/** \brief Set SPIx clock prescaler
+  * \param  SPIx: where x can be 1, 2 or 3 to select the SPI peripheral.
+  * \param  prescaler: divider of SPIx bus frequency from SD_SPI_Prescaler_t enum
+  * \retval None
+*/
+void SD_SPI_SetPrescaler(SPI_TypeDef * SPIx, SD_SPI_Prescaler_t prescaler)
+{
+    /*Baud rate should not be changed while SPIx is enabled*/
+    SPIx->CR1 &= ~(SPI_CR1_SPE);
+    SPIx->CR1 &= ~(SPI_CR1_BR);
+    SPIx->CR1 |= ((uint16_t)prescaler << 3) & SPI_CR1_BR;
+    SPIx->CR1 |= SPI_CR1_SPE;
+}
+
+/** \brief Get current SPIx clock prescaler
+  * \param  SPIx: where x can be 1, 2 or 3 to select the SPI peripheral.
+  * \retval prescaler from SD_SPI_Prescaler_t enum
+*/
+SD_SPI_Prescaler_t SD_SPI_GetPrescaler(SPI_TypeDef * SPIx)
+{
+    return (SD_SPI_Prescaler_t)((SPIx->CR1 & SPI_CR1_BR) >> 3);
+}
+
+/** \brief Get the fastest SPIx clock prescaler for clock limit
+  * \param  clk: current SPIx bus frequency.
+  * \param  maxClk: highest allowed SPIx clock.
+  * \retval prescaler from SD_SPI_Prescaler_t enum
+*/
+SD_SPI_Prescaler_t SD_SPI_GetPrescalerFor(uint32_t clk, uint32_t maxClk)
+{
+    SD_SPI_Prescaler_t prescaler = SD_SPI_PRESCALER_2;
+    while((prescaler < SD_SPI_PRESCALER_256) && ((clk >> (prescaler + 1)) > maxClk))
+        prescaler++;
+    return prescaler;
+}
 
 /** \brief Sends 8-bit data to slave
   * \param  SPIx: where x can be 1, 2 or 3 to select the SPI peripheral.
@@ -434,7 +571,7 @@ SD_SPI_Status_t SD_SPI_Send16Data(SPI_TypeDef * SPIx, uint16_t * data, uint32_t
   *   This parameter can be one of the following values:
   *     \arg ENABLE: CRC16 calculation is enabled.
   *     \arg DISABLE: CRC16 calculation is enabled.
-  * \retval SPIx state
+  * \retval SPIx state, SD_SPI_CRC_ERROR if received CRC16 is wrong
 */
 SD_SPI_Status_t SD_SPI_Receive16Data(SPI_TypeDef * SPIx, uint16_t * data, uint32_t len, FunctionalState crcState)
 {
@@ -469,7 +606,53 @@ SD_SPI_Status_t SD_SPI_Receive16Data(SPI_TypeDef * SPIx, uint16_t * data, uint32
     }
     /*If CRC16 is enabled get crc after data block*/
     if(crcState == ENABLE)
+        return SD_SPI_Receive16CRC(SPIx);
+    /*Wait while SPIx busy */
+    while((SPIx->SR & SPI_SR_BSY))
     {
+        if(DWT_Timeout(SD_SPI_TIMEOUT, timestamp))
+            return SD_SPI_ERROR;
+    }
+    return SD_SPI_OK;
+}
+
+/** \brief Start receiving 16-bit data block with CRC16 from slave.
+  *         With SD_SPI_DMA defined block is received by DMA in background,
+  *         otherwise it is received here. Data is kept in SPI frame order, see SD_SPI_Swap16Data.
+  * \param  SPIx: where x can be 1, 2 or 3 to select the SPI peripheral.
+  * \param  data: pointer to data buffer.
+  * \param  len: number of 16-bit words to receive
+  * \retval SPIx state
+*/
+SD_SPI_Status_t SD_SPI_StartReceive16Data(SPI_TypeDef * SPIx, uint16_t * data, uint32_t len)
+{
+    /*Configure SPIx to 16-bit transfer mode and start CRC16 calculation*/
+    SD_SPI_SetDataSize(SPIx, SD_SPI_16BIT);
+    SD_SPI_CRC_Cmd(SPIx, SD_SPI_CRC16_POL, ENABLE);
+#ifdef SD_SPI_DMA
+    /*Transmit channel sends the same word to put 16 clocks on SCK line*/
+    static const uint16_t dummy = 0xFFFF;
+    SD_SPI_DMA_t dma;
+    SD_SPI_GetDMA(SPIx, &dma);
+    SD_SPI_StopDMA(SPIx, &dma);
+    dma.rx->CPAR = (uint32_t)&SPIx->DR;
+    dma.rx->CMAR = (uint32_t)data;
+    dma.rx->CNDTR = len;
+    dma.rx->CCR = DMA_CCR_MINC | DMA_CCR_PSIZE_0 | DMA_CCR_MSIZE_0 | DMA_CCR_PL_1;
+    dma.tx->CPAR = (uint32_t)&SPIx->DR;
+    dma.tx->CMAR = (uint32_t)&dummy;
+    dma.tx->CNDTR = len;
+    dma.tx->CCR = DMA_CCR_DIR | DMA_CCR_PSIZE_0 | DMA_CCR_MSIZE_0;
+    /*Receive requests are enabled first not to lose any frame*/
+    SPIx->CR2 |= SPI_CR2_RXDMAEN;
+    dma.rx->CCR |= DMA_CCR_EN;
+    dma.tx->CCR |= DMA_CCR_EN;
+    SPIx->CR2 |= SPI_CR2_TXDMAEN;
+#else
+    uint32_t timestamp = 0;
+    for(uint32_t i = 0; i < len; ++i)
+    {
+        timestamp = DWT_GetCycle();
         while(!(SPIx->SR & SPI_SR_TXE))
         {
             if(DWT_Timeout(SD_SPI_TIMEOUT, timestamp))
@@ -483,23 +666,50 @@ SD_SPI_Status_t SD_SPI_Receive16Data(SPI_TypeDef * SPIx, uint16_t * data, uint32
             if(DWT_Timeout(SD_SPI_TIMEOUT, timestamp))
                 return SD_SPI_ERROR;
         }
-         /*Clear receive FIFO*/
-        SPIx->DR;
-        while((SPIx->SR & SPI_SR_BSY))
-        {
-            if(DWT_Timeout(SD_SPI_TIMEOUT, timestamp))
-                return SD_SPI_ERROR;
-        }
-        /*Check for received crc validation*/
-        if(SD_SPI_CRC_Check(SPIx) == SD_SPI_ERROR)
-            return SD_SPI_ERROR;
+        data[i] = SPIx->DR;
     }
-    /*Wait while SPIx busy */
-    while((SPIx->SR & SPI_SR_BSY))
+#endif
+    return SD_SPI_OK;
+}
+
+/** \brief Wait for data block started by SD_SPI_StartReceive16Data, receive and check CRC16 after it
+  * \param  SPIx: where x can be 1, 2 or 3 to select the SPI peripheral.
+  * \retval SPIx state, SD_SPI_CRC_ERROR if received CRC16 is wrong
+*/
+SD_SPI_Status_t SD_SPI_WaitReceive16Data(SPI_TypeDef * SPIx)
+{
+#ifdef SD_SPI_DMA
+    SD_SPI_DMA_t dma;
+    SD_SPI_GetDMA(SPIx, &dma);
+    uint32_t left = dma.rx->CNDTR;
+    uint32_t timestamp = DWT_GetCycle();
+    while(dma.rx->CNDTR)
     {
-        if(DWT_Timeout(SD_SPI_TIMEOUT, timestamp))
+        /*Timeout counts from the last received frame like in polling mode*/
+        if(dma.rx->CNDTR != left)
+        {
+            left = dma.rx->CNDTR;
+            timestamp = DWT_GetCycle();
+        }
+        if((dma.DMAx->ISR & ((DMA_ISR_TEIF1 << dma.rxShift) | (DMA_ISR_TEIF1 << dma.txShift))) ||
+           DWT_Timeout(SD_SPI_TIMEOUT, timestamp))
+        {
+            SD_SPI_StopDMA(SPIx, &dma);
             return SD_SPI_ERROR;
+        }
     }
-    return SD_SPI_OK;
+    SD_SPI_StopDMA(SPIx, &dma);
+#endif
+    return SD_SPI_Receive16CRC(SPIx);
 }
 
+/** \brief Convert data received in 16-bit SPI frames to byte order
+  * \param  data: pointer to data buffer.
+  * \param  len: number of 16-bit words
+  * \retval None
+*/
+void SD_SPI_Swap16Data(uint16_t * data, uint32_t len)
+{
+    for(uint32_t i = 0; i < len; ++i)
+        data[i] = (data[i] >> 8) | (data[i] << 8);
+}
@@ -0,0 +1,155 @@
+/*MIT License
+
+Copyright (c) 2019 DoHelloWorld
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.*/
+
+#include <string.h>
+#include "SDCard_Stream.h"
+
+/*Number of blocks from address to the end of allocation unit*/
+static uint32_t SD_StreamToBoundary(SD_Stream_t * stream, uint32_t address);
+/*Write blocks of staging buffer and drop written ones*/
+static SD_Error_t SD_StreamWriteBuffer(SD_Stream_t * stream, uint32_t blocks);
+
+/** \brief Get number of blocks to the end of allocation unit
+  * \param  stream: pointer to stream structure
+  * \param  address: number of SD data block
+  * \retval number of blocks
+*/
+static uint32_t SD_StreamToBoundary(SD_Stream_t * stream, uint32_t address)
+{
+    /*Without allocation unit stream is not aligned*/
+    if(!stream->auBlocks)
+        return 0xFFFFFFFF;
+    return stream->auBlocks - (address % stream->auBlocks);
+}
+
+/** \brief Write blocks of staging buffer to SD card
+  * \param  stream: pointer to stream structure
+  * \param  blocks: number of blocks to write
+  * \retval SD error number
+*/
+static SD_Error_t SD_StreamWriteBuffer(SD_Stream_t * stream, uint32_t blocks)
+{
+    uint32_t blockSize = stream->sd->blockSize;
+    SD_Error_t error = SD_WriteMultipleBlock(stream->sd, stream->address, stream->buffer, blocks);
+    uint32_t written = stream->sd->writtenBlocks;
+    /*Only full blocks leave staging buffer, padded block is written again later*/
+    if(written > stream->fill / blockSize)
+        written = stream->fill / blockSize;
+    if(written)
+    {
+        stream->fill -= written * blockSize;
+        memmove(stream->buffer, stream->buffer + written * blockSize, stream->fill);
+        stream->address += written;
+    }
+    return error;
+}
+
+/** \brief Start write stream
+  * \param  stream: pointer to stream structure
+  * \param  sd: pointer to SD card parameters structure
+  * \param  address: SD data block where stream starts
+  * \param  buffer: pointer to staging buffer
+  * \param  bufferBlocks: size of staging buffer in blocks, at least 1
+  * \retval None
+*/
+void SD_StreamInit(SD_Stream_t * stream, SD_Parameters_t * sd, uint32_t address, uint8_t * buffer, uint32_t bufferBlocks)
+{
+    stream->sd = sd;
+    stream->buffer = buffer;
+    stream->bufferBlocks = bufferBlocks;
+    stream->fill = 0;
+    stream->address = address;
+    stream->auBlocks = sd->auBlocks;
+    stream->position = 0;
+}
+
+/** \brief Write data to stream. Bursts never cross allocation unit boundaries,
+  *        data which does not fill burst is collected in staging buffer
+  * \param  stream: pointer to stream structure
+  * \param  data: pointer to data
+  * \param  len: number of bytes
+  * \retval SD error number. position member of stream keeps number of accepted bytes
+*/
+SD_Error_t SD_StreamWrite(SD_Stream_t * stream, uint8_t * data, uint32_t len)
+{
+    SD_Error_t error = SD_OK;
+    uint32_t blockSize = stream->sd->blockSize;
+    while(len)
+    {
+        uint32_t boundary = SD_StreamToBoundary(stream, stream->address);
+        /*Staging buffer is empty - big bursts are written straight from data*/
+        if(!stream->fill && (len >= blockSize))
+        {
+            uint32_t blocks = len / blockSize;
+            if(blocks > boundary)
+                blocks = boundary;
+            /*Burst fills allocation unit up to the end or is bigger than staging buffer*/
+            if((blocks == boundary) || (blocks >= stream->bufferBlocks))
+            {
+                error = SD_WriteMultipleBlock(stream->sd, stream->address, data, blocks);
+                uint32_t written = stream->sd->writtenBlocks * blockSize;
+                stream->address += stream->sd->writtenBlocks;
+                stream->position += written;
+                data += written;
+                len -= written;
+                if(error != SD_OK)
+                    return error;
+                continue;
+            }
+        }
+        /*Collect data in staging buffer, it never crosses allocation unit boundary*/
+        uint32_t limit = stream->bufferBlocks;
+        if(limit > boundary)
+            limit = boundary;
+        limit *= blockSize;
+        uint32_t part = limit - stream->fill;
+        if(part > len)
+            part = len;
+        memcpy(stream->buffer + stream->fill, data, part);
+        stream->fill += part;
+        stream->position += part;
+        data += part;
+        len -= part;
+        if(stream->fill == limit)
+        {
+            error = SD_StreamWriteBuffer(stream, limit / blockSize);
+            if(error != SD_OK)
+                return error;
+        }
+    }
+    return SD_OK;
+}
+
+/** \brief Write all data from staging buffer to SD card
+  * \param  stream: pointer to stream structure
+  * \retval SD error number
+*/
+SD_Error_t SD_StreamFlush(SD_Stream_t * stream)
+{
+    uint32_t blockSize = stream->sd->blockSize;
+    uint32_t blocks = (stream->fill + blockSize - 1) / blockSize;
+    if(!blocks)
+        return SD_OK;
+    /*Pad last block with zeros, it stays in buffer until it is full*/
+    memset(stream->buffer + stream->fill, 0, blocks * blockSize - stream->fill);
+    return SD_StreamWriteBuffer(stream, blocks);
+}
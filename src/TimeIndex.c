@@ -0,0 +1,360 @@
+/*MIT License
+
+Copyright (c) 2019 DoHelloWorld
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.*/
+
+
+#include <string.h>
+#include "TimeIndex.h"
+#include "Utils.h"
+
+#define TIDX_BLOCK_SIZE         512         /**< Size of index block */
+#define TIDX_MAGIC              0x58444954  /**< "TIDX" at the start of every index block */
+#define TIDX_HEADER_SIZE        16          /**< Magic, log epoch, block number, number of entries */
+#define TIDX_ENTRY_SIZE         24          /**< Timestamp, record position, record sequence, reserved */
+#define TIDX_CRC_OFFSET         508         /**< CRC32 of block bytes before it */
+
+/*Get little-endian 32-bit value*/
+static uint32_t TIDX_Load32(const uint8_t * p);
+/*Put little-endian 32-bit value*/
+static void TIDX_Store32(uint8_t * p, uint32_t value);
+/*Get little-endian 64-bit value*/
+static uint64_t TIDX_Load64(const uint8_t * p);
+/*Put little-endian 64-bit value*/
+static void TIDX_Store64(uint8_t * p, uint64_t value);
+/*Get pointer to entry of index block*/
+static uint8_t * TIDX_Entry(uint8_t * block, uint32_t entry);
+/*Read index block and check it*/
+static TIDX_Error_t TIDX_ReadBlock(TIDX_t * index, uint32_t number, uint8_t * valid);
+/*Write pending block*/
+static TIDX_Error_t TIDX_WritePending(TIDX_t * index);
+/*Drop entries which point after log end*/
+static TIDX_Error_t TIDX_Trim(TIDX_t * index, uint32_t blocks);
+
+/** \brief Get little-endian 32-bit value
+  * \param  p: pointer to value
+  * \retval value
+*/
+static uint32_t TIDX_Load32(const uint8_t * p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/** \brief Put little-endian 32-bit value
+  * \param  p: pointer to value
+  * \param  value: value to store
+  * \retval None
+*/
+static void TIDX_Store32(uint8_t * p, uint32_t value)
+{
+    p[0] = value;
+    p[1] = value >> 8;
+    p[2] = value >> 16;
+    p[3] = value >> 24;
+}
+
+/** \brief Get little-endian 64-bit value
+  * \param  p: pointer to value
+  * \retval value
+*/
+static uint64_t TIDX_Load64(const uint8_t * p)
+{
+    return TIDX_Load32(p) | ((uint64_t)TIDX_Load32(p + 4) << 32);
+}
+
+/** \brief Put little-endian 64-bit value
+  * \param  p: pointer to value
+  * \param  value: value to store
+  * \retval None
+*/
+static void TIDX_Store64(uint8_t * p, uint64_t value)
+{
+    TIDX_Store32(p, (uint32_t)value);
+    TIDX_Store32(p + 4, (uint32_t)(value >> 32));
+}
+
+/** \brief Get pointer to entry of index block
+  * \param  block: pointer to index block
+  * \param  entry: entry number
+  * \retval pointer to entry: timestamp, position and sequence at offsets 0, 8 and 16
+*/
+static uint8_t * TIDX_Entry(uint8_t * block, uint32_t entry)
+{
+    return block + TIDX_HEADER_SIZE + entry * TIDX_ENTRY_SIZE;
+}
+
+/** \brief Read index block to buffer and check magic, log epoch, block number and CRC32
+  * \param  index: pointer to index structure
+  * \param  number: index block number
+  * \param  valid: pointer where to put 1 for valid block and 0 for not valid one
+  * \retval index error number
+*/
+static TIDX_Error_t TIDX_ReadBlock(TIDX_t * index, uint32_t number, uint8_t * valid)
+{
+    uint8_t * p = index->buffer;
+    *valid = 0;
+    if(SD_PartitionRead(index->part, number, p, 1) != SD_OK)
+        return TIDX_DISK_ERROR;
+    uint32_t count = TIDX_Load32(p + 12);
+    /*Blocks of previous log formats have other epoch*/
+    if((TIDX_Load32(p) == TIDX_MAGIC) && (TIDX_Load32(p + 4) == index->log->epoch) && (TIDX_Load32(p + 8) == number) &&
+       count && (count <= TIDX_ENTRIES) && (CRC32_Update(0, p, TIDX_CRC_OFFSET) == TIDX_Load32(p + TIDX_CRC_OFFSET)))
+        *valid = 1;
+    return TIDX_OK;
+}
+
+/** \brief Write pending block after full blocks, full pending block becomes full block
+  * \param  index: pointer to index structure
+  * \retval index error number
+*/
+static TIDX_Error_t TIDX_WritePending(TIDX_t * index)
+{
+    uint8_t * p = index->pending;
+    TIDX_Store32(p, TIDX_MAGIC);
+    TIDX_Store32(p + 4, index->log->epoch);
+    TIDX_Store32(p + 8, index->blocks);
+    TIDX_Store32(p + 12, index->count);
+    TIDX_Store32(p + TIDX_CRC_OFFSET, CRC32_Update(0, p, TIDX_CRC_OFFSET));
+    if(SD_PartitionWrite(index->part, index->blocks, p, 1) != SD_OK)
+        return TIDX_DISK_ERROR;
+    if(index->count == TIDX_ENTRIES)
+    {
+        index->blocks++;
+        index->count = 0;
+        memset(p, 0, TIDX_BLOCK_SIZE);
+    }
+    return TIDX_OK;
+}
+
+/** \brief Drop entries which point at or after log end, they belong to records lost at power off.
+  *        Blocks after the last kept entry are erased so they are not found again
+  * \param  index: pointer to index structure
+  * \param  blocks: number of valid index blocks on SD card
+  * \retval index error number
+*/
+static TIDX_Error_t TIDX_Trim(TIDX_t * index, uint32_t blocks)
+{
+    TIDX_Error_t error = TIDX_OK;
+    uint64_t end = index->log->stream.position;
+    uint32_t low = 0;
+    uint32_t high = blocks;
+    uint8_t valid = 0;
+    /*Count blocks which start before log end*/
+    while(low < high)
+    {
+        uint32_t middle = low + (high - low) / 2;
+        error = TIDX_ReadBlock(index, middle, &valid);
+        if(error != TIDX_OK)
+            return error;
+        if(!valid)
+            return TIDX_CORRUPT;
+        if(TIDX_Load64(TIDX_Entry(index->buffer, 0) + 8) < end)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    if(low < blocks)
+    {
+        if(SD_PartitionErase(index->part, low, blocks - low) != SD_OK)
+            return TIDX_DISK_ERROR;
+    }
+    if(!low)
+        return TIDX_OK;
+    /*Last kept block goes to pending block*/
+    error = TIDX_ReadBlock(index, low - 1, &valid);
+    if(error != TIDX_OK)
+        return error;
+    if(!valid)
+        return TIDX_CORRUPT;
+    memcpy(index->pending, index->buffer, TIDX_BLOCK_SIZE);
+    index->blocks = low - 1;
+    index->count = TIDX_Load32(index->pending + 12);
+    uint32_t count = index->count;
+    while(index->count && (TIDX_Load64(TIDX_Entry(index->pending, index->count - 1) + 8) >= end))
+        index->count--;
+    memset(TIDX_Entry(index->pending, index->count), 0, (TIDX_ENTRIES - index->count) * TIDX_ENTRY_SIZE);
+    uint8_t * last = TIDX_Entry(index->pending, index->count - 1);
+    index->last = TIDX_Load64(last + 8);
+    index->lastTimestamp = TIDX_Load64(last);
+    /*Block with dropped entries is written again before new entries can come to its place*/
+    if(index->count != count)
+    {
+        error = TIDX_WritePending(index);
+        if(error != TIDX_OK)
+            return error;
+    }
+    /*Full block is kept on SD card*/
+    if(index->count == TIDX_ENTRIES)
+    {
+        index->blocks++;
+        index->count = 0;
+        memset(index->pending, 0, TIDX_BLOCK_SIZE);
+    }
+    return TIDX_OK;
+}
+
+/** \brief Open index of opened log. Valid index blocks are found with binary search, entries which
+  *        point after log end are dropped
+  * \param  index: pointer to index structure
+  * \param  part: pointer to partition for index blocks
+  * \param  log: pointer to opened log
+  * \param  interval: log bytes between index entries
+  * \retval index error number
+*/
+TIDX_Error_t TIDX_Open(TIDX_t * index, SD_Partition_t * part, LOG_t * log, uint32_t interval)
+{
+    TIDX_Error_t error = TIDX_OK;
+    uint32_t low = 0;
+    uint32_t high = part->blocks;
+    uint8_t valid = 0;
+    index->part = part;
+    index->log = log;
+    index->interval = interval;
+    index->blocks = 0;
+    index->count = 0;
+    index->last = 0;
+    index->lastTimestamp = 0;
+    index->logError = LOG_OK;
+    memset(index->pending, 0, TIDX_BLOCK_SIZE);
+    if(!part->blocks)
+        return TIDX_DENIED;
+    /*Index blocks are written in order, valid ones make prefix of partition*/
+    while(low < high)
+    {
+        uint32_t middle = low + (high - low) / 2;
+        error = TIDX_ReadBlock(index, middle, &valid);
+        if(error != TIDX_OK)
+            return error;
+        if(valid)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    return TIDX_Trim(index, low);
+}
+
+/** \brief Append record to log, index entry is added when record starts interval bytes after
+  *        previous entry. Timestamps should not go back
+  * \param  index: pointer to index structure
+  * \param  timestamp: timestamp of record
+  * \param  data: pointer to record
+  * \param  len: record length in bytes
+  * \retval index error number, TIDX_LOG_ERROR with error in logError member of index
+*/
+TIDX_Error_t TIDX_Append(TIDX_t * index, uint64_t timestamp, uint8_t * data, uint32_t len)
+{
+    uint64_t position = index->log->stream.position;
+    uint32_t sequence = index->log->sequence;
+    uint8_t empty = !index->blocks && !index->count;
+    if(!empty && (timestamp < index->lastTimestamp))
+        return TIDX_DENIED;
+    uint8_t add = empty || (position - index->last >= index->interval);
+    /*Full block was not written by previous append*/
+    if(add && (index->count >= TIDX_ENTRIES))
+    {
+        TIDX_Error_t error = TIDX_WritePending(index);
+        if(error != TIDX_OK)
+            return error;
+    }
+    if(add && (index->blocks >= index->part->blocks))
+        return TIDX_FULL;
+    index->logError = LOG_Append(index->log, data, len);
+    if(index->logError != LOG_OK)
+        return TIDX_LOG_ERROR;
+    if(!add)
+        return TIDX_OK;
+    uint8_t * entry = TIDX_Entry(index->pending, index->count);
+    TIDX_Store64(entry, timestamp);
+    TIDX_Store64(entry + 8, position);
+    TIDX_Store32(entry + 16, sequence);
+    index->count++;
+    index->last = position;
+    index->lastTimestamp = timestamp;
+    if(index->count == TIDX_ENTRIES)
+        return TIDX_WritePending(index);
+    return TIDX_OK;
+}
+
+/** \brief Sync log and write pending index block, it is written again when it gets more entries
+  * \param  index: pointer to index structure
+  * \retval index error number
+*/
+TIDX_Error_t TIDX_Sync(TIDX_t * index)
+{
+    index->logError = LOG_Sync(index->log);
+    if(index->logError != LOG_OK)
+        return TIDX_LOG_ERROR;
+    if(!index->count)
+        return TIDX_OK;
+    return TIDX_WritePending(index);
+}
+
+/** \brief Move log reader to the last indexed record with timestamp before given one, or to the first
+  *        record if no entry is before it. Records with equal timestamps can span several entries, so reader
+  *        starts before the first of them. Search reads about log2(index blocks) + 1 blocks,
+  *        then records are read from there with read-ahead buffer of reader
+  * \param  index: pointer to index structure
+  * \param  timestamp: start of time window
+  * \param  reader: pointer to log reader
+  * \retval index error number
+*/
+TIDX_Error_t TIDX_Find(TIDX_t * index, uint64_t timestamp, LOG_Reader_t * reader)
+{
+    TIDX_Error_t error = TIDX_OK;
+    uint8_t * block = index->pending;
+    uint32_t count = index->count;
+    uint8_t valid = 0;
+    if(!count || (TIDX_Load64(TIDX_Entry(block, 0)) >= timestamp))
+    {
+        /*Count full blocks which start before timestamp*/
+        uint32_t low = 0;
+        uint32_t high = index->blocks;
+        while(low < high)
+        {
+            uint32_t middle = low + (high - low) / 2;
+            error = TIDX_ReadBlock(index, middle, &valid);
+            if(error != TIDX_OK)
+                return error;
+            if(!valid)
+                return TIDX_CORRUPT;
+            if(TIDX_Load64(TIDX_Entry(index->buffer, 0)) < timestamp)
+                low = middle + 1;
+            else
+                high = middle;
+        }
+        if(!low)
+        {
+            LOG_ReaderSeek(reader, 0, LOG_FIRST_SEQUENCE);
+            return TIDX_OK;
+        }
+        error = TIDX_ReadBlock(index, low - 1, &valid);
+        if(error != TIDX_OK)
+            return error;
+        if(!valid)
+            return TIDX_CORRUPT;
+        block = index->buffer;
+        count = TIDX_ENTRIES;
+    }
+    while((count > 1) && (TIDX_Load64(TIDX_Entry(block, count - 1)) >= timestamp))
+        count--;
+    uint8_t * entry = TIDX_Entry(block, count - 1);
+    LOG_ReaderSeek(reader, TIDX_Load64(entry + 8), TIDX_Load32(entry + 16));
+    return TIDX_OK;
+}
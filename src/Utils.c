@@ -34,6 +34,8 @@ typedef struct
 
 /*calculate number of cycles in millisecond*/
 static uint32_t DWT_CyclesInMs(void);
+/*calculate number of cycles in microsecond*/
+static uint32_t DWT_CyclesInUs(void);
 
 
 /** \brief Configure DWT module
@@ -75,6 +77,71 @@ uint8_t DWT_Timeout(uint32_t timeout_ms, uint32_t timestamp)
     return 1;
 }
 
+/** \brief Convert number of cycles to microseconds
+ *
+ * \param cycles : number of cycles
+ * \return Number of microseconds
+ *
+ */
+uint32_t DWT_CyclesToUs(uint32_t cycles)
+{
+    return cycles / DWT_CyclesInUs();
+}
+
+/** \brief Check if DWT cycles reaches timeout in microseconds
+ *
+ * \param timeout_us : timeout in microseconds
+ * \param timestamp : timestamp from where we should count timeout
+ * \return 1 if reach timeout. 0 if not.
+ *
+ */
+uint8_t DWT_TimeoutUs(uint32_t timeout_us, uint32_t timestamp)
+{
+    uint32_t timeout = timeout_us * DWT_CyclesInUs();
+    if(timeout >= (DWT_GetCycle() - timestamp))
+        return 0;
+    return 1;
+}
+
+/** \brief Check if absolute deadline is passed
+ *
+ * \param deadline : cycle number, should be less than 2^31 cycles ahead
+ * \return 1 if deadline is passed. 0 if not.
+ *
+ */
+uint8_t DWT_Expired(uint32_t deadline)
+{
+    /*Signed difference keeps working when cycle counter wraps*/
+    if((int32_t)(DWT_GetCycle() - deadline) < 0)
+        return 0;
+    return 1;
+}
+
+/** \brief Continue CRC32 calculation, table with 16 entries keeps flash usage small
+ *
+ * \param crc : CRC32 of previous data, 0 for the first part
+ * \param data : pointer to data
+ * \param len : number of bytes
+ * \return CRC32 of previous data and this part
+ *
+ */
+uint32_t CRC32_Update(uint32_t crc, const uint8_t * data, uint32_t len)
+{
+    static const uint32_t table[16] =
+    {
+        0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+        0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+    };
+    crc = ~crc;
+    while(len--)
+    {
+        crc ^= *data++;
+        crc = (crc >> 4) ^ table[crc & 0x0F];
+        crc = (crc >> 4) ^ table[crc & 0x0F];
+    }
+    return ~crc;
+}
+
 /** \brief Get cycles count in millisecond
  *
  * \param None
@@ -85,3 +152,14 @@ static uint32_t DWT_CyclesInMs(void)
 {
     return SystemCoreClock / 1000;
 }
+
+/** \brief Get cycles count in microsecond
+ *
+ * \param None
+ * \return Number of cycles in microsecond
+ *
+ */
+static uint32_t DWT_CyclesInUs(void)
+{
+    return SystemCoreClock / 1000000;
+}
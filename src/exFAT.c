@@ -0,0 +1,1528 @@
+/*MIT License
+
+Copyright (c) 2019 DoHelloWorld
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.*/
+
+
+#include <string.h>
+#include "exFAT.h"
+
+#define EXFAT_BLOCK_SIZE    512         /**< exFAT sector size supported by driver */
+#define EXFAT_NO_WINDOW     0xFFFFFFFF  /**< Window block when window is empty */
+#define EXFAT_EOC           0xFFFFFFF8  /**< Entries from this value end cluster chain */
+#define EXFAT_EOC_MARK      0xFFFFFFFF  /**< End of chain mark written by driver */
+#define EXFAT_DIR_ENTRY     32          /**< Size of directory entry */
+#define EXFAT_NAME_LEN      255         /**< Maximum length of file name */
+#define EXFAT_NAME_PART     15          /**< Name characters in one file name entry */
+#define EXFAT_TYPE_BITMAP   0x81        /**< Allocation bitmap entry */
+#define EXFAT_TYPE_FILE     0x85        /**< File entry, the first entry of set */
+#define EXFAT_TYPE_STREAM   0xC0        /**< Stream extension entry */
+#define EXFAT_TYPE_NAME     0xC1        /**< File name entry */
+#define EXFAT_TYPE_IN_USE   0x80        /**< Entry type bit of used entry */
+#define EXFAT_ALLOC_POSSIBLE 0x01       /**< Stream flag: clusters can be allocated */
+#define EXFAT_NO_FAT_CHAIN  0x02        /**< Stream flag: clusters are contiguous, FAT is not used */
+#define EXFAT_ATTR_DIRECTORY 0x10       /**< Directory */
+#define EXFAT_ATTR_ARCHIVE  0x20        /**< Archive, set for new files */
+#define EXFAT_FLAG_ACTIVE_FAT 0x01      /**< VolumeFlags: the second FAT and bitmap are active */
+#define EXFAT_FLAG_DIRTY    0x02        /**< VolumeFlags: volume may be inconsistent */
+#define EXFAT_TIMESTAMP     0x00210000  /**< 1980-01-01 00:00:00, written to new files */
+
+/*Little-endian fields of on-disk structures*/
+static uint16_t EXFAT_Load16(const uint8_t * data);
+static uint32_t EXFAT_Load32(const uint8_t * data);
+static uint64_t EXFAT_Load64(const uint8_t * data);
+static void EXFAT_Store16(uint8_t * data, uint16_t value);
+static void EXFAT_Store32(uint8_t * data, uint32_t value);
+static void EXFAT_Store64(uint8_t * data, uint64_t value);
+/*Sector window functions*/
+static EXFAT_Error_t EXFAT_Flush(EXFAT_FS_t * fs);
+static EXFAT_Error_t EXFAT_Move(EXFAT_FS_t * fs, uint32_t block);
+static EXFAT_Error_t EXFAT_DropWindow(EXFAT_FS_t * fs, uint32_t block, uint32_t num);
+/*Multiple block transfers of data clusters*/
+static EXFAT_Error_t EXFAT_ReadBlocks(EXFAT_FS_t * fs, uint32_t block, uint8_t * data, uint32_t num);
+static EXFAT_Error_t EXFAT_WriteBlocks(EXFAT_FS_t * fs, uint32_t block, uint8_t * data, uint32_t num);
+/*First block of cluster*/
+static uint32_t EXFAT_ClusterBlock(EXFAT_FS_t * fs, uint32_t cluster);
+/*Check if cluster number is inside volume*/
+static uint8_t EXFAT_IsCluster(EXFAT_FS_t * fs, uint32_t cluster);
+/*FAT entry access*/
+static EXFAT_Error_t EXFAT_GetEntry(EXFAT_FS_t * fs, uint32_t cluster, uint32_t * value);
+static EXFAT_Error_t EXFAT_SetEntry(EXFAT_FS_t * fs, uint32_t cluster, uint32_t value);
+/*Set VolumeDirty flag before the first change of volume*/
+static EXFAT_Error_t EXFAT_MarkDirty(EXFAT_FS_t * fs);
+/*Allocation bitmap access*/
+static EXFAT_Error_t EXFAT_GetBit(EXFAT_FS_t * fs, uint32_t cluster, uint8_t * used);
+static EXFAT_Error_t EXFAT_SetBit(EXFAT_FS_t * fs, uint32_t cluster, uint8_t used);
+/*Find and allocate free cluster in bitmap*/
+static EXFAT_Error_t EXFAT_AllocCluster(EXFAT_FS_t * fs, uint32_t * cluster);
+/*Find free run of clusters which starts on allocation unit boundary*/
+static uint32_t EXFAT_AlignCluster(uint32_t cluster, uint32_t step, uint32_t phase);
+static EXFAT_Error_t EXFAT_FindRun(EXFAT_FS_t * fs, uint32_t count, uint32_t * first);
+/*Mark run of clusters as allocated*/
+static EXFAT_Error_t EXFAT_SetRun(EXFAT_FS_t * fs, uint32_t first, uint32_t count);
+/*Free clusters of chain or contiguous run*/
+static EXFAT_Error_t EXFAT_FreeClusters(EXFAT_FS_t * fs, uint32_t cluster, uint32_t count, uint8_t noFatChain);
+/*Find volume cluster of file cluster and number of contiguous clusters from it*/
+static EXFAT_Error_t EXFAT_MapCluster(EXFAT_File_t * file, uint32_t index, uint32_t want, uint32_t * cluster, uint32_t * count);
+/*Allocate clusters of file, contiguous file gets FAT chain when it can not grow in place*/
+static EXFAT_Error_t EXFAT_ExtendFile(EXFAT_File_t * file, uint32_t clusters);
+/*Name helpers*/
+static uint16_t EXFAT_Upcase(uint16_t c);
+static EXFAT_Error_t EXFAT_MakeName(const char ** path, char * name, uint8_t * len);
+static uint16_t EXFAT_NameHash(const char * name, uint8_t len);
+/*Directory walk*/
+static EXFAT_Error_t EXFAT_Entry(EXFAT_FS_t * fs, EXFAT_Dir_t * dir, uint8_t ** entry);
+static EXFAT_Error_t EXFAT_NextEntry(EXFAT_FS_t * fs, EXFAT_Dir_t * dir);
+static void EXFAT_StartDir(EXFAT_Dir_t * dir, uint32_t first, uint32_t length);
+/*Update checksum of entry set*/
+static EXFAT_Error_t EXFAT_SetChecksum(EXFAT_FS_t * fs, EXFAT_Dir_t * set);
+/*Find file in directory*/
+static EXFAT_Error_t EXFAT_FindEntry(EXFAT_FS_t * fs, EXFAT_Dir_t dir, const char * name, uint8_t len, EXFAT_File_t * file, uint16_t * attributes);
+/*Create entry set of empty file in directory*/
+static EXFAT_Error_t EXFAT_AddEntry(EXFAT_FS_t * fs, EXFAT_Dir_t dir, const char * name, uint8_t len, EXFAT_Dir_t * set);
+
+/** \brief Load 16-bit little-endian value
+  * \param  data: pointer to value
+  * \retval value
+*/
+static uint16_t EXFAT_Load16(const uint8_t * data)
+{
+    return data[0] | (data[1] << 8);
+}
+
+/** \brief Load 32-bit little-endian value
+  * \param  data: pointer to value
+  * \retval value
+*/
+static uint32_t EXFAT_Load32(const uint8_t * data)
+{
+    return data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+/** \brief Load 64-bit little-endian value
+  * \param  data: pointer to value
+  * \retval value
+*/
+static uint64_t EXFAT_Load64(const uint8_t * data)
+{
+    return EXFAT_Load32(data) | ((uint64_t)EXFAT_Load32(data + 4) << 32);
+}
+
+/** \brief Store 16-bit little-endian value
+  * \param  data: pointer where to put value
+  * \param  value: value
+  * \retval None
+*/
+static void EXFAT_Store16(uint8_t * data, uint16_t value)
+{
+    data[0] = (uint8_t)value;
+    data[1] = (uint8_t)(value >> 8);
+}
+
+/** \brief Store 32-bit little-endian value
+  * \param  data: pointer where to put value
+  * \param  value: value
+  * \retval None
+*/
+static void EXFAT_Store32(uint8_t * data, uint32_t value)
+{
+    data[0] = (uint8_t)value;
+    data[1] = (uint8_t)(value >> 8);
+    data[2] = (uint8_t)(value >> 16);
+    data[3] = (uint8_t)(value >> 24);
+}
+
+/** \brief Store 64-bit little-endian value
+  * \param  data: pointer where to put value
+  * \param  value: value
+  * \retval None
+*/
+static void EXFAT_Store64(uint8_t * data, uint64_t value)
+{
+    EXFAT_Store32(data, (uint32_t)value);
+    EXFAT_Store32(data + 4, (uint32_t)(value >> 32));
+}
+
+/** \brief Write changed window to SD card
+  * \param  fs: pointer to volume structure
+  * \retval exFAT error number
+*/
+static EXFAT_Error_t EXFAT_Flush(EXFAT_FS_t * fs)
+{
+    if(!fs->dirty)
+        return EXFAT_OK;
+    if(SD_PartitionWrite(fs->part, fs->window, fs->buffer, 1) != SD_OK)
+        return EXFAT_DISK_ERROR;
+    fs->dirty = 0;
+    return EXFAT_OK;
+}
+
+/** \brief Load block to window, changed window is written before
+  * \param  fs: pointer to volume structure
+  * \param  block: volume block
+  * \retval exFAT error number
+*/
+static EXFAT_Error_t EXFAT_Move(EXFAT_FS_t * fs, uint32_t block)
+{
+    EXFAT_Error_t error = EXFAT_OK;
+    if(fs->window == block)
+        return EXFAT_OK;
+    error = EXFAT_Flush(fs);
+    if(error != EXFAT_OK)
+        return error;
+    if(SD_PartitionRead(fs->part, block, fs->buffer, 1) != SD_OK)
+    {
+        fs->window = EXFAT_NO_WINDOW;
+        return EXFAT_DISK_ERROR;
+    }
+    fs->window = block;
+    return EXFAT_OK;
+}
+
+/** \brief Drop window if it is inside range of direct transfer, changed window is written before
+  * \param  fs: pointer to volume structure
+  * \param  block: first volume block of transfer
+  * \param  num: number of blocks
+  * \retval exFAT error number
+*/
+static EXFAT_Error_t EXFAT_DropWindow(EXFAT_FS_t * fs, uint32_t block, uint32_t num)
+{
+    EXFAT_Error_t error = EXFAT_OK;
+    if((fs->window < block) || (fs->window >= block + num))
+        return EXFAT_OK;
+    error = EXFAT_Flush(fs);
+    fs->window = EXFAT_NO_WINDOW;
+    return error;
+}
+
+/** \brief Read data blocks, several blocks are read with one multiple read
+  * \param  fs: pointer to volume structure
+  * \param  block: first volume block
+  * \param  data: pointer to buffer for data
+  * \param  num: number of blocks
+  * \retval exFAT error number
+*/
+static EXFAT_Error_t EXFAT_ReadBlocks(EXFAT_FS_t * fs, uint32_t block, uint8_t * data, uint32_t num)
+{
+    return (SD_PartitionRead(fs->part, block, data, num) == SD_OK) ? EXFAT_OK : EXFAT_DISK_ERROR;
+}
+
+/** \brief Write data blocks, several blocks are written with one multiple write
+  * \param  fs: pointer to volume structure
+  * \param  block: first volume block
+  * \param  data: pointer to data
+  * \param  num: number of blocks
+  * \retval exFAT error number
+*/
+static EXFAT_Error_t EXFAT_WriteBlocks(EXFAT_FS_t * fs, uint32_t block, uint8_t * data, uint32_t num)
+{
+    return (SD_PartitionWrite(fs->part, block, data, num) == SD_OK) ? EXFAT_OK : EXFAT_DISK_ERROR;
+}
+
+/** \brief Get first block of cluster
+  * \param  fs: pointer to volume structure
+  * \param  cluster: cluster number
+  * \retval volume block
+*/
+static uint32_t EXFAT_ClusterBlock(EXFAT_FS_t * fs, uint32_t cluster)
+{
+    return fs->dataStart + (cluster - 2) * fs->clusterBlocks;
+}
+
+/** \brief Check if cluster number is inside volume
+  * \param  fs: pointer to volume structure
+  * \param  cluster: cluster number
+  * \retval 1 if cluster is valid, 0 if not
+*/
+static uint8_t EXFAT_IsCluster(EXFAT_FS_t * fs, uint32_t cluster)
+{
+    return (cluster >= 2) && (cluster < fs->clusters + 2);
+}
+
+/** \brief Read FAT entry
+  * \param  fs: pointer to volume structure
+  * \param  cluster: cluster number
+  * \param  value: pointer where to put entry value
+  * \retval exFAT error number
+*/
+static EXFAT_Error_t EXFAT_GetEntry(EXFAT_FS_t * fs, uint32_t cluster, uint32_t * value)
+{
+    EXFAT_Error_t error = EXFAT_Move(fs, fs->fatStart + cluster / (EXFAT_BLOCK_SIZE / 4));
+    if(error != EXFAT_OK)
+        return error;
+    *value = EXFAT_Load32(fs->buffer + (cluster % (EXFAT_BLOCK_SIZE / 4)) * 4);
+    return EXFAT_OK;
+}
+
+/** \brief Write FAT entry
+  * \param  fs: pointer to volume structure
+  * \param  cluster: cluster number
+  * \param  value: entry value
+  * \retval exFAT error number
+*/
+static EXFAT_Error_t EXFAT_SetEntry(EXFAT_FS_t * fs, uint32_t cluster, uint32_t value)
+{
+    EXFAT_Error_t error = EXFAT_Move(fs, fs->fatStart + cluster / (EXFAT_BLOCK_SIZE / 4));
+    if(error != EXFAT_OK)
+        return error;
+    EXFAT_Store32(fs->buffer + (cluster % (EXFAT_BLOCK_SIZE / 4)) * 4, value);
+    fs->dirty = 1;
+    return EXFAT_OK;
+}
+
+/** \brief Set VolumeDirty flag and mark PercentInUse as unknown before the first change of volume.
+  *        Both fields are excluded from boot region checksum
+  * \param  fs: pointer to volume structure
+  * \retval exFAT error number
+*/
+static EXFAT_Error_t EXFAT_MarkDirty(EXFAT_FS_t * fs)
+{
+    EXFAT_Error_t error = EXFAT_OK;
+    if(fs->volumeDirty)
+        return EXFAT_OK;
+    error = EXFAT_Move(fs, 0);
+    if(error != EXFAT_OK)
+        return error;
+    uint16_t flags = EXFAT_Load16(fs->buffer + 106);
+    fs->wasDirty = (flags & EXFAT_FLAG_DIRTY) ? 1 : 0;
+    EXFAT_Store16(fs->buffer + 106, flags | EXFAT_FLAG_DIRTY);
+    fs->buffer[112] = 0xFF;
+    fs->dirty = 1;
+    fs->volumeDirty = 1;
+    /*Flag must reach the card before any other change*/
+    return EXFAT_Flush(fs);
+}
+
+/** \brief Read allocation bitmap bit of cluster
+  * \param  fs: pointer to volume structure
+  * \param  cluster: cluster number
+  * \param  used: pointer where to put 1 if cluster is allocated
+  * \retval exFAT error number
+*/
+static EXFAT_Error_t EXFAT_GetBit(EXFAT_FS_t * fs, uint32_t cluster, uint8_t * used)
+{
+    uint32_t bit = cluster - 2;
+    EXFAT_Error_t error = EXFAT_Move(fs, fs->bitmapStart + bit / (EXFAT_BLOCK_SIZE * 8));
+    if(error != EXFAT_OK)
+        return error;
+    *used = (fs->buffer[(bit / 8) % EXFAT_BLOCK_SIZE] >> (bit % 8)) & 1;
+    return EXFAT_OK;
+}
+
+/** \brief Write allocation bitmap bit of cluster
+  * \param  fs: pointer to volume structure
+  * \param  cluster: cluster number
+  * \param  used: 1 to allocate cluster, 0 to free it
+  * \retval exFAT error number
+*/
+static EXFAT_Error_t EXFAT_SetBit(EXFAT_FS_t * fs, uint32_t cluster, uint8_t used)
+{
+    uint32_t bit = cluster - 2;
+    EXFAT_Error_t error = EXFAT_MarkDirty(fs);
+    if(error == EXFAT_OK)
+        error = EXFAT_Move(fs, fs->bitmapStart + bit / (EXFAT_BLOCK_SIZE * 8));
+    if(error != EXFAT_OK)
+        return error;
+    uint8_t * byte = &fs->buffer[(bit / 8) % EXFAT_BLOCK_SIZE];
+    if(used)
+        *byte |= 1 << (bit % 8);
+    else
+        *byte &= ~(1 << (bit % 8));
+    fs->dirty = 1;
+    return EXFAT_OK;
+}
+
+/** \brief Find free cluster in allocation bitmap and allocate it, full bytes are skipped at once
+  * \param  fs: pointer to volume structure
+  * \param  cluster: pointer where to put allocated cluster
+  * \retval exFAT error number
+*/
+static EXFAT_Error_t EXFAT_AllocCluster(EXFAT_FS_t * fs, uint32_t * cluster)
+{
+    EXFAT_Error_t error = EXFAT_OK;
+    uint32_t candidate = fs->nextFree;
+    uint32_t checked = 0;
+    while(checked < fs->clusters)
+    {
+        if(!EXFAT_IsCluster(fs, candidate))
+            candidate = 2;
+        uint32_t bit = candidate - 2;
+        error = EXFAT_Move(fs, fs->bitmapStart + bit / (EXFAT_BLOCK_SIZE * 8));
+        if(error != EXFAT_OK)
+            return error;
+        uint8_t byte = fs->buffer[(bit / 8) % EXFAT_BLOCK_SIZE];
+        if(byte == 0xFF)
+        {
+            candidate += 8 - bit % 8;
+            checked += 8 - bit % 8;
+            continue;
+        }
+        if(!((byte >> (bit % 8)) & 1))
+        {
+            error = EXFAT_SetBit(fs, candidate, 1);
+            if(error != EXFAT_OK)
+                return error;
+            fs->nextFree = candidate + 1;
+            *cluster = candidate;
+            return EXFAT_OK;
+        }
+        candidate++;
+        checked++;
+    }
+    return EXFAT_NO_SPACE;
+}
+
+/** \brief Get the first cluster from given one which starts allocation unit
+  * \param  cluster: cluster number
+  * \param  step: clusters in allocation unit
+  * \param  phase: number of the first aligned cluster counted from cluster 2
+  * \retval aligned cluster number
+*/
+static uint32_t EXFAT_AlignCluster(uint32_t cluster, uint32_t step, uint32_t phase)
+{
+    uint32_t index = cluster - 2;
+    return cluster + (phase + step - index % step) % step;
+}
+
+/** \brief Find free run of clusters. Run starts on allocation unit boundary when cluster heap
+  *        is aligned to it, search starts from free cluster hint, so it costs amortised O(1) per cluster
+  * \param  fs: pointer to volume structure
+  * \param  count: number of clusters
+  * \param  first: pointer where to put the first cluster of run
+  * \retval exFAT error number
+*/
+static EXFAT_Error_t EXFAT_FindRun(EXFAT_FS_t * fs, uint32_t count, uint32_t * first)
+{
+    EXFAT_Error_t error = EXFAT_OK;
+    uint32_t au = fs->part->auBlocks;
+    uint32_t step = 1;
+    uint32_t phase = 0;
+    uint32_t end = fs->clusters + 2;
+    uint8_t wrapped = 0;
+    /*Cluster c starts allocation unit when (start + dataStart + (c - 2) * clusterBlocks) % au == 0*/
+    if(au && !(au % fs->clusterBlocks))
+    {
+        uint32_t shift = (au - (fs->part->start + fs->dataStart) % au) % au;
+        if(!(shift % fs->clusterBlocks))
+        {
+            step = au / fs->clusterBlocks;
+            phase = shift / fs->clusterBlocks;
+        }
+    }
+    uint32_t start = EXFAT_AlignCluster(EXFAT_IsCluster(fs, fs->nextFree) ? fs->nextFree : 2, step, phase);
+    uint32_t candidate = start;
+    while(1)
+    {
+        uint32_t i = 0;
+        if(wrapped && (candidate >= start))
+            return EXFAT_NO_SPACE;
+        if((candidate >= end) || (count > end - candidate))
+        {
+            if(wrapped)
+                return EXFAT_NO_SPACE;
+            wrapped = 1;
+            candidate = EXFAT_AlignCluster(2, step, phase);
+            continue;
+        }
+        while(i < count)
+        {
+            uint32_t bit = candidate + i - 2;
+            error = EXFAT_Move(fs, fs->bitmapStart + bit / (EXFAT_BLOCK_SIZE * 8));
+            if(error != EXFAT_OK)
+                return error;
+            uint8_t byte = fs->buffer[(bit / 8) % EXFAT_BLOCK_SIZE];
+            /*Free bytes are checked at once*/
+            if(!byte && !(bit % 8) && (count - i >= 8))
+            {
+                i += 8;
+                continue;
+            }
+            if((byte >> (bit % 8)) & 1)
+                break;
+            i++;
+        }
+        if(i >= count)
+        {
+            *first = candidate;
+            return EXFAT_OK;
+        }
+        candidate = EXFAT_AlignCluster(candidate + i + 1, step, phase);
+    }
+}
+
+/** \brief Mark run of clusters as allocated in bitmap, whole bytes are set at once
+  * \param  fs: pointer to volume structure
+  * \param  first: the first cluster of run
+  * \param  count: number of clusters
+  * \retval exFAT error number
+*/
+static EXFAT_Error_t EXFAT_SetRun(EXFAT_FS_t * fs, uint32_t first, uint32_t count)
+{
+    EXFAT_Error_t error = EXFAT_MarkDirty(fs);
+    uint32_t i = 0;
+    while((error == EXFAT_OK) && (i < count))
+    {
+        uint32_t bit = first + i - 2;
+        error = EXFAT_Move(fs, fs->bitmapStart + bit / (EXFAT_BLOCK_SIZE * 8));
+        if(error != EXFAT_OK)
+            break;
+        uint8_t * byte = &fs->buffer[(bit / 8) % EXFAT_BLOCK_SIZE];
+        if(!(bit % 8) && (count - i >= 8))
+        {
+            *byte = 0xFF;
+            i += 8;
+        }
+        else
+        {
+            *byte |= 1 << (bit % 8);
+            i++;
+        }
+        fs->dirty = 1;
+    }
+    if((error == EXFAT_OK) && (first + count > fs->nextFree))
+        fs->nextFree = first + count;
+    return error;
+}
+
+/** \brief Free clusters in allocation bitmap. FAT entries of free clusters are not used
+  * \param  fs: pointer to volume structure
+  * \param  cluster: first cluster to free
+  * \param  count: number of clusters
+  * \param  noFatChain: 1 if clusters are contiguous, 0 if they are linked in FAT
+  * \retval exFAT error number
+*/
+static EXFAT_Error_t EXFAT_FreeClusters(EXFAT_FS_t * fs, uint32_t cluster, uint32_t count, uint8_t noFatChain)
+{
+    EXFAT_Error_t error = EXFAT_OK;
+    for(uint32_t i = 0; i < count; ++i)
+    {
+        if(!EXFAT_IsCluster(fs, cluster))
+            return EXFAT_CORRUPT;
+        error = EXFAT_SetBit(fs, cluster, 0);
+        if(error != EXFAT_OK)
+            return error;
+        if(cluster < fs->nextFree)
+            fs->nextFree = cluster;
+        if(noFatChain)
+            cluster++;
+        else if(i + 1 < count)
+        {
+            error = EXFAT_GetEntry(fs, cluster, &cluster);
+            if(error != EXFAT_OK)
+                return error;
+        }
+    }
+    return EXFAT_OK;
+}
+
+/** \brief Find volume cluster of file cluster. Contiguous file is mapped without FAT,
+  *        FAT chain is walked from cursor and contiguous clusters are counted until want clusters are known
+  * \param  file: pointer to file structure
+  * \param  index: number of cluster in file
+  * \param  want: number of clusters needed from index
+  * \param  cluster: pointer where to put volume cluster
+  * \param  count: pointer where to put number of known contiguous clusters from cluster
+  * \retval exFAT error number, EXFAT_NOT_FOUND if file has less clusters
+*/
+static EXFAT_Error_t EXFAT_MapCluster(EXFAT_File_t * file, uint32_t index, uint32_t want, uint32_t * cluster, uint32_t * count)
+{
+    EXFAT_FS_t * fs = file->fs;
+    EXFAT_Error_t error = EXFAT_OK;
+    uint32_t next = 0;
+    if(index >= file->clusters)
+        return EXFAT_NOT_FOUND;
+    if(file->noFatChain)
+    {
+        *cluster = file->firstCluster + index;
+        *count = file->clusters - index;
+        return EXFAT_OK;
+    }
+    if(!file->cursorCluster || (index < file->cursorIndex))
+    {
+        file->cursorIndex = 0;
+        file->cursorCluster = file->firstCluster;
+    }
+    while(file->cursorIndex < index)
+    {
+        error = EXFAT_GetEntry(fs, file->cursorCluster, &next);
+        if(error != EXFAT_OK)
+            return error;
+        if(!EXFAT_IsCluster(fs, next))
+            return EXFAT_CORRUPT;
+        file->cursorCluster = next;
+        file->cursorIndex++;
+    }
+    *cluster = file->cursorCluster;
+    *count = 1;
+    /*Cursor stays at the last visited cluster, the next call starts there*/
+    while((*count < want) && (file->cursorIndex + 1 < file->clusters))
+    {
+        error = EXFAT_GetEntry(fs, file->cursorCluster, &next);
+        if(error != EXFAT_OK)
+            return error;
+        if(!EXFAT_IsCluster(fs, next))
+            return EXFAT_CORRUPT;
+        file->cursorIndex++;
+        if(next != file->cursorCluster + 1)
+        {
+            file->cursorCluster = next;
+            break;
+        }
+        file->cursorCluster = next;
+        (*count)++;
+    }
+    return EXFAT_OK;
+}
+
+/** \brief Allocate clusters of file. Contiguous file grows in place while the next cluster is free,
+  *        otherwise its clusters are linked in FAT and NoFatChain flag is cleared
+  * \param  file: pointer to file structure
+  * \param  clusters: needed number of clusters
+  * \retval exFAT error number
+*/
+static EXFAT_Error_t EXFAT_ExtendFile(EXFAT_File_t * file, uint32_t clusters)
+{
+    EXFAT_FS_t * fs = file->fs;
+    EXFAT_Error_t error = EXFAT_OK;
+    uint32_t cluster = 0;
+    uint32_t count = 0;
+    uint8_t used = 1;
+    if(file->clusters >= clusters)
+        return EXFAT_OK;
+    file->modified = 1;
+    if(!file->clusters)
+    {
+        error = EXFAT_AllocCluster(fs, &cluster);
+        if(error != EXFAT_OK)
+            return error;
+        file->firstCluster = cluster;
+        file->tail = cluster;
+        file->noFatChain = 1;
+        file->clusters = 1;
+    }
+    if(file->noFatChain)
+        file->tail = file->firstCluster + file->clusters - 1;
+    else if(!file->tail)
+    {
+        error = EXFAT_MapCluster(file, file->clusters - 1, 1, &file->tail, &count);
+        if(error != EXFAT_OK)
+            return error;
+    }
+    while(file->clusters < clusters)
+    {
+        /*Cluster right after the tail keeps file contiguous*/
+        cluster = file->tail + 1;
+        used = 1;
+        if(EXFAT_IsCluster(fs, cluster))
+        {
+            error = EXFAT_GetBit(fs, cluster, &used);
+            if(error != EXFAT_OK)
+                return error;
+        }
+        if(!used)
+            error = EXFAT_SetBit(fs, cluster, 1);
+        else
+        {
+            error = EXFAT_AllocCluster(fs, &cluster);
+            if(error != EXFAT_OK)
+                return error;
+            /*File is fragmented from now, link existing clusters*/
+            for(uint32_t i = 0; (error == EXFAT_OK) && file->noFatChain && (i + 1 < file->clusters); ++i)
+                error = EXFAT_SetEntry(fs, file->firstCluster + i, file->firstCluster + i + 1);
+            if(error != EXFAT_OK)
+            {
+                /*Contiguous file stays valid without new cluster*/
+                EXFAT_SetBit(fs, cluster, 0);
+                return error;
+            }
+            file->noFatChain = 0;
+        }
+        if((error == EXFAT_OK) && !file->noFatChain)
+        {
+            error = EXFAT_SetEntry(fs, file->tail, cluster);
+            if(error == EXFAT_OK)
+                error = EXFAT_SetEntry(fs, cluster, EXFAT_EOC_MARK);
+        }
+        if(error != EXFAT_OK)
+            return error;
+        if(cluster >= fs->nextFree)
+            fs->nextFree = cluster + 1;
+        file->tail = cluster;
+        file->clusters++;
+    }
+    return EXFAT_OK;
+}
+
+/** \brief Convert ASCII character to upper case, other characters are not changed
+  * \param  c: UTF-16 character
+  * \retval character in upper case
+*/
+static uint16_t EXFAT_Upcase(uint16_t c)
+{
+    return ((c >= 'a') && (c <= 'z')) ? c - ('a' - 'A') : c;
+}
+
+/** \brief Take path component as file name
+  * \param  path: pointer to path, it is moved to the next component
+  * \param  name: pointer to buffer of 255 characters for name
+  * \param  len: pointer where to put name length
+  * \retval exFAT error number
+*/
+static EXFAT_Error_t EXFAT_MakeName(const char ** path, char * name, uint8_t * len)
+{
+    const char * p = *path;
+    uint16_t i = 0;
+    while(*p && (*p != '/'))
+    {
+        char c = *p++;
+        if((i >= EXFAT_NAME_LEN) || ((uint8_t)c < ' ') || ((uint8_t)c >= 0x80) || strchr("\"*:<>?\\|", c))
+            return EXFAT_INVALID_NAME;
+        name[i++] = c;
+    }
+    if(!i || ((i == 1) && (name[0] == '.')) || ((i == 2) && (name[0] == '.') && (name[1] == '.')))
+        return EXFAT_INVALID_NAME;
+    if(*p == '/')
+        p++;
+    *path = p;
+    *len = (uint8_t)i;
+    return EXFAT_OK;
+}
+
+/** \brief Calculate name hash of stream extension entry
+  * \param  name: pointer to name
+  * \param  len: name length
+  * \retval hash of up-cased name
+*/
+static uint16_t EXFAT_NameHash(const char * name, uint8_t len)
+{
+    uint16_t hash = 0;
+    for(uint8_t i = 0; i < len; ++i)
+    {
+        uint16_t c = EXFAT_Upcase((uint8_t)name[i]);
+        hash = ((hash & 1) ? 0x8000 : 0) + (hash >> 1) + (c & 0xFF);
+        hash = ((hash & 1) ? 0x8000 : 0) + (hash >> 1) + (c >> 8);
+    }
+    return hash;
+}
+
+/** \brief Load block of directory entry to window
+  * \param  fs: pointer to volume structure
+  * \param  dir: pointer to position in directory
+  * \param  entry: pointer where to put pointer to entry in window
+  * \retval exFAT error number
+*/
+static EXFAT_Error_t EXFAT_Entry(EXFAT_FS_t * fs, EXFAT_Dir_t * dir, uint8_t ** entry)
+{
+    EXFAT_Error_t error = EXFAT_Move(fs, EXFAT_ClusterBlock(fs, dir->cluster) + dir->block);
+    *entry = fs->buffer + dir->offset;
+    return error;
+}
+
+/** \brief Move position to the next directory entry
+  * \param  fs: pointer to volume structure
+  * \param  dir: pointer to position in directory
+  * \retval exFAT error number, EXFAT_NOT_FOUND at the end of directory. Cluster stays the last one then
+*/
+static EXFAT_Error_t EXFAT_NextEntry(EXFAT_FS_t * fs, EXFAT_Dir_t * dir)
+{
+    EXFAT_Error_t error = EXFAT_OK;
+    uint32_t next = 0;
+    dir->offset += EXFAT_DIR_ENTRY;
+    if(dir->offset < EXFAT_BLOCK_SIZE)
+        return EXFAT_OK;
+    dir->offset = 0;
+    if(++dir->block < fs->clusterBlocks)
+        return EXFAT_OK;
+    dir->block = 0;
+    if(dir->length)
+    {
+        if(dir->index + 1 >= dir->length)
+            return EXFAT_NOT_FOUND;
+        next = dir->cluster + 1;
+    }
+    else
+    {
+        error = EXFAT_GetEntry(fs, dir->cluster, &next);
+        if(error != EXFAT_OK)
+            return error;
+        if(next >= EXFAT_EOC)
+            return EXFAT_NOT_FOUND;
+        if(!EXFAT_IsCluster(fs, next))
+            return EXFAT_CORRUPT;
+    }
+    dir->cluster = next;
+    dir->index++;
+    return EXFAT_OK;
+}
+
+/** \brief Set position to the first entry of directory
+  * \param  dir: pointer to position in directory
+  * \param  first: first cluster of directory
+  * \param  length: clusters of contiguous directory, 0 if directory uses FAT chain
+  * \retval None
+*/
+static void EXFAT_StartDir(EXFAT_Dir_t * dir, uint32_t first, uint32_t length)
+{
+    dir->first = first;
+    dir->length = length;
+    dir->cluster = first;
+    dir->index = 0;
+    dir->block = 0;
+    dir->offset = 0;
+}
+
+/** \brief Calculate and store checksum of entry set
+  * \param  fs: pointer to volume structure
+  * \param  set: position of file entry
+  * \retval exFAT error number
+*/
+static EXFAT_Error_t EXFAT_SetChecksum(EXFAT_FS_t * fs, EXFAT_Dir_t * set)
+{
+    EXFAT_Error_t error = EXFAT_OK;
+    EXFAT_Dir_t dir = *set;
+    uint8_t * entry = 0;
+    uint16_t checksum = 0;
+    uint8_t count = 0;
+    error = EXFAT_Entry(fs, &dir, &entry);
+    if(error != EXFAT_OK)
+        return error;
+    count = entry[1] + 1;
+    for(uint8_t i = 0; i < count; ++i)
+    {
+        if(i)
+        {
+            error = EXFAT_NextEntry(fs, &dir);
+            if(error == EXFAT_OK)
+                error = EXFAT_Entry(fs, &dir, &entry);
+            if(error != EXFAT_OK)
+                return (error == EXFAT_NOT_FOUND) ? EXFAT_CORRUPT : error;
+        }
+        for(uint8_t j = 0; j < EXFAT_DIR_ENTRY; ++j)
+        {
+            /*Checksum field itself is skipped*/
+            if(!i && ((j == 2) || (j == 3)))
+                continue;
+            checksum = ((checksum & 1) ? 0x8000 : 0) + (checksum >> 1) + entry[j];
+        }
+    }
+    dir = *set;
+    error = EXFAT_Entry(fs, &dir, &entry);
+    if(error != EXFAT_OK)
+        return error;
+    EXFAT_Store16(entry + 2, checksum);
+    fs->dirty = 1;
+    return EXFAT_OK;
+}
+
+/** \brief Find file in directory, name is compared without case of ASCII letters
+  * \param  fs: pointer to volume structure
+  * \param  dir: position at the start of directory
+  * \param  name: file name
+  * \param  len: name length
+  * \param  file: pointer to file structure where to put entry position, clusters and sizes
+  * \param  attributes: pointer where to put file attributes
+  * \retval exFAT error number
+*/
+static EXFAT_Error_t EXFAT_FindEntry(EXFAT_FS_t * fs, EXFAT_Dir_t dir, const char * name, uint8_t len, EXFAT_File_t * file, uint16_t * attributes)
+{
+    EXFAT_Error_t error = EXFAT_OK;
+    uint16_t hash = EXFAT_NameHash(name, len);
+    uint8_t * entry = 0;
+    while(1)
+    {
+        error = EXFAT_Entry(fs, &dir, &entry);
+        if(error != EXFAT_OK)
+            return error;
+        /*Zero type ends directory*/
+        if(!entry[0])
+            return EXFAT_NOT_FOUND;
+        if(entry[0] == EXFAT_TYPE_FILE)
+        {
+            EXFAT_Dir_t set = dir;
+            uint8_t secondary = entry[1];
+            uint16_t attr = EXFAT_Load16(entry + 4);
+            uint8_t k = 0;
+            error = EXFAT_NextEntry(fs, &dir);
+            if(error == EXFAT_OK)
+                error = EXFAT_Entry(fs, &dir, &entry);
+            if(error != EXFAT_OK)
+                return error;
+            if((entry[0] != EXFAT_TYPE_STREAM) || (entry[3] != len) || (EXFAT_Load16(entry + 4) != hash) ||
+               (secondary < 1 + (len + EXFAT_NAME_PART - 1) / EXFAT_NAME_PART))
+                continue;
+            file->entry = set;
+            file->noFatChain = (entry[1] & EXFAT_NO_FAT_CHAIN) ? 1 : 0;
+            file->size = EXFAT_Load64(entry + 8);
+            file->firstCluster = EXFAT_Load32(entry + 20);
+            file->length = EXFAT_Load64(entry + 24);
+            /*Compare name in file name entries*/
+            for(k = 0; k < len; ++k)
+            {
+                if(!(k % EXFAT_NAME_PART))
+                {
+                    error = EXFAT_NextEntry(fs, &dir);
+                    if(error == EXFAT_OK)
+                        error = EXFAT_Entry(fs, &dir, &entry);
+                    if(error != EXFAT_OK)
+                        return error;
+                    if(entry[0] != EXFAT_TYPE_NAME)
+                        break;
+                }
+                if(EXFAT_Upcase(EXFAT_Load16(entry + 2 + 2 * (k % EXFAT_NAME_PART))) != EXFAT_Upcase((uint8_t)name[k]))
+                    break;
+            }
+            if(k == len)
+            {
+                *attributes = attr;
+                return EXFAT_OK;
+            }
+            continue;
+        }
+        error = EXFAT_NextEntry(fs, &dir);
+        if(error != EXFAT_OK)
+            return error;
+    }
+}
+
+/** \brief Create entry set of empty file. Root directory gets new zeroed cluster when it is full
+  * \param  fs: pointer to volume structure
+  * \param  dir: position at the start of directory
+  * \param  name: file name
+  * \param  len: name length
+  * \param  set: pointer where to put position of file entry
+  * \retval exFAT error number
+*/
+static EXFAT_Error_t EXFAT_AddEntry(EXFAT_FS_t * fs, EXFAT_Dir_t dir, const char * name, uint8_t len, EXFAT_Dir_t * set)
+{
+    EXFAT_Error_t error = EXFAT_OK;
+    uint8_t count = 2 + (len + EXFAT_NAME_PART - 1) / EXFAT_NAME_PART;
+    uint8_t found = 0;
+    uint8_t * entry = 0;
+    uint32_t cluster = 0;
+    error = EXFAT_MarkDirty(fs);
+    if(error != EXFAT_OK)
+        return error;
+    /*Find run of unused entries*/
+    while(found < count)
+    {
+        error = EXFAT_Entry(fs, &dir, &entry);
+        if(error != EXFAT_OK)
+            return error;
+        if(entry[0] & EXFAT_TYPE_IN_USE)
+            found = 0;
+        else if(!found++)
+            *set = dir;
+        if(found == count)
+            break;
+        error = EXFAT_NextEntry(fs, &dir);
+        if(error != EXFAT_NOT_FOUND)
+        {
+            if(error != EXFAT_OK)
+                return error;
+            continue;
+        }
+        /*Subdirectory size is kept in parent entry set, only root directory can grow here*/
+        if(dir.first != fs->rootCluster)
+            return EXFAT_NO_SPACE;
+        error = EXFAT_AllocCluster(fs, &cluster);
+        if(error == EXFAT_OK)
+            error = EXFAT_SetEntry(fs, dir.cluster, cluster);
+        if(error == EXFAT_OK)
+            error = EXFAT_SetEntry(fs, cluster, EXFAT_EOC_MARK);
+        for(uint32_t b = 0; (error == EXFAT_OK) && (b < fs->clusterBlocks); ++b)
+        {
+            error = EXFAT_Flush(fs);
+            memset(fs->buffer, 0, EXFAT_BLOCK_SIZE);
+            fs->window = EXFAT_ClusterBlock(fs, cluster) + b;
+            fs->dirty = 1;
+        }
+        if(error != EXFAT_OK)
+            return error;
+        dir.cluster = cluster;
+        dir.index++;
+    }
+    /*Write file, stream extension and file name entries*/
+    dir = *set;
+    for(uint8_t i = 0; i < count; ++i)
+    {
+        if(i)
+        {
+            error = EXFAT_NextEntry(fs, &dir);
+            if(error != EXFAT_OK)
+                return error;
+        }
+        error = EXFAT_Entry(fs, &dir, &entry);
+        if(error != EXFAT_OK)
+            return error;
+        memset(entry, 0, EXFAT_DIR_ENTRY);
+        if(!i)
+        {
+            entry[0] = EXFAT_TYPE_FILE;
+            entry[1] = count - 1;
+            EXFAT_Store16(entry + 4, EXFAT_ATTR_ARCHIVE);
+            EXFAT_Store32(entry + 8, EXFAT_TIMESTAMP);
+            EXFAT_Store32(entry + 12, EXFAT_TIMESTAMP);
+            EXFAT_Store32(entry + 16, EXFAT_TIMESTAMP);
+        }
+        else if(i == 1)
+        {
+            entry[0] = EXFAT_TYPE_STREAM;
+            entry[1] = EXFAT_ALLOC_POSSIBLE | EXFAT_NO_FAT_CHAIN;
+            entry[3] = len;
+            EXFAT_Store16(entry + 4, EXFAT_NameHash(name, len));
+        }
+        else
+        {
+            entry[0] = EXFAT_TYPE_NAME;
+            for(uint8_t k = 0; k < EXFAT_NAME_PART; ++k)
+            {
+                uint16_t c = (i - 2) * EXFAT_NAME_PART + k;
+                if(c < len)
+                    EXFAT_Store16(entry + 2 + 2 * k, (uint8_t)name[c]);
+            }
+        }
+        fs->dirty = 1;
+    }
+    return EXFAT_SetChecksum(fs, set);
+}
+
+/** \brief Mount exFAT volume
+  * \param  fs: pointer to volume structure
+  * \param  part: pointer to partition with boot sector of volume in its first block
+  * \retval exFAT error number
+*/
+EXFAT_Error_t EXFAT_Mount(EXFAT_FS_t * fs, SD_Partition_t * part)
+{
+    EXFAT_Error_t error = EXFAT_OK;
+    uint8_t * boot = fs->buffer;
+    uint8_t * entry = 0;
+    EXFAT_Dir_t dir;
+    fs->part = part;
+    fs->window = EXFAT_NO_WINDOW;
+    fs->dirty = 0;
+    fs->volumeDirty = 0;
+    fs->wasDirty = 0;
+    error = EXFAT_Move(fs, 0);
+    if(error != EXFAT_OK)
+        return error;
+    /*Boot sector signature, name and 512-byte sectors*/
+    if((EXFAT_Load16(boot + 510) != 0xAA55) || memcmp(boot + 3, "EXFAT   ", 8) || (boot[108] != 9) || (boot[109] > 25 - 9))
+        return EXFAT_NO_FILESYSTEM;
+    /*Volume should fit in partition*/
+    if(EXFAT_Load32(boot + 76) || (EXFAT_Load32(boot + 72) > part->blocks))
+        return EXFAT_NO_FILESYSTEM;
+    uint32_t fatOffset = EXFAT_Load32(boot + 80);
+    uint32_t fatLength = EXFAT_Load32(boot + 84);
+    uint8_t active = (EXFAT_Load16(boot + 106) & EXFAT_FLAG_ACTIVE_FAT) && (boot[110] > 1);
+    fs->fatStart = fatOffset + (active ? fatLength : 0);
+    fs->clusterBlocks = (uint32_t)1 << boot[109];
+    fs->dataStart = EXFAT_Load32(boot + 88);
+    fs->clusters = EXFAT_Load32(boot + 92);
+    fs->rootCluster = EXFAT_Load32(boot + 96);
+    if(!fatOffset || !fs->clusters || ((uint64_t)fatLength * (EXFAT_BLOCK_SIZE / 4) < (uint64_t)fs->clusters + 2) ||
+       !EXFAT_IsCluster(fs, fs->rootCluster))
+        return EXFAT_NO_FILESYSTEM;
+    fs->nextFree = 2;
+    /*Allocation bitmap of active FAT is in root directory*/
+    EXFAT_StartDir(&dir, fs->rootCluster, 0);
+    while(1)
+    {
+        error = EXFAT_Entry(fs, &dir, &entry);
+        if(error != EXFAT_OK)
+            return error;
+        if(!entry[0])
+            return EXFAT_NO_FILESYSTEM;
+        if((entry[0] == EXFAT_TYPE_BITMAP) && ((entry[1] & 1) == active))
+            break;
+        error = EXFAT_NextEntry(fs, &dir);
+        if(error != EXFAT_OK)
+            return (error == EXFAT_NOT_FOUND) ? EXFAT_NO_FILESYSTEM : error;
+    }
+    uint32_t bitmap = EXFAT_Load32(entry + 20);
+    uint64_t bitmapLength = EXFAT_Load64(entry + 24);
+    if(!EXFAT_IsCluster(fs, bitmap) || (bitmapLength < (fs->clusters + 7) / 8))
+        return EXFAT_NO_FILESYSTEM;
+    fs->bitmapStart = EXFAT_ClusterBlock(fs, bitmap);
+    /*Bitmap is addressed as contiguous blocks, check its chain*/
+    uint32_t bitmapClusters = (uint32_t)((bitmapLength + fs->clusterBlocks * EXFAT_BLOCK_SIZE - 1) / (fs->clusterBlocks * EXFAT_BLOCK_SIZE));
+    for(uint32_t i = 0; i + 1 < bitmapClusters; ++i)
+    {
+        uint32_t next = 0;
+        error = EXFAT_GetEntry(fs, bitmap + i, &next);
+        if(error != EXFAT_OK)
+            return error;
+        if(next && (next != bitmap + i + 1))
+            return EXFAT_NO_FILESYSTEM;
+    }
+    return EXFAT_OK;
+}
+
+/** \brief Write changed window to SD card and clear VolumeDirty flag if it was clear at mount
+  * \param  fs: pointer to volume structure
+  * \retval exFAT error number
+*/
+EXFAT_Error_t EXFAT_Unmount(EXFAT_FS_t * fs)
+{
+    EXFAT_Error_t error = EXFAT_Flush(fs);
+    if((error != EXFAT_OK) || !fs->volumeDirty)
+        return error;
+    if(!fs->wasDirty)
+    {
+        error = EXFAT_Move(fs, 0);
+        if(error != EXFAT_OK)
+            return error;
+        EXFAT_Store16(fs->buffer + 106, EXFAT_Load16(fs->buffer + 106) & ~EXFAT_FLAG_DIRTY);
+        fs->dirty = 1;
+        error = EXFAT_Flush(fs);
+    }
+    if(error == EXFAT_OK)
+        fs->volumeDirty = 0;
+    return error;
+}
+
+/** \brief Open file
+  * \param  file: pointer to file structure
+  * \param  fs: pointer to mounted volume structure
+  * \param  path: path from root directory with ASCII names, e.g. "Logs/Data.bin"
+  * \param  mode: combination of EXFAT_Mode_t flags
+  * \retval exFAT error number
+*/
+EXFAT_Error_t EXFAT_Open(EXFAT_File_t * file, EXFAT_FS_t * fs, const char * path, uint8_t mode)
+{
+    EXFAT_Error_t error = EXFAT_OK;
+    char name[EXFAT_NAME_LEN];
+    uint8_t len = 0;
+    uint16_t attributes = 0;
+    uint32_t clusterBytes = fs->clusterBlocks * EXFAT_BLOCK_SIZE;
+    EXFAT_Dir_t dir;
+    memset(file, 0, sizeof(EXFAT_File_t));
+    file->fs = fs;
+    file->mode = mode;
+    EXFAT_StartDir(&dir, fs->rootCluster, 0);
+    if(*path == '/')
+        path++;
+    while(1)
+    {
+        error = EXFAT_MakeName(&path, name, &len);
+        if(error != EXFAT_OK)
+            return error;
+        error = EXFAT_FindEntry(fs, dir, name, len, file, &attributes);
+        /*The last component is file*/
+        if(!*path)
+            break;
+        if(error != EXFAT_OK)
+            return error;
+        if(!(attributes & EXFAT_ATTR_DIRECTORY) || !EXFAT_IsCluster(fs, file->firstCluster))
+            return EXFAT_NOT_FOUND;
+        EXFAT_StartDir(&dir, file->firstCluster,
+                       file->noFatChain ? (uint32_t)((file->length + clusterBytes - 1) / clusterBytes) : 0);
+    }
+    if((error == EXFAT_NOT_FOUND) && (mode & EXFAT_MODE_CREATE))
+    {
+        error = EXFAT_AddEntry(fs, dir, name, len, &file->entry);
+        if(error != EXFAT_OK)
+            return error;
+        file->firstCluster = 0;
+        file->noFatChain = 1;
+        file->size = 0;
+        file->length = 0;
+        attributes = EXFAT_ATTR_ARCHIVE;
+    }
+    else if(error != EXFAT_OK)
+        return error;
+    if(attributes & EXFAT_ATTR_DIRECTORY)
+        return EXFAT_DENIED;
+    file->clusters = (uint32_t)((file->length + clusterBytes - 1) / clusterBytes);
+    if(file->clusters && !EXFAT_IsCluster(fs, file->firstCluster))
+        return EXFAT_CORRUPT;
+    if((mode & EXFAT_MODE_TRUNCATE) && (mode & EXFAT_MODE_WRITE) && (file->clusters || file->length))
+    {
+        error = EXFAT_FreeClusters(fs, file->firstCluster, file->clusters, file->noFatChain);
+        if(error != EXFAT_OK)
+            return error;
+        file->firstCluster = 0;
+        file->clusters = 0;
+        file->noFatChain = 1;
+        file->size = 0;
+        file->length = 0;
+        file->modified = 1;
+        /*Entry set should not point to free clusters*/
+        error = EXFAT_Sync(file);
+        if(error != EXFAT_OK)
+            return error;
+    }
+    if(mode & EXFAT_MODE_APPEND)
+        file->position = file->size;
+    return EXFAT_OK;
+}
+
+/** \brief Read data from file. Whole blocks of contiguous clusters are read with one multiple read
+  * \param  file: pointer to file structure
+  * \param  data: pointer to buffer for data
+  * \param  len: number of bytes to read
+  * \param  read: pointer where to put number of bytes read
+  * \retval exFAT error number
+*/
+EXFAT_Error_t EXFAT_Read(EXFAT_File_t * file, uint8_t * data, uint32_t len, uint32_t * read)
+{
+    EXFAT_FS_t * fs = file->fs;
+    EXFAT_Error_t error = EXFAT_OK;
+    uint32_t clusterBytes = fs->clusterBlocks * EXFAT_BLOCK_SIZE;
+    *read = 0;
+    if(!(file->mode & EXFAT_MODE_READ))
+        return EXFAT_DENIED;
+    if(len > file->size - file->position)
+        len = (uint32_t)(file->size - file->position);
+    while(len)
+    {
+        uint32_t inCluster = (uint32_t)(file->position % clusterBytes);
+        uint32_t offset = (uint32_t)(file->position % EXFAT_BLOCK_SIZE);
+        uint32_t cluster = 0;
+        uint32_t count = 0;
+        uint32_t part = 0;
+        /*Ask for all clusters the rest of read needs*/
+        error = EXFAT_MapCluster(file, (uint32_t)(file->position / clusterBytes),
+                                 (uint32_t)(((uint64_t)inCluster + len + clusterBytes - 1) / clusterBytes), &cluster, &count);
+        if(error != EXFAT_OK)
+            return (error == EXFAT_NOT_FOUND) ? EXFAT_CORRUPT : error;
+        uint32_t block = EXFAT_ClusterBlock(fs, cluster) + inCluster / EXFAT_BLOCK_SIZE;
+        if(offset || (len < EXFAT_BLOCK_SIZE))
+        {
+            /*Part of block goes through window*/
+            part = EXFAT_BLOCK_SIZE - offset;
+            if(part > len)
+                part = len;
+            error = EXFAT_Move(fs, block);
+            if(error != EXFAT_OK)
+                return error;
+            memcpy(data, fs->buffer + offset, part);
+        }
+        else
+        {
+            uint32_t blocks = len / EXFAT_BLOCK_SIZE;
+            uint32_t limit = count * fs->clusterBlocks - inCluster / EXFAT_BLOCK_SIZE;
+            if(blocks > limit)
+                blocks = limit;
+            error = EXFAT_DropWindow(fs, block, blocks);
+            if(error == EXFAT_OK)
+                error = EXFAT_ReadBlocks(fs, block, data, blocks);
+            if(error != EXFAT_OK)
+                return error;
+            part = blocks * EXFAT_BLOCK_SIZE;
+        }
+        data += part;
+        len -= part;
+        file->position += part;
+        *read += part;
+    }
+    return EXFAT_OK;
+}
+
+/** \brief Write data to file. Clusters are allocated before transfer,
+  *        whole blocks of contiguous clusters are written with one multiple write
+  * \param  file: pointer to file structure
+  * \param  data: pointer to data
+  * \param  len: number of bytes to write
+  * \param  written: pointer where to put number of bytes written
+  * \retval exFAT error number
+*/
+EXFAT_Error_t EXFAT_Write(EXFAT_File_t * file, uint8_t * data, uint32_t len, uint32_t * written)
+{
+    EXFAT_FS_t * fs = file->fs;
+    EXFAT_Error_t error = EXFAT_OK;
+    uint32_t clusterBytes = fs->clusterBlocks * EXFAT_BLOCK_SIZE;
+    uint64_t need = (file->position + len + clusterBytes - 1) / clusterBytes;
+    *written = 0;
+    if(!(file->mode & EXFAT_MODE_WRITE))
+        return EXFAT_DENIED;
+    if(!len)
+        return EXFAT_OK;
+    if(need > 0xFFFFFFFF)
+        return EXFAT_NO_SPACE;
+    error = EXFAT_ExtendFile(file, (uint32_t)need);
+    if(error != EXFAT_OK)
+        return error;
+    while(len)
+    {
+        uint32_t inCluster = (uint32_t)(file->position % clusterBytes);
+        uint32_t offset = (uint32_t)(file->position % EXFAT_BLOCK_SIZE);
+        uint32_t cluster = 0;
+        uint32_t count = 0;
+        uint32_t part = 0;
+        error = EXFAT_MapCluster(file, (uint32_t)(file->position / clusterBytes),
+                                 (uint32_t)(((uint64_t)inCluster + len + clusterBytes - 1) / clusterBytes), &cluster, &count);
+        if(error != EXFAT_OK)
+            return (error == EXFAT_NOT_FOUND) ? EXFAT_CORRUPT : error;
+        uint32_t block = EXFAT_ClusterBlock(fs, cluster) + inCluster / EXFAT_BLOCK_SIZE;
+        if(offset || (len < EXFAT_BLOCK_SIZE))
+        {
+            /*Part of block goes through window*/
+            part = EXFAT_BLOCK_SIZE - offset;
+            if(part > len)
+                part = len;
+            error = EXFAT_Move(fs, block);
+            if(error != EXFAT_OK)
+                return error;
+            memcpy(fs->buffer + offset, data, part);
+            fs->dirty = 1;
+        }
+        else
+        {
+            uint32_t blocks = len / EXFAT_BLOCK_SIZE;
+            uint32_t limit = count * fs->clusterBlocks - inCluster / EXFAT_BLOCK_SIZE;
+            if(blocks > limit)
+                blocks = limit;
+            error = EXFAT_DropWindow(fs, block, blocks);
+            if(error == EXFAT_OK)
+                error = EXFAT_WriteBlocks(fs, block, data, blocks);
+            if(error != EXFAT_OK)
+                return error;
+            part = blocks * EXFAT_BLOCK_SIZE;
+        }
+        data += part;
+        len -= part;
+        file->position += part;
+        *written += part;
+        if(file->position > file->size)
+        {
+            file->size = file->position;
+            file->modified = 1;
+        }
+    }
+    /*Write-through partition keeps no changed blocks in window between calls*/
+    if(fs->part->cache == SD_PARTITION_WRITE_THROUGH)
+        return EXFAT_Flush(fs);
+    return EXFAT_OK;
+}
+
+/** \brief Set position in file
+  * \param  file: pointer to file structure
+  * \param  position: position in bytes, it is limited by file size
+  * \retval exFAT error number
+*/
+EXFAT_Error_t EXFAT_Seek(EXFAT_File_t * file, uint64_t position)
+{
+    if(position > file->size)
+        position = file->size;
+    file->position = position;
+    return EXFAT_OK;
+}
+
+/** \brief Reserve contiguous clusters for empty file. Run starts on allocation unit boundary,
+  *        so stream writes of file never share allocation unit with other data
+  * \param  file: pointer to file structure opened for write
+  * \param  bytes: number of bytes to reserve
+  * \param  erase: 1 to erase reserved blocks with CMD38 before recording
+  * \retval exFAT error number. File size stays 0, reserved clusters are kept in DataLength until
+  *         EXFAT_Trim or EXFAT_Close frees clusters after file end
+*/
+EXFAT_Error_t EXFAT_Preallocate(EXFAT_File_t * file, uint64_t bytes, uint8_t erase)
+{
+    EXFAT_FS_t * fs = file->fs;
+    EXFAT_Error_t error = EXFAT_OK;
+    uint32_t clusterBytes = fs->clusterBlocks * EXFAT_BLOCK_SIZE;
+    uint64_t count = (bytes + clusterBytes - 1) / clusterBytes;
+    uint32_t first = 0;
+    if(!(file->mode & EXFAT_MODE_WRITE) || file->clusters)
+        return EXFAT_DENIED;
+    if(!count)
+        return EXFAT_OK;
+    if(count > fs->clusters)
+        return EXFAT_NO_SPACE;
+    error = EXFAT_FindRun(fs, (uint32_t)count, &first);
+    if(error == EXFAT_OK)
+        error = EXFAT_SetRun(fs, first, (uint32_t)count);
+    if(error != EXFAT_OK)
+        return error;
+    file->firstCluster = first;
+    file->clusters = (uint32_t)count;
+    file->noFatChain = 1;
+    file->tail = first + file->clusters - 1;
+    file->length = count * clusterBytes;
+    file->modified = 1;
+    /*Entry set owns clusters before the long erase*/
+    error = EXFAT_Sync(file);
+    if(error != EXFAT_OK)
+        return error;
+    if(erase && (SD_PartitionErase(fs->part, EXFAT_ClusterBlock(fs, first), file->clusters * fs->clusterBlocks) != SD_OK))
+        return EXFAT_DISK_ERROR;
+    return EXFAT_OK;
+}
+
+/** \brief Start write stream at current position of contiguous file
+  * \param  file: pointer to file structure opened for write
+  * \param  stream: pointer to stream structure
+  * \param  buffer: pointer to staging buffer
+  * \param  bufferBlocks: size of staging buffer in blocks, at least 1
+  * \retval exFAT error number. Position should be multiple of block size
+*/
+EXFAT_Error_t EXFAT_StreamOpen(EXFAT_File_t * file, SD_Stream_t * stream, uint8_t * buffer, uint32_t bufferBlocks)
+{
+    EXFAT_FS_t * fs = file->fs;
+    EXFAT_Error_t error = EXFAT_OK;
+    if(!(file->mode & EXFAT_MODE_WRITE) || !file->clusters || !file->noFatChain || (file->position % EXFAT_BLOCK_SIZE))
+        return EXFAT_DENIED;
+    uint32_t first = EXFAT_ClusterBlock(fs, file->firstCluster);
+    /*Window must not keep old copy of file block*/
+    error = EXFAT_DropWindow(fs, first, file->clusters * fs->clusterBlocks);
+    if(error != EXFAT_OK)
+        return error;
+    SD_StreamInit(stream, fs->part->sd, fs->part->start + first + (uint32_t)(file->position / EXFAT_BLOCK_SIZE), buffer, bufferBlocks);
+    /*Stream is aligned to allocation unit of partition*/
+    stream->auBlocks = fs->part->auBlocks;
+    return EXFAT_OK;
+}
+
+/** \brief Write data to file through stream, blocks are addressed without FAT and bitmap
+  * \param  file: pointer to file structure
+  * \param  stream: pointer to stream started by EXFAT_StreamOpen
+  * \param  data: pointer to data
+  * \param  len: number of bytes
+  * \retval exFAT error number, EXFAT_NO_SPACE if data does not fit reserved clusters
+*/
+EXFAT_Error_t EXFAT_StreamWrite(EXFAT_File_t * file, SD_Stream_t * stream, uint8_t * data, uint32_t len)
+{
+    uint64_t reserved = (uint64_t)file->clusters * file->fs->clusterBlocks * EXFAT_BLOCK_SIZE;
+    if(file->position + stream->position + len > reserved)
+        return EXFAT_NO_SPACE;
+    return (SD_StreamWrite(stream, data, len) == SD_OK) ? EXFAT_OK : EXFAT_DISK_ERROR;
+}
+
+/** \brief Flush stream and set file size to the end of streamed data. Reserved clusters are kept
+  *        for the next stream, EXFAT_Close frees them
+  * \param  file: pointer to file structure
+  * \param  stream: pointer to stream started by EXFAT_StreamOpen
+  * \retval exFAT error number
+*/
+EXFAT_Error_t EXFAT_StreamClose(EXFAT_File_t * file, SD_Stream_t * stream)
+{
+    EXFAT_Error_t error = (SD_StreamFlush(stream) == SD_OK) ? EXFAT_OK : EXFAT_DISK_ERROR;
+    file->position += stream->position;
+    if(file->position > file->size)
+    {
+        file->size = file->position;
+        file->modified = 1;
+    }
+    stream->position = 0;
+    if(error != EXFAT_OK)
+        return error;
+    return EXFAT_Sync(file);
+}
+
+/** \brief Update stream extension and checksum of entry set, write changed window to SD card.
+  *        DataLength covers all allocated clusters, ValidDataLength is file size
+  * \param  file: pointer to file structure
+  * \retval exFAT error number
+*/
+EXFAT_Error_t EXFAT_Sync(EXFAT_File_t * file)
+{
+    EXFAT_FS_t * fs = file->fs;
+    EXFAT_Error_t error = EXFAT_OK;
+    uint64_t clusterBytes = fs->clusterBlocks * EXFAT_BLOCK_SIZE;
+    EXFAT_Dir_t dir = file->entry;
+    uint8_t * entry = 0;
+    if(file->modified)
+    {
+        if(file->length < file->size)
+            file->length = file->size;
+        if((file->length + clusterBytes - 1) / clusterBytes < file->clusters)
+            file->length = file->clusters * clusterBytes;
+        error = EXFAT_MarkDirty(fs);
+        if(error == EXFAT_OK)
+            error = EXFAT_NextEntry(fs, &dir);
+        if(error == EXFAT_OK)
+            error = EXFAT_Entry(fs, &dir, &entry);
+        if(error != EXFAT_OK)
+            return (error == EXFAT_NOT_FOUND) ? EXFAT_CORRUPT : error;
+        if(entry[0] != EXFAT_TYPE_STREAM)
+            return EXFAT_CORRUPT;
+        entry[1] = (entry[1] & ~EXFAT_NO_FAT_CHAIN) | EXFAT_ALLOC_POSSIBLE | (file->noFatChain ? EXFAT_NO_FAT_CHAIN : 0);
+        EXFAT_Store64(entry + 8, file->size);
+        EXFAT_Store32(entry + 20, file->firstCluster);
+        EXFAT_Store64(entry + 24, file->length);
+        fs->dirty = 1;
+        error = EXFAT_SetChecksum(fs, &file->entry);
+        if(error != EXFAT_OK)
+            return error;
+        file->modified = 0;
+    }
+    return EXFAT_Flush(fs);
+}
+
+/** \brief Free clusters after file size rounded up to cluster and cut DataLength to the rest,
+  *        then sync file. Clusters reserved by EXFAT_Preallocate and not filled go back to bitmap
+  * \param  file: pointer to file structure opened for write
+  * \retval exFAT error number
+*/
+EXFAT_Error_t EXFAT_Trim(EXFAT_File_t * file)
+{
+    EXFAT_FS_t * fs = file->fs;
+    EXFAT_Error_t error = EXFAT_OK;
+    uint64_t clusterBytes = fs->clusterBlocks * EXFAT_BLOCK_SIZE;
+    uint32_t keep = (uint32_t)((file->size + clusterBytes - 1) / clusterBytes);
+    uint32_t cluster = file->firstCluster;
+    uint32_t count = 0;
+    if(!(file->mode & EXFAT_MODE_WRITE))
+        return EXFAT_DENIED;
+    if(keep < file->clusters)
+    {
+        if(keep && file->noFatChain)
+            cluster = file->firstCluster + keep;
+        /*The last kept cluster ends FAT chain*/
+        else if(keep)
+        {
+            error = EXFAT_MapCluster(file, keep - 1, 1, &file->tail, &count);
+            if(error == EXFAT_OK)
+                error = EXFAT_GetEntry(fs, file->tail, &cluster);
+            if(error == EXFAT_OK)
+                error = EXFAT_SetEntry(fs, file->tail, EXFAT_EOC_MARK);
+            if(error != EXFAT_OK)
+                return (error == EXFAT_NOT_FOUND) ? EXFAT_CORRUPT : error;
+        }
+        error = EXFAT_FreeClusters(fs, cluster, file->clusters - keep, file->noFatChain);
+        if(error != EXFAT_OK)
+            return error;
+        file->clusters = keep;
+        file->length = keep * clusterBytes;
+        file->cursorIndex = 0;
+        file->cursorCluster = 0;
+        if(!keep)
+        {
+            file->firstCluster = 0;
+            file->noFatChain = 1;
+            file->tail = 0;
+        }
+        else if(file->noFatChain)
+            file->tail = file->firstCluster + keep - 1;
+        file->modified = 1;
+    }
+    return EXFAT_Sync(file);
+}
+
+/** \brief Close file, file opened for write is trimmed to its size
+  * \param  file: pointer to file structure
+  * \retval exFAT error number
+*/
+EXFAT_Error_t EXFAT_Close(EXFAT_File_t * file)
+{
+    EXFAT_Error_t error = (file->mode & EXFAT_MODE_WRITE) ? EXFAT_Trim(file) : EXFAT_Sync(file);
+    file->mode = 0;
+    return error;
+}
@@ -0,0 +1,412 @@
+#!/usr/bin/env python3
+"""FAT32 image fixtures and checker for host tests of FAT32 layer.
+
+make IMAGE MANIFEST    build MBR card image with FAT32 volume and list its files in MANIFEST
+check IMAGE MANIFEST   check volume structure and compare files of volume with MANIFEST
+mtools IMAGE MANIFEST  read files of MANIFEST with mtype, IMAGE is given as image@@offset
+
+make and check work without FAT32 code of the driver, so they are reference for host tests.
+Manifest lines are "D path" for directories and "F path size crc32" for files.
+"""
+
+import struct
+import subprocess
+import sys
+import zlib
+
+BLOCK = 512
+PART_START = 2048
+PART_BLOCKS = 80000
+RESERVED = 32
+NUM_FATS = 2
+CLUSTER_BLOCKS = 1
+ROOT_CLUSTER = 2
+EOC = 0x0FFFFFF8
+EOC_MARK = 0x0FFFFFFF
+ATTR_VOLUME = 0x08
+ATTR_DIRECTORY = 0x10
+ATTR_ARCHIVE = 0x20
+ATTR_LFN = 0x0F
+
+
+def pattern(seed, size):
+    """Deterministic file content"""
+    return bytes((seed * 131 + i * 7 + (i >> 9)) & 0xFF for i in range(size))
+
+
+def short_name(name):
+    base, _, ext = name.partition(".")
+    return (base.ljust(8) + ext.ljust(3)).encode("ascii")
+
+
+def lfn_checksum(name11):
+    s = 0
+    for c in name11:
+        s = (((s & 1) << 7) + (s >> 1) + c) & 0xFF
+    return s
+
+
+def lfn_entries(long_name, name11):
+    """Long name entries in on-disk order, the last part goes first"""
+    chars = [ord(c) for c in long_name] + [0]
+    while len(chars) % 13:
+        chars.append(0xFFFF)
+    parts = [chars[i:i + 13] for i in range(0, len(chars), 13)]
+    checksum = lfn_checksum(name11)
+    entries = []
+    for n, part in enumerate(parts, 1):
+        order = n | (0x40 if n == len(parts) else 0)
+        e = bytearray(32)
+        e[0] = order
+        e[11] = ATTR_LFN
+        e[13] = checksum
+        for i, c in enumerate(part):
+            off = (1 + 2 * i) if i < 5 else (14 + 2 * (i - 5)) if i < 11 else (28 + 2 * (i - 11))
+            struct.pack_into("<H", e, off, c)
+        entries.append(bytes(e))
+    return list(reversed(entries))
+
+
+def dir_entry(name11, attr, cluster, size):
+    e = bytearray(32)
+    e[0:11] = name11
+    e[11] = attr
+    struct.pack_into("<H", e, 20, cluster >> 16)
+    struct.pack_into("<H", e, 26, cluster & 0xFFFF)
+    struct.pack_into("<I", e, 28, size)
+    return bytes(e)
+
+
+class Volume:
+    """FAT32 volume in memory, used to build fixtures"""
+
+    def __init__(self):
+        self.fat_size = 1
+        while True:
+            clusters = (PART_BLOCKS - RESERVED - NUM_FATS * self.fat_size) // CLUSTER_BLOCKS
+            need = (clusters + 2 + BLOCK // 4 - 1) // (BLOCK // 4)
+            if need <= self.fat_size:
+                break
+            self.fat_size = need
+        self.clusters = clusters
+        self.data_start = RESERVED + NUM_FATS * self.fat_size
+        self.fat = [0] * (self.clusters + 2)
+        self.fat[0] = 0x0FFFFFF8
+        self.fat[1] = 0x0FFFFFFF
+        self.data = {}
+        self.next = ROOT_CLUSTER
+
+    def alloc(self):
+        while self.fat[self.next]:
+            self.next += 1
+        cluster = self.next
+        self.fat[cluster] = EOC_MARK
+        return cluster
+
+    def chain(self, clusters):
+        for a, b in zip(clusters, clusters[1:]):
+            self.fat[a] = b
+        self.fat[clusters[-1]] = EOC_MARK
+
+    def put(self, clusters, content):
+        size = CLUSTER_BLOCKS * BLOCK
+        for i, cluster in enumerate(clusters):
+            self.data[cluster] = content[i * size:(i + 1) * size].ljust(size, b"\0")
+
+    def image(self):
+        card = bytearray((PART_START + PART_BLOCKS) * BLOCK)
+        # MBR with one FAT32 LBA partition
+        mbr = bytearray(BLOCK)
+        entry = struct.pack("<B3sB3sII", 0x00, b"\xfe\xff\xff", 0x0C, b"\xfe\xff\xff", PART_START, PART_BLOCKS)
+        mbr[446:462] = entry
+        mbr[510:512] = b"\x55\xaa"
+        card[0:BLOCK] = mbr
+        vol = bytearray(PART_BLOCKS * BLOCK)
+        bpb = bytearray(BLOCK)
+        bpb[0:3] = b"\xeb\x58\x90"
+        bpb[3:11] = b"MSWIN4.1"
+        struct.pack_into("<HBHBHHBHHHII", bpb, 11, BLOCK, CLUSTER_BLOCKS, RESERVED, NUM_FATS, 0, 0, 0xF8, 0, 63, 255,
+                         PART_START, PART_BLOCKS)
+        struct.pack_into("<IHHIHH", bpb, 36, self.fat_size, 0, 0, ROOT_CLUSTER, 1, 6)
+        bpb[64] = 0x80
+        bpb[66] = 0x29
+        struct.pack_into("<I", bpb, 67, 0x12345678)
+        bpb[71:82] = b"SDTEST     "
+        bpb[82:90] = b"FAT32   "
+        bpb[510:512] = b"\x55\xaa"
+        free = sum(1 for c in range(2, self.clusters + 2) if not self.fat[c])
+        fsinfo = bytearray(BLOCK)
+        struct.pack_into("<I", fsinfo, 0, 0x41615252)
+        struct.pack_into("<III", fsinfo, 484, 0x61417272, free, self.next)
+        struct.pack_into("<I", fsinfo, 508, 0xAA550000)
+        for base in (0, 6):
+            vol[(base + 0) * BLOCK:(base + 1) * BLOCK] = bpb
+            vol[(base + 1) * BLOCK:(base + 2) * BLOCK] = fsinfo
+        fat = b"".join(struct.pack("<I", v) for v in self.fat).ljust(self.fat_size * BLOCK, b"\0")
+        for n in range(NUM_FATS):
+            start = (RESERVED + n * self.fat_size) * BLOCK
+            vol[start:start + len(fat)] = fat
+        for cluster, content in self.data.items():
+            start = (self.data_start + (cluster - 2) * CLUSTER_BLOCKS) * BLOCK
+            vol[start:start + len(content)] = content
+        card[PART_START * BLOCK:] = vol
+        return card
+
+
+def make(image_path, manifest_path):
+    v = Volume()
+    cluster_bytes = CLUSTER_BLOCKS * BLOCK
+    manifest = []
+    files = {}
+
+    def clusters_for(size):
+        return (size + cluster_bytes - 1) // cluster_bytes
+
+    def new_file(path, size, seed, clusters=None):
+        content = pattern(seed, size)
+        if clusters is None:
+            clusters = [v.alloc() for _ in range(clusters_for(size))]
+        if clusters:
+            v.chain(clusters)
+            v.put(clusters, content)
+        files[path] = content
+        manifest.append("F %s %d %08x" % (path, size, zlib.crc32(content)))
+        return clusters[0] if clusters else 0
+
+    root = [v.alloc()]
+    data_dir = [v.alloc()]
+    sub_dir = [v.alloc()]
+    # LOG1.BIN and LOG2.BIN take clusters in turn, so both are fragmented
+    log1, log2 = [], []
+    for _ in range(24):
+        log1.append(v.alloc())
+        log2.append(v.alloc())
+    root_entries = [
+        dir_entry(b"SDTEST     ", ATTR_VOLUME, 0, 0),
+        dir_entry(short_name("README.TXT"), ATTR_ARCHIVE, new_file("README.TXT", 700, 1), 700),
+    ]
+    long_name = short_name("LONGNA~1.TXT")
+    root_entries += lfn_entries("Long name file.txt", long_name)
+    root_entries.append(dir_entry(long_name, ATTR_ARCHIVE, new_file("LONGNA~1.TXT", 100, 2), 100))
+    deleted = bytearray(dir_entry(short_name("OLD.TXT"), ATTR_ARCHIVE, 0, 0))
+    deleted[0] = 0xE5
+    root_entries.append(bytes(deleted))
+    root_entries.append(dir_entry(short_name("EMPTY.TXT"), ATTR_ARCHIVE, new_file("EMPTY.TXT", 0, 3), 0))
+    root_entries.append(dir_entry(short_name("DATA"), ATTR_DIRECTORY, data_dir[0], 0))
+    manifest.append("D DATA")
+    data_entries = [
+        dir_entry(b".          ", ATTR_DIRECTORY, data_dir[0], 0),
+        dir_entry(b"..         ", ATTR_DIRECTORY, 0, 0),
+        dir_entry(short_name("LOG1.BIN"), ATTR_ARCHIVE, new_file("DATA/LOG1.BIN", 24 * 512 - 100, 4, log1), 24 * 512 - 100),
+        dir_entry(short_name("LOG2.BIN"), ATTR_ARCHIVE, new_file("DATA/LOG2.BIN", 24 * 512, 5, log2), 24 * 512),
+        dir_entry(short_name("BIG.BIN"), ATTR_ARCHIVE, new_file("DATA/BIG.BIN", 306000, 6), 306000),
+        dir_entry(short_name("SUB"), ATTR_DIRECTORY, sub_dir[0], 0),
+    ]
+    manifest.append("D DATA/SUB")
+    sub_entries = [
+        dir_entry(b".          ", ATTR_DIRECTORY, sub_dir[0], 0),
+        dir_entry(b"..         ", ATTR_DIRECTORY, data_dir[0], 0),
+        dir_entry(short_name("DEEP.TXT"), ATTR_ARCHIVE, new_file("DATA/SUB/DEEP.TXT", 1500, 7), 1500),
+    ]
+    v.put(root, b"".join(root_entries))
+    v.put(data_dir, b"".join(data_entries))
+    v.put(sub_dir, b"".join(sub_entries))
+    with open(image_path, "wb") as f:
+        f.write(v.image())
+    with open(manifest_path, "w") as f:
+        f.write("\n".join(manifest) + "\n")
+
+
+class Checker:
+    """Structure checks of FAT32 volume like disk checkers do"""
+
+    def __init__(self, card):
+        self.errors = []
+        mbr = card[0:BLOCK]
+        start, blocks = struct.unpack_from("<II", mbr, 446 + 8)
+        if mbr[510:512] != b"\x55\xaa" or mbr[446 + 4] not in (0x0B, 0x0C):
+            raise SystemExit("no FAT32 partition in MBR")
+        self.vol = card[start * BLOCK:(start + blocks) * BLOCK]
+        bpb = self.vol[0:BLOCK]
+        (bytes_per_block, self.cluster_blocks, reserved, num_fats, root_entries, total16, _, fat16) = \
+            struct.unpack_from("<HBHBHHBH", bpb, 11)
+        total = struct.unpack_from("<I", bpb, 32)[0]
+        self.fat_size, _, _, self.root, fsinfo = struct.unpack_from("<IHHIH", bpb, 36)
+        if bpb[510:512] != b"\x55\xaa" or bytes_per_block != BLOCK or root_entries or total16 or fat16:
+            raise SystemExit("boot sector is not FAT32")
+        self.data_start = reserved + num_fats * self.fat_size
+        self.clusters = min((total - self.data_start) // self.cluster_blocks, self.fat_size * BLOCK // 4 - 2)
+        fats = [self.vol[(reserved + n * self.fat_size) * BLOCK:(reserved + (n + 1) * self.fat_size) * BLOCK]
+                for n in range(num_fats)]
+        for n in range(1, num_fats):
+            if fats[n] != fats[0]:
+                self.error("FAT copy %d differs from FAT 0" % n)
+        self.fat = [v & 0x0FFFFFFF for v in struct.unpack_from("<%dI" % (self.clusters + 2), fats[0])]
+        self.owner = {}
+        self.fsinfo = fsinfo
+
+    def error(self, text):
+        self.errors.append(text)
+
+    def cluster_data(self, cluster):
+        start = (self.data_start + (cluster - 2) * self.cluster_blocks) * BLOCK
+        return self.vol[start:start + self.cluster_blocks * BLOCK]
+
+    def walk_chain(self, first, path):
+        chain = []
+        cluster = first
+        while True:
+            if cluster < 2 or cluster >= self.clusters + 2:
+                self.error("%s: cluster %d outside of volume" % (path, cluster))
+                return chain
+            if cluster in self.owner:
+                self.error("%s: cluster %d is cross-linked with %s" % (path, cluster, self.owner[cluster]))
+                return chain
+            if not self.fat[cluster]:
+                self.error("%s: cluster %d of chain is free" % (path, cluster))
+                return chain
+            self.owner[cluster] = path
+            chain.append(cluster)
+            value = self.fat[cluster]
+            if value >= EOC:
+                return chain
+            cluster = value
+
+    def read_dir(self, first, path, parent):
+        chain = self.walk_chain(first, path or "/")
+        raw = b"".join(self.cluster_data(c) for c in chain)
+        entries = []
+        lfn = []
+        for off in range(0, len(raw), 32):
+            e = raw[off:off + 32]
+            if e[0] == 0:
+                break
+            if e[0] == 0xE5:
+                lfn = []
+                continue
+            if e[11] == ATTR_LFN:
+                lfn.append(e)
+                continue
+            if lfn:
+                checksum = lfn_checksum(e[0:11])
+                if any(x[13] != checksum for x in lfn):
+                    self.error("%s: long name entries do not match %r" % (path or "/", e[0:11]))
+                lfn = []
+            if e[11] & ATTR_VOLUME:
+                continue
+            entries.append(e)
+        if lfn:
+            self.error("%s: long name entries without short entry" % (path or "/"))
+        if path:
+            if len(entries) < 2 or entries[0][0:11] != b".          " or entries[1][0:11] != b"..         ":
+                self.error("%s: no . and .. entries" % path)
+                return entries
+            dot = (entries[0][20] | entries[0][21] << 8) << 16 | (entries[0][26] | entries[0][27] << 8)
+            dotdot = (entries[1][20] | entries[1][21] << 8) << 16 | (entries[1][26] | entries[1][27] << 8)
+            if dot != first or dotdot != (0 if parent == self.root else parent):
+                self.error("%s: wrong . or .. cluster" % path)
+            entries = entries[2:]
+        return entries
+
+    def walk(self):
+        tree = {}
+        pending = [("", self.root, None)]
+        while pending:
+            path, first, parent = pending.pop()
+            for e in self.read_dir(first, path, parent):
+                base = e[0:8].decode("latin-1").rstrip()
+                ext = e[8:11].decode("latin-1").rstrip()
+                if base.startswith("\x05"):
+                    base = "\xe5" + base[1:]
+                name = base + ("." + ext if ext else "")
+                full = path + "/" + name if path else name
+                if any(c in name for c in "\"*+,/:;<=>?[\\]|") or any(ord(c) < 0x20 for c in name):
+                    self.error("%s: invalid name" % full)
+                if full in tree:
+                    self.error("%s: duplicate entry" % full)
+                cluster = (e[20] | e[21] << 8) << 16 | (e[26] | e[27] << 8)
+                size = struct.unpack_from("<I", e, 28)[0]
+                if e[11] & ATTR_DIRECTORY:
+                    tree[full] = None
+                    pending.append((full, cluster, first))
+                    continue
+                if not cluster:
+                    if size:
+                        self.error("%s: size %d without clusters" % (full, size))
+                    tree[full] = b""
+                    continue
+                chain = self.walk_chain(cluster, full)
+                need = (size + self.cluster_blocks * BLOCK - 1) // (self.cluster_blocks * BLOCK)
+                if len(chain) != need:
+                    self.error("%s: %d clusters for size %d" % (full, len(chain), size))
+                tree[full] = b"".join(self.cluster_data(c) for c in chain)[:size]
+        free = 0
+        for cluster in range(2, self.clusters + 2):
+            if not self.fat[cluster]:
+                free += 1
+            elif cluster not in self.owner:
+                self.error("lost cluster %d" % cluster)
+        if self.fsinfo:
+            info = self.vol[self.fsinfo * BLOCK:(self.fsinfo + 1) * BLOCK]
+            count, hint = struct.unpack_from("<II", info, 488)
+            if count != 0xFFFFFFFF and count != free:
+                self.error("FSInfo free count %d, FAT has %d free clusters" % (count, free))
+            if hint != 0xFFFFFFFF and not 2 <= hint < self.clusters + 2:
+                self.error("FSInfo next free cluster %d outside of volume" % hint)
+        return tree
+
+
+def check(image_path, manifest_path):
+    with open(image_path, "rb") as f:
+        checker = Checker(f.read())
+    tree = checker.walk()
+    expected = {}
+    with open(manifest_path) as f:
+        for line in f:
+            fields = line.split()
+            if not fields:
+                continue
+            if fields[0] == "D":
+                expected[fields[1]] = None
+            else:
+                expected[fields[1]] = (int(fields[2]), int(fields[3], 16))
+    for path in sorted(set(tree) | set(expected)):
+        if path not in tree:
+            checker.error("%s: missing" % path)
+        elif path not in expected:
+            checker.error("%s: not expected" % path)
+        elif (tree[path] is None) != (expected[path] is None):
+            checker.error("%s: file and directory mismatch" % path)
+        elif tree[path] is not None and (len(tree[path]), zlib.crc32(tree[path])) != expected[path]:
+            checker.error("%s: size %d crc %08x, expected size %d crc %08x" %
+                          (path, len(tree[path]), zlib.crc32(tree[path]), expected[path][0], expected[path][1]))
+    for text in checker.errors:
+        print("%s: %s" % (image_path, text))
+    print("%s: %d entries, %d errors" % (image_path, len(tree), len(checker.errors)))
+    return 1 if checker.errors else 0
+
+
+def mtools(image, manifest_path):
+    errors = 0
+    with open(manifest_path) as f:
+        for line in f:
+            fields = line.split()
+            if not fields or fields[0] != "F":
+                continue
+            content = subprocess.run(["mtype", "-i", image, "::/" + fields[1]], stdout=subprocess.PIPE).stdout
+            if (len(content), zlib.crc32(content)) != (int(fields[2]), int(fields[3], 16)):
+                print("%s: %s differs in mtype output" % (image, fields[1]))
+                errors += 1
+    print("%s: %d errors in mtype output" % (image, errors))
+    return 1 if errors else 0
+
+
+if __name__ == "__main__":
+    if len(sys.argv) != 4 or sys.argv[1] not in ("make", "check", "mtools"):
+        sys.exit(__doc__)
+    if sys.argv[1] == "make":
+        make(sys.argv[2], sys.argv[3])
+    elif sys.argv[1] == "check":
+        sys.exit(check(sys.argv[2], sys.argv[3]))
+    else:
+        sys.exit(mtools(sys.argv[2], sys.argv[3]))
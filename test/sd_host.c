@@ -0,0 +1,240 @@
+/*MIT License
+
+Copyright (c) 2019 DoHelloWorld
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.*/
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "sd_host.h"
+
+#define SD_HOST_BLOCK   512
+#define SD_HOST_DWT     0xE0001000UL    /**< DWT base address used by Utils */
+#define SD_HOST_PAGE    4096
+
+/*System clock of MCU, Utils needs it for DWT conversions*/
+uint32_t SystemCoreClock = 72000000;
+
+/*Card data and size in blocks*/
+static uint8_t * SD_HostDisk = 0;
+static uint32_t SD_HostBlocks = 0;
+
+/*Check if range of blocks is on card*/
+static int SD_HostRange(uint32_t address, uint32_t num);
+/*Map DWT registers to RAM*/
+static int SD_HostMapDWT(void);
+/*Set card parameters for loaded or created disk*/
+static int SD_HostSetup(SD_Parameters_t * sd);
+
+/** \brief Check if range of blocks is on card
+  * \param  address: first block
+  * \param  num: number of blocks
+  * \retval 1 if range is on card, 0 if not
+*/
+static int SD_HostRange(uint32_t address, uint32_t num)
+{
+    return SD_HostDisk && (address < SD_HostBlocks) && (num <= SD_HostBlocks - address);
+}
+
+/** \brief Map page with DWT registers to RAM, so cycle counter of Utils can be read on host
+  * \param  None
+  * \retval 0 on success, -1 on error
+*/
+static int SD_HostMapDWT(void)
+{
+    static uint8_t mapped = 0;
+    if(mapped)
+        return 0;
+    void * page = mmap((void *)SD_HOST_DWT, SD_HOST_PAGE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(page == MAP_FAILED)
+        return -1;
+    /*Address is only a hint, other mapping can be there*/
+    if(page != (void *)SD_HOST_DWT)
+    {
+        munmap(page, SD_HOST_PAGE);
+        return -1;
+    }
+    mapped = 1;
+    return 0;
+}
+
+/** \brief Set card parameters for disk in RAM
+  * \param  sd: pointer to SD card parameters structure
+  * \retval 0 on success, -1 on error
+*/
+static int SD_HostSetup(SD_Parameters_t * sd)
+{
+    memset(sd, 0, sizeof(SD_Parameters_t));
+    sd->type = SD_TYPE_SDHC;
+    sd->blockSize = SD_HOST_BLOCK;
+    sd->capacity = (uint64_t)SD_HostBlocks * SD_HOST_BLOCK;
+    /*4 MiB allocation unit*/
+    sd->auBlocks = 8192;
+    return SD_HostMapDWT();
+}
+
+/** \brief Load image file to RAM and set card parameters
+  * \param  sd: pointer to SD card parameters structure
+  * \param  path: image file
+  * \retval 0 on success, -1 on error
+*/
+int SD_HostLoad(SD_Parameters_t * sd, const char * path)
+{
+    FILE * f = fopen(path, "rb");
+    long size = 0;
+    if(!f)
+        return -1;
+    if((fseek(f, 0, SEEK_END) != 0) || ((size = ftell(f)) < SD_HOST_BLOCK) || (fseek(f, 0, SEEK_SET) != 0))
+    {
+        fclose(f);
+        return -1;
+    }
+    SD_HostFree();
+    SD_HostBlocks = (uint32_t)(size / SD_HOST_BLOCK);
+    SD_HostDisk = malloc((size_t)SD_HostBlocks * SD_HOST_BLOCK);
+    if(!SD_HostDisk || (fread(SD_HostDisk, SD_HOST_BLOCK, SD_HostBlocks, f) != SD_HostBlocks))
+    {
+        fclose(f);
+        SD_HostFree();
+        return -1;
+    }
+    fclose(f);
+    return SD_HostSetup(sd);
+}
+
+/** \brief Create blank card in RAM and set card parameters
+  * \param  sd: pointer to SD card parameters structure
+  * \param  blocks: card size in blocks
+  * \retval 0 on success, -1 on error
+*/
+int SD_HostCreate(SD_Parameters_t * sd, uint32_t blocks)
+{
+    SD_HostFree();
+    SD_HostDisk = calloc(blocks, SD_HOST_BLOCK);
+    if(!blocks || !SD_HostDisk)
+    {
+        SD_HostFree();
+        return -1;
+    }
+    SD_HostBlocks = blocks;
+    return SD_HostSetup(sd);
+}
+
+/** \brief Write card to image file
+  * \param  path: image file
+  * \retval 0 on success, -1 on error
+*/
+int SD_HostSave(const char * path)
+{
+    FILE * f = fopen(path, "wb");
+    int result = 0;
+    if(!f)
+        return -1;
+    if(fwrite(SD_HostDisk, SD_HOST_BLOCK, SD_HostBlocks, f) != SD_HostBlocks)
+        result = -1;
+    if(fclose(f) != 0)
+        result = -1;
+    return result;
+}
+
+/** \brief Free RAM of card
+  * \param  None
+  * \retval None
+*/
+void SD_HostFree(void)
+{
+    free(SD_HostDisk);
+    SD_HostDisk = 0;
+    SD_HostBlocks = 0;
+}
+
+/** \brief Read one block
+  * \param  sd: pointer to SD card parameters structure
+  * \param  address: block number
+  * \param  data: pointer to buffer for block
+  * \retval SD error number
+*/
+SD_Error_t SD_ReadBlock(SD_Parameters_t * sd, uint32_t address, uint8_t * data)
+{
+    return SD_ReadMultipleBlock(sd, address, data, 1);
+}
+
+/** \brief Read blocks
+  * \param  sd: pointer to SD card parameters structure
+  * \param  address: first block
+  * \param  data: pointer to buffer for blocks
+  * \param  num: number of blocks
+  * \retval SD error number
+*/
+SD_Error_t SD_ReadMultipleBlock(SD_Parameters_t * sd, uint32_t address, uint8_t * data, uint32_t num)
+{
+    sd->readBlocks = 0;
+    if(!SD_HostRange(address, num))
+        return SD_ERROR;
+    memcpy(data, SD_HostDisk + (size_t)address * SD_HOST_BLOCK, (size_t)num * SD_HOST_BLOCK);
+    sd->readBlocks = num;
+    return SD_OK;
+}
+
+/** \brief Write one block
+  * \param  sd: pointer to SD card parameters structure
+  * \param  address: block number
+  * \param  data: pointer to block
+  * \retval SD error number
+*/
+SD_Error_t SD_WriteBlock(SD_Parameters_t * sd, uint32_t address, uint8_t * data)
+{
+    return SD_WriteMultipleBlock(sd, address, data, 1);
+}
+
+/** \brief Write blocks
+  * \param  sd: pointer to SD card parameters structure
+  * \param  address: first block
+  * \param  data: pointer to blocks
+  * \param  num: number of blocks
+  * \retval SD error number
+*/
+SD_Error_t SD_WriteMultipleBlock(SD_Parameters_t * sd, uint32_t address, uint8_t * data, uint32_t num)
+{
+    sd->writtenBlocks = 0;
+    if(!SD_HostRange(address, num))
+        return SD_ERROR;
+    memcpy(SD_HostDisk + (size_t)address * SD_HOST_BLOCK, data, (size_t)num * SD_HOST_BLOCK);
+    sd->writtenBlocks = num;
+    return SD_OK;
+}
+
+/** \brief Erase blocks, erased blocks read as zeros
+  * \param  sd: pointer to SD card parameters structure
+  * \param  address: first block
+  * \param  num: number of blocks
+  * \retval SD error number
+*/
+SD_Error_t SD_Erase(SD_Parameters_t * sd, uint32_t address, uint32_t num)
+{
+    (void)sd;
+    if(!SD_HostRange(address, num))
+        return SD_ERROR;
+    memset(SD_HostDisk + (size_t)address * SD_HOST_BLOCK, 0, (size_t)num * SD_HOST_BLOCK);
+    return SD_OK;
+}
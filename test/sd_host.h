@@ -0,0 +1,45 @@
+/*MIT License
+
+Copyright (c) 2019 DoHelloWorld
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.*/
+
+
+
+#ifndef SD_HOST_H_INCLUDED
+#define SD_HOST_H_INCLUDED
+#include "SDCard.h"
+
+/*Host SD card
+    Replaces SPI driver in host tests, data blocks of card are image file loaded to RAM.
+    DWT registers read by Utils are mapped to RAM page, cycle counter stays 0*/
+
+/*Load image file, card capacity is image size rounded down to blocks. Returns 0 on success*/
+int SD_HostLoad(SD_Parameters_t * sd, const char * path);
+
+/*Create blank card of blocks blocks without image file. Returns 0 on success*/
+int SD_HostCreate(SD_Parameters_t * sd, uint32_t blocks);
+
+/*Write card back to image file. Returns 0 on success*/
+int SD_HostSave(const char * path);
+
+/*Free RAM of card*/
+void SD_HostFree(void);
+
+#endif /* SD_HOST_H_INCLUDED */
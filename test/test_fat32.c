@@ -0,0 +1,571 @@
+/*MIT License
+
+Copyright (c) 2019 DoHelloWorld
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.*/
+
+
+
+/*Host test of FAT32 layer
+    Usage: test_fat32 IMAGE MANIFEST RESULT
+    Volume of image should have files and directories from MANIFEST, see fat32_image.py.
+    Test reads them through FAT32 layer, changes volume and writes expected tree to RESULT,
+    changed image is checked with fat32_image.py or disk checkers*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "FAT32.h"
+#include "Utils.h"
+#include "sd_host.h"
+
+#define TEST_MAX_FILES  96
+#define TEST_MAX_PATH   64
+#define TEST_MAX_SIZE   (512 * 1024)
+
+/*File or directory of expected tree*/
+typedef struct
+{
+    char path[TEST_MAX_PATH];
+    /*1 for directory*/
+    uint8_t dir;
+    /*expected content*/
+    uint8_t * data;
+    uint32_t size;
+}TEST_Entry_t;
+
+static SD_Parameters_t TEST_Card;
+static SD_Partition_t TEST_Part;
+static FAT_FS_t TEST_FS;
+static TEST_Entry_t TEST_Tree[TEST_MAX_FILES];
+static uint32_t TEST_Count = 0;
+static uint32_t TEST_Failures = 0;
+static uint8_t TEST_Buffer[TEST_MAX_SIZE];
+
+#define TEST_CHECK(condition) TEST_Check((condition), #condition, __LINE__)
+
+/*Count and print failed check*/
+static void TEST_Check(int condition, const char * text, int line);
+/*Content of written data, same as pattern of fat32_image.py*/
+static void TEST_Pattern(uint8_t * data, uint32_t size, uint32_t seed);
+/*Expected tree*/
+static TEST_Entry_t * TEST_Find(const char * path);
+static TEST_Entry_t * TEST_Add(const char * path, uint8_t dir);
+static void TEST_Remove(const char * path);
+static void TEST_SetData(TEST_Entry_t * entry, const uint8_t * data, uint32_t size);
+/*Read manifest and check files of volume with it*/
+static int TEST_LoadManifest(const char * path);
+static int TEST_SaveManifest(const char * path);
+/*Read whole file with one call or with chunks of different sizes*/
+static FAT_Error_t TEST_ReadFile(const char * path, uint8_t * data, uint32_t * size);
+static FAT_Error_t TEST_ReadChunks(const char * path, uint8_t * data, uint32_t * size);
+/*Write data to file at position, -1 appends*/
+static FAT_Error_t TEST_WriteFile(const char * path, uint8_t mode, int32_t position, const uint8_t * data, uint32_t size);
+/*Check every file of expected tree through FAT32 layer*/
+static void TEST_VerifyTree(void);
+/*Mount volume of the first partition*/
+static FAT_Error_t TEST_Mount(void);
+/*Test steps*/
+static void TEST_Bursts(void);
+static void TEST_Seek(void);
+static void TEST_Writes(void);
+static void TEST_Directory(void);
+static void TEST_Errors(void);
+static void TEST_FreeMap(void);
+
+/** \brief Count and print failed check
+  * \param  condition: result of check
+  * \param  text: checked expression
+  * \param  line: source line of check
+  * \retval None
+*/
+static void TEST_Check(int condition, const char * text, int line)
+{
+    if(condition)
+        return;
+    TEST_Failures++;
+    printf("test_fat32.c:%d: check failed: %s\n", line, text);
+}
+
+/** \brief Fill buffer with content of test file
+  * \param  data: pointer to buffer
+  * \param  size: number of bytes
+  * \param  seed: file seed
+  * \retval None
+*/
+static void TEST_Pattern(uint8_t * data, uint32_t size, uint32_t seed)
+{
+    for(uint32_t i = 0; i < size; ++i)
+        data[i] = (uint8_t)(seed * 131 + i * 7 + (i >> 9));
+}
+
+/** \brief Find entry of expected tree
+  * \param  path: path of file or directory
+  * \retval pointer to entry, NULL if there is no entry
+*/
+static TEST_Entry_t * TEST_Find(const char * path)
+{
+    for(uint32_t i = 0; i < TEST_Count; ++i)
+    {
+        if(!strcmp(TEST_Tree[i].path, path))
+            return &TEST_Tree[i];
+    }
+    return 0;
+}
+
+/** \brief Add empty entry to expected tree
+  * \param  path: path of file or directory
+  * \param  dir: 1 for directory
+  * \retval pointer to entry
+*/
+static TEST_Entry_t * TEST_Add(const char * path, uint8_t dir)
+{
+    TEST_Entry_t * entry = TEST_Find(path);
+    if(entry)
+        return entry;
+    if((TEST_Count >= TEST_MAX_FILES) || (strlen(path) >= TEST_MAX_PATH))
+    {
+        printf("expected tree is full\n");
+        exit(2);
+    }
+    entry = &TEST_Tree[TEST_Count++];
+    memset(entry, 0, sizeof(TEST_Entry_t));
+    strcpy(entry->path, path);
+    entry->dir = dir;
+    return entry;
+}
+
+/** \brief Remove entry from expected tree
+  * \param  path: path of file
+  * \retval None
+*/
+static void TEST_Remove(const char * path)
+{
+    TEST_Entry_t * entry = TEST_Find(path);
+    if(!entry)
+        return;
+    free(entry->data);
+    *entry = TEST_Tree[--TEST_Count];
+}
+
+/** \brief Set expected content of file
+  * \param  entry: pointer to entry
+  * \param  data: pointer to content
+  * \param  size: content size
+  * \retval None
+*/
+static void TEST_SetData(TEST_Entry_t * entry, const uint8_t * data, uint32_t size)
+{
+    free(entry->data);
+    entry->data = malloc(size ? size : 1);
+    memcpy(entry->data, data, size);
+    entry->size = size;
+}
+
+/** \brief Read whole file with one read call
+  * \param  path: path of file
+  * \param  data: pointer to buffer of TEST_MAX_SIZE bytes
+  * \param  size: pointer where to put file size
+  * \retval FAT error number
+*/
+static FAT_Error_t TEST_ReadFile(const char * path, uint8_t * data, uint32_t * size)
+{
+    FAT_File_t file;
+    FAT_Error_t error = FAT_Open(&file, &TEST_FS, path, FAT_MODE_READ);
+    if(error != FAT_OK)
+        return error;
+    error = FAT_Read(&file, data, TEST_MAX_SIZE, size);
+    if(error == FAT_OK)
+        error = FAT_Close(&file);
+    return error;
+}
+
+/** \brief Read whole file with chunks of different sizes, chunks start inside blocks and clusters
+  * \param  path: path of file
+  * \param  data: pointer to buffer of TEST_MAX_SIZE bytes
+  * \param  size: pointer where to put file size
+  * \retval FAT error number
+*/
+static FAT_Error_t TEST_ReadChunks(const char * path, uint8_t * data, uint32_t * size)
+{
+    static const uint32_t chunks[] = {1, 511, 513, 4096, 37, 1024, 3000};
+    FAT_File_t file;
+    uint32_t read = 0;
+    uint32_t i = 0;
+    FAT_Error_t error = FAT_Open(&file, &TEST_FS, path, FAT_MODE_READ);
+    *size = 0;
+    if(error != FAT_OK)
+        return error;
+    do
+    {
+        error = FAT_Read(&file, data + *size, chunks[i++ % (sizeof(chunks) / sizeof(chunks[0]))], &read);
+        *size += read;
+    }
+    while((error == FAT_OK) && read);
+    if(error == FAT_OK)
+        error = FAT_Close(&file);
+    return error;
+}
+
+/** \brief Write data to file
+  * \param  path: path of file
+  * \param  mode: open mode
+  * \param  position: position of data, -1 for the end of file
+  * \param  data: pointer to data
+  * \param  size: number of bytes
+  * \retval FAT error number
+*/
+static FAT_Error_t TEST_WriteFile(const char * path, uint8_t mode, int32_t position, const uint8_t * data, uint32_t size)
+{
+    FAT_File_t file;
+    uint32_t written = 0;
+    FAT_Error_t error = FAT_Open(&file, &TEST_FS, path, mode);
+    if(error != FAT_OK)
+        return error;
+    error = FAT_Seek(&file, (position < 0) ? file.size : (uint32_t)position);
+    if(error == FAT_OK)
+        error = FAT_Write(&file, (uint8_t *)data, size, &written);
+    if((error == FAT_OK) && (written != size))
+        error = FAT_DISK_ERROR;
+    if(error == FAT_OK)
+        error = FAT_Close(&file);
+    return error;
+}
+
+/** \brief Read manifest, check every file of it through FAT32 layer and keep files as expected tree
+  * \param  path: manifest file
+  * \retval 0 on success, -1 on error
+*/
+static int TEST_LoadManifest(const char * path)
+{
+    char line[128];
+    char name[TEST_MAX_PATH];
+    char kind = 0;
+    unsigned long size = 0;
+    unsigned long crc = 0;
+    FILE * f = fopen(path, "r");
+    if(!f)
+        return -1;
+    while(fgets(line, sizeof(line), f))
+    {
+        if(sscanf(line, " %c %63s %lu %lx", &kind, name, &size, &crc) < 2)
+            continue;
+        TEST_Entry_t * entry = TEST_Add(name, kind == 'D');
+        if(entry->dir)
+            continue;
+        uint32_t read = 0;
+        FAT_Error_t error = TEST_ReadFile(name, TEST_Buffer, &read);
+        TEST_CHECK(error == FAT_OK);
+        TEST_CHECK(read == size);
+        TEST_CHECK(CRC32_Update(0, TEST_Buffer, read) == crc);
+        if((error != FAT_OK) || (read != size))
+            printf("  %s: error %d, %u of %lu bytes\n", name, error, read, size);
+        TEST_SetData(entry, TEST_Buffer, read);
+    }
+    fclose(f);
+    return 0;
+}
+
+/** \brief Write expected tree as manifest
+  * \param  path: manifest file
+  * \retval 0 on success, -1 on error
+*/
+static int TEST_SaveManifest(const char * path)
+{
+    FILE * f = fopen(path, "w");
+    if(!f)
+        return -1;
+    for(uint32_t i = 0; i < TEST_Count; ++i)
+    {
+        TEST_Entry_t * entry = &TEST_Tree[i];
+        if(entry->dir)
+            fprintf(f, "D %s\n", entry->path);
+        else
+            fprintf(f, "F %s %u %08x\n", entry->path, entry->size, CRC32_Update(0, entry->data, entry->size));
+    }
+    return fclose(f) ? -1 : 0;
+}
+
+/** \brief Check every file of expected tree with whole and chunked reads
+  * \param  None
+  * \retval None
+*/
+static void TEST_VerifyTree(void)
+{
+    for(uint32_t i = 0; i < TEST_Count; ++i)
+    {
+        TEST_Entry_t * entry = &TEST_Tree[i];
+        uint32_t size = 0;
+        if(entry->dir)
+            continue;
+        FAT_Error_t error = TEST_ReadFile(entry->path, TEST_Buffer, &size);
+        TEST_CHECK((error == FAT_OK) && (size == entry->size) && !memcmp(TEST_Buffer, entry->data, size));
+        memset(TEST_Buffer, 0, entry->size);
+        error = TEST_ReadChunks(entry->path, TEST_Buffer, &size);
+        TEST_CHECK((error == FAT_OK) && (size == entry->size) && !memcmp(TEST_Buffer, entry->data, size));
+        if((error != FAT_OK) || (size != entry->size))
+            printf("  %s: error %d, %u of %u bytes\n", entry->path, error, size, entry->size);
+    }
+}
+
+/** \brief Find partition of card and mount its volume
+  * \param  None
+  * \retval FAT error number
+*/
+static FAT_Error_t TEST_Mount(void)
+{
+    SD_Partition_t parts[4];
+    uint8_t count = 0;
+    if(SD_PartitionScan(&TEST_Card, TEST_Buffer, parts, 4, &count) != SD_OK)
+        return FAT_DISK_ERROR;
+    TEST_CHECK(count == 1);
+    TEST_CHECK(parts[0].type == 0x0C);
+    TEST_Part = parts[0];
+    return FAT_Mount(&TEST_FS, &TEST_Part);
+}
+
+/** \brief Whole blocks of contiguous file are moved with long multiple block transfers
+  * \param  None
+  * \retval None
+*/
+static void TEST_Bursts(void)
+{
+    uint32_t size = 0;
+    SD_PartitionResetStats(&TEST_Part);
+    TEST_CHECK(TEST_ReadFile("DATA/BIG.BIN", TEST_Buffer, &size) == FAT_OK);
+    TEST_CHECK(TEST_Part.stats.blocksRead >= size / 512);
+    /*FAT blocks of chain and a few data bursts*/
+    TEST_CHECK(TEST_Part.stats.reads * 32 < TEST_Part.stats.blocksRead);
+    TEST_Pattern(TEST_Buffer, 200000, 10);
+    SD_PartitionResetStats(&TEST_Part);
+    TEST_CHECK(TEST_WriteFile("BURST.BIN", FAT_MODE_WRITE | FAT_MODE_CREATE, 0, TEST_Buffer, 200000) == FAT_OK);
+    TEST_CHECK(TEST_Part.stats.writes * 16 < TEST_Part.stats.blocksWritten);
+    TEST_SetData(TEST_Add("BURST.BIN", 0), TEST_Buffer, 200000);
+}
+
+/** \brief Reads from random positions of fragmented file
+  * \param  None
+  * \retval None
+*/
+static void TEST_Seek(void)
+{
+    TEST_Entry_t * entry = TEST_Find("DATA/LOG1.BIN");
+    FAT_File_t file;
+    uint32_t read = 0;
+    uint32_t seed = 12345;
+    TEST_CHECK(FAT_Open(&file, &TEST_FS, "DATA/LOG1.BIN", FAT_MODE_READ) == FAT_OK);
+    for(uint32_t i = 0; i < 200; ++i)
+    {
+        seed = seed * 1103515245 + 12345;
+        uint32_t position = (seed >> 8) % (entry->size + 1);
+        uint32_t len = (seed >> 4) % 1500;
+        TEST_CHECK(FAT_Seek(&file, position) == FAT_OK);
+        TEST_CHECK(FAT_Read(&file, TEST_Buffer, len, &read) == FAT_OK);
+        uint32_t expected = (len < entry->size - position) ? len : entry->size - position;
+        TEST_CHECK((read == expected) && !memcmp(TEST_Buffer, entry->data + position, read));
+    }
+    TEST_CHECK(FAT_Seek(&file, entry->size + 100) == FAT_OK);
+    TEST_CHECK(file.position == entry->size);
+    TEST_CHECK(FAT_Close(&file) == FAT_OK);
+}
+
+/** \brief Overwrite, append, truncate, remove and allocation in holes of removed file
+  * \param  None
+  * \retval None
+*/
+static void TEST_Writes(void)
+{
+    static uint8_t data[TEST_MAX_SIZE];
+    TEST_Entry_t * entry = TEST_Find("DATA/LOG1.BIN");
+    uint32_t size = entry->size;
+    /*Overwrite inside file and over its end*/
+    memcpy(data, entry->data, size);
+    TEST_Pattern(data + 1000, 3000, 20);
+    TEST_CHECK(TEST_WriteFile("DATA/LOG1.BIN", FAT_MODE_READ | FAT_MODE_WRITE, 1000, data + 1000, 3000) == FAT_OK);
+    TEST_Pattern(data + size - 300, 5000, 21);
+    TEST_CHECK(TEST_WriteFile("DATA/LOG1.BIN", FAT_MODE_WRITE, size - 300, data + size - 300, 5000) == FAT_OK);
+    size += 4700;
+    /*Append grows chain of fragmented file*/
+    TEST_Pattern(data + size, 7777, 22);
+    TEST_CHECK(TEST_WriteFile("DATA/LOG1.BIN", FAT_MODE_WRITE | FAT_MODE_APPEND, -1, data + size, 7777) == FAT_OK);
+    size += 7777;
+    TEST_SetData(entry, data, size);
+    /*Truncate frees chain and new data takes new one*/
+    TEST_Pattern(data, 1000, 23);
+    TEST_CHECK(TEST_WriteFile("DATA/BIG.BIN", FAT_MODE_WRITE | FAT_MODE_TRUNCATE, 0, data, 1000) == FAT_OK);
+    TEST_SetData(TEST_Find("DATA/BIG.BIN"), data, 1000);
+    /*Write to empty file and to new file in subdirectory*/
+    TEST_Pattern(data, 513, 24);
+    TEST_CHECK(TEST_WriteFile("EMPTY.TXT", FAT_MODE_WRITE, 0, data, 513) == FAT_OK);
+    TEST_SetData(TEST_Find("EMPTY.TXT"), data, 513);
+    TEST_Pattern(data, 2048, 25);
+    TEST_CHECK(TEST_WriteFile("DATA/SUB/NEW.TXT", FAT_MODE_WRITE | FAT_MODE_CREATE, 0, data, 2048) == FAT_OK);
+    TEST_SetData(TEST_Add("DATA/SUB/NEW.TXT", 0), data, 2048);
+    /*Clusters of removed file are holes between clusters of LOG1.BIN*/
+    TEST_CHECK(FAT_Remove(&TEST_FS, "DATA/LOG2.BIN") == FAT_OK);
+    TEST_Remove("DATA/LOG2.BIN");
+    TEST_CHECK(FAT_Remove(&TEST_FS, "README.TXT") == FAT_OK);
+    TEST_Remove("README.TXT");
+    TEST_CHECK(TEST_ReadFile("README.TXT", data, &size) == FAT_NOT_FOUND);
+    TEST_Pattern(data, 40000, 26);
+    TEST_CHECK(TEST_WriteFile("DATA/HOLE.BIN", FAT_MODE_WRITE | FAT_MODE_CREATE, 0, data, 40000) == FAT_OK);
+    TEST_SetData(TEST_Add("DATA/HOLE.BIN", 0), data, 40000);
+    /*Write-through partition leaves no changed block in window*/
+    TEST_Part.cache = SD_PARTITION_WRITE_THROUGH;
+    TEST_Pattern(data, 777, 27);
+    TEST_CHECK(TEST_WriteFile("THROUGH.BIN", FAT_MODE_WRITE | FAT_MODE_CREATE, 0, data, 777) == FAT_OK);
+    TEST_CHECK(!TEST_FS.dirty);
+    TEST_SetData(TEST_Add("THROUGH.BIN", 0), data, 777);
+    TEST_Part.cache = SD_PARTITION_WRITE_BACK;
+}
+
+/** \brief Directory with index grows over several clusters, entries are removed and added again
+  * \param  None
+  * \retval None
+*/
+static void TEST_Directory(void)
+{
+    static FAT_DirIndex_t index;
+    static FAT_IndexSlot_t slots[128];
+    uint8_t data[2000];
+    char path[TEST_MAX_PATH];
+    uint32_t size = 0;
+    TEST_CHECK(FAT_IndexInit(&TEST_FS, &index, "DATA", slots, 128) == FAT_OK);
+    for(uint32_t i = 0; i < 60; ++i)
+    {
+        sprintf(path, "DATA/F%02u.DAT", i);
+        TEST_Pattern(data, i * 31, 100 + i);
+        TEST_CHECK(TEST_WriteFile(path, FAT_MODE_WRITE | FAT_MODE_CREATE, 0, data, i * 31) == FAT_OK);
+        TEST_SetData(TEST_Add(path, 0), data, i * 31);
+    }
+    TEST_CHECK(index.state == FAT_INDEX_READY);
+    for(uint32_t i = 0; i < 60; i += 3)
+    {
+        sprintf(path, "DATA/F%02u.DAT", i);
+        TEST_CHECK(FAT_Remove(&TEST_FS, path) == FAT_OK);
+        TEST_Remove(path);
+        TEST_CHECK(TEST_ReadFile(path, data, &size) == FAT_NOT_FOUND);
+    }
+    /*Free entries are taken again*/
+    for(uint32_t i = 0; i < 10; ++i)
+    {
+        sprintf(path, "DATA/G%02u.DAT", i);
+        TEST_Pattern(data, 1000 + i, 200 + i);
+        TEST_CHECK(TEST_WriteFile(path, FAT_MODE_WRITE | FAT_MODE_CREATE, 0, data, 1000 + i) == FAT_OK);
+        TEST_SetData(TEST_Add(path, 0), data, 1000 + i);
+    }
+    /*Names are case-insensitive*/
+    TEST_CHECK(TEST_ReadFile("data/g05.dat", data, &size) == FAT_OK);
+    TEST_CHECK(size == 1005);
+    TEST_CHECK(FAT_IndexInit(&TEST_FS, 0, "", 0, 0) == FAT_OK);
+}
+
+/** \brief Errors of path and access mode
+  * \param  None
+  * \retval None
+*/
+static void TEST_Errors(void)
+{
+    FAT_File_t file;
+    uint8_t data[16] = {0};
+    uint32_t done = 0;
+    TEST_CHECK(FAT_Open(&file, &TEST_FS, "NOPE.TXT", FAT_MODE_READ) == FAT_NOT_FOUND);
+    TEST_CHECK(FAT_Open(&file, &TEST_FS, "NOPE/FILE.TXT", FAT_MODE_READ | FAT_MODE_CREATE) == FAT_NOT_FOUND);
+    TEST_CHECK(FAT_Open(&file, &TEST_FS, "TOOLONGNAME.TXT", FAT_MODE_READ) == FAT_INVALID_NAME);
+    TEST_CHECK(FAT_Open(&file, &TEST_FS, "A.B.C", FAT_MODE_READ) == FAT_INVALID_NAME);
+    TEST_CHECK(FAT_Open(&file, &TEST_FS, "DATA", FAT_MODE_READ) == FAT_DENIED);
+    TEST_CHECK(FAT_Open(&file, &TEST_FS, "DATA/SUB/DEEP.TXT/X", FAT_MODE_READ) == FAT_NOT_FOUND);
+    TEST_CHECK(FAT_Open(&file, &TEST_FS, "DATA/SUB/DEEP.TXT", FAT_MODE_READ) == FAT_OK);
+    TEST_CHECK(FAT_Write(&file, data, sizeof(data), &done) == FAT_DENIED);
+    TEST_CHECK(FAT_Close(&file) == FAT_OK);
+    TEST_CHECK(FAT_Open(&file, &TEST_FS, "DATA/SUB/DEEP.TXT", FAT_MODE_WRITE) == FAT_OK);
+    TEST_CHECK(FAT_Read(&file, data, sizeof(data), &done) == FAT_DENIED);
+    TEST_CHECK(FAT_Close(&file) == FAT_OK);
+    TEST_CHECK(FAT_Remove(&TEST_FS, "DATA/NOPE.BIN") == FAT_NOT_FOUND);
+}
+
+/** \brief Free map scan verifies free count, allocation with map skips full groups
+  * \param  None
+  * \retval None
+*/
+static void TEST_FreeMap(void)
+{
+    static uint8_t map[64];
+    uint8_t data[5000];
+    TEST_CHECK(FAT_MapInit(&TEST_FS, map, sizeof(map)) == FAT_OK);
+    for(uint32_t i = 0; (i < 10000) && !TEST_FS.freeVerified; ++i)
+        TEST_CHECK(FAT_MapStep(&TEST_FS, 4) == FAT_OK);
+    TEST_CHECK(TEST_FS.freeVerified);
+    uint32_t free = TEST_FS.freeCount;
+    TEST_Pattern(data, sizeof(data), 30);
+    TEST_CHECK(TEST_WriteFile("MAP.BIN", FAT_MODE_WRITE | FAT_MODE_CREATE, 0, data, sizeof(data)) == FAT_OK);
+    TEST_SetData(TEST_Add("MAP.BIN", 0), data, sizeof(data));
+    TEST_CHECK(TEST_FS.freeCount == free - (sizeof(data) + 511) / 512);
+}
+
+/** \brief Run test steps on image, the last mount writes free count for checkers
+  * \param  argc: number of arguments
+  * \param  argv: image, manifest of image and manifest of result
+  * \retval 0 if all checks passed
+*/
+int main(int argc, char ** argv)
+{
+    if(argc != 4)
+    {
+        printf("usage: test_fat32 IMAGE MANIFEST RESULT\n");
+        return 2;
+    }
+    if(SD_HostLoad(&TEST_Card, argv[1]))
+    {
+        printf("can not load %s\n", argv[1]);
+        return 2;
+    }
+    TEST_CHECK(TEST_Mount() == FAT_OK);
+    if(TEST_LoadManifest(argv[2]))
+    {
+        printf("can not read %s\n", argv[2]);
+        return 2;
+    }
+    TEST_VerifyTree();
+    TEST_Bursts();
+    TEST_Seek();
+    TEST_Writes();
+    TEST_Directory();
+    TEST_Errors();
+    TEST_VerifyTree();
+    TEST_CHECK(FAT_Unmount(&TEST_FS) == FAT_OK);
+    /*Everything is on card after remount*/
+    memset(&TEST_FS, 0, sizeof(TEST_FS));
+    TEST_CHECK(TEST_Mount() == FAT_OK);
+    TEST_VerifyTree();
+    TEST_FreeMap();
+    TEST_CHECK(FAT_Unmount(&TEST_FS) == FAT_OK);
+    memset(&TEST_FS, 0, sizeof(TEST_FS));
+    TEST_CHECK(TEST_Mount() == FAT_OK);
+    TEST_VerifyTree();
+    TEST_CHECK(FAT_Unmount(&TEST_FS) == FAT_OK);
+    if(SD_HostSave(argv[1]) || TEST_SaveManifest(argv[3]))
+    {
+        printf("can not write results\n");
+        return 2;
+    }
+    SD_HostFree();
+    printf("test_fat32: %u failed checks\n", TEST_Failures);
+    return TEST_Failures ? 1 : 0;
+}
@@ -0,0 +1,223 @@
+/*MIT License
+
+Copyright (c) 2019 DoHelloWorld
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.*/
+
+
+
+
+/*Host test of time index
+    Usage: test_timeindex
+    Log with runs of records with equal timestamps is written to blank card in RAM. Runs span several
+    index entries, search should start reader before the first record of every timestamp*/
+
+#include <stdio.h>
+#include <string.h>
+#include "TimeIndex.h"
+#include "sd_host.h"
+
+#define TEST_CARD_BLOCKS    8192
+#define TEST_LOG_BLOCKS     6000
+#define TEST_INDEX_BLOCKS   200
+#define TEST_RECORDS        3900
+#define TEST_INTERVAL       256
+#define TEST_MAX_RECORD     120
+#define TEST_FIRST_TIME     1000
+
+static SD_Parameters_t TEST_Card;
+static SD_Partition_t TEST_LogPart;
+static SD_Partition_t TEST_IndexPart;
+static LOG_t TEST_Log;
+static TIDX_t TEST_Index;
+static uint8_t TEST_Staging[4 * 512];
+static uint8_t TEST_ReadAhead[8 * 512];
+/*Timestamp and length of every appended record*/
+static uint64_t TEST_Time[TEST_RECORDS];
+static uint32_t TEST_Len[TEST_RECORDS];
+static uint32_t TEST_Failures = 0;
+
+#define TEST_CHECK(condition) TEST_Check((condition), #condition, __LINE__)
+
+/*Count and print failed check*/
+static void TEST_Check(int condition, const char * text, int line);
+/*Record content: timestamp, record number and pattern*/
+static void TEST_Record(uint8_t * data, uint32_t number);
+/*Append records with runs of equal timestamps*/
+static void TEST_Append(void);
+/*Find timestamp and check the first record read after it*/
+static void TEST_FindTime(uint64_t timestamp);
+/*Find every timestamp and its neighbours*/
+static void TEST_FindAll(void);
+
+/** \brief Count and print failed check
+  * \param  condition: result of check
+  * \param  text: checked expression
+  * \param  line: source line of check
+  * \retval None
+*/
+static void TEST_Check(int condition, const char * text, int line)
+{
+    if(condition)
+        return;
+    TEST_Failures++;
+    printf("test_timeindex.c:%d: check failed: %s\n", line, text);
+}
+
+/** \brief Fill record with its timestamp, number and pattern
+  * \param  data: pointer to record buffer
+  * \param  number: record number
+  * \retval None
+*/
+static void TEST_Record(uint8_t * data, uint32_t number)
+{
+    memcpy(data, &TEST_Time[number], 8);
+    memcpy(data + 8, &number, 4);
+    for(uint32_t i = 12; i < TEST_Len[number]; ++i)
+        data[i] = (uint8_t)(number * 7 + i);
+}
+
+/** \brief Append records, runs of equal timestamps are from 1 to 61 records long,
+  *        so one timestamp takes up to several thousand log bytes
+  * \param  None
+  * \retval None
+*/
+static void TEST_Append(void)
+{
+    uint8_t data[TEST_MAX_RECORD];
+    uint64_t timestamp = TEST_FIRST_TIME;
+    uint32_t run = 0;
+    uint32_t runs = 0;
+    for(uint32_t i = 0; i < TEST_RECORDS; ++i)
+    {
+        if(!run)
+        {
+            run = (runs * 37) % 61 + 1;
+            runs++;
+            timestamp += 1 + runs % 3;
+        }
+        run--;
+        TEST_Time[i] = timestamp;
+        TEST_Len[i] = 12 + (i * 13) % (TEST_MAX_RECORD - 12);
+        TEST_Record(data, i);
+        TEST_CHECK(TIDX_Append(&TEST_Index, TEST_Time[i], data, TEST_Len[i]) == TIDX_OK);
+    }
+    TEST_CHECK(TIDX_Sync(&TEST_Index) == TIDX_OK);
+}
+
+/** \brief Find timestamp, the first record with timestamp not before it should not be skipped,
+  *        records before it should fit in one index interval
+  * \param  timestamp: searched timestamp
+  * \retval None
+*/
+static void TEST_FindTime(uint64_t timestamp)
+{
+    LOG_Reader_t reader;
+    uint8_t data[TEST_MAX_RECORD];
+    uint32_t len = 0;
+    uint32_t expected = 0;
+    uint32_t skipped = 0;
+    while((expected < TEST_RECORDS) && (TEST_Time[expected] < timestamp))
+        expected++;
+    LOG_ReaderInit(&reader);
+    LOG_ReaderBuffer(&reader, TEST_ReadAhead, sizeof(TEST_ReadAhead) / 512);
+    TEST_CHECK(TIDX_Find(&TEST_Index, timestamp, &reader) == TIDX_OK);
+    while(1)
+    {
+        uint64_t recordTime = 0;
+        uint32_t number = 0;
+        LOG_Error_t error = LOG_ReadNext(&TEST_Log, &reader, data, sizeof(data), &len);
+        if(error == LOG_END)
+        {
+            TEST_CHECK(expected == TEST_RECORDS);
+            break;
+        }
+        TEST_CHECK(error == LOG_OK);
+        if(error != LOG_OK)
+            break;
+        memcpy(&recordTime, data, 8);
+        memcpy(&number, data + 8, 4);
+        if(recordTime >= timestamp)
+        {
+            if(number != expected)
+                printf("timestamp %llu: record %u, expected %u\n", (unsigned long long)timestamp, number, expected);
+            TEST_CHECK(number == expected);
+            break;
+        }
+        skipped += len;
+    }
+    /*Reader starts at the last entry before timestamp, next entry is not before it*/
+    TEST_CHECK(skipped < TEST_INTERVAL + TEST_MAX_RECORD);
+}
+
+/** \brief Find every timestamp of log, timestamps between them and outside of log
+  * \param  None
+  * \retval None
+*/
+static void TEST_FindAll(void)
+{
+    TEST_FindTime(0);
+    TEST_FindTime(TEST_FIRST_TIME);
+    for(uint32_t i = 0; i < TEST_RECORDS; ++i)
+    {
+        if(i && (TEST_Time[i] == TEST_Time[i - 1]))
+            continue;
+        TEST_FindTime(TEST_Time[i] - 1);
+        TEST_FindTime(TEST_Time[i]);
+        TEST_FindTime(TEST_Time[i] + 1);
+    }
+    TEST_FindTime(TEST_Time[TEST_RECORDS - 1] + 100);
+}
+
+/** \brief Write log with index and search it before and after reopen
+  * \param  None
+  * \retval 0 if all checks passed
+*/
+int main(void)
+{
+    if(SD_HostCreate(&TEST_Card, TEST_CARD_BLOCKS))
+    {
+        printf("can not create card\n");
+        return 2;
+    }
+    SD_PartitionInit(&TEST_LogPart, &TEST_Card, 0, TEST_LOG_BLOCKS);
+    SD_PartitionInit(&TEST_IndexPart, &TEST_Card, TEST_LOG_BLOCKS, TEST_INDEX_BLOCKS);
+    /*Records of log start after one allocation unit, host card has 4 MiB one*/
+    TEST_LogPart.auBlocks = 64;
+    if((LOG_Format(&TEST_Log, &TEST_LogPart, TEST_Staging, sizeof(TEST_Staging) / 512) != LOG_OK) ||
+       (TIDX_Open(&TEST_Index, &TEST_IndexPart, &TEST_Log, TEST_INTERVAL) != TIDX_OK))
+    {
+        printf("can not create log\n");
+        return 2;
+    }
+    TEST_Append();
+    /*Several full index blocks and entries in pending block*/
+    TEST_CHECK(TEST_Index.blocks > 2);
+    TEST_CHECK(TEST_Index.count > 0);
+    TEST_FindAll();
+    TEST_CHECK(LOG_Checkpoint(&TEST_Log) == LOG_OK);
+    memset(&TEST_Log, 0, sizeof(TEST_Log));
+    memset(&TEST_Index, 0, sizeof(TEST_Index));
+    TEST_CHECK(LOG_Open(&TEST_Log, &TEST_LogPart, TEST_Staging, sizeof(TEST_Staging) / 512) == LOG_OK);
+    TEST_CHECK(TIDX_Open(&TEST_Index, &TEST_IndexPart, &TEST_Log, TEST_INTERVAL) == TIDX_OK);
+    TEST_FindAll();
+    SD_HostFree();
+    printf("test_timeindex: %u failed checks\n", TEST_Failures);
+    return TEST_Failures ? 1 : 0;
+}